@@ -407,6 +407,14 @@ fastq_pair_vec adapter_set::get_adapter_set(size_t nth) const
 }
 
 
+adapter_profile adapter_set::get_adapter_profile(size_t nth,
+                                                 int max_shift,
+                                                 const alignment_options& options) const
+{
+    return adapter_profile(get_adapter_set(nth), max_shift, options);
+}
+
+
 string_pair_vec adapter_set::get_pretty_adapter_set(size_t nth) const
 {
     fastq_pair barcodes;
@@ -25,6 +25,7 @@
 #ifndef AR_ADAPTERS_H
 #define AR_ADAPTERS_H
 
+#include "alignment.hpp"
 #include "commontypes.hpp"
 #include "fastq.hpp"
 
@@ -80,6 +81,14 @@ public:
      */
     fastq_pair_vec get_adapter_set(size_t nth) const;
 
+    /**
+     * Returns the nth set of adapters (see above), compiled for alignments
+     * using the given max shift and alignment options.
+     */
+    adapter_profile get_adapter_profile(size_t nth,
+                                        int max_shift,
+                                        const alignment_options& options) const;
+
     /** Returns get_adapter_set(nth) formatted for printing. */
     string_pair_vec get_pretty_adapter_set(size_t nth) const;
 
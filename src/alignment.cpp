@@ -29,10 +29,19 @@
 #include <vector>
 #include <stdexcept>
 #include <cstring>
+#include <algorithm>
+#include <array>
+#include <type_traits>
 
 #include "alignment.hpp"
 #include "debug.hpp"
 #include "fastq.hpp"
+#include "packed_sequence.hpp"
+#include "simd.hpp"
+
+#ifdef AR_SIMD_DISPATCH
+#include <immintrin.h>
+#endif
 
 namespace ar
 {
@@ -61,31 +70,308 @@ inline size_t COUNT_BITS_128(__m128i value)
     // Return the 0th and 4th shorts containing the sums calculated above
     return _mm_extract_epi16(value, 0) + _mm_extract_epi16(value, 4);
 }
+
+
+/** Reverses the order of the 16 bytes in a 128b integer. */
+inline __m128i reverse_128(__m128i value)
+{
+    value = _mm_shuffle_epi32(value, _MM_SHUFFLE(0, 1, 2, 3));
+    value = _mm_shufflelo_epi16(value, _MM_SHUFFLE(2, 3, 0, 1));
+    value = _mm_shufflehi_epi16(value, _MM_SHUFFLE(2, 3, 0, 1));
+
+    return _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+}
+
+
+/** Complements 16 nucleotides in "ACGTN"; see complement_nt. */
+inline __m128i complement_128(__m128i value)
+{
+    // A ^ T == 0x15 and C ^ G == 0x04; N is left unchanged
+    const __m128i is_at = _mm_or_si128(_mm_cmpeq_epi8(value, _mm_set1_epi8('A')),
+                                       _mm_cmpeq_epi8(value, _mm_set1_epi8('T')));
+    const __m128i is_cg = _mm_or_si128(_mm_cmpeq_epi8(value, _mm_set1_epi8('C')),
+                                       _mm_cmpeq_epi8(value, _mm_set1_epi8('G')));
+
+    return _mm_xor_si128(value, _mm_or_si128(_mm_and_si128(is_at, _mm_set1_epi8(0x15)),
+                                             _mm_and_si128(is_cg, _mm_set1_epi8(0x04))));
+}
 #else
 #warning SEE optimizations disabled!
 #endif
 
 
+/** Sequence stored in a single, contiguous buffer. */
+class contiguous_sequence
+{
+public:
+    explicit contiguous_sequence(const char* data)
+        : m_data(data)
+    {
+    }
+
+    /** Returns the base at pos. */
+    char at(size_t pos) const
+    {
+        return m_data[pos];
+    }
+
+    /** Returns a pointer to 'size' bases starting at pos; see joined_sequence. */
+    const char* block(size_t pos, size_t /* size */, char* /* buffer */) const
+    {
+        return m_data + pos;
+    }
+
+private:
+    //! Pointer to the first base in the sequence
+    const char* m_data;
+};
+
+
 /**
- * Compares two subsequences in an alignment to a previous (best) alignment.
- *
- * @param best The currently best alignment, used for evaluating this alignment
- * @param current The current alignment to be evaluated (counts are assumed to be zero'd!)
- * @param seq_1_ptr Pointer to the first base in the first sequence in the alignment.
- * @param seq_2_ptr Pointer to the first base in the second sequence in the alignment.
- * @return True if the current alignment is at least as good as the best alignment, false otherwise.
- *
- * If the function returns false, the current alignment cannot be assumed to
- * have been completely evaluated (due to early termination), and hence counts
- * and scores are not reliable. The function assumes uppercase nucleotides.
+ * A sequence consisting of the (virtual) concatenation of two strings, used to
+ * align e.g. adapter 2 + read 1 without constructing a temporary string.
  */
-bool compare_subsequences(const alignment_info& best, alignment_info& current,
-                          const char* seq_1_ptr, const char* seq_2_ptr)
+class joined_sequence
 {
-    int remaining_bases = current.score = current.length;
+public:
+    joined_sequence(const char* head, size_t head_len,
+                    const char* tail, size_t tail_len)
+        : m_head(head)
+        , m_head_len(head_len)
+        , m_tail(tail)
+        , m_tail_len(tail_len)
+    {
+    }
+
+    joined_sequence(const std::string& head, const std::string& tail)
+        : joined_sequence(head.data(), head.length(), tail.data(), tail.length())
+    {
+    }
+
+    /** Returns the combined length of the two strings. */
+    size_t length() const
+    {
+        return m_head_len + m_tail_len;
+    }
+
+    /** Returns the first part of the sequence. */
+    const char* head() const
+    {
+        return m_head;
+    }
+
+    /** Returns the length of the first part of the sequence. */
+    size_t head_length() const
+    {
+        return m_head_len;
+    }
+
+    /** Returns the second part of the sequence. */
+    const char* tail() const
+    {
+        return m_tail;
+    }
+
+    /** Returns the length of the second part of the sequence. */
+    size_t tail_length() const
+    {
+        return m_tail_len;
+    }
+
+    /** Returns the base at pos. */
+    char at(size_t pos) const
+    {
+        return (pos < m_head_len) ? m_head[pos] : m_tail[pos - m_head_len];
+    }
+
+    /**
+     * Returns a pointer to 'size' bases starting at pos. If these bases span
+     * both strings, they are copied into 'buffer', which must be able to
+     * hold at least 'size' bases, and a pointer to the buffer is returned.
+     */
+    const char* block(size_t pos, size_t size, char* buffer) const
+    {
+        if (pos >= m_head_len) {
+            return m_tail + (pos - m_head_len);
+        } else if (pos + size <= m_head_len) {
+            return m_head + pos;
+        }
+
+        std::memcpy(buffer, m_head + pos, m_head_len - pos);
+        std::memcpy(buffer + (m_head_len - pos), m_tail, size - (m_head_len - pos));
+
+        return buffer;
+    }
+
+private:
+    //! The first part of the sequence
+    const char* m_head;
+    //! The length of the first part of the sequence
+    size_t m_head_len;
+    //! The second part of the sequence
+    const char* m_tail;
+    //! The length of the second part of the sequence
+    size_t m_tail_len;
+};
+
+
+/**
+ * A sequence consisting of the reverse complement of one string, followed by
+ * a second string, used to align e.g. mate 2 + adapter 1 without reverse
+ * complementing a copy of mate 2. Bases from the first string are complemented
+ * into a buffer when accessed, 16 bases at a time where possible.
+ */
+class reverse_complement_sequence
+{
+public:
+    reverse_complement_sequence(const char* head, size_t head_len,
+                                const char* tail, size_t tail_len)
+        : m_head(head)
+        , m_head_len(head_len)
+        , m_tail(tail)
+        , m_tail_len(tail_len)
+    {
+    }
+
+    reverse_complement_sequence(const std::string& head, const std::string& tail)
+        : reverse_complement_sequence(head.data(), head.length(), tail.data(), tail.length())
+    {
+    }
+
+    /** Returns the combined length of the two strings. */
+    size_t length() const
+    {
+        return m_head_len + m_tail_len;
+    }
+
+    /** Returns the first part of the sequence, prior to reverse complementing. */
+    const char* head() const
+    {
+        return m_head;
+    }
+
+    /** Returns the length of the first part of the sequence. */
+    size_t head_length() const
+    {
+        return m_head_len;
+    }
+
+    /** Returns the second part of the sequence. */
+    const char* tail() const
+    {
+        return m_tail;
+    }
+
+    /** Returns the length of the second part of the sequence. */
+    size_t tail_length() const
+    {
+        return m_tail_len;
+    }
+
+    /** Returns the base at pos. */
+    char at(size_t pos) const
+    {
+        return (pos < m_head_len) ? complement_nt(m_head[m_head_len - pos - 1]) : m_tail[pos - m_head_len];
+    }
+
+    /**
+     * Returns a pointer to 'size' bases starting at pos. Bases in the first
+     * string are reverse complemented into 'buffer', which must be able to
+     * hold at least 'size' bases, and a pointer to the buffer is returned.
+     */
+    const char* block(size_t pos, size_t size, char* buffer) const
+    {
+        if (pos >= m_head_len) {
+            return m_tail + (pos - m_head_len);
+        }
+
+        const size_t in_head = std::min(size, m_head_len - pos);
+        // Position following the last base copied from the head
+        const char* src = m_head + (m_head_len - pos);
+        size_t i = 0;
+#if defined(__SSE__) && defined(__SSE2__)
+        for (; i + 16 <= in_head; i += 16) {
+            src -= 16;
+
+            const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(buffer + i), complement_128(reverse_128(value)));
+        }
+#endif
+        for (; i < in_head; ++i) {
+            buffer[i] = complement_nt(*--src);
+        }
+
+        std::memcpy(buffer + in_head, m_tail, size - in_head);
+
+        return buffer;
+    }
+
+private:
+    //! The first part of the sequence, prior to reverse complementing
+    const char* m_head;
+    //! The length of the first part of the sequence
+    size_t m_head_len;
+    //! The second part of the sequence
+    const char* m_tail;
+    //! The length of the second part of the sequence
+    size_t m_tail_len;
+};
+
+
+/**
+ * Compares the remaining bases of two subsequences one base at a time; used
+ * for the bases not processed by the vectorized kernels below.
+ */
+template <typename S1, typename S2>
+inline bool compare_subsequences_std(const alignment_info& best,
+                                     alignment_info& current,
+                                     const S1& seq_1, size_t pos_1,
+                                     const S2& seq_2, size_t pos_2,
+                                     int remaining_bases)
+{
+    for (; remaining_bases && current.score >= best.score; --remaining_bases) {
+        const char nt_1 = seq_1.at(pos_1++);
+        const char nt_2 = seq_2.at(pos_2++);
+
+        if (nt_1 == 'N' || nt_2 == 'N') {
+            current.n_ambiguous++;
+            current.score--;
+        } else if (nt_1 != nt_2) {
+            current.n_mismatches++;
+            current.score -= 2;
+        }
+    }
+
+    return current.is_better_than(best);
+}
+
+
+/** Scalar implementation of compare_subsequences. */
+template <typename S1, typename S2>
+bool compare_subsequences_std(const alignment_info& best, alignment_info& current,
+                              const S1& seq_1, size_t pos_1,
+                              const S2& seq_2, size_t pos_2)
+{
+    const int remaining_bases = current.score = current.length;
+
+    return compare_subsequences_std(best, current, seq_1, pos_1, seq_2, pos_2, remaining_bases);
+}
+
 
 #if defined(__SSE__) && defined(__SSE2__)
+/** SSE2 implementation of compare_subsequences; processes 16 bases at a time. */
+template <typename S1, typename S2>
+bool compare_subsequences_sse2(const alignment_info& best, alignment_info& current,
+                               const S1& seq_1, size_t pos_1,
+                               const S2& seq_2, size_t pos_2)
+{
+    int remaining_bases = current.score = current.length;
+    char buffer_1[16];
+    char buffer_2[16];
+
     while (remaining_bases >= 16 && current.score >= best.score) {
+        const char* seq_1_ptr = seq_1.block(pos_1, 16, buffer_1);
+        const char* seq_2_ptr = seq_2.block(pos_2, 16, buffer_2);
         const __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq_1_ptr));
         const __m128i s2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq_2_ptr));
 
@@ -100,225 +386,1799 @@ bool compare_subsequences(const alignment_info& best, alignment_info& current,
         // `~(some __m128i)` doesn't work on Intel compilers. XOR(thing, 0xff)
         // is the same, so we use that
 
-        current.n_ambiguous += COUNT_BITS_128(_mm_and_si128(ns_mask, BIT_MASK_128));
-        current.n_mismatches += COUNT_BITS_128(_mm_and_si128(mm_mask, BIT_MASK_128));
+        current.n_ambiguous += COUNT_BITS_128(_mm_and_si128(ns_mask, BIT_MASK_128));
+        current.n_mismatches += COUNT_BITS_128(_mm_and_si128(mm_mask, BIT_MASK_128));
+
+        // Matches count for 1, Ns for 0, and mismatches for -1
+        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+
+        pos_1 += 16;
+        pos_2 += 16;
+        remaining_bases -= 16;
+    }
+
+    return compare_subsequences_std(best, current, seq_1, pos_1, seq_2, pos_2, remaining_bases);
+}
+#endif
+
+
+#ifdef AR_SIMD_DISPATCH
+/** Loads 32 bases starting at pos, using 'buffer' as described for block. */
+template <typename S>
+AR_TARGET("avx2")
+inline __m256i load_avx2(const S& seq, size_t pos, char* buffer)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq.block(pos, 32, buffer)));
+}
+
+
+/**
+ * Loads 32 bases starting at pos. Blocks found wholly in the first string are
+ * reverse complemented in registers, by reversing the bytes using shuffles and
+ * looking up the complement of each base using the last 4 bits (see
+ * complement_nt), which is considerably faster than using block.
+ */
+AR_TARGET("avx2")
+inline __m256i load_avx2(const reverse_complement_sequence& seq, size_t pos, char* buffer)
+{
+    if (pos + 32 > seq.head_length()) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq.block(pos, 32, buffer)));
+    }
+
+    const __m256i reverse_lanes = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                                   15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256i complements = _mm256_setr_epi8(0, 'T', 0, 'G', 'A', 0, 0, 'C', 0, 0, 0, 0, 0, 0, 'N', 0,
+                                                 0, 'T', 0, 'G', 'A', 0, 0, 'C', 0, 0, 0, 0, 0, 0, 'N', 0);
+
+    const char* src = seq.head() + (seq.head_length() - pos - 32);
+    __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    // Reverse the bytes in each 128b lane, and then swap the lanes
+    value = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(value, reverse_lanes), _MM_SHUFFLE(1, 0, 3, 2));
+
+    // Bases have the most significant bit unset, so only the last 4 bits are
+    // used by the shuffle
+    return _mm256_shuffle_epi8(complements, value);
+}
+
+
+/**
+ * AVX2 implementation of compare_subsequences; processes 32 bases at a time,
+ * counting Ns and mismatches using byte-masks and POPCNT.
+ */
+template <typename S1, typename S2>
+AR_TARGET("avx2,popcnt")
+bool compare_subsequences_avx2(const alignment_info& best, alignment_info& current,
+                               const S1& seq_1, size_t pos_1,
+                               const S2& seq_2, size_t pos_2)
+{
+    int remaining_bases = current.score = current.length;
+    const __m256i n_mask = _mm256_set1_epi8('N');
+    char buffer_1[32];
+    char buffer_2[32];
+
+    while (remaining_bases >= 32 && current.score >= best.score) {
+        const __m256i s1 = load_avx2(seq_1, pos_1, buffer_1);
+        const __m256i s2 = load_avx2(seq_2, pos_2, buffer_2);
+
+        // One bit per position where one or both nts is N
+        const unsigned int ns_bits = _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(s1, n_mask),
+                            _mm256_cmpeq_epi8(s2, n_mask)));
+        // One bit per position where the nts are identical
+        const unsigned int eq_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(s1, s2));
+
+        current.n_ambiguous += __builtin_popcount(ns_bits);
+        current.n_mismatches += __builtin_popcount(~(ns_bits | eq_bits));
+
+        // Matches count for 1, Ns for 0, and mismatches for -1
+        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+
+        pos_1 += 32;
+        pos_2 += 32;
+        remaining_bases -= 32;
+    }
+
+    if (remaining_bases >= 16 && current.score >= best.score) {
+        const char* seq_1_ptr = seq_1.block(pos_1, 16, buffer_1);
+        const char* seq_2_ptr = seq_2.block(pos_2, 16, buffer_2);
+        const __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq_1_ptr));
+        const __m128i s2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq_2_ptr));
+
+        const unsigned int ns_bits = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(s1, _mm256_castsi256_si128(n_mask)),
+                         _mm_cmpeq_epi8(s2, _mm256_castsi256_si128(n_mask))));
+        const unsigned int eq_bits = _mm_movemask_epi8(_mm_cmpeq_epi8(s1, s2));
+
+        current.n_ambiguous += __builtin_popcount(ns_bits);
+        current.n_mismatches += __builtin_popcount(~(ns_bits | eq_bits) & 0xFFFFu);
+        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+
+        pos_1 += 16;
+        pos_2 += 16;
+        remaining_bases -= 16;
+    }
+
+    return compare_subsequences_std(best, current, seq_1, pos_1, seq_2, pos_2, remaining_bases);
+}
+
+
+/** Loads the bases selected by 'mask', starting at pos, zeroing other bytes. */
+AR_TARGET("avx512f,avx512bw")
+inline __m512i load_avx512(const contiguous_sequence& seq, size_t pos, __mmask64 mask)
+{
+    return _mm512_maskz_loadu_epi8(mask, seq.block(pos, 0, nullptr));
+}
+
+
+/**
+ * Loads the bases selected by 'mask', starting at pos, zeroing other bytes.
+ * Blocks spanning both strings are loaded using two masked loads, in order to
+ * avoid copying the bases into a temporary buffer.
+ */
+AR_TARGET("avx512f,avx512bw")
+inline __m512i load_avx512(const joined_sequence& seq, size_t pos, __mmask64 mask)
+{
+    const size_t head_len = seq.head_length();
+    if (pos >= head_len) {
+        return _mm512_maskz_loadu_epi8(mask, seq.tail() + (pos - head_len));
+    }
+
+    const size_t in_head = head_len - pos;
+    if (in_head >= 64) {
+        return _mm512_maskz_loadu_epi8(mask, seq.head() + pos);
+    }
+
+    const __mmask64 head_mask = mask & ((static_cast<__mmask64>(1) << in_head) - 1);
+    // Masked bytes are never accessed, so the (virtual) start of the block
+    // relative to the tail is allowed to precede the start of the tail.
+    const uintptr_t tail_start = reinterpret_cast<uintptr_t>(seq.tail()) - in_head;
+
+    return _mm512_or_si512(_mm512_maskz_loadu_epi8(head_mask, seq.head() + pos),
+                           _mm512_maskz_loadu_epi8(mask & ~head_mask,
+                                                   reinterpret_cast<const void*>(tail_start)));
+}
+
+
+/**
+ * Reverses the order of the 128b lanes in a vector. The zero-masking shuffle
+ * is used with a full mask, since the unmasked shuffle reads an undefined
+ * vector in GCC, resulting in -Wmaybe-uninitialized warnings.
+ */
+AR_TARGET("avx512f")
+inline __m512i reverse_lanes_avx512(__m512i value)
+{
+    return _mm512_maskz_shuffle_i64x2(0xFF, value, value, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+
+/**
+ * Loads the bases selected by 'mask', starting at pos, zeroing other bytes.
+ * Bases in the first string are reverse complemented in registers as in
+ * load_avx2, while bases in the second string are loaded as for
+ * joined_sequence. The mask selects the lowest bytes of the block.
+ */
+AR_TARGET("avx512f,avx512bw")
+inline __m512i load_avx512(const reverse_complement_sequence& seq, size_t pos, __mmask64 mask)
+{
+    const size_t head_len = seq.head_length();
+    if (pos >= head_len) {
+        return _mm512_maskz_loadu_epi8(mask, seq.tail() + (pos - head_len));
+    }
+
+    // The tables used by load_avx2, repeated in each 128b lane; these are set
+    // directly, since _mm512_broadcast_i32x4 reads an undefined vector in GCC
+    // Bytes 15, 14, ..., 0
+    const __m512i reverse_lanes = _mm512_set4_epi32(0x00010203, 0x04050607, 0x08090A0B, 0x0C0D0E0F);
+    // 'T' at 1, 'G' at 3, 'A' at 4, 'C' at 7, and 'N' at 14, otherwise 0
+    const __m512i complements = _mm512_set4_epi32(0x004E0000, 0x00000000, 0x43000041, 0x47005400);
+
+    const size_t in_head = head_len - pos;
+    if (in_head >= 64) {
+        __m512i value = _mm512_loadu_si512(seq.head() + (in_head - 64));
+        // Reverse the bytes in each 128b lane, and then the order of the lanes
+        value = reverse_lanes_avx512(_mm512_shuffle_epi8(value, reverse_lanes));
+
+        // Bases have the most significant bit unset (see load_avx2)
+        return _mm512_maskz_shuffle_epi8(mask, complements, value);
+    }
+
+    const __mmask64 head_mask = mask & ((static_cast<__mmask64>(1) << in_head) - 1);
+    // The head bytes of the block are the reverse of the last bytes of a 64
+    // byte block ending at the end of the head; masked bytes are never
+    // accessed, so the start of that block may precede the start of the head.
+    const uintptr_t head_start = reinterpret_cast<uintptr_t>(seq.head()) + in_head - 64;
+    __m512i value = _mm512_maskz_loadu_epi8(~static_cast<__mmask64>(0) << (64 - in_head),
+                                            reinterpret_cast<const void*>(head_start));
+    value = reverse_lanes_avx512(_mm512_shuffle_epi8(value, reverse_lanes));
+    value = _mm512_maskz_shuffle_epi8(head_mask, complements, value);
+
+    const uintptr_t tail_start = reinterpret_cast<uintptr_t>(seq.tail()) - in_head;
+
+    return _mm512_or_si512(value, _mm512_maskz_loadu_epi8(mask & ~head_mask,
+                                                          reinterpret_cast<const void*>(tail_start)));
+}
+
+
+/**
+ * AVX-512BW implementation of compare_subsequences; processes 64 bases at a
+ * time using mask registers. The final, partial block is processed using
+ * masked loads, which never touch memory past the end of the sequences.
+ */
+template <typename S1, typename S2>
+AR_TARGET("avx512f,avx512bw,popcnt")
+bool compare_subsequences_avx512(const alignment_info& best, alignment_info& current,
+                                 const S1& seq_1, size_t pos_1,
+                                 const S2& seq_2, size_t pos_2)
+{
+    int remaining_bases = current.score = current.length;
+    const __m512i n_mask = _mm512_set1_epi8('N');
+
+    while (remaining_bases > 0 && current.score >= best.score) {
+        const size_t block_size = std::min<int>(64, remaining_bases);
+        const __mmask64 load_mask = (block_size == 64)
+            ? ~static_cast<__mmask64>(0)
+            : (static_cast<__mmask64>(1) << block_size) - 1;
+
+        const __m512i s1 = load_avx512(seq_1, pos_1, load_mask);
+        const __m512i s2 = load_avx512(seq_2, pos_2, load_mask);
+
+        // Zero'd (unloaded) positions are neither Ns nor mismatches
+        const __mmask64 ns_bits = _mm512_cmpeq_epi8_mask(s1, n_mask)
+                                | _mm512_cmpeq_epi8_mask(s2, n_mask);
+        const __mmask64 mm_bits = _mm512_mask_cmpneq_epi8_mask(~ns_bits, s1, s2);
+
+        current.n_ambiguous += __builtin_popcountll(ns_bits);
+        current.n_mismatches += __builtin_popcountll(mm_bits);
+
+        // Matches count for 1, Ns for 0, and mismatches for -1
+        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+
+        pos_1 += 64;
+        pos_2 += 64;
+        remaining_bases -= 64;
+    }
+
+    return current.is_better_than(best);
+}
+#endif
+
+
+/**
+ * Signature of functions comparing two subsequences, starting at the given
+ * positions; see compare_subsequences.
+ */
+template <typename S1, typename S2 = S1>
+struct compare_kernel
+{
+    typedef bool (*type)(const alignment_info& best,
+                         alignment_info& current,
+                         const S1& seq_1, size_t pos_1,
+                         const S2& seq_2, size_t pos_2);
+};
+
+
+/**
+ * Returns the implementation of compare_subsequences for a given instruction
+ * set; the instruction set is assumed to be supported by the host CPU.
+ */
+template <typename S1, typename S2 = S1>
+typename compare_kernel<S1, S2>::type select_compare_kernel(simd::instruction_set is)
+{
+    switch (is) {
+        case simd::instruction_set::none:
+            return &compare_subsequences_std<S1, S2>;
+#if defined(__SSE__) && defined(__SSE2__)
+        case simd::instruction_set::sse2:
+            return &compare_subsequences_sse2<S1, S2>;
+#endif
+#ifdef AR_SIMD_DISPATCH
+        case simd::instruction_set::avx2:
+            return &compare_subsequences_avx2<S1, S2>;
+        case simd::instruction_set::avx512:
+            return &compare_subsequences_avx512<S1, S2>;
+#endif
+        default:
+            throw std::invalid_argument("unsupported instruction set");
+    }
+}
+
+
+/** Returns the best implementation of compare_subsequences for this CPU. */
+template <typename S1, typename S2 = S1>
+typename compare_kernel<S1, S2>::type get_compare_kernel()
+{
+    static const typename compare_kernel<S1, S2>::type func = select_compare_kernel<S1, S2>(simd::detect());
+
+    return func;
+}
+
+
+/**
+ * Signature of functions comparing two subsequences; see compare_subsequences.
+ */
+typedef bool (*compare_subsequences_func)(const alignment_info& best,
+                                          alignment_info& current,
+                                          const char* seq_1_ptr,
+                                          const char* seq_2_ptr);
+
+
+/** Wrapper providing the compare_subsequences_func signature for a kernel. */
+template <simd::instruction_set IS>
+bool compare_contiguous_subsequences(const alignment_info& best, alignment_info& current,
+                                     const char* seq_1_ptr, const char* seq_2_ptr)
+{
+    static const compare_kernel<contiguous_sequence>::type func = select_compare_kernel<contiguous_sequence>(IS);
+
+    return func(best, current, contiguous_sequence(seq_1_ptr), 0, contiguous_sequence(seq_2_ptr), 0);
+}
+
+
+/**
+ * Returns the implementation of compare_subsequences for a given instruction
+ * set; the instruction set is assumed to be supported by the host CPU.
+ */
+compare_subsequences_func select_compare_subsequences(simd::instruction_set is)
+{
+    switch (is) {
+        case simd::instruction_set::none:
+            return &compare_contiguous_subsequences<simd::instruction_set::none>;
+        case simd::instruction_set::sse2:
+            return &compare_contiguous_subsequences<simd::instruction_set::sse2>;
+        case simd::instruction_set::avx2:
+            return &compare_contiguous_subsequences<simd::instruction_set::avx2>;
+        case simd::instruction_set::avx512:
+            return &compare_contiguous_subsequences<simd::instruction_set::avx512>;
+        default:
+            throw std::invalid_argument("unsupported instruction set");
+    }
+}
+
+
+/**
+ * Signature of functions comparing two joined sequences, i.e. head_1 + tail_1
+ * and head_2 + tail_2, from the first base; see compare_subsequences.
+ */
+typedef bool (*compare_joined_subsequences_func)(const alignment_info& best,
+                                                 alignment_info& current,
+                                                 const std::string& head_1,
+                                                 const std::string& tail_1,
+                                                 const std::string& head_2,
+                                                 const std::string& tail_2);
+
+
+/** Wrapper providing the compare_joined_subsequences_func signature for a kernel. */
+template <simd::instruction_set IS>
+bool compare_joined_subsequences(const alignment_info& best, alignment_info& current,
+                                 const std::string& head_1, const std::string& tail_1,
+                                 const std::string& head_2, const std::string& tail_2)
+{
+    static const compare_kernel<joined_sequence>::type func = select_compare_kernel<joined_sequence>(IS);
+
+    return func(best, current, joined_sequence(head_1, tail_1), 0, joined_sequence(head_2, tail_2), 0);
+}
+
+
+/** Returns the joined_sequence implementation of compare_subsequences for 'is'. */
+compare_joined_subsequences_func select_compare_joined_subsequences(simd::instruction_set is)
+{
+    switch (is) {
+        case simd::instruction_set::none:
+            return &compare_joined_subsequences<simd::instruction_set::none>;
+        case simd::instruction_set::sse2:
+            return &compare_joined_subsequences<simd::instruction_set::sse2>;
+        case simd::instruction_set::avx2:
+            return &compare_joined_subsequences<simd::instruction_set::avx2>;
+        case simd::instruction_set::avx512:
+            return &compare_joined_subsequences<simd::instruction_set::avx512>;
+        default:
+            throw std::invalid_argument("unsupported instruction set");
+    }
+}
+
+
+/**
+ * Wrapper providing the compare_joined_subsequences_func signature for a
+ * kernel comparing head_1 + tail_1 and reverse complement(head_2) + tail_2.
+ */
+template <simd::instruction_set IS>
+bool compare_reverse_complement_subsequences(const alignment_info& best, alignment_info& current,
+                                             const std::string& head_1, const std::string& tail_1,
+                                             const std::string& head_2, const std::string& tail_2)
+{
+    static const compare_kernel<joined_sequence, reverse_complement_sequence>::type func
+        = select_compare_kernel<joined_sequence, reverse_complement_sequence>(IS);
+
+    return func(best, current,
+                joined_sequence(head_1, tail_1), 0,
+                reverse_complement_sequence(head_2, tail_2), 0);
+}
+
+
+/** Returns the reverse_complement_sequence implementation of compare_subsequences for 'is'. */
+compare_joined_subsequences_func select_compare_reverse_complement_subsequences(simd::instruction_set is)
+{
+    switch (is) {
+        case simd::instruction_set::none:
+            return &compare_reverse_complement_subsequences<simd::instruction_set::none>;
+        case simd::instruction_set::sse2:
+            return &compare_reverse_complement_subsequences<simd::instruction_set::sse2>;
+        case simd::instruction_set::avx2:
+            return &compare_reverse_complement_subsequences<simd::instruction_set::avx2>;
+        case simd::instruction_set::avx512:
+            return &compare_reverse_complement_subsequences<simd::instruction_set::avx512>;
+        default:
+            throw std::invalid_argument("unsupported instruction set");
+    }
+}
+
+
+/**
+ * Compares two subsequences in an alignment to a previous (best) alignment.
+ *
+ * @param best The currently best alignment, used for evaluating this alignment
+ * @param current The current alignment to be evaluated (counts are assumed to be zero'd!)
+ * @param seq_1_ptr Pointer to the first base in the first sequence in the alignment.
+ * @param seq_2_ptr Pointer to the first base in the second sequence in the alignment.
+ * @return True if the current alignment is at least as good as the best alignment, false otherwise.
+ *
+ * If the function returns false, the current alignment cannot be assumed to
+ * have been completely evaluated (due to early termination), and hence counts
+ * and scores are not reliable. The function assumes uppercase nucleotides.
+ *
+ * The implementation used (AVX-512BW, AVX2, SSE2, or scalar) is selected at
+ * run-time, based on the instruction sets supported by the host CPU.
+ */
+bool compare_subsequences(const alignment_info& best, alignment_info& current,
+                          const char* seq_1_ptr, const char* seq_2_ptr)
+{
+    return get_compare_kernel<contiguous_sequence>()(best, current,
+                                                     contiguous_sequence(seq_1_ptr), 0,
+                                                     contiguous_sequence(seq_2_ptr), 0);
+}
+
+
+/**
+ * Compares two subsequences of 2-bit packed sequences, 32 bases at a time;
+ * see compare_subsequences for a description of parameters / return values.
+ */
+bool compare_packed_subsequences(const alignment_info& best,
+                                 alignment_info& current,
+                                 const packed_sequence& seq_1, size_t pos_1,
+                                 const packed_sequence& seq_2, size_t pos_2)
+{
+    //! The least significant bit in each 2-bit lane
+    const uint64_t LANE_MASK = 0x5555555555555555ull;
+
+    int remaining_bases = current.score = current.length;
+    while (remaining_bases > 0 && current.score >= best.score) {
+        // Lanes past the end of the alignment are excluded
+        const uint64_t valid_mask = (remaining_bases >= 32)
+            ? LANE_MASK
+            : LANE_MASK & ((static_cast<uint64_t>(1) << (remaining_bases * 2)) - 1);
+
+        const uint64_t ns_mask = (seq_1.ambiguous(pos_1) | seq_2.ambiguous(pos_2)) & valid_mask;
+        // Lanes are non-zero where the bases differ; fold each onto its low bit
+        const uint64_t diff = seq_1.bases(pos_1) ^ seq_2.bases(pos_2);
+        const uint64_t mm_mask = (diff | (diff >> 1)) & valid_mask & ~ns_mask;
+
+        current.n_ambiguous += __builtin_popcountll(ns_mask);
+        current.n_mismatches += __builtin_popcountll(mm_mask);
+
+        // Matches count for 1, Ns for 0, and mismatches for -1
+        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+
+        pos_1 += 32;
+        pos_2 += 32;
+        remaining_bases -= 32;
+    }
+
+    return current.is_better_than(best);
+}
+
+
+/**
+ * Returns a table of 2-bit codes for each nucleotide (A = 0, C = 1, G = 2,
+ * T = 3); all other characters are assigned the code -1.
+ */
+const std::array<int8_t, 256>& kmer_codes()
+{
+    static const std::array<int8_t, 256> codes = []() {
+        std::array<int8_t, 256> table;
+        table.fill(-1);
+        table['A'] = 0;
+        table['C'] = 1;
+        table['G'] = 2;
+        table['T'] = 3;
+
+        return table;
+    }();
+
+    return codes;
+}
+
+
+/**
+ * Rolling 2-bit encoding of the k-mers in a sequence (A = 0, C = 1, G = 2,
+ * T = 3), to which the codes of bases (see kmer_codes) are added in order.
+ */
+class kmer_encoder
+{
+public:
+    explicit kmer_encoder(size_t kmer_length)
+        : m_kmer_length(kmer_length)
+        , m_mask((kmer_length < 16) ? (1u << (2 * kmer_length)) - 1 : ~0u)
+        , m_code(0)
+        , m_valid(0)
+        , m_pos(0)
+    {
+    }
+
+    /**
+     * Adds the next base, calling func(code, pos) if it completes a k-mer not
+     * containing Ns. Bases are encoded using a lookup table, since branching
+     * on (random) bases is slow.
+     */
+    template <typename T>
+    void add(int nt_code, const T& func)
+    {
+        ++m_pos;
+
+        m_code = (m_code << 2) | (nt_code & 0x3);
+        // k-mers containing Ns (or other bases) are never used as seeds
+        m_valid = (nt_code < 0) ? 0 : m_valid + 1;
+
+        if (m_valid >= m_kmer_length) {
+            func(m_code & m_mask, m_pos - m_kmer_length);
+        }
+    }
+
+private:
+    //! Length of k-mers
+    size_t m_kmer_length;
+    //! Mask of the 2-bit lanes used by a k-mer
+    uint32_t m_mask;
+    //! The most recently added bases
+    uint32_t m_code;
+    //! Number of bases added since the last N
+    size_t m_valid;
+    //! Number of bases added
+    size_t m_pos;
+};
+
+
+/**
+ * Calls func(code, pos) for every k-mer in sequence not containing Ns, where
+ * code is the 2-bit encoded k-mer (A = 0, C = 1, G = 2, T = 3).
+ */
+template <typename T>
+void for_each_kmer(const joined_sequence& sequence, size_t kmer_length, const T& func)
+{
+    const std::array<int8_t, 256>& codes = kmer_codes();
+    kmer_encoder encoder(kmer_length);
+
+    for (size_t i = 0; i < sequence.head_length(); ++i) {
+        encoder.add(codes[static_cast<uint8_t>(sequence.head()[i])], func);
+    }
+
+    for (size_t i = 0; i < sequence.tail_length(); ++i) {
+        encoder.add(codes[static_cast<uint8_t>(sequence.tail()[i])], func);
+    }
+}
+
+
+template <typename T>
+void for_each_kmer(const reverse_complement_sequence& sequence, size_t kmer_length, const T& func)
+{
+    const std::array<int8_t, 256>& codes = kmer_codes();
+    kmer_encoder encoder(kmer_length);
+
+    // The codes of complementary bases sum to 3, and so XOR'ing codes with 3
+    // complements them, while the codes of Ns (-1) remain negative
+    for (size_t i = sequence.head_length(); i; --i) {
+        encoder.add(codes[static_cast<uint8_t>(sequence.head()[i - 1])] ^ 0x3, func);
+    }
+
+    for (size_t i = 0; i < sequence.tail_length(); ++i) {
+        encoder.add(codes[static_cast<uint8_t>(sequence.tail()[i])], func);
+    }
+}
+
+
+template <typename T>
+void for_each_kmer(const std::string& sequence, size_t kmer_length, const T& func)
+{
+    for_each_kmer(joined_sequence(sequence, std::string()), kmer_length, func);
+}
+
+
+/**
+ * Chained hash-table of the k-mers in a sequence, used to find the positions
+ * at which k-mers in other sequences are found in this sequence.
+ */
+class kmer_table
+{
+public:
+    kmer_table()
+        : m_heads()
+        , m_entries()
+    {
+    }
+
+    /**
+     * Builds a table of the k-mers in sequence, calling func(code, pos) for
+     * each k-mer before it is added to the table.
+     */
+    template <typename S, typename T>
+    void build(const S& sequence, size_t kmer_length, const T& func)
+    {
+        // Positions are stored + 1, so that 0 marks the end of chains
+        m_heads.fill(0);
+        m_entries.resize(sequence.length());
+
+        for_each_kmer(sequence, kmer_length, [&](uint32_t code, size_t pos) {
+            func(code, pos);
+
+            uint32_t& head = m_heads[bucket(code)];
+            m_entries[pos] = std::make_pair(code, head);
+            head = pos + 1;
+        });
+    }
+
+    /** Calls func(pos) for each position at which a k-mer is found. */
+    template <typename T>
+    void find(uint32_t code, const T& func) const
+    {
+        for (uint32_t it = m_heads[bucket(code)]; it; it = m_entries[it - 1].second) {
+            if (m_entries[it - 1].first == code) {
+                func(it - 1);
+            }
+        }
+    }
+
+private:
+    //! Number of bits used to select buckets in the k-mer hash-table
+    static const size_t BUCKET_BITS = 10;
+    //! Number of buckets in the k-mer hash-table
+    static const size_t BUCKETS = 1 << BUCKET_BITS;
+
+    /** Returns the bucket for a k-mer. */
+    static size_t bucket(uint32_t code)
+    {
+        return (code * 2654435761u) >> (32 - BUCKET_BITS);
+    }
+
+    //! Position + 1 of the last k-mer for each bucket, or 0 if empty
+    std::array<uint32_t, BUCKETS> m_heads;
+    //! K-mer found at each position, and the position + 1 of the previous
+    //! k-mer in the same bucket, or 0
+    std::vector<std::pair<uint32_t, uint32_t>> m_entries;
+};
+
+
+/** Calls func(pos) for each position of code in a sorted list of k-mers. */
+template <typename T>
+void find_kmer(const adapter_seeds::kmer_vec& kmers, uint32_t code, const T& func)
+{
+    const auto key = std::make_pair(code, static_cast<size_t>(0));
+    for (auto it = std::lower_bound(kmers.begin(), kmers.end(), key);
+         it != kmers.end() && it->first == code; ++it) {
+        func(it->second);
+    }
+}
+
+
+/**
+ * Tracks offsets at which two sequences share at least one exact k-mer (seed),
+ * allowing offsets inconsistent with any seed hit to be skipped. Offsets with
+ * overlaps shorter than twice the seed length are always considered
+ * candidates, and are therefore scored exhaustively.
+ *
+ * Adapter seeds are located once per sample (see adapter_seeds), while reads
+ * are scanned once per read using build_*, after which the candidate offsets
+ * for each adapter (pair) are selected using select_*.
+ */
+class seed_filter
+{
+public:
+    /** Creates filter using the seeds found in the adapters of a profile. */
+    explicit seed_filter(const adapter_seeds& seeds)
+        : m_seeds(seeds)
+        , m_seed_length(seeds.seed_length())
+        , m_offset_bias(0)
+        , m_candidates()
+        , m_hits()
+        , m_read_1(nullptr)
+        , m_read_1_len(0)
+        , m_read_2(nullptr)
+        , m_read_2_len(0)
+        , m_reverse_2(false)
+        , m_table_1()
+        , m_table_2()
+        , m_read_offsets()
+        , m_junction_1()
+        , m_junction_2()
+    {
+    }
+
+    //! Copy construction; pointers remain valid as long as the reads do
+    seed_filter(const seed_filter&) = default;
+    //! Assignment not supported
+    seed_filter& operator=(const seed_filter&) = delete;
+
+    /** Finds seeds shared by a (window of a) SE read and the first adapters. */
+    void build_single_ended(const char* read, size_t length)
+    {
+        m_read_1 = read;
+        m_read_1_len = length;
+
+        m_hits.clear();
+        m_seeds.find_hits_1(read, length, m_hits);
+        std::sort(m_hits.begin(), m_hits.end());
+    }
+
+    /**
+     * Selects candidate offsets for aligning the first adapter of the nth
+     * pair against the SE read passed to build_single_ended.
+     */
+    void select_single_ended(size_t nth, size_t adapter_len)
+    {
+        reset(m_read_1_len, adapter_len);
+
+        const auto key = std::pair<size_t, int>(nth, std::numeric_limits<int>::min());
+        for (auto it = std::lower_bound(m_hits.begin(), m_hits.end(), key);
+             it != m_hits.end() && it->first == nth; ++it) {
+            add(it->second);
+        }
+    }
+
+    /**
+     * Finds seeds shared by the two mates of a PE read. If reverse_2 is true,
+     * read_2 is given in the orientation in which it was sequenced, and is
+     * reverse complemented on the fly.
+     */
+    void build_paired_ended(const std::string& read_1, const std::string& read_2, bool reverse_2)
+    {
+        m_read_1 = read_1.data();
+        m_read_1_len = read_1.length();
+        m_read_2 = read_2.data();
+        m_read_2_len = read_2.length();
+        m_reverse_2 = reverse_2;
+
+        if (reverse_2) {
+            m_table_2.build(reverse_complement_sequence(m_read_2, m_read_2_len, nullptr, 0),
+                            m_seed_length, [](uint32_t, size_t) {});
+        } else {
+            m_table_2.build(joined_sequence(m_read_2, m_read_2_len, nullptr, 0),
+                            m_seed_length, [](uint32_t, size_t) {});
+        }
+
+        m_read_offsets.clear();
+        m_read_offsets.reserve(m_read_1_len);
+        m_table_1.build(joined_sequence(m_read_1, m_read_1_len, nullptr, 0),
+                        m_seed_length, [&](uint32_t code, size_t pos_1) {
+            m_table_2.find(code, [&](size_t pos_2) {
+                m_read_offsets.push_back(static_cast<int>(pos_1) - static_cast<int>(pos_2));
+            });
+        });
+
+        m_junction_1.reserve(m_seed_length);
+        m_junction_2.reserve(m_seed_length);
+    }
+
+    /**
+     * Selects candidate offsets for aligning adapter 2 + read 1 against read 2
+     * + adapter 1 for the nth pair, using the PE read passed to
+     * build_paired_ended. The k-mers found wholly within the reads or wholly
+     * within the adapters are known in advance, and only the k-mers spanning
+     * the junctions between adapters and reads are found here.
+     */
+    void select_paired_ended(size_t nth,
+                             const char* adapter_1, size_t adapter_1_len,
+                             const char* adapter_2, size_t adapter_2_len)
+    {
+        const int read_1_start = adapter_2_len;
+        const int adapter_1_start = m_read_2_len;
+
+        reset(adapter_2_len + m_read_1_len, m_read_2_len + adapter_1_len);
+        // Only the last / first seed_length - 1 bases may be part of junction k-mers
+        const size_t adapter_2_part = std::min<size_t>(adapter_2_len, m_seed_length - 1);
+        const size_t read_1_part = std::min<size_t>(m_read_1_len, m_seed_length - 1);
+        const size_t read_2_part = std::min<size_t>(m_read_2_len, m_seed_length - 1);
+        const size_t adapter_1_part = std::min<size_t>(adapter_1_len, m_seed_length - 1);
+
+        find_junction(joined_sequence(adapter_2 + adapter_2_len - adapter_2_part, adapter_2_part,
+                                      m_read_1, read_1_part),
+                      adapter_2_len - adapter_2_part, m_junction_1);
+        if (m_reverse_2) {
+            // The last bases of the reverse complement are the first bases of the mate
+            find_junction(reverse_complement_sequence(m_read_2, read_2_part, adapter_1, adapter_1_part),
+                          m_read_2_len - read_2_part, m_junction_2);
+        } else {
+            find_junction(joined_sequence(m_read_2 + m_read_2_len - read_2_part, read_2_part,
+                                          adapter_1, adapter_1_part),
+                          m_read_2_len - read_2_part, m_junction_2);
+        }
+
+        const adapter_seeds::kmer_vec& adapter_kmers_1 = m_seeds.kmers_1(nth);
+        const adapter_seeds::kmer_vec& adapter_kmers_2 = m_seeds.kmers_2(nth);
+
+        // Read 1 vs read 2
+        for (const int offset : m_read_offsets) {
+            add(read_1_start + offset);
+        }
+
+        // Adapter 2 vs adapter 1
+        for (const int offset : m_seeds.shared_offsets(nth)) {
+            add(offset - adapter_1_start);
+        }
+
+        // Adapter 2 vs read 2
+        for (const auto& kmer : adapter_kmers_2) {
+            m_table_2.find(kmer.first, [&](size_t pos_2) {
+                add(static_cast<int>(kmer.second) - static_cast<int>(pos_2));
+            });
+        }
+
+        // Read 1 vs adapter 1
+        for (const auto& kmer : adapter_kmers_1) {
+            m_table_1.find(kmer.first, [&](size_t pos_1) {
+                add(read_1_start + static_cast<int>(pos_1) - adapter_1_start - static_cast<int>(kmer.second));
+            });
+        }
+
+        // Junction of adapter 2 and read 1 vs read 2, junction, and adapter 1
+        for (const auto& kmer : m_junction_1) {
+            const int pos_1 = kmer.second;
+
+            m_table_2.find(kmer.first, [&](size_t pos_2) {
+                add(pos_1 - static_cast<int>(pos_2));
+            });
+
+            for (const auto& other : m_junction_2) {
+                if (kmer.first == other.first) {
+                    add(pos_1 - static_cast<int>(other.second));
+                }
+            }
+
+            find_kmer(adapter_kmers_1, kmer.first, [&](size_t pos_2) {
+                add(pos_1 - adapter_1_start - static_cast<int>(pos_2));
+            });
+        }
+
+        // Adapter 2 and read 1 vs junction of read 2 and adapter 1
+        for (const auto& kmer : m_junction_2) {
+            const int pos_2 = kmer.second;
+
+            find_kmer(adapter_kmers_2, kmer.first, [&](size_t pos_1) {
+                add(static_cast<int>(pos_1) - pos_2);
+            });
+
+            m_table_1.find(kmer.first, [&](size_t pos_1) {
+                add(read_1_start + static_cast<int>(pos_1) - pos_2);
+            });
+        }
+    }
+
+    /** Returns true if an offset/overlap may be consistent with a seed hit. */
+    bool is_candidate(int offset, size_t length) const
+    {
+        if (length < 2 * m_seed_length) {
+            return true;
+        }
+
+        const size_t index = offset + m_offset_bias;
+
+        return (m_candidates[index / 64] >> (index % 64)) & 1;
+    }
+
+private:
+    /** Clears candidates for aligning sequences of the given lengths. */
+    void reset(size_t seq1_len, size_t seq2_len)
+    {
+        // Valid offsets range from -len(seq2) + 1 to len(seq1) - 1
+        m_offset_bias = seq2_len;
+        m_candidates.assign((seq1_len + seq2_len + 63) / 64, 0);
+    }
+
+    /** Marks an offset as a candidate. */
+    void add(int offset)
+    {
+        const size_t index = offset + m_offset_bias;
+        AR_DEBUG_ASSERT(index / 64 < m_candidates.size());
+
+        m_candidates[index / 64] |= static_cast<uint64_t>(1) << (index % 64);
+    }
+
+    /**
+     * Collects (k-mer, position) pairs for the k-mers in a junction consisting
+     * of the end of one sequence and the start of another, where 'start' is
+     * the position of the junction relative to the first sequence.
+     */
+    template <typename S>
+    void find_junction(const S& junction, size_t start, adapter_seeds::kmer_vec& kmers)
+    {
+        kmers.clear();
+        for_each_kmer(junction, m_seed_length, [&](uint32_t code, size_t pos) {
+            kmers.push_back(std::make_pair(code, start + pos));
+        });
+    }
+
+    //! Seeds found in the adapters
+    const adapter_seeds& m_seeds;
+    //! Length of k-mers used as seeds
+    size_t m_seed_length;
+    //! Value added to offsets to get the index into m_candidates
+    size_t m_offset_bias;
+    //! Bit-set of offsets for which one or more seed hits were found
+    std::vector<uint64_t> m_candidates;
+    //! (Adapter id, offset) pairs for the SE read; sorted
+    adapter_seeds::hit_vec m_hits;
+    //! The (SE or PE) read being aligned
+    const char* m_read_1;
+    size_t m_read_1_len;
+    const char* m_read_2;
+    size_t m_read_2_len;
+    //! Whether mate 2 is reverse complemented on the fly
+    bool m_reverse_2;
+    //! Tables of the k-mers found in mate 1 / mate 2
+    kmer_table m_table_1;
+    kmer_table m_table_2;
+    //! Offsets (pos in mate 1 - pos in mate 2) of k-mers shared by the mates
+    std::vector<int> m_read_offsets;
+    //! K-mers spanning adapter 2 + read 1 / read 2 + adapter 1
+    adapter_seeds::kmer_vec m_junction_1;
+    adapter_seeds::kmer_vec m_junction_2;
+};
+
+
+/**
+ * Aligns two sequences of lengths seq1_len and seq2_len at each offset in the
+ * range min_offset to max_offset, using compare(best, current, pos1, pos2) to
+ * evaluate the alignment of seq1[pos1:] and seq2[pos2:]. If seeds is not
+ * null, only offsets that are candidates according to the filter are scored.
+ */
+template <typename T>
+alignment_info pairwise_align_sequences(const alignment_info& best_alignment,
+                                        size_t seq1_len,
+                                        size_t seq2_len,
+                                        int min_offset,
+                                        int max_offset,
+                                        const T& compare,
+                                        const seed_filter* seeds)
+{
+    const int start_offset = std::max<int>(min_offset, -static_cast<int>(seq2_len) + 1);
+    const int end_offset = std::min<int>(max_offset, static_cast<int>(seq1_len) - 1);
+
+    alignment_info best = best_alignment;
+    for (int offset = start_offset; offset <= end_offset; ++offset) {
+        const size_t initial_seq1_offset = std::max<int>(0,  offset);
+        const size_t initial_seq2_offset = std::max<int>(0, -offset);
+        const size_t length = std::min(seq1_len - initial_seq1_offset,
+                                       seq2_len - initial_seq2_offset);
+
+        // An alignment can at best score its length, in which case it has no
+        // mismatches or Ns. It can therefore only be better than the current
+        // best alignment if its length is greater than the best score, since
+        // a best alignment scoring that length is at least as long and has no
+        // more Ns (ties are resolved in favor of the first alignment).
+        if (static_cast<int>(length) > best.score
+            && (!seeds || seeds->is_candidate(offset, length))) {
+            alignment_info current;
+            current.offset = offset;
+            current.length = length;
+
+            if (compare(best, current, initial_seq1_offset, initial_seq2_offset)) {
+                best = current;
+            }
+        }
+    }
+
+    return best;
+}
+
+
+/** Aligns two sequences (see above) using the best available kernel. */
+template <typename S1, typename S2>
+alignment_info pairwise_align_sequences(const alignment_info& best_alignment,
+                                        const S1& seq1,
+                                        size_t seq1_len,
+                                        const S2& seq2,
+                                        size_t seq2_len,
+                                        int min_offset,
+                                        int max_offset,
+                                        const seed_filter* seeds)
+{
+    const typename compare_kernel<S1, S2>::type compare_func = get_compare_kernel<S1, S2>();
+    const auto compare = [&](const alignment_info& best, alignment_info& current,
+                             size_t pos_1, size_t pos_2) {
+        return compare_func(best, current, seq1, pos_1, seq2, pos_2);
+    };
+
+    return pairwise_align_sequences(best_alignment, seq1_len, seq2_len,
+                                    min_offset, max_offset, compare, seeds);
+}
+
+
+/**
+ * Aligns adapter 2 + read 1 against read 2 + adapter 1, where read 2 is
+ * either reverse complemented in advance (joined_sequence) or on the fly
+ * (reverse_complement_sequence).
+ */
+template <typename S>
+alignment_info pairwise_align_sequences(const alignment_info& best_alignment,
+                                        const joined_sequence& seq1,
+                                        const S& seq2,
+                                        int min_offset,
+                                        int max_offset,
+                                        const seed_filter* seeds)
+{
+    return pairwise_align_sequences(best_alignment,
+                                    seq1, seq1.length(),
+                                    seq2, seq2.length(),
+                                    min_offset, max_offset, seeds);
+}
+
+
+alignment_info pairwise_align_sequences(const alignment_info& best_alignment,
+                                        const packed_sequence& seq1,
+                                        const packed_sequence& seq2,
+                                        int min_offset,
+                                        int max_offset,
+                                        const seed_filter* seeds)
+{
+    const auto compare = [&](const alignment_info& best, alignment_info& current,
+                             size_t pos_1, size_t pos_2) {
+        return compare_packed_subsequences(best, current, seq1, pos_1, seq2, pos_2);
+    };
+
+    return pairwise_align_sequences(best_alignment, seq1.length(), seq2.length(),
+                                    min_offset, max_offset, compare, seeds);
+}
+
+
+struct phred_scores
+{
+    phred_scores()
+      : identical_nts(std::numeric_limits<char>::min())
+      , different_nts(std::numeric_limits<char>::min())
+    {
+    }
+
+    //! Phred score to assign if the two nucleotides are identical
+    char identical_nts;
+    //! Phred score to assign if the two nucleotides differ
+    char different_nts;
+};
+
+
+//! Number of rows / columns in the table of consensus Phred scores
+const size_t PHRED_TABLE_STRIDE = MAX_PHRED_SCORE + 1;
+
+
+/**
+ * Calculates the phred scores to be assigned to a consensus base based on two
+ * bases, depending on the Phred scores assigned two these two bases. A phred
+ * score is calculated for both the case where the two bases are identical, and
+ * the case where they differ.
+ *
+ * The returned vector is inded by (phred1 * PHRED_TABLE_STRIDE) + phred2,
+ * where phred1 is assumed to be >= phred2. This is because we always select
+ * the base with the higher Phred score.
+ */
+std::vector<phred_scores> calculate_phred_score()
+{
+    std::vector<double> Perror(MAX_PHRED_SCORE + 1, 0.0);
+    std::vector<double> Ptrue(MAX_PHRED_SCORE + 1, 0.0);
+    for (int i = 0; i <= MAX_PHRED_SCORE; ++i) {
+        const double p_err = std::min<double>(0.75, std::pow(10, static_cast<double>(i) / -10.0));
+
+        Perror.at(i) = std::log(p_err / 3.0);
+        Ptrue.at(i) = std::log(1.0 - p_err);
+    }
+
+    std::vector<phred_scores> new_scores(PHRED_TABLE_STRIDE * PHRED_TABLE_STRIDE);
+    for (int i = 0; i <= MAX_PHRED_SCORE; ++i) {
+        for (int j = 0; j <= i; ++j) {
+            const size_t index = (i * PHRED_TABLE_STRIDE) + j;
+            phred_scores& scores = new_scores.at(index);
+
+            {   // When two nucleotides are identical
+                const double ptrue = Ptrue.at(i) + Ptrue.at(j);
+                const double perror = Perror.at(i) + Perror.at(j);
+                const double normconstant = 1.0 + 3.0 * std::exp(perror - ptrue);
+                scores.identical_nts = fastq::p_to_phred_33(1.0 - 1.0 / normconstant);
+            }
+
+            {   // When two nucleotides differ
+                const double ptrue = Ptrue.at(i) + Perror.at(j);
+                const double perror_one = Perror.at(i) + Ptrue.at(j);
+                const double perror_both = Perror.at(i) + Perror.at(j);
+                const double normconstant = 1.0 + 2.0 * std::exp(perror_both - ptrue) + std::exp(perror_one - ptrue);
+                scores.different_nts = fastq::p_to_phred_33(1.0 - 1.0 / normconstant);
+            }
+        }
+    }
+
+    return new_scores;
+}
+
+
+/**
+ * Table of pre-calculated Phred scores for consensus bases; see above. The
+ * table is built once, when the object file is loaded, so that lookups need
+ * neither bounds checks nor the guard of a function-local static.
+ */
+const std::vector<phred_scores> g_updated_phred_scores = calculate_phred_score();
+
+
+/** Returns the consensus scores for two Phred+33 scores, where q1 >= q2. */
+inline const phred_scores& get_updated_phred_scores(char qual_1, char qual_2)
+{
+    AR_DEBUG_ASSERT(qual_1 >= qual_2);
+
+    const size_t index = static_cast<size_t>(qual_1 - PHRED_OFFSET_33) * PHRED_TABLE_STRIDE
+                         + static_cast<size_t>(qual_2 - PHRED_OFFSET_33);
+    return g_updated_phred_scores[index];
+}
+
+
+/** Collapses a single pair of overlapping bases; see collapse_sequence. */
+inline void collapse_base(char nt_1, char nt_2, char qual_1, char qual_2,
+                          std::mt19937& rng, char& out_nt, char& out_qual)
+{
+    if (nt_1 == 'N' || nt_2 == 'N') {
+        // If one of the bases are N, then we suppose that we just have (at
+        // most) a single read at that site and choose that.
+        if (nt_1 != 'N') {
+            out_nt = nt_1;
+            out_qual = qual_1;
+        } else if (nt_2 != 'N') {
+            out_nt = nt_2;
+            out_qual = qual_2;
+        } else {
+            out_nt = 'N';
+            out_qual = PHRED_OFFSET_33;
+        }
+    } else if (nt_1 != nt_2 && qual_1 == qual_2) {
+        const int shuffle = rng() & 1;
+        out_nt = shuffle ? nt_1 : nt_2;
+        out_qual = get_updated_phred_scores(qual_1, qual_2).different_nts;
+    } else {
+        // Ensure that nt_1 / qual_1 always contains the preferred nt / score
+        // This is an assumption of the g_updated_phred_scores cache.
+        if (qual_1 < qual_2) {
+            std::swap(nt_1, nt_2);
+            std::swap(qual_1, qual_2);
+        }
+
+        const phred_scores& new_scores = get_updated_phred_scores(qual_1, qual_2);
+
+        out_nt = nt_1;
+        out_qual = (nt_1 == nt_2) ? new_scores.identical_nts : new_scores.different_nts;
+    }
+}
+
+
+/**
+ * Collapses 'length' overlapping bases, writing the consensus sequence and
+ * qualities to 'out_seq' and 'out_qual'. Identical, unambiguous bases are
+ * resolved 16 at a time; all other sites are handled by collapse_base in
+ * sequence order, so that random numbers are drawn in the same order as when
+ * every site is processed one at a time.
+ *
+ * If 'reverse_2' is true, seq_2 and qual_2 are read backwards and seq_2 is
+ * complemented, corresponding to collapsing the reverse complement of mate 2.
+ */
+template <bool reverse_2>
+void collapse_sequence(const char* seq_1,
+                       const char* seq_2,
+                       const char* qual_1,
+                       const char* qual_2,
+                       const size_t length,
+                       char* out_seq,
+                       char* out_qual,
+                       std::mt19937& rng)
+{
+    const auto nt_2 = [=](size_t i) {
+        return reverse_2 ? complement_nt(seq_2[length - 1 - i]) : seq_2[i];
+    };
+
+    const auto phred_2 = [=](size_t i) {
+        return reverse_2 ? qual_2[length - 1 - i] : qual_2[i];
+    };
+
+    size_t i = 0;
+
+#if defined(__SSE__) && defined(__SSE2__)
+    const __m128i offset = _mm_set1_epi8(PHRED_OFFSET_33);
+
+    for (; i + 16 <= length; i += 16) {
+        // Mate 2 is loaded from the mirrored position, if reversed
+        const size_t i_2 = reverse_2 ? length - i - 16 : i;
+
+        const __m128i nts_1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq_1 + i));
+        __m128i nts_2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq_2 + i_2));
+        const __m128i quals_1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(qual_1 + i));
+        __m128i quals_2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(qual_2 + i_2));
+
+        if (reverse_2) {
+            nts_2 = complement_128(reverse_128(nts_2));
+            quals_2 = reverse_128(quals_2);
+        }
+
+        const __m128i ambiguous = _mm_or_si128(_mm_cmpeq_epi8(nts_1, N_MASK_128),
+                                               _mm_cmpeq_epi8(nts_2, N_MASK_128));
+        const __m128i identical = _mm_cmpeq_epi8(nts_1, nts_2);
+        unsigned remaining = (~_mm_movemask_epi8(identical) | _mm_movemask_epi8(ambiguous)) & 0xFFFF;
+
+        // Every site is first treated as identical; the rest are fixed below
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out_seq + i), nts_1);
+
+        // Phred scores are in the range 0 .. 93, so unsigned max/min is safe
+        uint8_t highest[16];
+        uint8_t lowest[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(highest),
+                         _mm_sub_epi8(_mm_max_epu8(quals_1, quals_2), offset));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lowest),
+                         _mm_sub_epi8(_mm_min_epu8(quals_1, quals_2), offset));
+
+        for (size_t j = 0; j < 16; ++j) {
+            const size_t index = highest[j] * PHRED_TABLE_STRIDE + lowest[j];
+            out_qual[i + j] = g_updated_phred_scores[index].identical_nts;
+        }
+
+        while (remaining) {
+            const size_t j = i + __builtin_ctz(remaining);
+            remaining &= remaining - 1;
+
+            collapse_base(seq_1[j], nt_2(j), qual_1[j], phred_2(j),
+                          rng, out_seq[j], out_qual[j]);
+        }
+    }
+#endif
+
+    for (; i < length; ++i) {
+        collapse_base(seq_1[i], nt_2(i), qual_1[i], phred_2(i),
+                      rng, out_seq[i], out_qual[i]);
+    }
+}
+
+
+/**
+ * Collapses read1 and read2 into 'out_seq' and 'out_qual'; if 'reverse_2' is
+ * true, read2 is reverse complemented on the fly. See the public functions
+ * collapse_paired_ended_sequences and collapse_paired_ended_mates.
+ */
+template <bool reverse_2>
+void collapse_mates(const alignment_info& alignment,
+                    const fastq& read1,
+                    const fastq& read2,
+                    std::mt19937& rng,
+                    std::string& out_seq,
+                    std::string& out_qual)
+{
+    if (alignment.offset > static_cast<int>(read1.length())) {
+        // Gap between the two reads is not allowed
+        throw std::invalid_argument("invalid offset");
+    }
+
+    // Offset to the first base overlapping read 2
+    const size_t read_1_offset = static_cast<size_t>(std::max(0, alignment.offset));
+    // Number of bases in read 1 overlapping read 2
+    const size_t overlap = read1.length() - read_1_offset;
+    if (overlap > read2.length()) {
+        throw std::invalid_argument("invalid offset");
+    }
+
+    // Number of bases in read 2 following the overlap
+    const size_t read_2_remaining = read2.length() - overlap;
+
+    out_seq.resize(read_1_offset + read2.length());
+    out_qual.resize(read_1_offset + read2.length());
+
+    const char* seq_1 = read1.sequence().data();
+    const char* seq_2 = read2.sequence().data();
+    const char* qual_1 = read1.qualities().data();
+    const char* qual_2 = read2.qualities().data();
+    char* seq_out = &out_seq[0];
+    char* qual_out = &out_qual[0];
+
+    // Bases from read 1 preceding the overlap
+    std::copy(seq_1, seq_1 + read_1_offset, seq_out);
+    std::copy(qual_1, qual_1 + read_1_offset, qual_out);
+
+    // Collapse only the overlapping parts; as sequenced, these are the last
+    // bases of read 2 rather than the first
+    const size_t overlap_2 = reverse_2 ? read_2_remaining : 0;
+    collapse_sequence<reverse_2>(seq_1 + read_1_offset,
+                                 seq_2 + overlap_2,
+                                 qual_1 + read_1_offset,
+                                 qual_2 + overlap_2,
+                                 overlap,
+                                 seq_out + read_1_offset,
+                                 qual_out + read_1_offset,
+                                 rng);
+
+    // Bases from read 2 following the overlap
+    seq_out += read_1_offset + overlap;
+    qual_out += read_1_offset + overlap;
+    if (reverse_2) {
+        for (size_t i = 0; i < read_2_remaining; ++i) {
+            seq_out[i] = complement_nt(seq_2[read_2_remaining - 1 - i]);
+            qual_out[i] = qual_2[read_2_remaining - 1 - i];
+        }
+    } else {
+        std::copy(seq_2 + overlap, seq_2 + read2.length(), seq_out);
+        std::copy(qual_2 + overlap, qual_2 + read2.length(), qual_out);
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Public functions
+
+
+alignment_info::alignment_info()
+    : score(0)
+    , offset(0)
+    , length(0)
+    , n_mismatches(0)
+    , n_ambiguous(0)
+    , adapter_id(-1)
+{
+}
+
+
+bool alignment_info::is_better_than(const alignment_info& other) const
+{
+    if (score > other.score) {
+        return true;
+    } else if (score == other.score) {
+        if (length > other.length) {
+            return true;
+        } else if (length == other.length) {
+            return n_ambiguous < other.n_ambiguous;
+        }
+    }
+
+    return false;
+}
+
+
+alignment_options::alignment_options()
+    : packed(false)
+    , seed_length(0)
+    , index_kmer_length(0)
+    , long_read_window(0)
+{
+}
+
+
+adapter_index::adapter_index()
+    : m_kmer_length(0)
+    , m_filter_1()
+    , m_filter_2()
+    , m_kmers_1()
+    , m_kmers_2()
+{
+}
+
+
+adapter_index::adapter_index(const fastq_pair_vec& adapters, unsigned kmer_length)
+    : m_kmer_length(kmer_length)
+    , m_filter_1(FILTER_BITS, false)
+    , m_filter_2(FILTER_BITS, false)
+    , m_kmers_1()
+    , m_kmers_2()
+{
+    for (size_t adapter_id = 0; adapter_id < adapters.size(); ++adapter_id) {
+        const fastq_pair& adapter_pair = adapters.at(adapter_id);
+
+        for_each_kmer(adapter_pair.first.sequence(), kmer_length, [&](uint32_t code, size_t) {
+            m_kmers_1.push_back(std::make_pair(code, adapter_id));
+            m_filter_1[filter_bit(code)] = true;
+        });
+
+        for_each_kmer(adapter_pair.second.sequence(), kmer_length, [&](uint32_t code, size_t) {
+            m_kmers_2.push_back(std::make_pair(code, adapter_id));
+            m_filter_2[filter_bit(code)] = true;
+        });
+    }
+
+    for (kmer_vec* kmers : { &m_kmers_1, &m_kmers_2 }) {
+        std::sort(kmers->begin(), kmers->end());
+        kmers->erase(std::unique(kmers->begin(), kmers->end()), kmers->end());
+    }
+}
+
+
+void adapter_index::find_candidates(const std::string& sequence,
+                                    bool first_adapter,
+                                    std::vector<bool>& candidates) const
+{
+    find_kmer_candidates(joined_sequence(sequence, std::string()), first_adapter, candidates);
+}
+
 
-        // Matches count for 1, Ns for 0, and mismatches for -1
-        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+void adapter_index::find_candidates_reverse_complement(const std::string& sequence,
+                                                       bool first_adapter,
+                                                       std::vector<bool>& candidates) const
+{
+    find_kmer_candidates(reverse_complement_sequence(sequence, std::string()), first_adapter, candidates);
+}
 
-        seq_1_ptr += 16;
-        seq_2_ptr += 16;
-        remaining_bases -= 16;
+
+template <typename S>
+void adapter_index::find_kmer_candidates(const S& sequence,
+                                         bool first_adapter,
+                                         std::vector<bool>& candidates) const
+{
+    const kmer_vec& kmers = first_adapter ? m_kmers_1 : m_kmers_2;
+    const std::vector<bool>& filter = first_adapter ? m_filter_1 : m_filter_2;
+    if (!m_kmer_length || kmers.empty()) {
+        return;
     }
-#endif
 
-    for (; remaining_bases && current.score >= best.score; --remaining_bases) {
-        const char nt_1 = *seq_1_ptr++;
-        const char nt_2 = *seq_2_ptr++;
+    for_each_kmer(sequence, m_kmer_length, [&](uint32_t code, size_t) {
+        if (!filter[filter_bit(code)]) {
+            return;
+        }
 
-        if (nt_1 == 'N' || nt_2 == 'N') {
-            current.n_ambiguous++;
-            current.score--;
-        } else if (nt_1 != nt_2) {
-            current.n_mismatches++;
-            current.score -= 2;
+        const auto key = std::make_pair(code, static_cast<size_t>(0));
+        for (auto it = std::lower_bound(kmers.begin(), kmers.end(), key);
+             it != kmers.end() && it->first == code; ++it) {
+            candidates.at(it->second) = true;
         }
-    }
+    });
+}
 
-    return current.is_better_than(best);
+
+adapter_seeds::adapter_seeds()
+    : m_seed_length(0)
+    , m_filter_1()
+    , m_all_kmers_1()
+    , m_kmers_1()
+    , m_kmers_2()
+    , m_shared()
+{
 }
 
 
-alignment_info pairwise_align_sequences(const alignment_info& best_alignment,
-                                        const std::string& seq1,
-                                        const std::string& seq2,
-                                        int min_offset = std::numeric_limits<int>::min(),
-                                        int max_offset = std::numeric_limits<int>::max())
+adapter_seeds::adapter_seeds(const fastq_pair_vec& adapters, unsigned seed_length)
+    : m_seed_length(seed_length)
+    , m_filter_1(FILTER_BITS, false)
+    , m_all_kmers_1()
+    , m_kmers_1()
+    , m_kmers_2()
+    , m_shared()
 {
-    const int start_offset = std::max<int>(min_offset, -static_cast<int>(seq2.length()) + 1);
-    const int end_offset = std::min<int>(max_offset, static_cast<int>(seq1.length()) - 1);
+    for (size_t adapter_id = 0; adapter_id < adapters.size(); ++adapter_id) {
+        const fastq_pair& adapter_pair = adapters.at(adapter_id);
+
+        kmer_vec kmers_1;
+        for_each_kmer(adapter_pair.first.sequence(), seed_length, [&](uint32_t code, size_t pos) {
+            kmers_1.push_back(std::make_pair(code, pos));
+            m_all_kmers_1.push_back({code, adapter_id, pos});
+            m_filter_1[filter_bit(code)] = true;
+        });
+
+        kmer_vec kmers_2;
+        for_each_kmer(adapter_pair.second.sequence(), seed_length, [&](uint32_t code, size_t pos) {
+            kmers_2.push_back(std::make_pair(code, pos));
+        });
+
+        std::sort(kmers_1.begin(), kmers_1.end());
+        std::sort(kmers_2.begin(), kmers_2.end());
+
+        std::vector<int> shared;
+        for (const auto& kmer : kmers_2) {
+            const auto key = std::make_pair(kmer.first, static_cast<size_t>(0));
+            for (auto it = std::lower_bound(kmers_1.begin(), kmers_1.end(), key);
+                 it != kmers_1.end() && it->first == kmer.first; ++it) {
+                shared.push_back(static_cast<int>(kmer.second) - static_cast<int>(it->second));
+            }
+        }
 
-    alignment_info best = best_alignment;
-    for (int offset = start_offset; offset <= end_offset; ++offset) {
-        const size_t initial_seq1_offset = std::max<int>(0,  offset);
-        const size_t initial_seq2_offset = std::max<int>(0, -offset);
-        const size_t length = std::min(seq1.length() - initial_seq1_offset,
-                                       seq2.length() - initial_seq2_offset);
+        std::sort(shared.begin(), shared.end());
+        shared.erase(std::unique(shared.begin(), shared.end()), shared.end());
 
-        if (static_cast<int>(length) >= best.score) {
-            alignment_info current;
-            current.offset = offset;
-            current.length = length;
+        m_kmers_1.push_back(kmers_1);
+        m_kmers_2.push_back(kmers_2);
+        m_shared.push_back(shared);
+    }
 
-            const char* seq_1_ptr = seq1.data() + initial_seq1_offset;
-            const char* seq_2_ptr = seq2.data() + initial_seq2_offset;
+    std::sort(m_all_kmers_1.begin(), m_all_kmers_1.end(),
+              [](const adapter_kmer& a, const adapter_kmer& b) { return a.code < b.code; });
+}
 
-            if (compare_subsequences(best, current, seq_1_ptr, seq_2_ptr)) {
-                best = current;
-            }
+
+void adapter_seeds::find_hits_1(const char* sequence, size_t length, hit_vec& hits) const
+{
+    const auto compare = [](const adapter_kmer& kmer, uint32_t code) { return kmer.code < code; };
+
+    for_each_kmer(joined_sequence(sequence, length, nullptr, 0), m_seed_length,
+                  [&](uint32_t code, size_t pos) {
+        if (!m_filter_1[filter_bit(code)]) {
+            return;
         }
-    }
 
-    return best;
+        for (auto it = std::lower_bound(m_all_kmers_1.begin(), m_all_kmers_1.end(), code, compare);
+             it != m_all_kmers_1.end() && it->code == code; ++it) {
+            hits.push_back(std::make_pair(it->adapter_id,
+                                          static_cast<int>(pos) - static_cast<int>(it->position)));
+        }
+    });
 }
 
 
-struct phred_scores
+adapter_profile::adapter_profile()
+    : m_max_shift(0)
+    , m_max_length_1(0)
+    , m_max_length_2(0)
+    , m_options()
+    , m_index()
+    , m_seeds()
+    , m_adapters()
+    , m_sequences()
+    , m_packed()
 {
-    phred_scores()
-      : identical_nts(std::numeric_limits<char>::min())
-      , different_nts(std::numeric_limits<char>::min())
-    {
+}
+
+
+adapter_profile::adapter_profile(const fastq_pair_vec& adapters,
+                                 int max_shift,
+                                 const alignment_options& options)
+    : m_max_shift(max_shift)
+    , m_max_length_1(0)
+    , m_max_length_2(0)
+    , m_options(options)
+    , m_index()
+    , m_seeds()
+    , m_adapters()
+    , m_sequences()
+    , m_packed()
+{
+    if (options.index_kmer_length) {
+        m_index = adapter_index(adapters, options.index_kmer_length);
     }
 
-    //! Phred score to assign if the two nucleotides are identical
-    char identical_nts;
-    //! Phred score to assign if the two nucleotides differ
-    char different_nts;
-};
+    if (options.seed_length) {
+        m_seeds = adapter_seeds(adapters, options.seed_length);
+    }
+
+    // Adapters sharing no k-mers with a read are only aligned at offsets
+    // where the adapter overlaps fewer than this number of bases
+    const size_t max_unindexed_overlap = 2 * options.index_kmer_length;
+
+    for (const auto& pair : adapters) {
+        const std::string& adapter_1 = pair.first.sequence();
+        const std::string& adapter_2 = pair.second.sequence();
+
+        adapter_pair entry;
+        entry.offset_1 = m_sequences.length();
+        entry.length_1 = adapter_1.length();
+        m_sequences.append(adapter_1);
+        entry.offset_2 = m_sequences.length();
+        entry.length_2 = adapter_2.length();
+        m_sequences.append(adapter_2);
+
+        entry.se_prunable = max_unindexed_overlap
+            && adapter_1.length() >= max_unindexed_overlap + max_shift;
+        entry.pe_prunable = max_unindexed_overlap
+            && adapter_1.length() >= max_unindexed_overlap
+            && adapter_2.length() >= max_unindexed_overlap;
+
+        m_adapters.push_back(entry);
+        m_max_length_1 = std::max(m_max_length_1, adapter_1.length());
+        m_max_length_2 = std::max(m_max_length_2, adapter_2.length());
+
+        if (options.packed) {
+            m_packed.push_back(packed_sequence(adapter_1));
+            m_packed.push_back(packed_sequence(adapter_2));
+        }
+    }
+}
 
 
 /**
- * Calculates the phred scores to be assigned to a consensus base based on two
- * bases, depending on the Phred scores assigned two these two bases. A phred
- * score is calculated for both the case where the two bases are identical, and
- * the case where they differ.
- *
- * The returned vector is inded by (phred1 * MAX_PHRED_SCORE) + phred2, where
- * phred1 is assumed to be >= phred2. This is because we always select the base
- * with the higher Phred score.
+ * Returns true if no more than max_mismatches mismatches are found when
+ * comparing 'length' bases of two sequences; Ns in seq_2 are ignored.
  */
-std::vector<phred_scores> calculate_phred_score()
+bool has_few_mismatches(const char* seq_1, const char* seq_2, size_t length, int max_mismatches)
 {
-    std::vector<double> Perror(MAX_PHRED_SCORE + 1, 0.0);
-    std::vector<double> Ptrue(MAX_PHRED_SCORE + 1, 0.0);
-    for (int i = 0; i <= MAX_PHRED_SCORE; ++i) {
-        const double p_err = std::min<double>(0.75, std::pow(10, static_cast<double>(i) / -10.0));
-
-        Perror.at(i) = std::log(p_err / 3.0);
-        Ptrue.at(i) = std::log(1.0 - p_err);
+    int mismatches = 0;
+    for (size_t i = 0; i < length && mismatches <= max_mismatches; ++i) {
+        mismatches += (seq_2[i] != 'N' && seq_1[i] != seq_2[i]);
     }
 
-    std::vector<phred_scores> new_scores((MAX_PHRED_SCORE + 1) * (MAX_PHRED_SCORE + 1));
-    for (int i = 0; i <= MAX_PHRED_SCORE; ++i) {
-        for (int j = 0; j <= i; ++j) {
-            const int index = (i * MAX_PHRED_SCORE) + j;
-            phred_scores& scores = new_scores.at(index);
+    return mismatches <= max_mismatches;
+}
 
-            {   // When two nucleotides are identical
-                const double ptrue = Ptrue.at(i) + Ptrue.at(j);
-                const double perror = Perror.at(i) + Perror.at(j);
-                const double normconstant = 1.0 + 3.0 * std::exp(perror - ptrue);
-                scores.identical_nts = fastq::p_to_phred_33(1.0 - 1.0 / normconstant);
+
+adapter_prefilter::adapter_info::adapter_info()
+    : sequence()
+    , runs()
+    , max_mismatches(-1)
+    , prefixes()
+{
+}
+
+
+adapter_prefilter::adapter_prefilter()
+    : m_max_shift(0)
+    , m_kmer_length(0)
+    , m_kmers()
+    , m_adapters()
+    , m_max_mismatches()
+{
+}
+
+
+adapter_prefilter::adapter_prefilter(const fastq_pair_vec& adapters,
+                                     int max_shift,
+                                     unsigned kmer_length,
+                                     const predicate& is_good)
+    : m_max_shift(max_shift)
+    , m_kmer_length(kmer_length)
+    , m_kmers()
+    , m_adapters()
+    , m_max_mismatches()
+{
+    if (kmer_length < 1 || kmer_length > 12) {
+        throw std::invalid_argument("prefilter k-mer length must be in the range 1 to 12");
+    }
+
+    m_kmers.resize(size_t(1) << (2 * kmer_length), false);
+
+    size_t max_length = 0;
+    for (const auto& pair : adapters) {
+        adapter_info adapter;
+        adapter.sequence = pair.first.sequence();
+        max_length = std::max(max_length, adapter.sequence.length());
+
+        uint32_t code = 0;
+        size_t start = 0;
+        for (size_t i = 0; i < adapter.sequence.length(); ++i) {
+            const char nt = adapter.sequence.at(i);
+            if (nt == 'N') {
+                if (start < i) {
+                    adapter.runs.push_back(std::make_pair(start, i));
+                }
+
+                start = i + 1;
+                continue;
             }
 
-            {   // When two nucleotides differ
-                const double ptrue = Ptrue.at(i) + Perror.at(j);
-                const double perror_one = Perror.at(i) + Ptrue.at(j);
-                const double perror_both = Perror.at(i) + Perror.at(j);
-                const double normconstant = 1.0 + 2.0 * std::exp(perror_both - ptrue) + std::exp(perror_one - ptrue);
-                scores.different_nts = fastq::p_to_phred_33(1.0 - 1.0 / normconstant);
+            code = (code << 2) | encode(nt);
+            if (i + 1 - start >= kmer_length) {
+                m_kmers.at(code & (m_kmers.size() - 1)) = true;
             }
         }
-    }
 
-    return new_scores;
-}
+        if (start < adapter.sequence.length()) {
+            adapter.runs.push_back(std::make_pair(start, adapter.sequence.length()));
+        }
 
+        m_adapters.push_back(adapter);
+    }
 
-const phred_scores& get_updated_phred_scores(char qual_1, char qual_2)
-{
-    AR_DEBUG_ASSERT(qual_1 >= qual_2);
+    m_max_mismatches.assign(max_length + 1, -1);
+    for (size_t length = 1; length <= max_length; ++length) {
+        alignment_info alignment;
+        alignment.length = length;
+        alignment.score = length;
+        alignment.adapter_id = 0;
+
+        // Alignments with more mismatches are never acceptable (see above)
+        while (static_cast<size_t>(alignment.n_mismatches) <= length && is_good(alignment)) {
+            m_max_mismatches.at(length) = alignment.n_mismatches++;
+            alignment.score -= 2;
+        }
+    }
 
-    // Cache of pre-calculated Phred scores for consensus bases; see above.
-    static const std::vector<phred_scores> updated_phred_scores = calculate_phred_score();
+    // Overlaps between the 5' end of the adapter and the read are by far the
+    // most common, and the prefixes that must be checked are cached
+    bool usable = true;
+    for (auto& adapter : m_adapters) {
+        const size_t length = adapter.sequence.length();
+        adapter.max_mismatches = max_mismatches(adapter, 0, length);
+        // Otherwise every offset at which the whole adapter overlaps a read
+        // must be checked, which is no cheaper than aligning the read
+        usable &= adapter.max_mismatches < 0;
+
+        for (size_t prefix = 1; prefix < length; ++prefix) {
+            const int value = max_mismatches(adapter, 0, prefix);
+            if (value >= 0) {
+                adapter.prefixes.push_back(std::make_pair(prefix, value));
+            }
+        }
+    }
 
-    const size_t index = (static_cast<size_t>(qual_1 - PHRED_OFFSET_33) * MAX_PHRED_SCORE) + static_cast<size_t>(qual_2 - PHRED_OFFSET_33);
-    return updated_phred_scores.at(index);
+    if (!usable) {
+        m_adapters.clear();
+    }
 }
 
 
-string_pair collapse_sequence(const std::string& sequence1,
-                              const std::string& sequence2,
-                              const std::string& qualities1,
-                              const std::string& qualities2,
-                              std::mt19937& rng)
+bool adapter_prefilter::is_adapter_free(const fastq& read) const
 {
-    AR_DEBUG_ASSERT(sequence1.length() == sequence2.length() &&
-                     sequence1.length() == qualities1.length() &&
-                     sequence1.length() == qualities2.length());
+    const std::string& sequence = read.sequence();
+    if (!enabled() || sequence.find('N') != std::string::npos
+        || has_adapter_kmers(sequence)) {
+        return false;
+    }
 
-    std::string collapsed_seq(sequence1.length(), 'X');
-    std::string collapsed_qual(sequence1.length(), '\0');
+    for (const auto& adapter : m_adapters) {
+        const int adapter_len = adapter.sequence.length();
+        const int read_len = sequence.length();
 
-    for (size_t i = 0; i < collapsed_seq.size(); ++i) {
-        char nt_1 = sequence1.at(i);
-        char nt_2 = sequence2.at(i);
-        char qual_1 = qualities1.at(i);
-        char qual_2 = qualities2.at(i);
+        // Offsets at which the 5' end of the adapter is missing (see --shift)
+        for (int offset = std::max(-m_max_shift, -adapter_len + 1); offset < 0; ++offset) {
+            const size_t length = std::min(read_len, adapter_len + offset);
+            const int value = max_mismatches(adapter, -offset, length);
 
-        if (nt_1 == 'N' || nt_2 == 'N') {
-            // If one of the bases are N, then we suppose that we just have (at
-            // most) a single read at that site and choose that.
-            if (nt_1 != 'N') {
-                collapsed_seq.at(i) = nt_1;
-                collapsed_qual.at(i) = qual_1;
-            } else if (nt_2 != 'N') {
-                collapsed_seq.at(i) = nt_2;
-                collapsed_qual.at(i) = qual_2;
-            } else {
-                collapsed_seq.at(i) = 'N';
-                collapsed_qual.at(i) = PHRED_OFFSET_33;
+            if (value >= 0 && has_few_mismatches(sequence.data(),
+                                                 adapter.sequence.data() - offset,
+                                                 length,
+                                                 value)) {
+                return false;
             }
-        } else if (nt_1 != nt_2 && qual_1 == qual_2) {
-            const int shuffle = rng() & 1;
-            collapsed_seq.at(i) = shuffle ? nt_1 : nt_2;
+        }
 
-            const phred_scores& new_scores = get_updated_phred_scores(qual_1, qual_2);
-            collapsed_qual.at(i) = new_scores.different_nts;
-        } else {
-            // Ensure that nt_1 / qual_1 always contains the preferred nt / score
-            // This is an assumption of the g_updated_phred_scores cache.
-            if (qual_1 < qual_2) {
-                std::swap(nt_1, nt_2);
-                std::swap(qual_1, qual_2);
+        // Offsets at which a prefix of the adapter overlaps the 3' end of the read
+        for (const auto& prefix : adapter.prefixes) {
+            if (prefix.first <= sequence.length()
+                && has_few_mismatches(sequence.data() + read_len - prefix.first,
+                                      adapter.sequence.data(),
+                                      prefix.first,
+                                      prefix.second)) {
+                return false;
             }
-
-            const phred_scores& new_scores = get_updated_phred_scores(qual_1, qual_2);
-
-            collapsed_seq.at(i) = nt_1;
-            collapsed_qual.at(i) = (nt_1 == nt_2) ? new_scores.identical_nts : new_scores.different_nts;
         }
     }
 
-    return string_pair(collapsed_seq, collapsed_qual);
+    return true;
 }
 
 
-///////////////////////////////////////////////////////////////////////////////
-// Public functions
+int adapter_prefilter::max_mismatches(const adapter_info& adapter,
+                                      size_t start,
+                                      size_t length) const
+{
+    // Count the non-N bases and the non-overlapping k-mers without Ns
+    size_t n_called = 0;
+    size_t n_kmers = 0;
+    for (const auto& run : adapter.runs) {
+        const size_t run_start = std::max(run.first, start);
+        const size_t run_end = std::min(run.second, start + length);
+
+        if (run_start < run_end) {
+            n_called += run_end - run_start;
+            n_kmers += (run_end - run_start) / m_kmer_length;
+        }
+    }
 
+    // Either no alignment is acceptable, or acceptable alignments must share
+    // a k-mer with the adapter, which is ruled out before this is used
+    const int value = m_max_mismatches.at(n_called);
+    if (value < 0 || static_cast<int>(n_kmers) > value) {
+        return -1;
+    }
 
-alignment_info::alignment_info()
-    : score(0)
-    , offset(0)
-    , length(0)
-    , n_mismatches(0)
-    , n_ambiguous(0)
-    , adapter_id(-1)
-{
+    return value;
 }
 
 
-bool alignment_info::is_better_than(const alignment_info& other) const
+bool adapter_prefilter::has_adapter_kmers(const std::string& read) const
 {
-    if (score > other.score) {
-        return true;
-    } else if (score == other.score) {
-        if (length > other.length) {
+    const uint32_t mask = m_kmers.size() - 1;
+
+    uint32_t code = 0;
+    for (size_t i = 0; i < read.length(); ++i) {
+        code = (code << 2) | encode(read[i]);
+
+        if (i + 1 >= m_kmer_length && m_kmers[code & mask]) {
             return true;
-        } else if (length == other.length) {
-            return n_ambiguous < other.n_ambiguous;
         }
     }
 
@@ -328,24 +2188,146 @@ bool alignment_info::is_better_than(const alignment_info& other) const
 
 alignment_info align_single_ended_sequence(const fastq& read,
                                            const fastq_pair_vec& adapters,
-                                           int max_shift)
+                                           int max_shift,
+                                           const alignment_options& options)
 {
-    size_t adapter_id = 0;
-    alignment_info best_alignment;
-    for (const auto& adapter_pair : adapters) {
-        const fastq& adapter = adapter_pair.first;
-        const alignment_info alignment = pairwise_align_sequences(best_alignment,
-                                                                  read.sequence(),
-                                                                  adapter.sequence(),
-                                                                  -max_shift,
-                                                                  std::numeric_limits<int>::max());
+    return align_single_ended_sequence(read, adapter_profile(adapters, max_shift, options));
+}
 
-        if (alignment.is_better_than(best_alignment)) {
-            best_alignment = alignment;
-            best_alignment.adapter_id = adapter_id;
+
+/**
+ * Region of a SE read against which adapters are aligned, and the largest
+ * offset (relative to the start of the region) at which to align them.
+ */
+struct read_window
+{
+    //! Position of the first base of the region in the read
+    size_t start;
+    //! Number of bases in the region
+    size_t length;
+    //! Largest offset aligned, relative to the start of the region
+    int max_offset;
+};
+
+
+/**
+ * Returns the regions of a read of the given length against which adapters
+ * are aligned; see alignment_options::long_read_window. The 5' region extends
+ * far enough past the window that any adapter aligned within the window
+ * overlaps as many bases as it would when aligned against the full read.
+ */
+std::vector<read_window> get_read_windows(size_t read_length, const adapter_profile& adapters)
+{
+    const size_t window = adapters.options().long_read_window;
+
+    std::vector<read_window> windows;
+    if (!window || read_length <= 2 * window) {
+        windows.push_back({0, read_length, std::numeric_limits<int>::max()});
+    } else {
+        const size_t head_length = std::min(read_length, window + adapters.max_length_1());
+
+        windows.push_back({0, head_length, static_cast<int>(window) - 1});
+        windows.push_back({read_length - window, window, std::numeric_limits<int>::max()});
+    }
+
+    return windows;
+}
+
+
+alignment_info align_single_ended_sequence(const fastq& read,
+                                           const adapter_profile& adapters)
+{
+    const alignment_options& options = adapters.options();
+    const adapter_index& index = adapters.index();
+    const std::string& sequence = read.sequence();
+
+    // Adapters sharing no k-mers with the read are only aligned at offsets
+    // where the adapter overlaps fewer than this number of bases
+    const size_t max_unindexed_overlap = 2 * index.kmer_length();
+    std::vector<bool> candidates;
+    if (max_unindexed_overlap) {
+        candidates.assign(adapters.size(), false);
+        index.find_candidates(sequence, true, candidates);
+    }
+
+    const std::vector<read_window> windows = get_read_windows(sequence.length(), adapters);
+
+    std::vector<packed_sequence> packed_windows;
+    if (options.packed) {
+        for (const auto& window : windows) {
+            if (windows.size() == 1) {
+                packed_windows.push_back(packed_sequence(sequence));
+            } else {
+                packed_windows.push_back(packed_sequence(sequence.substr(window.start, window.length)));
+            }
+        }
+    }
+
+    // Seeds are located once per window, and then selected for each adapter
+    std::vector<seed_filter> seeds;
+    if (options.seed_length) {
+        for (const auto& window : windows) {
+            seeds.emplace_back(adapters.seeds());
+            seeds.back().build_single_ended(sequence.data() + window.start, window.length);
+        }
+    }
+
+    alignment_info best_alignment;
+    for (size_t adapter_id = 0; adapter_id < adapters.size(); ++adapter_id) {
+        const adapter_profile::adapter_pair& adapter = adapters.at(adapter_id);
+        const char* const adapter_seq = adapters.sequence_1(adapter);
+
+        int min_offset = -adapters.max_shift();
+        if (adapter.se_prunable && !candidates.at(adapter_id)
+            && sequence.length() >= max_unindexed_overlap) {
+            // Only offsets with overlaps < max_unindexed_overlap are aligned
+            min_offset = sequence.length() - max_unindexed_overlap + 1;
         }
 
-        ++adapter_id;
+        for (size_t nth = 0; nth < windows.size(); ++nth) {
+            const read_window& window = windows.at(nth);
+            const char* const window_seq = sequence.data() + window.start;
+
+            // Offsets are relative to the window, and adapters may not
+            // extend past the 5' end of windows not starting at the 5' end
+            const int window_min_offset = window.start
+                ? std::max<int>(0, min_offset - static_cast<int>(window.start))
+                : min_offset;
+            if (window_min_offset > window.max_offset) {
+                continue;
+            }
+
+            seed_filter* seeds_ptr = nullptr;
+            if (!seeds.empty()) {
+                seeds_ptr = &seeds.at(nth);
+                seeds_ptr->select_single_ended(adapter_id, adapter.length_1);
+            }
+
+            alignment_info alignment;
+            if (options.packed) {
+                alignment = pairwise_align_sequences(best_alignment,
+                                                     packed_windows.at(nth),
+                                                     adapters.packed_1(adapter_id),
+                                                     window_min_offset,
+                                                     window.max_offset,
+                                                     seeds_ptr);
+            } else {
+                alignment = pairwise_align_sequences(best_alignment,
+                                                     contiguous_sequence(window_seq),
+                                                     window.length,
+                                                     contiguous_sequence(adapter_seq),
+                                                     adapter.length_1,
+                                                     window_min_offset,
+                                                     window.max_offset,
+                                                     seeds_ptr);
+            }
+
+            if (alignment.is_better_than(best_alignment)) {
+                best_alignment = alignment;
+                best_alignment.offset += window.start;
+                best_alignment.adapter_id = adapter_id;
+            }
+        }
     }
 
     return best_alignment;
@@ -355,41 +2337,147 @@ alignment_info align_single_ended_sequence(const fastq& read,
 alignment_info align_paired_ended_sequences(const fastq& read1,
                                             const fastq& read2,
                                             const fastq_pair_vec& adapters,
-                                            int max_shift)
+                                            int max_shift,
+                                            const alignment_options& options)
 {
-    size_t adapter_id = 0;
-    alignment_info best_alignment;
-    for (const auto& adapter_pair : adapters) {
-        const fastq& adapter1 = adapter_pair.first;
-        const fastq& adapter2 = adapter_pair.second;
+    return align_paired_ended_sequences(read1, read2, adapter_profile(adapters, max_shift, options));
+}
+
+
+/**
+ * Aligns PE mates, along with each adapter pair in a profile. If reverse_2 is
+ * true, read2 is given in the orientation in which it was sequenced, and is
+ * reverse complemented on the fly.
+ */
+template <bool reverse_2>
+alignment_info align_mates(const fastq& read1,
+                           const fastq& read2,
+                           const adapter_profile& adapters)
+{
+    typedef typename std::conditional<reverse_2,
+                                      reverse_complement_sequence,
+                                      joined_sequence>::type mate_2_sequence;
+
+    const alignment_options& options = adapters.options();
+    const adapter_index& index = adapters.index();
+    const std::string& sequence1 = read1.sequence();
+    const std::string& sequence2 = read2.sequence();
+
+    // Adapters sharing no k-mers with the reads are only aligned at offsets
+    // where each adapter overlaps fewer than this number of bases
+    const size_t max_unindexed_overlap = 2 * index.kmer_length();
+    std::vector<bool> candidates;
+    if (max_unindexed_overlap) {
+        candidates.assign(adapters.size(), false);
+        index.find_candidates(sequence1, true, candidates);
+        if (reverse_2) {
+            index.find_candidates_reverse_complement(sequence2, false, candidates);
+        } else {
+            index.find_candidates(sequence2, false, candidates);
+        }
+    }
+
+    packed_sequence packed_read1;
+    packed_sequence packed_read2;
+    packed_sequence packed_sequence1;
+    packed_sequence packed_sequence2;
+    if (options.packed) {
+        packed_read1.assign(sequence1);
+        if (reverse_2) {
+            packed_read2.assign_reverse_complement(sequence2);
+        } else {
+            packed_read2.assign(sequence2);
+        }
+    }
+
+    // The mates are scanned for seeds once, after which only seeds spanning
+    // the adapter / read junctions are located for each adapter pair
+    seed_filter seeds(adapters.seeds());
+    seed_filter* const seeds_ptr = options.seed_length ? &seeds : nullptr;
+    if (seeds_ptr) {
+        seeds.build_paired_ended(sequence1, sequence2, reverse_2);
+    }
+
+    // Number of bases by which read 1 extends past the 3' end of read 2
+    const int no_adapter_overhang = std::max<int>(0, sequence1.length() - sequence2.length());
 
-        const std::string sequence1 = adapter2.sequence() + read1.sequence();
-        const std::string sequence2 = read2.sequence() + adapter1.sequence();
+    alignment_info best_alignment;
+    for (size_t adapter_id = 0; adapter_id < adapters.size(); ++adapter_id) {
+        const adapter_profile::adapter_pair& adapter = adapters.at(adapter_id);
+        const int adapter2_len = adapter.length_2;
 
         // Only consider alignments where at least one nucleotide from each read
         // is aligned against the other, included shifted alignments to account
         // for missing bases at the 5' ends of the reads.
-        const int min_offset = adapter2.length() - read2.length() - max_shift;
-        alignment_info alignment = pairwise_align_sequences(best_alignment,
-                                                            sequence1,
-                                                            sequence2,
-                                                            min_offset,
-                                                            std::numeric_limits<int>::max());
+        int min_offset = adapter2_len - static_cast<int>(sequence2.length()) - adapters.max_shift();
+        // Offsets at and past which neither adapter overlaps the other sequence
+        const int no_adapter_offset = adapter2_len + no_adapter_overhang;
+        // Such alignments are identical for all adapter pairs, and therefore
+        // only need to be considered for the first pair (as ties are ignored)
+        const int max_offset = adapter_id ? no_adapter_offset - 1 : std::numeric_limits<int>::max();
+
+        if (adapter.pe_prunable && !candidates.at(adapter_id)) {
+            min_offset = std::max<int>(min_offset, no_adapter_offset - max_unindexed_overlap + 1);
+        }
+
+        const joined_sequence joined1(adapters.sequence_2(adapter), adapter.length_2,
+                                      sequence1.data(), sequence1.length());
+        const mate_2_sequence joined2(sequence2.data(), sequence2.length(),
+                                      adapters.sequence_1(adapter), adapter.length_1);
+        if (seeds_ptr) {
+            seeds.select_paired_ended(adapter_id,
+                                      adapters.sequence_1(adapter), adapter.length_1,
+                                      adapters.sequence_2(adapter), adapter.length_2);
+        }
+
+        alignment_info alignment;
+        if (options.packed) {
+            packed_sequence1.assign(adapters.packed_2(adapter_id), packed_read1);
+            packed_sequence2.assign(packed_read2, adapters.packed_1(adapter_id));
+
+            alignment = pairwise_align_sequences(best_alignment,
+                                                 packed_sequence1,
+                                                 packed_sequence2,
+                                                 min_offset,
+                                                 max_offset,
+                                                 seeds_ptr);
+        } else {
+            alignment = pairwise_align_sequences(best_alignment,
+                                                 joined1,
+                                                 joined2,
+                                                 min_offset,
+                                                 max_offset,
+                                                 seeds_ptr);
+        }
 
         if (alignment.is_better_than(best_alignment)) {
             best_alignment = alignment;
             best_alignment.adapter_id = adapter_id;
             // Convert the alignment into an alignment between read 1 & 2 only
-            best_alignment.offset -= adapter2.length();
+            best_alignment.offset -= adapter2_len;
         }
-
-        ++adapter_id;
     }
 
     return best_alignment;
 }
 
 
+alignment_info align_paired_ended_sequences(const fastq& read1,
+                                            const fastq& read2,
+                                            const adapter_profile& adapters)
+{
+    return align_mates<false>(read1, read2, adapters);
+}
+
+
+alignment_info align_paired_ended_mates(const fastq& read1,
+                                        const fastq& read2,
+                                        const adapter_profile& adapters)
+{
+    return align_mates<true>(read1, read2, adapters);
+}
+
+
 void truncate_single_ended_sequence(const alignment_info& alignment,
                                     fastq& read)
 {
@@ -428,6 +2516,31 @@ size_t truncate_paired_ended_sequences(const alignment_info& alignment,
 }
 
 
+size_t truncate_paired_ended_mates(const alignment_info& alignment,
+                                   fastq& read1,
+                                   fastq& read2)
+{
+    size_t had_adapter = 0;
+    const int template_length = std::max<int>(0, static_cast<int>(read2.length()) + alignment.offset);
+    if (alignment.offset > static_cast<int>(read1.length())) {
+        throw std::invalid_argument("invalid offset");
+    } else if (alignment.offset >= 0) {
+        // As in truncate_paired_ended_sequences; read2 is never truncated
+        had_adapter += static_cast<size_t>(template_length) < read1.length();
+        read1.truncate(0, static_cast<size_t>(template_length));
+    } else {
+        had_adapter += static_cast<size_t>(template_length) < read1.length();
+        had_adapter += static_cast<size_t>(template_length) < read2.length();
+
+        read1.truncate(0, static_cast<size_t>(template_length));
+        // Adapter sequence is found at the 3' end of read2 as sequenced
+        read2.truncate(0, static_cast<size_t>(template_length));
+    }
+
+    return had_adapter;
+}
+
+
 std::string strip_mate_info(const std::string& header, const char mate_sep)
 {
     size_t pos = header.find_first_of(' ');
@@ -454,33 +2567,31 @@ fastq collapse_paired_ended_sequences(const alignment_info& alignment,
                                       std::mt19937& rng,
                                       const char mate_sep)
 {
-    if (alignment.offset > static_cast<int>(read1.length())) {
-        // Gap between the two reads is not allowed
-        throw std::invalid_argument("invalid offset");
-    }
+    fastq collapsed;
+    collapse_mates<false>(alignment, read1, read2, rng,
+                          collapsed.m_sequence, collapsed.m_qualities);
 
-    // Offset to the first base overlapping read 2
-    const size_t read_1_offset = static_cast<size_t>(std::max(0, alignment.offset));
-    const std::string read_1_seq = read1.sequence().substr(0, read_1_offset);
-    const std::string read_1_qual = read1.qualities().substr(0, read_1_offset);
+    // Remove mate number from read, if present, when building new record
+    collapsed.m_header = mate_sep ? strip_mate_info(read1.header(), mate_sep) : read1.header();
+
+    return collapsed;
+}
 
-    // Offset to the last base overlapping read 1
-    const size_t read_2_offset = static_cast<int>(read1.length()) - std::max(0, alignment.offset);
-    const std::string read_2_seq = read2.sequence().substr(read_2_offset);
-    const std::string read_2_qual = read2.qualities().substr(read_2_offset);
 
-    // Collapse only the overlapping parts
-    string_pair collapsed = collapse_sequence(read1.sequence().substr(read_1_offset),
-                                              read2.sequence().substr(0, read_2_offset),
-                                              read1.qualities().substr(read_1_offset),
-                                              read2.qualities().substr(0, read_2_offset),
-                                              rng);
+fastq collapse_paired_ended_mates(const alignment_info& alignment,
+                                  const fastq& read1,
+                                  const fastq& read2,
+                                  std::mt19937& rng,
+                                  const char mate_sep)
+{
+    fastq collapsed;
+    collapse_mates<true>(alignment, read1, read2, rng,
+                         collapsed.m_sequence, collapsed.m_qualities);
 
     // Remove mate number from read, if present, when building new record
-    return fastq(mate_sep ? strip_mate_info(read1.header(), mate_sep) : read1.header(),
-                 read_1_seq + collapsed.first + read_2_seq,
-                 read_1_qual + collapsed.second + read_2_qual,
-                 FASTQ_ENCODING_SAM);
+    collapsed.m_header = mate_sep ? strip_mate_info(read1.header(), mate_sep) : read1.header();
+
+    return collapsed;
 }
 
 
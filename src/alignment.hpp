@@ -24,10 +24,14 @@
 #ifndef ALIGNMENT_H
 #define ALIGNMENT_H
 
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <random>
+#include <vector>
 
 #include "fastq.hpp"
+#include "packed_sequence.hpp"
 
 namespace ar
 {
@@ -114,6 +118,352 @@ struct alignment_info
 };
 
 
+/**
+ * Options affecting how alignments are carried out.
+ */
+struct alignment_options
+{
+    /** Defaults to unpacked sequences and exhaustive alignments. **/
+    alignment_options();
+
+    //! If true, sequences are 2-bit packed and compared 32 bases at a time.
+    //! This does not change the resulting alignments.
+    bool packed;
+    //! If not zero, offsets are only scored if the two sequences share an
+    //! exact k-mer of this length (a seed) at that offset, or if the overlap
+    //! is shorter than twice the seed length. Alignments lacking any exact
+    //! seed may therefore be missed.
+    unsigned seed_length;
+    //! If not zero, reads are only aligned in full against adapters sharing
+    //! one or more k-mers of this length with the read (see adapter_index).
+    unsigned index_kmer_length;
+    //! If not zero, SE reads longer than twice this number of bases are only
+    //! aligned at offsets within this many bases of the 5' or 3' end of the
+    //! read, making alignments linear in the length of (long) reads.
+    unsigned long_read_window;
+};
+
+
+/**
+ * Index of the k-mers found in a set of adapter pairs, used to select the
+ * adapters that may plausibly be found in a given read. Adapters that share
+ * no k-mers with a read are only aligned at offsets where the adapter
+ * overlaps fewer than 2 * k bases of the read, since such short overlaps may
+ * not contain any exact k-mers. Alignments spanning more bases, but lacking
+ * exact k-mers, may therefore be missed.
+ */
+class adapter_index
+{
+public:
+    /** Creates an empty index, which does not exclude any adapters. */
+    adapter_index();
+
+    /** Creates an index of k-mers in both adapters of each pair. */
+    adapter_index(const fastq_pair_vec& adapters, unsigned kmer_length);
+
+    /** Returns the length of k-mers; 0 for empty indexes. */
+    unsigned kmer_length() const { return m_kmer_length; }
+
+    /**
+     * Sets candidates[id] to true for each adapter pair for which the first
+     * (or second) adapter shares one or more k-mers with sequence. Entries
+     * for adapters without shared k-mers are not modified.
+     */
+    void find_candidates(const std::string& sequence,
+                         bool first_adapter,
+                         std::vector<bool>& candidates) const;
+
+    /**
+     * As find_candidates, except that k-mers are taken from the reverse
+     * complement of sequence, without reverse complementing a copy.
+     */
+    void find_candidates_reverse_complement(const std::string& sequence,
+                                            bool first_adapter,
+                                            std::vector<bool>& candidates) const;
+
+private:
+    typedef std::vector<std::pair<uint32_t, size_t>> kmer_vec;
+
+    /** Implementation of find_candidates for sequence views. */
+    template <typename S>
+    void find_kmer_candidates(const S& sequence,
+                              bool first_adapter,
+                              std::vector<bool>& candidates) const;
+
+    //! Number of bits in the k-mer pre-filters
+    static const size_t FILTER_BITS = 1 << 16;
+
+    /** Returns the pre-filter bit for a k-mer. */
+    static size_t filter_bit(uint32_t code)
+    {
+        return (code * 2654435761u) >> 16;
+    }
+
+    //! Length of k-mers; 0 if the index is empty
+    unsigned m_kmer_length;
+    //! Bit-sets of (hashed) k-mers found in the first / second adapters;
+    //! used to quickly skip k-mers not found in any adapter.
+    std::vector<bool> m_filter_1;
+    std::vector<bool> m_filter_2;
+    //! Sorted list of (k-mer, adapter id) for the first adapters
+    kmer_vec m_kmers_1;
+    //! Sorted list of (k-mer, adapter id) for the second adapters
+    kmer_vec m_kmers_2;
+};
+
+
+/**
+ * The k-mers (seeds) found in each adapter pair, located once per sample when
+ * seeded alignments are enabled (see alignment_options::seed_length), so that
+ * only the read itself needs to be scanned for seeds when aligning a read.
+ */
+class adapter_seeds
+{
+public:
+    //! Sorted list of (k-mer, position) pairs
+    typedef std::vector<std::pair<uint32_t, size_t>> kmer_vec;
+    //! List of (adapter id, offset) pairs
+    typedef std::vector<std::pair<size_t, int>> hit_vec;
+
+    /** Creates an empty set of seeds. */
+    adapter_seeds();
+
+    /** Locates the k-mers of the given length in both adapters of each pair. */
+    adapter_seeds(const fastq_pair_vec& adapters, unsigned seed_length);
+
+    /** Returns the length of seeds; 0 if empty. */
+    unsigned seed_length() const { return m_seed_length; }
+
+    /** Returns the k-mers in the first / second adapter of the nth pair. */
+    const kmer_vec& kmers_1(size_t nth) const { return m_kmers_1.at(nth); }
+    const kmer_vec& kmers_2(size_t nth) const { return m_kmers_2.at(nth); }
+
+    /**
+     * Returns the offsets of k-mers shared by the two adapters in the nth
+     * pair, i.e. the position in the second minus the position in the first.
+     */
+    const std::vector<int>& shared_offsets(size_t nth) const { return m_shared.at(nth); }
+
+    /**
+     * Adds (adapter id, offset) to hits for each k-mer in sequence that is
+     * found in the first adapter of a pair, where offset is the position of
+     * the k-mer in the sequence minus the position in the adapter.
+     */
+    void find_hits_1(const char* sequence, size_t length, hit_vec& hits) const;
+
+private:
+    /** A k-mer found in the first adapter of a pair. */
+    struct adapter_kmer
+    {
+        uint32_t code;
+        size_t adapter_id;
+        size_t position;
+    };
+
+    //! Number of bits in the k-mer pre-filter
+    static const size_t FILTER_BITS = 1 << 16;
+
+    /** Returns the pre-filter bit for a k-mer. */
+    static size_t filter_bit(uint32_t code)
+    {
+        return (code * 2654435761u) >> 16;
+    }
+
+    //! Length of k-mers; 0 if empty
+    unsigned m_seed_length;
+    //! Bit-set of (hashed) k-mers found in the first adapters; used to
+    //! quickly skip k-mers in reads that are not found in any adapter.
+    std::vector<bool> m_filter_1;
+    //! K-mers found in the first adapters, sorted by k-mer
+    std::vector<adapter_kmer> m_all_kmers_1;
+    //! Sorted (k-mer, position) pairs for the first / second adapters
+    std::vector<kmer_vec> m_kmers_1;
+    std::vector<kmer_vec> m_kmers_2;
+    //! Offsets of k-mers shared by the adapters in each pair
+    std::vector<std::vector<int>> m_shared;
+};
+
+
+/**
+ * Adapter pairs compiled for repeated alignments against reads.
+ *
+ * The profile is built once per sample, and stores all adapter sequences
+ * back-to-back in a single buffer, along with their lengths, packed copies
+ * (if packed alignments are enabled), the adapter_index and adapter_seeds (if
+ * enabled), and the per-adapter offset bounds that do not depend on the read
+ * being aligned.
+ */
+class adapter_profile
+{
+public:
+    /** Per-adapter-pair values cached by the profile. */
+    struct adapter_pair
+    {
+        //! Position of the first / second adapter in the sequence buffer
+        size_t offset_1;
+        size_t offset_2;
+        //! Length of the first / second adapter
+        size_t length_1;
+        size_t length_2;
+        //! True if the first adapter is long enough that offsets overlapping
+        //! 2 * k or more bases may be skipped in SE mode (see adapter_index)
+        bool se_prunable;
+        //! True if both adapters are long enough that offsets overlapping
+        //! 2 * k or more bases may be skipped in PE mode (see adapter_index)
+        bool pe_prunable;
+    };
+
+    /** Creates an empty profile. */
+    adapter_profile();
+
+    /**
+     * Compiles a set of adapter pairs; sequences are assumed to have been
+     * cleaned (uppercased, with '.' replaced by 'N') as done by fastq.
+     */
+    adapter_profile(const fastq_pair_vec& adapters,
+                    int max_shift,
+                    const alignment_options& options = alignment_options());
+
+    /** Returns the number of adapter pairs. */
+    size_t size() const { return m_adapters.size(); }
+
+    /** Returns the max number of missing bases at the 5' ends of reads. */
+    int max_shift() const { return m_max_shift; }
+
+    /** Returns the length of the longest first / second adapter in the profile. */
+    size_t max_length_1() const { return m_max_length_1; }
+    size_t max_length_2() const { return m_max_length_2; }
+
+    /** Returns the options used when aligning using this profile. */
+    const alignment_options& options() const { return m_options; }
+
+    /** Returns the adapter k-mer index; empty unless enabled in options. */
+    const adapter_index& index() const { return m_index; }
+
+    /** Returns the adapter seeds; empty unless enabled in options. */
+    const adapter_seeds& seeds() const { return m_seeds; }
+
+    /** Returns the cached values for the nth adapter pair. */
+    const adapter_pair& at(size_t nth) const { return m_adapters[nth]; }
+
+    /** Returns the first base of the first / second adapter in a pair. */
+    const char* sequence_1(const adapter_pair& pair) const { return m_sequences.data() + pair.offset_1; }
+    const char* sequence_2(const adapter_pair& pair) const { return m_sequences.data() + pair.offset_2; }
+
+    /** Returns the packed first / second adapter; only set if packed. */
+    const packed_sequence& packed_1(size_t nth) const { return m_packed.at(nth * 2); }
+    const packed_sequence& packed_2(size_t nth) const { return m_packed.at(nth * 2 + 1); }
+
+private:
+    //! Max number of missing bases at the 5' ends of reads
+    int m_max_shift;
+    //! Length of the longest first / second adapter
+    size_t m_max_length_1;
+    size_t m_max_length_2;
+    //! Options used when aligning using this profile
+    alignment_options m_options;
+    //! Index of adapter k-mers; empty unless enabled in options
+    adapter_index m_index;
+    //! Seeds found in each adapter pair; empty unless enabled in options
+    adapter_seeds m_seeds;
+    //! Cached values for each adapter pair
+    std::vector<adapter_pair> m_adapters;
+    //! All adapter sequences, stored back-to-back
+    std::string m_sequences;
+    //! Packed adapter sequences (adapter 1, adapter 2, ...), if enabled
+    std::vector<packed_sequence> m_packed;
+};
+
+
+/**
+ * Filter used to prove that SE reads cannot be aligned to any adapter.
+ *
+ * A read free of Ns that overlaps an adapter with at most M mismatches must
+ * share an exact k-mer with the adapter if the overlap contains more than M
+ * non-overlapping k-mers without Ns, since at least one of these k-mers
+ * contains no mismatches. If a read shares no k-mers with any adapter, then
+ * acceptable alignments are only possible at offsets where this argument does
+ * not apply, typically short overlaps, and these are checked directly. Reads
+ * for which no acceptable alignment is possible can be treated as unaligned
+ * without calling the aligner.
+ */
+class adapter_prefilter
+{
+public:
+    /** Predicate returning true for acceptable alignments. */
+    typedef std::function<bool(const alignment_info&)> predicate;
+
+    /** Creates a disabled filter; no reads are excluded. */
+    adapter_prefilter();
+
+    /**
+     * Creates a filter for the first adapter of each pair. The filter is
+     * disabled if the k-mers are too long to rule out alignments in which a
+     * whole adapter overlaps a read, given the acceptable number of mismatches.
+     *
+     * @param adapters A set of adapter pairs; only the first adapters are used.
+     * @param max_shift Max number of missing bases at the 5' ends of reads.
+     * @param kmer_length Length of k-mers; must be in the range 1 to 12.
+     * @param is_good Returns true if an alignment is acceptable; the result
+     *                must only depend on the number of aligned bases that
+     *                are not Ns and the number of mismatches, and must be
+     *                false for alignments with more mismatches than an
+     *                alignment with the same number of bases that is not.
+     */
+    adapter_prefilter(const fastq_pair_vec& adapters,
+                      int max_shift,
+                      unsigned kmer_length,
+                      const predicate& is_good);
+
+    /** Returns true if the filter may exclude reads. */
+    bool enabled() const { return !m_adapters.empty(); }
+
+    /** Returns true if no acceptable alignment is possible for a read. */
+    bool is_adapter_free(const fastq& read) const;
+
+private:
+    /** An adapter and values used to select offsets that must be checked. */
+    struct adapter_info
+    {
+        adapter_info();
+
+        std::string sequence;
+        //! The [start, end) coordinates of stretches without Ns
+        std::vector<std::pair<size_t, size_t>> runs;
+        //! Max mismatches allowed when the whole adapter overlaps the read;
+        //! the filter is disabled unless this is -1 for all adapters
+        int max_mismatches;
+        //! Lengths of shorter adapter prefixes that must be checked, along
+        //! with the max number of mismatches allowed for each
+        std::vector<std::pair<size_t, int>> prefixes;
+    };
+
+    /**
+     * Returns max mismatches allowed for the overlap [start, start + length)
+     * of the adapter, or -1 if no acceptable alignment is possible without
+     * shared k-mers.
+     */
+    int max_mismatches(const adapter_info& adapter, size_t start, size_t length) const;
+
+    /** Returns true if the read contains any k-mer found in the adapters. */
+    bool has_adapter_kmers(const std::string& read) const;
+
+    /** Returns the 2-bit code for a (non-N) nucleotide. */
+    static uint32_t encode(char nt) { return (nt >> 1) & 0x3; }
+
+    //! Max number of missing bases at the 5' ends of reads
+    int m_max_shift;
+    //! Length of k-mers used by the filter
+    size_t m_kmer_length;
+    //! Bit-set of (2-bit encoded) k-mers found in the adapters
+    std::vector<bool> m_kmers;
+    //! The first adapter of each pair; empty if the filter is disabled
+    std::vector<adapter_info> m_adapters;
+    //! Max mismatches in acceptable alignments of N non-N bases; -1 if none
+    std::vector<int> m_max_mismatches;
+};
+
+
 /**
  * Attempts to align adapters sequences against a SE read.
  *
@@ -121,13 +471,19 @@ struct alignment_info
  * @param adapters A set of adapter pairs; only the first adapters are used.
  * @param max_shift Allow up to this number of missing bases at the 5' end of
  *                  the read, when aligning the adapter.
+ * @param options Options determining how the alignment is carried out.
  * @return The best alignment, or a length 0 alignment if not aligned.
  *
  * The best alignment is selected using alignment_info::is_better_than.
  */
 alignment_info align_single_ended_sequence(const fastq& read,
                                            const fastq_pair_vec& adapters,
-                                           int max_shift);
+                                           int max_shift,
+                                           const alignment_options& options = alignment_options());
+
+/** Aligns the first adapter of each pair in a profile against a SE read. */
+alignment_info align_single_ended_sequence(const fastq& read,
+                                           const adapter_profile& adapters);
 
 
 /**
@@ -138,6 +494,7 @@ alignment_info align_single_ended_sequence(const fastq& read,
  * @param adapters A set of adapter pairs; both in each pair adapters are used.
  * @param max_shift Allow up to this number of missing bases at the 5' end of
  *                  both mate reads.
+ * @param options Options determining how the alignment is carried out.
  * @return The best alignment, or a length 0 alignment if not aligned.
  *
  * The alignment is carried out following the concatenation of pcr2 and read1,
@@ -152,7 +509,23 @@ alignment_info align_single_ended_sequence(const fastq& read,
 alignment_info align_paired_ended_sequences(const fastq& read1,
                                             const fastq& read2,
                                             const fastq_pair_vec& adapters,
-                                            int max_shift);
+                                            int max_shift,
+                                            const alignment_options& options = alignment_options());
+
+/** Aligns PE mates, along with each adapter pair in a profile. */
+alignment_info align_paired_ended_sequences(const fastq& read1,
+                                            const fastq& read2,
+                                            const adapter_profile& adapters);
+
+/**
+ * As align_paired_ended_sequences, except that read2 is given in the
+ * orientation in which it was sequenced (i.e. not reverse complemented). Read
+ * 2 is reverse complemented on the fly, and the result is identical to that
+ * of align_paired_ended_sequences for the reverse complemented read.
+ */
+alignment_info align_paired_ended_mates(const fastq& read1,
+                                        const fastq& read2,
+                                        const adapter_profile& adapters);
 
 
 /**
@@ -174,6 +547,14 @@ size_t truncate_paired_ended_sequences(const alignment_info& alignment,
                                        fastq& read1,
                                        fastq& read2);
 
+/**
+ * As truncate_paired_ended_sequences, except that read2 is given in the
+ * orientation in which it was sequenced (i.e. not reverse complemented).
+ */
+size_t truncate_paired_ended_mates(const alignment_info& alignment,
+                                   fastq& read1,
+                                   fastq& read2);
+
 
 /**
  * Collapses two overlapping PE mates into a single sequence, recalculating the
@@ -196,6 +577,20 @@ fastq collapse_paired_ended_sequences(const alignment_info& alignment,
                                       const char mate_sep=MATE_SEPARATOR);
 
 
+/**
+ * As collapse_paired_ended_sequences, except that read2 is given in the
+ * orientation in which it was sequenced (i.e. not reverse complemented), and
+ * is assumed to have been trimmed using truncate_paired_ended_mates. Read 2 is
+ * reverse complemented on the fly, and the result is identical to that of
+ * collapse_paired_ended_sequences for the reverse complemented read.
+ */
+fastq collapse_paired_ended_mates(const alignment_info& alignment,
+                                  const fastq& read1,
+                                  const fastq& read2,
+                                  std::mt19937& rng,
+                                  const char mate_sep=MATE_SEPARATOR);
+
+
 /**
  * Truncates reads such that only adapter sequence remains.
  *
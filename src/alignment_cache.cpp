@@ -0,0 +1,101 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <stdexcept>
+
+#include "alignment_cache.hpp"
+
+namespace ar
+{
+
+alignment_cache::entry::entry()
+  : hash(0)
+  , used(false)
+  , sequence_1()
+  , sequence_2()
+  , alignment()
+{
+}
+
+
+alignment_cache::alignment_cache(size_t capacity)
+  : m_entries(capacity)
+{
+    if (!capacity) {
+        throw std::invalid_argument("alignment cache capacity must be at least 1");
+    }
+}
+
+
+bool alignment_cache::lookup(const std::string& sequence_1,
+                             const std::string& sequence_2,
+                             alignment_info& alignment) const
+{
+    const uint64_t key = hash(sequence_1, sequence_2);
+    const entry& slot = m_entries.at(key % m_entries.size());
+
+    if (slot.used && slot.hash == key && slot.sequence_1 == sequence_1
+        && slot.sequence_2 == sequence_2) {
+        alignment = slot.alignment;
+        return true;
+    }
+
+    return false;
+}
+
+
+void alignment_cache::insert(const std::string& sequence_1,
+                             const std::string& sequence_2,
+                             const alignment_info& alignment)
+{
+    const uint64_t key = hash(sequence_1, sequence_2);
+    entry& slot = m_entries.at(key % m_entries.size());
+
+    slot.hash = key;
+    slot.used = true;
+    // Assignment re-uses the storage of the previous entry, if large enough
+    slot.sequence_1.assign(sequence_1);
+    slot.sequence_2.assign(sequence_2);
+    slot.alignment = alignment;
+}
+
+
+uint64_t alignment_cache::hash(const std::string& sequence_1, const std::string& sequence_2)
+{
+    // 64-bit FNV-1a
+    uint64_t value = 14695981039346656037ull;
+    for (const char nt : sequence_1) {
+        value = (value ^ static_cast<uint8_t>(nt)) * 1099511628211ull;
+    }
+
+    // Separator ensures that splitting a sequence differently changes the hash
+    value = (value ^ 0xFFu) * 1099511628211ull;
+    for (const char nt : sequence_2) {
+        value = (value ^ static_cast<uint8_t>(nt)) * 1099511628211ull;
+    }
+
+    return value;
+}
+
+} // namespace ar
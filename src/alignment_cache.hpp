@@ -0,0 +1,90 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef ALIGNMENT_CACHE_H
+#define ALIGNMENT_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "alignment.hpp"
+
+namespace ar
+{
+
+/**
+ * Bounded cache of alignments, keyed by the sequence of a read (SE) or the
+ * sequences of a read pair (PE), used to avoid re-aligning duplicate reads.
+ *
+ * The cache is direct-mapped: each key is stored in a single slot selected by
+ * a hash of the sequences, replacing any previous entry in that slot. Lookups
+ * compare the full sequences, so hash collisions never return the wrong
+ * alignment. The cache is not thread-safe; one cache is used per thread.
+ */
+class alignment_cache
+{
+public:
+    /** Creates a cache holding at most 'capacity' alignments. */
+    explicit alignment_cache(size_t capacity);
+
+    /**
+     * Returns true and sets 'alignment' if an alignment has been cached for
+     * the sequence(s); sequence_2 is empty for SE reads.
+     */
+    bool lookup(const std::string& sequence_1,
+                const std::string& sequence_2,
+                alignment_info& alignment) const;
+
+    /** Caches an alignment, possibly replacing a previously cached alignment. */
+    void insert(const std::string& sequence_1,
+                const std::string& sequence_2,
+                const alignment_info& alignment);
+
+    /** Returns the max number of alignments cached. */
+    size_t capacity() const { return m_entries.size(); }
+
+private:
+    struct entry
+    {
+        entry();
+
+        //! Hash of the sequences; used to quickly reject mismatching slots
+        uint64_t hash;
+        //! True if the slot contains an alignment
+        bool used;
+        std::string sequence_1;
+        std::string sequence_2;
+        alignment_info alignment;
+    };
+
+    /** Returns the hash of a pair of sequences. */
+    static uint64_t hash(const std::string& sequence_1, const std::string& sequence_2);
+
+    std::vector<entry> m_entries;
+};
+
+} // namespace ar
+
+#endif
@@ -0,0 +1,686 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "batch_alignment.hpp"
+#include "debug.hpp"
+#include "fastq.hpp"
+
+#ifdef AR_SIMD_DISPATCH
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE__) && defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
+
+namespace ar
+{
+
+//! Number of reads aligned in parallel
+const size_t BATCH_SIZE = 64;
+//! Min number of consecutive reads of identical length aligned in a batch
+const size_t MIN_BATCH_SIZE = 8;
+//! Max length of sequences aligned in batches, limited by 16-bit counters
+const size_t MAX_BATCH_LENGTH = std::numeric_limits<uint16_t>::max();
+
+
+/** The bases found at one position in each read in a batch. */
+struct column
+{
+    char bases[BATCH_SIZE];
+};
+
+typedef std::vector<column> column_vec;
+typedef std::vector<const column*> column_ptr_vec;
+
+
+/**
+ * Adds counts of Ns and mismatches, collected for a block of up to 255
+ * columns using 8-bit integers, to the totals for each read in a batch.
+ */
+inline void add_block_counts(const uint8_t* block_ambiguous,
+                             const uint8_t* block_mismatches,
+                             uint16_t* n_ambiguous,
+                             uint16_t* n_mismatches)
+{
+    for (size_t j = 0; j < BATCH_SIZE; ++j) {
+        n_ambiguous[j] += block_ambiguous[j];
+        n_mismatches[j] += block_mismatches[j];
+    }
+}
+
+
+/**
+ * Scalar implementation of count_columns: Counts Ns and mismatches between two
+ * sequences of columns for each read in a batch, adding the counts to
+ * n_ambiguous and n_mismatches.
+ */
+void count_columns_std(const column* const* columns_1,
+                       const column* const* columns_2,
+                       size_t length,
+                       uint16_t* n_ambiguous,
+                       uint16_t* n_mismatches)
+{
+    for (size_t i = 0; i < length; ++i) {
+        const char* const bases_1 = columns_1[i]->bases;
+        const char* const bases_2 = columns_2[i]->bases;
+
+        for (size_t j = 0; j < BATCH_SIZE; ++j) {
+            if (bases_1[j] == 'N' || bases_2[j] == 'N') {
+                n_ambiguous[j]++;
+            } else if (bases_1[j] != bases_2[j]) {
+                n_mismatches[j]++;
+            }
+        }
+    }
+}
+
+
+#if defined(__SSE__) && defined(__SSE2__)
+/** SSE2 implementation of count_columns; processes 16 reads at a time. */
+void count_columns_sse2(const column* const* columns_1,
+                        const column* const* columns_2,
+                        size_t length,
+                        uint16_t* n_ambiguous,
+                        uint16_t* n_mismatches)
+{
+    const size_t VECTORS = BATCH_SIZE / 16;
+    const __m128i n_values = _mm_set1_epi8('N');
+    const __m128i ones = _mm_set1_epi8(-1);
+
+    alignas(16) uint8_t block_ambiguous[BATCH_SIZE];
+    alignas(16) uint8_t block_mismatches[BATCH_SIZE];
+    while (length) {
+        const size_t block_length = std::min<size_t>(length, std::numeric_limits<uint8_t>::max());
+
+        __m128i ambiguous[VECTORS];
+        __m128i mismatches[VECTORS];
+        for (size_t v = 0; v < VECTORS; ++v) {
+            ambiguous[v] = mismatches[v] = _mm_setzero_si128();
+        }
+
+        for (size_t i = 0; i < block_length; ++i) {
+            const char* const bases_1 = columns_1[i]->bases;
+            const char* const bases_2 = columns_2[i]->bases;
+
+            for (size_t v = 0; v < VECTORS; ++v) {
+                const __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bases_1) + v);
+                const __m128i s2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bases_2) + v);
+
+                // Masks are -1 for positions with Ns / mismatches, otherwise 0
+                const __m128i ns_mask = _mm_or_si128(_mm_cmpeq_epi8(s1, n_values),
+                                                     _mm_cmpeq_epi8(s2, n_values));
+                const __m128i mm_mask = _mm_andnot_si128(_mm_or_si128(ns_mask, _mm_cmpeq_epi8(s1, s2)), ones);
+
+                ambiguous[v] = _mm_sub_epi8(ambiguous[v], ns_mask);
+                mismatches[v] = _mm_sub_epi8(mismatches[v], mm_mask);
+            }
+        }
+
+        for (size_t v = 0; v < VECTORS; ++v) {
+            _mm_store_si128(reinterpret_cast<__m128i*>(block_ambiguous) + v, ambiguous[v]);
+            _mm_store_si128(reinterpret_cast<__m128i*>(block_mismatches) + v, mismatches[v]);
+        }
+
+        add_block_counts(block_ambiguous, block_mismatches, n_ambiguous, n_mismatches);
+
+        columns_1 += block_length;
+        columns_2 += block_length;
+        length -= block_length;
+    }
+}
+#endif
+
+
+#ifdef AR_SIMD_DISPATCH
+/** AVX2 implementation of count_columns; processes 32 reads at a time. */
+AR_TARGET("avx2")
+void count_columns_avx2(const column* const* columns_1,
+                        const column* const* columns_2,
+                        size_t length,
+                        uint16_t* n_ambiguous,
+                        uint16_t* n_mismatches)
+{
+    const size_t VECTORS = BATCH_SIZE / 32;
+    const __m256i n_values = _mm256_set1_epi8('N');
+    const __m256i ones = _mm256_set1_epi8(-1);
+
+    alignas(32) uint8_t block_ambiguous[BATCH_SIZE];
+    alignas(32) uint8_t block_mismatches[BATCH_SIZE];
+    while (length) {
+        const size_t block_length = std::min<size_t>(length, std::numeric_limits<uint8_t>::max());
+
+        __m256i ambiguous[VECTORS];
+        __m256i mismatches[VECTORS];
+        for (size_t v = 0; v < VECTORS; ++v) {
+            ambiguous[v] = mismatches[v] = _mm256_setzero_si256();
+        }
+
+        for (size_t i = 0; i < block_length; ++i) {
+            const char* const bases_1 = columns_1[i]->bases;
+            const char* const bases_2 = columns_2[i]->bases;
+
+            for (size_t v = 0; v < VECTORS; ++v) {
+                const __m256i s1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bases_1) + v);
+                const __m256i s2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bases_2) + v);
+
+                // Masks are -1 for positions with Ns / mismatches, otherwise 0
+                const __m256i ns_mask = _mm256_or_si256(_mm256_cmpeq_epi8(s1, n_values),
+                                                        _mm256_cmpeq_epi8(s2, n_values));
+                const __m256i mm_mask = _mm256_andnot_si256(_mm256_or_si256(ns_mask, _mm256_cmpeq_epi8(s1, s2)), ones);
+
+                ambiguous[v] = _mm256_sub_epi8(ambiguous[v], ns_mask);
+                mismatches[v] = _mm256_sub_epi8(mismatches[v], mm_mask);
+            }
+        }
+
+        for (size_t v = 0; v < VECTORS; ++v) {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(block_ambiguous) + v, ambiguous[v]);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(block_mismatches) + v, mismatches[v]);
+        }
+
+        add_block_counts(block_ambiguous, block_mismatches, n_ambiguous, n_mismatches);
+
+        columns_1 += block_length;
+        columns_2 += block_length;
+        length -= block_length;
+    }
+}
+
+
+/** AVX512 implementation of count_columns; processes 64 reads at a time. */
+AR_TARGET("avx512f,avx512bw")
+void count_columns_avx512(const column* const* columns_1,
+                          const column* const* columns_2,
+                          size_t length,
+                          uint16_t* n_ambiguous,
+                          uint16_t* n_mismatches)
+{
+    static_assert(BATCH_SIZE == 64, "AVX512 kernel expects 64 reads per batch");
+    const __m512i n_values = _mm512_set1_epi8('N');
+    const __m512i ones = _mm512_set1_epi8(1);
+
+    alignas(64) uint8_t block_ambiguous[BATCH_SIZE];
+    alignas(64) uint8_t block_mismatches[BATCH_SIZE];
+    while (length) {
+        const size_t block_length = std::min<size_t>(length, std::numeric_limits<uint8_t>::max());
+
+        __m512i ambiguous = _mm512_setzero_si512();
+        __m512i mismatches = _mm512_setzero_si512();
+        for (size_t i = 0; i < block_length; ++i) {
+            const __m512i s1 = _mm512_loadu_si512(columns_1[i]->bases);
+            const __m512i s2 = _mm512_loadu_si512(columns_2[i]->bases);
+
+            const __mmask64 ns_mask = _mm512_cmpeq_epi8_mask(s1, n_values)
+                                    | _mm512_cmpeq_epi8_mask(s2, n_values);
+            const __mmask64 mm_mask = ~(ns_mask | _mm512_cmpeq_epi8_mask(s1, s2));
+
+            ambiguous = _mm512_mask_add_epi8(ambiguous, ns_mask, ambiguous, ones);
+            mismatches = _mm512_mask_add_epi8(mismatches, mm_mask, mismatches, ones);
+        }
+
+        _mm512_store_si512(block_ambiguous, ambiguous);
+        _mm512_store_si512(block_mismatches, mismatches);
+        add_block_counts(block_ambiguous, block_mismatches, n_ambiguous, n_mismatches);
+
+        columns_1 += block_length;
+        columns_2 += block_length;
+        length -= block_length;
+    }
+}
+#endif
+
+
+/** Signature of the implementations of count_columns above. */
+typedef void (*count_columns_func)(const column* const* columns_1,
+                                   const column* const* columns_2,
+                                   size_t length,
+                                   uint16_t* n_ambiguous,
+                                   uint16_t* n_mismatches);
+
+
+/**
+ * Returns the implementation of count_columns for a given instruction set.
+ */
+count_columns_func select_count_columns(simd::instruction_set is)
+{
+    switch (is) {
+        case simd::instruction_set::none:
+            return &count_columns_std;
+#if defined(__SSE__) && defined(__SSE2__)
+        case simd::instruction_set::sse2:
+            return &count_columns_sse2;
+#endif
+#ifdef AR_SIMD_DISPATCH
+        case simd::instruction_set::avx2:
+            return &count_columns_avx2;
+        case simd::instruction_set::avx512:
+            return &count_columns_avx512;
+#endif
+        default:
+            throw std::invalid_argument("unsupported instruction set");
+    }
+}
+
+
+/**
+ * Transposes reads[indices[first:first + count]] into columns; see column. If
+ * 'reverse_complement' is true, the reads are reverse complemented on the fly.
+ */
+void transpose_reads(const fastq_vec& reads, const index_vec& indices,
+                     size_t first, size_t count, column_vec& columns,
+                     bool reverse_complement = false)
+{
+    AR_DEBUG_ASSERT(count <= BATCH_SIZE);
+
+    const size_t length = reads.at(indices.at(first)).length();
+    // Unused lanes are filled with Ns, and the results for these discarded
+    column filler;
+    std::memset(filler.bases, 'N', BATCH_SIZE);
+    columns.assign(length, filler);
+
+    for (size_t j = 0; j < count; ++j) {
+        const std::string& sequence = reads.at(indices.at(first + j)).sequence();
+        AR_DEBUG_ASSERT(sequence.length() == length);
+
+        if (reverse_complement) {
+            for (size_t pos = 0; pos < length; ++pos) {
+                columns[length - 1 - pos].bases[j] = complement_nt(sequence[pos]);
+            }
+        } else {
+            for (size_t pos = 0; pos < length; ++pos) {
+                columns[pos].bases[j] = sequence[pos];
+            }
+        }
+    }
+}
+
+
+/** Sets 'columns' to contain each base in sequence, repeated for all reads. */
+void broadcast_sequence(const char* sequence, size_t length, column_vec& columns)
+{
+    columns.resize(length);
+    for (size_t pos = 0; pos < length; ++pos) {
+        std::memset(columns[pos].bases, sequence[pos], BATCH_SIZE);
+    }
+}
+
+
+/** Appends a pointer to each column to 'ptrs'. */
+void append_columns(const column_vec& columns, column_ptr_vec& ptrs)
+{
+    for (const auto& value : columns) {
+        ptrs.push_back(&value);
+    }
+}
+
+
+/**
+ * Scores each offset in the range min_offset to max_offset (as in
+ * pairwise_align_sequences) for every read in a batch, replacing the best
+ * alignments when a better alignment is found. Since ties are resolved in
+ * favor of the first alignment, and since every offset is scored in full,
+ * the results are identical to aligning each read on its own.
+ */
+void align_batch(const column_ptr_vec& seq1,
+                 const column_ptr_vec& seq2,
+                 int min_offset,
+                 int max_offset,
+                 int offset_adjustment,
+                 size_t adapter_id,
+                 size_t count,
+                 count_columns_func count_func,
+                 alignment_info* best)
+{
+    const int start_offset = std::max<int>(min_offset, -static_cast<int>(seq2.size()) + 1);
+    const int end_offset = std::min<int>(max_offset, static_cast<int>(seq1.size()) - 1);
+
+    uint16_t n_ambiguous[BATCH_SIZE];
+    uint16_t n_mismatches[BATCH_SIZE];
+    for (int offset = start_offset; offset <= end_offset; ++offset) {
+        const size_t initial_seq1_offset = std::max<int>(0,  offset);
+        const size_t initial_seq2_offset = std::max<int>(0, -offset);
+        const size_t length = std::min(seq1.size() - initial_seq1_offset,
+                                       seq2.size() - initial_seq2_offset);
+
+        // Skip offsets that cannot improve on any best alignment in the
+        // batch; see pairwise_align_sequences in alignment.cpp
+        int min_score = best[0].score;
+        for (size_t j = 1; j < count; ++j) {
+            min_score = std::min(min_score, best[j].score);
+        }
+
+        if (static_cast<int>(length) <= min_score) {
+            continue;
+        }
+
+        std::memset(n_ambiguous, 0, sizeof(n_ambiguous));
+        std::memset(n_mismatches, 0, sizeof(n_mismatches));
+        count_func(seq1.data() + initial_seq1_offset,
+                   seq2.data() + initial_seq2_offset,
+                   length,
+                   n_ambiguous,
+                   n_mismatches);
+
+        for (size_t j = 0; j < count; ++j) {
+            alignment_info current;
+            current.offset = offset + offset_adjustment;
+            current.length = length;
+            current.n_ambiguous = n_ambiguous[j];
+            current.n_mismatches = n_mismatches[j];
+            current.score = length - n_ambiguous[j] - 2 * n_mismatches[j];
+            current.adapter_id = adapter_id;
+
+            if (current.is_better_than(best[j])) {
+                best[j] = current;
+            }
+        }
+    }
+}
+
+
+/** Returns true if batches may be used with the options in the profile. */
+bool can_align_batches(const adapter_profile& adapters)
+{
+    // Seeds, indexes, and long-read windows restrict offsets per read, while
+    // packed alignments are only implemented for reads aligned one at a time
+    const alignment_options& options = adapters.options();
+
+    return !options.seed_length && !options.index_kmer_length && !options.long_read_window
+        && !options.packed;
+}
+
+
+/**
+ * Returns the number of consecutive indices, starting at first, to batch.
+ * Reads are aligned one at a time if the number of bases aligned at an offset
+ * may exceed MAX_BATCH_LENGTH; this is bounded by the length of the read for
+ * SE reads, and by the lengths of adapter 2 + read 1 and of read 2 + adapter
+ * 1 for PE reads.
+ */
+size_t batch_size(const fastq_vec& reads1, const fastq_vec* reads2,
+                  const index_vec& indices, size_t first,
+                  const adapter_profile& adapters)
+{
+    const size_t length1 = reads1.at(indices.at(first)).length();
+    const size_t length2 = reads2 ? reads2->at(indices.at(first)).length() : 0;
+    if (length1 > MAX_BATCH_LENGTH) {
+        return 1;
+    } else if (reads2 && (adapters.max_length_2() + length1 > MAX_BATCH_LENGTH
+                          || length2 + adapters.max_length_1() > MAX_BATCH_LENGTH)) {
+        return 1;
+    }
+
+    size_t count = 1;
+    for (; count < BATCH_SIZE && first + count < indices.size(); ++count) {
+        const size_t index = indices.at(first + count);
+        if (reads1.at(index).length() != length1
+            || (reads2 && reads2->at(index).length() != length2)) {
+            break;
+        }
+    }
+
+    return count;
+}
+
+
+/** Returns the indices 0 to size - 1. */
+index_vec all_indices(size_t size)
+{
+    index_vec indices(size);
+    for (size_t i = 0; i < size; ++i) {
+        indices.at(i) = i;
+    }
+
+    return indices;
+}
+
+
+std::vector<alignment_info> align_single_ended_sequences(const fastq_vec& reads,
+                                                         const index_vec& indices,
+                                                         const adapter_profile& adapters,
+                                                         simd::instruction_set is)
+{
+    const count_columns_func count_func = select_count_columns(is);
+    const bool use_batches = can_align_batches(adapters);
+
+    std::vector<alignment_info> results(indices.size());
+    column_vec read_columns;
+    column_vec adapter_columns;
+    column_ptr_vec seq1;
+    column_ptr_vec seq2;
+
+    for (size_t first = 0; first < indices.size();) {
+        const size_t count = use_batches ? batch_size(reads, nullptr, indices, first, adapters) : 1;
+        if (count < MIN_BATCH_SIZE) {
+            for (size_t i = first; i < first + count; ++i) {
+                results.at(i) = align_single_ended_sequence(reads.at(indices.at(i)), adapters);
+            }
+
+            first += count;
+            continue;
+        }
+
+        transpose_reads(reads, indices, first, count, read_columns);
+        seq1.clear();
+        append_columns(read_columns, seq1);
+
+        for (size_t adapter_id = 0; adapter_id < adapters.size(); ++adapter_id) {
+            const adapter_profile::adapter_pair& adapter = adapters.at(adapter_id);
+            broadcast_sequence(adapters.sequence_1(adapter), adapter.length_1, adapter_columns);
+            seq2.clear();
+            append_columns(adapter_columns, seq2);
+
+            align_batch(seq1, seq2,
+                        -adapters.max_shift(),
+                        std::numeric_limits<int>::max(),
+                        0,
+                        adapter_id,
+                        count,
+                        count_func,
+                        results.data() + first);
+        }
+
+        first += count;
+    }
+
+    return results;
+}
+
+
+std::vector<alignment_info> align_single_ended_sequences(const fastq_vec& reads,
+                                                         const adapter_profile& adapters,
+                                                         simd::instruction_set is)
+{
+    return align_single_ended_sequences(reads, all_indices(reads.size()), adapters, is);
+}
+
+
+std::vector<alignment_info> align_single_ended_sequences(const fastq_vec& reads,
+                                                         const adapter_profile& adapters)
+{
+    return align_single_ended_sequences(reads, all_indices(reads.size()), adapters, simd::detect());
+}
+
+
+std::vector<alignment_info> align_single_ended_sequences(const fastq_vec& reads,
+                                                         const index_vec& indices,
+                                                         const adapter_profile& adapters)
+{
+    return align_single_ended_sequences(reads, indices, adapters, simd::detect());
+}
+
+
+/**
+ * Aligns read pairs as described for align_paired_ended_sequences; if
+ * 'reverse_2' is true, then mate 2 reads are reverse complemented on the fly.
+ */
+std::vector<alignment_info> align_read_pairs(const fastq_vec& reads1,
+                                             const fastq_vec& reads2,
+                                             const index_vec& indices,
+                                             const adapter_profile& adapters,
+                                             simd::instruction_set is,
+                                             bool reverse_2)
+{
+    if (reads1.size() != reads2.size()) {
+        throw std::invalid_argument("unequal number of mate 1 and mate 2 reads");
+    }
+
+    const count_columns_func count_func = select_count_columns(is);
+    const bool use_batches = can_align_batches(adapters);
+
+    std::vector<alignment_info> results(indices.size());
+    column_vec read1_columns;
+    column_vec read2_columns;
+    column_vec adapter1_columns;
+    column_vec adapter2_columns;
+    column_ptr_vec seq1;
+    column_ptr_vec seq2;
+
+    for (size_t first = 0; first < indices.size();) {
+        const size_t count = use_batches ? batch_size(reads1, &reads2, indices, first, adapters) : 1;
+        if (count < MIN_BATCH_SIZE) {
+            for (size_t i = first; i < first + count; ++i) {
+                const size_t index = indices.at(i);
+                if (reverse_2) {
+                    results.at(i) = align_paired_ended_mates(reads1.at(index), reads2.at(index), adapters);
+                } else {
+                    results.at(i) = align_paired_ended_sequences(reads1.at(index), reads2.at(index), adapters);
+                }
+            }
+
+            first += count;
+            continue;
+        }
+
+        transpose_reads(reads1, indices, first, count, read1_columns);
+        transpose_reads(reads2, indices, first, count, read2_columns, reverse_2);
+
+        // Number of bases by which read 1 extends past the 3' end of read 2
+        const int no_adapter_overhang = std::max<int>(0, read1_columns.size() - read2_columns.size());
+
+        for (size_t adapter_id = 0; adapter_id < adapters.size(); ++adapter_id) {
+            const adapter_profile::adapter_pair& adapter = adapters.at(adapter_id);
+            const int adapter2_len = adapter.length_2;
+            // Offsets are selected as in align_paired_ended_sequences
+            const int min_offset = adapter2_len - static_cast<int>(read2_columns.size()) - adapters.max_shift();
+            const int no_adapter_offset = adapter2_len + no_adapter_overhang;
+            const int max_offset = adapter_id ? no_adapter_offset - 1 : std::numeric_limits<int>::max();
+
+            broadcast_sequence(adapters.sequence_1(adapter), adapter.length_1, adapter1_columns);
+            broadcast_sequence(adapters.sequence_2(adapter), adapter.length_2, adapter2_columns);
+
+            // Adapter 2 + read 1 is aligned against read 2 + adapter 1
+            seq1.clear();
+            append_columns(adapter2_columns, seq1);
+            append_columns(read1_columns, seq1);
+            seq2.clear();
+            append_columns(read2_columns, seq2);
+            append_columns(adapter1_columns, seq2);
+
+            align_batch(seq1, seq2,
+                        min_offset,
+                        max_offset,
+                        -adapter2_len,
+                        adapter_id,
+                        count,
+                        count_func,
+                        results.data() + first);
+        }
+
+        first += count;
+    }
+
+    return results;
+}
+
+
+std::vector<alignment_info> align_paired_ended_sequences(const fastq_vec& reads1,
+                                                         const fastq_vec& reads2,
+                                                         const index_vec& indices,
+                                                         const adapter_profile& adapters,
+                                                         simd::instruction_set is)
+{
+    return align_read_pairs(reads1, reads2, indices, adapters, is, false);
+}
+
+
+std::vector<alignment_info> align_paired_ended_sequences(const fastq_vec& reads1,
+                                                         const fastq_vec& reads2,
+                                                         const adapter_profile& adapters,
+                                                         simd::instruction_set is)
+{
+    return align_paired_ended_sequences(reads1, reads2, all_indices(reads1.size()), adapters, is);
+}
+
+
+std::vector<alignment_info> align_paired_ended_sequences(const fastq_vec& reads1,
+                                                         const fastq_vec& reads2,
+                                                         const adapter_profile& adapters)
+{
+    return align_paired_ended_sequences(reads1, reads2, all_indices(reads1.size()), adapters, simd::detect());
+}
+
+
+std::vector<alignment_info> align_paired_ended_sequences(const fastq_vec& reads1,
+                                                         const fastq_vec& reads2,
+                                                         const index_vec& indices,
+                                                         const adapter_profile& adapters)
+{
+    return align_paired_ended_sequences(reads1, reads2, indices, adapters, simd::detect());
+}
+
+
+std::vector<alignment_info> align_paired_ended_mates(const fastq_vec& reads1,
+                                                     const fastq_vec& reads2,
+                                                     const adapter_profile& adapters,
+                                                     simd::instruction_set is)
+{
+    return align_read_pairs(reads1, reads2, all_indices(reads1.size()), adapters, is, true);
+}
+
+
+std::vector<alignment_info> align_paired_ended_mates(const fastq_vec& reads1,
+                                                     const fastq_vec& reads2,
+                                                     const adapter_profile& adapters)
+{
+    return align_read_pairs(reads1, reads2, all_indices(reads1.size()), adapters, simd::detect(), true);
+}
+
+
+std::vector<alignment_info> align_paired_ended_mates(const fastq_vec& reads1,
+                                                     const fastq_vec& reads2,
+                                                     const index_vec& indices,
+                                                     const adapter_profile& adapters)
+{
+    return align_read_pairs(reads1, reads2, indices, adapters, simd::detect(), true);
+}
+
+} // namespace ar
@@ -0,0 +1,111 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef BATCH_ALIGNMENT_H
+#define BATCH_ALIGNMENT_H
+
+#include <vector>
+
+#include "alignment.hpp"
+#include "commontypes.hpp"
+#include "simd.hpp"
+
+namespace ar
+{
+
+typedef std::vector<size_t> index_vec;
+
+/**
+ * Aligns each read against the first adapter of each pair in a profile.
+ *
+ * The results are identical to those of calling align_single_ended_sequence
+ * for each read, but consecutive reads of identical length are transposed
+ * into a structure-of-arrays layout and aligned in batches, such that each
+ * offset is scored for a whole batch of reads at once. Reads that cannot be
+ * batched, and all reads when seeds, an adapter index, or packed alignments
+ * are used, are aligned one at a time.
+ */
+std::vector<alignment_info> align_single_ended_sequences(const fastq_vec& reads,
+                                                         const adapter_profile& adapters);
+
+/**
+ * Aligns each pair of reads along with each adapter pair in a profile; as
+ * above, the results are identical to those of align_paired_ended_sequences,
+ * which requires that the mate 2 reads have been reverse complemented.
+ */
+std::vector<alignment_info> align_paired_ended_sequences(const fastq_vec& reads1,
+                                                         const fastq_vec& reads2,
+                                                         const adapter_profile& adapters);
+
+/**
+ * As above, but only aligns the reads reads[indices[0]], reads[indices[1]],
+ * and so on; result i corresponds to read indices[i].
+ */
+std::vector<alignment_info> align_single_ended_sequences(const fastq_vec& reads,
+                                                         const index_vec& indices,
+                                                         const adapter_profile& adapters);
+
+/** As above, but only aligns the read pairs listed in indices. */
+std::vector<alignment_info> align_paired_ended_sequences(const fastq_vec& reads1,
+                                                         const fastq_vec& reads2,
+                                                         const index_vec& indices,
+                                                         const adapter_profile& adapters);
+
+/** As above, but using the kernel for a specific instruction set. */
+std::vector<alignment_info> align_single_ended_sequences(const fastq_vec& reads,
+                                                         const adapter_profile& adapters,
+                                                         simd::instruction_set is);
+
+/** As above, but using the kernel for a specific instruction set. */
+std::vector<alignment_info> align_paired_ended_sequences(const fastq_vec& reads1,
+                                                         const fastq_vec& reads2,
+                                                         const adapter_profile& adapters,
+                                                         simd::instruction_set is);
+
+/**
+ * As align_paired_ended_sequences, except that the mate 2 reads are given in
+ * the orientation in which they were sequenced (i.e. not reverse complemented).
+ * Batched mate 2 reads are reverse complemented while being transposed, while
+ * mates aligned one pair at a time are reverse complemented on the fly (see
+ * align_paired_ended_mates in alignment.hpp).
+ */
+std::vector<alignment_info> align_paired_ended_mates(const fastq_vec& reads1,
+                                                     const fastq_vec& reads2,
+                                                     const adapter_profile& adapters);
+
+/** As above, but only aligns the read pairs listed in indices. */
+std::vector<alignment_info> align_paired_ended_mates(const fastq_vec& reads1,
+                                                     const fastq_vec& reads2,
+                                                     const index_vec& indices,
+                                                     const adapter_profile& adapters);
+
+/** As above, but using the kernel for a specific instruction set. */
+std::vector<alignment_info> align_paired_ended_mates(const fastq_vec& reads1,
+                                                     const fastq_vec& reads2,
+                                                     const adapter_profile& adapters,
+                                                     simd::instruction_set is);
+
+} // namespace ar
+
+#endif
@@ -76,6 +76,24 @@ enum analyses_id
     //! Step for writing mate 2 reads which were not identified
     ai_write_unidentified_2,
 
+    //! Step for decompressing and locating records in SE or mate 1 reads
+    ai_decompress_fastq_1,
+    //! Step for decompressing and locating records in mate 2 reads
+    ai_decompress_fastq_2,
+    //! Step for splitting compressed SE or PE reads into gzip members or
+    //! bzip2 blocks
+    ai_split_blocks,
+    //! Step for decompressing gzip members or bzip2 blocks in SE or mate 1 reads
+    ai_inflate_blocks_1,
+    //! Step for decompressing gzip members or bzip2 blocks in mate 2 reads
+    ai_inflate_blocks_2,
+    //! Step for joining chunks of mate 1 and mate 2 records
+    ai_join_fastq,
+    //! Step for parsing records in SE or PE reads
+    ai_parse_fastq,
+    //! Step for reporting the first error in SE or PE reads
+    ai_check_fastq,
+
     //! Offset for post-demultiplexing analytical steps
     //! If enabled, the demultiplexing step will forward reads to the
     //! nth * ai_analyses_offset analytical step, corresponding to the
@@ -0,0 +1,962 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2017 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cstring>
+
+#include "debug.hpp"
+#include "decompressor.hpp"
+#include "linereader.hpp"
+#include "speculative_inflate.hpp"
+
+namespace ar
+{
+
+//! Minimum amount of space reserved for output when decompressing
+const size_t MIN_OUTPUT_SIZE = 64 * 1024;
+
+
+/** Returns the output space reserved when decompressing 'length' bytes. */
+inline size_t output_size(size_t length)
+{
+    return std::max(MIN_OUTPUT_SIZE, 4 * length);
+}
+
+
+bool is_gzip(const char* data, size_t length)
+{
+    return length >= 2 && data[0] == '\x1f' && data[1] == '\x8b';
+}
+
+
+/** Returns true if the data starts with a bzip2 (or bzip1) stream header. */
+inline bool is_bzip2_header(const char* data, size_t length)
+{
+    return length >= 4 && data[0] == 'B' && data[1] == 'Z'
+           // bzip2 or bzip1 (deprecated)
+           && (data[2] == 'h' || data[2] == '0')
+           // Blocksizes; '1' - '9'
+           && (data[3] >= '1' && data[3] <= '9');
+}
+
+
+bool is_compressed(const char* data, size_t length)
+{
+    return is_gzip(data, length) || is_bzip2_header(data, length);
+}
+
+
+size_t bgzf_block_size(const char* data, size_t length)
+{
+    const unsigned char* header = reinterpret_cast<const unsigned char*>(data);
+    // Header with the FEXTRA flag and the XLEN field
+    if (length < GZIP_HEADER_SIZE + 2 || !is_gzip(data, length)
+        || header[2] != 8 || !(header[3] & 4)) {
+        return 0;
+    }
+
+    const size_t xlen = header[10] | (header[11] << 8);
+    if (length < GZIP_HEADER_SIZE + 2 + xlen) {
+        return 0;
+    }
+
+    // Sub-fields consist of SI1, SI2, SLEN (2 bytes), and SLEN bytes of data
+    const unsigned char* field = header + GZIP_HEADER_SIZE + 2;
+    const unsigned char* end = field + xlen;
+    while (field + 4 <= end) {
+        const size_t slen = field[2] | (field[3] << 8);
+        if (field[0] == 'B' && field[1] == 'C' && slen == 2 && field + 6 <= end) {
+            // BSIZE is the total block size minus one
+            return (field[4] | (field[5] << 8)) + 1;
+        }
+
+        field += 4 + slen;
+    }
+
+    return 0;
+}
+
+
+size_t find_gzip_header(const char* data, size_t start, size_t end)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+
+    while (start + GZIP_HEADER_SIZE <= end) {
+        const void* match = memchr(bytes + start, 0x1f, end - start - GZIP_HEADER_SIZE + 1);
+        if (!match) {
+            break;
+        }
+
+        start = static_cast<const unsigned char*>(match) - bytes;
+        const unsigned char* header = bytes + start;
+        // Magic bytes, the DEFLATE method, no reserved flags, and a known OS
+        if (header[1] == 0x8b && header[2] == 8 && !(header[3] & 0xe0)
+            && (header[9] <= 13 || header[9] == 255)) {
+            return start;
+        }
+
+        ++start;
+    }
+
+    return end;
+}
+
+
+/**
+ * Returns the size of the gzip header at the start of the data, or zero if the
+ * header is incomplete. Errors are reported using the same messages as zlib.
+ */
+size_t gzip_header_size(const char* data, size_t length)
+{
+    const unsigned char* header = reinterpret_cast<const unsigned char*>(data);
+    const char* error = nullptr;
+    if (length >= 2 && !is_gzip(data, length)) {
+        error = "incorrect header check";
+    } else if (length >= 3 && header[2] != 8) {
+        error = "unknown compression method";
+    } else if (length >= 4 && (header[3] & 0xe0)) {
+        error = "unknown header flags set";
+    }
+
+    if (error) {
+        throw gzip_error("block_decompressor::decompress_gzip: unknown error",
+                         error);
+    } else if (length < GZIP_HEADER_SIZE) {
+        return 0;
+    }
+
+    const unsigned char flags = header[3];
+    size_t size = GZIP_HEADER_SIZE;
+    if (flags & 0x4) {
+        // FEXTRA; length of extra field followed by the field
+        if (length < size + 2) {
+            return 0;
+        }
+
+        size += 2 + (header[size] | (header[size + 1] << 8));
+    }
+
+    // FNAME and FCOMMENT; zero-terminated strings
+    for (const unsigned char flag : { 0x8, 0x10 }) {
+        if (flags & flag) {
+            if (size >= length) {
+                return 0;
+            }
+
+            const void* terminator = memchr(data + size, '\0', length - size);
+            if (!terminator) {
+                return 0;
+            }
+
+            size = static_cast<const char*>(terminator) - data + 1;
+        }
+    }
+
+    if (flags & 0x2) {
+        // FHCRC; the lower 16 bits of the CRC32 of the header
+        size += 2;
+        if (length < size) {
+            return 0;
+        }
+
+        const uLong crc = crc32(crc32(0, nullptr, 0), header, size - 2) & 0xffff;
+        const uLong stored_crc = header[size - 2] | (static_cast<uLong>(header[size - 1]) << 8);
+        if (crc != stored_crc) {
+            throw gzip_error("block_decompressor::decompress_gzip: unknown error",
+                             "header crc mismatch");
+        }
+    }
+
+    return length < size ? 0 : size;
+}
+
+
+bool inflate_gzip_members(const char* data, size_t length, std::string& dst)
+{
+    z_stream stream;
+    stream.zalloc = nullptr;
+    stream.zfree = nullptr;
+    stream.opaque = nullptr;
+    stream.avail_in = 0;
+    stream.next_in = nullptr;
+
+    if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+        throw gzip_error("inflate_gzip_members: failed to initialize stream",
+                         stream.msg);
+    }
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = length;
+
+    int result = Z_OK;
+    while (stream.avail_in) {
+        const size_t offset = dst.size();
+        const size_t reserved = output_size(stream.avail_in);
+        dst.resize(offset + reserved);
+
+        stream.next_out = reinterpret_cast<Bytef*>(&dst[offset]);
+        stream.avail_out = reserved;
+
+        result = inflate(&stream, Z_NO_FLUSH);
+        dst.resize(offset + reserved - stream.avail_out);
+
+        if (result == Z_STREAM_END) {
+            if (stream.avail_in && inflateReset(&stream) != Z_OK) {
+                break;
+            }
+        } else if (result != Z_OK && result != Z_BUF_ERROR) {
+            break;
+        }
+    }
+
+    inflateEnd(&stream);
+
+    return !stream.avail_in && result == Z_STREAM_END;
+}
+
+
+uint64_t read_bits(const char* data, size_t offset, size_t bits)
+{
+    AR_DEBUG_ASSERT(bits <= 57);
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    const size_t shift = offset % 8;
+
+    uint64_t value = 0;
+    for (size_t i = 0; i < (shift + bits + 7) / 8; ++i) {
+        value = (value << 8) | bytes[offset / 8 + i];
+    }
+
+    value >>= (8 - (shift + bits) % 8) % 8;
+
+    return value & ((uint64_t(1) << bits) - 1);
+}
+
+
+/** Returns true if a block or end-of-stream magic number starts at 'offset'. */
+inline bool is_bzip2_magic(const char* data, size_t offset)
+{
+    const uint64_t magic = read_bits(data, offset, BZIP2_MAGIC_BITS);
+
+    return magic == BZIP2_BLOCK_MAGIC || magic == BZIP2_END_MAGIC;
+}
+
+
+bool is_bzip2(const char* data, size_t length)
+{
+    return length >= BZIP2_HEADER_SIZE + BZIP2_MAGIC_BITS / 8
+           && data[0] == 'B' && data[1] == 'Z' && data[2] == 'h'
+           && data[3] >= '1' && data[3] <= '9'
+           && is_bzip2_magic(data, BZIP2_HEADER_SIZE * 8);
+}
+
+
+/**
+ * Table of the bit offsets (bit N set for offset N) for which a byte may
+ * follow the first (partial) byte of a block or end-of-stream magic number.
+ * Since the second byte lies entirely within the magic numbers, this allows
+ * most positions to be ruled out using a single lookup.
+ */
+struct bzip2_magic_table
+{
+    bzip2_magic_table()
+      : offsets()
+    {
+        for (const uint64_t magic : { BZIP2_BLOCK_MAGIC, BZIP2_END_MAGIC }) {
+            for (size_t offset = 0; offset < 8; ++offset) {
+                const size_t byte = (magic >> (BZIP2_MAGIC_BITS - 16 + offset)) & 0xff;
+
+                offsets[byte] |= 1 << offset;
+            }
+        }
+    }
+
+    unsigned char offsets[256];
+};
+
+
+size_t find_bzip2_magic(const char* data, size_t length, size_t offset)
+{
+    static const bzip2_magic_table table;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+
+    const size_t end = length * 8;
+    for (size_t i = offset / 8 + 1; i < length; ++i) {
+        if (const unsigned char offsets = table.offsets[bytes[i]]) {
+            for (size_t shift = 0; shift < 8; ++shift) {
+                const size_t position = (i - 1) * 8 + shift;
+
+                if ((offsets & (1 << shift)) && position >= offset
+                    && position + BZIP2_MAGIC_BITS <= end
+                    && is_bzip2_magic(data, position)) {
+                    return position;
+                }
+            }
+        }
+    }
+
+    return end;
+}
+
+
+bzip2_block::bzip2_block()
+  : begin(0)
+  , end(0)
+  , complete(false)
+  , stream_end(false)
+  , stream_crc(0)
+{
+}
+
+
+/** Helper class for writing bit-packed data, in bzip2 bit-order. */
+class bit_writer
+{
+public:
+    bit_writer(std::string& dst)
+      : m_dst(dst)
+      , m_value(0)
+      , m_bits(0)
+    {
+    }
+
+    /** Writes 'bits' (at most 56) bits. */
+    void write(uint64_t value, size_t bits)
+    {
+        m_value = (m_value << bits) | value;
+        m_bits += bits;
+
+        while (m_bits >= 8) {
+            m_bits -= 8;
+            m_dst.push_back(static_cast<char>(m_value >> m_bits));
+        }
+
+        m_value &= (uint64_t(1) << m_bits) - 1;
+    }
+
+    /** Copies the bits [begin, end) from 'data'. */
+    void copy(const char* data, size_t begin, size_t end)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        const size_t shift = begin % 8;
+
+        if (!m_bits) {
+            // Whole bytes are written directly
+            const unsigned char* src = bytes + begin / 8;
+            const size_t count = (end - begin) / 8;
+
+            const size_t offset = m_dst.size();
+            m_dst.resize(offset + count);
+            if (shift) {
+                for (size_t i = 0; i < count; ++i) {
+                    m_dst[offset + i] = static_cast<char>((src[i] << shift) | (src[i + 1] >> (8 - shift)));
+                }
+            } else {
+                std::copy(src, src + count, m_dst.begin() + offset);
+            }
+
+            begin += count * 8;
+        }
+
+        for (; begin < end; begin += std::min<size_t>(end - begin, 32)) {
+            const size_t bits = std::min<size_t>(end - begin, 32);
+            write(read_bits(data, begin, bits), bits);
+        }
+    }
+
+    /** Pads the last byte with zeros. */
+    void flush()
+    {
+        if (m_bits) {
+            write(0, 8 - m_bits);
+        }
+    }
+
+private:
+    std::string& m_dst;
+    uint64_t m_value;
+    size_t m_bits;
+};
+
+
+bool inflate_bzip2_block(const char* data, const bzip2_block& block,
+                         std::string& dst)
+{
+    if (block.begin == block.end) {
+        return true;
+    }
+
+    // The block is decompressed as a stream consisting only of this block; a
+    // block size of 9 is used, since the block size is only an upper bound
+    std::string stream = "BZh9";
+    stream.reserve(BZIP2_HEADER_SIZE + (block.end - block.begin) / 8 + 16);
+
+    bit_writer writer(stream);
+    writer.copy(data, block.begin, block.end);
+    if (block.complete) {
+        // The combined CRC of a single block is simply the CRC of the block
+        writer.write(BZIP2_END_MAGIC, BZIP2_MAGIC_BITS);
+        writer.write(read_bits(data, block.begin + BZIP2_MAGIC_BITS, 32), 32);
+    }
+    writer.flush();
+
+    bz_stream bzip2_stream;
+    bzip2_stream.bzalloc = nullptr;
+    bzip2_stream.bzfree = nullptr;
+    bzip2_stream.opaque = nullptr;
+
+    bzip2_initialize_stream(&bzip2_stream);
+
+    bzip2_stream.next_in = &stream[0];
+    bzip2_stream.avail_in = stream.size();
+
+    bool success = false;
+    while (true) {
+        const size_t offset = dst.size();
+        const size_t reserved = output_size(bzip2_stream.avail_in);
+        dst.resize(offset + reserved);
+
+        bzip2_stream.next_out = &dst[offset];
+        bzip2_stream.avail_out = reserved;
+
+        const int result = BZ2_bzDecompress(&bzip2_stream);
+        dst.resize(offset + reserved - bzip2_stream.avail_out);
+
+        if (result == BZ_STREAM_END) {
+            success = !bzip2_stream.avail_in;
+            break;
+        } else if (result != BZ_OK) {
+            break;
+        } else if (!bzip2_stream.avail_in && bzip2_stream.avail_out) {
+            // Truncated files are not treated as errors (see decompress_bzip2)
+            success = !block.complete;
+            break;
+        }
+    }
+
+    BZ2_bzDecompressEnd(&bzip2_stream);
+
+    return success;
+}
+
+
+block_decompressor::block_decompressor()
+  : m_identified(false)
+  , m_gzip_stream(nullptr)
+  , m_gzip_state(gzip_state::header)
+  , m_gzip_buffer()
+  , m_gzip_crc(0)
+  , m_gzip_size(0)
+  , m_bzip2_stream(nullptr)
+  , m_bzip2_pending()
+  , m_bzip2_block()
+  , m_bzip2_crc(0)
+{
+}
+
+
+block_decompressor::~block_decompressor()
+{
+    // Errors are not reported, as any output has already been consumed
+    if (m_gzip_stream) {
+        inflateEnd(m_gzip_stream);
+        delete m_gzip_stream;
+    }
+
+    if (m_bzip2_stream) {
+        BZ2_bzDecompressEnd(m_bzip2_stream);
+        delete m_bzip2_stream;
+    }
+}
+
+
+void block_decompressor::decompress(const char* data, size_t length,
+                                    std::string& dst,
+                                    const speculative_block* speculative)
+{
+    if (!m_identified) {
+        identify_format(data, length);
+    }
+
+    if (m_gzip_stream) {
+        decompress_gzip(data, length, dst, speculative);
+    } else if (m_bzip2_stream) {
+        decompress_bzip2(data, length, dst);
+    } else {
+        dst.append(data, length);
+    }
+}
+
+
+void block_decompressor::skip_gzip_members(const char* data, size_t length)
+{
+    AR_DEBUG_ASSERT(at_gzip_member());
+    if (!m_identified) {
+        identify_format(data, length);
+    }
+
+    AR_DEBUG_ASSERT(m_gzip_stream);
+}
+
+
+bool block_decompressor::at_gzip_member() const
+{
+    return !m_identified || (m_gzip_stream && m_gzip_state == gzip_state::header
+                             && m_gzip_buffer.empty());
+}
+
+
+void block_decompressor::decompress_bzip2_block(const char* data, size_t length,
+                                                const bzip2_block& block,
+                                                std::string& dst)
+{
+    if (m_bzip2_pending.empty()) {
+        m_bzip2_pending.assign(data, length);
+        m_bzip2_block = block;
+    } else {
+        // The block starts in the last byte of the pending block(s)
+        const size_t offset = m_bzip2_block.end / 8;
+        AR_DEBUG_ASSERT(block.begin == m_bzip2_block.end % 8);
+
+        m_bzip2_pending.resize(offset);
+        m_bzip2_pending.append(data, length);
+        m_bzip2_block.end = offset * 8 + block.end;
+        m_bzip2_block.complete = block.complete;
+        m_bzip2_block.stream_end = block.stream_end;
+        m_bzip2_block.stream_crc = block.stream_crc;
+    }
+
+    const size_t offset = dst.size();
+    if (inflate_bzip2_block(m_bzip2_pending.data(), m_bzip2_block, dst)) {
+        add_bzip2_block(m_bzip2_pending.data(), m_bzip2_block);
+        m_bzip2_pending.clear();
+    } else if (!block.complete || block.stream_end
+               || m_bzip2_pending.size() > BZIP2_MAX_BLOCK_SIZE) {
+        throw bzip2_error("block_decompressor::decompress_bzip2_block: "
+                          "malformed bzip2 file");
+    } else {
+        dst.resize(offset);
+    }
+}
+
+
+void block_decompressor::skip_bzip2_block(const char* data,
+                                          const bzip2_block& block)
+{
+    AR_DEBUG_ASSERT(at_bzip2_block());
+
+    add_bzip2_block(data, block);
+}
+
+
+bool block_decompressor::at_bzip2_block() const
+{
+    return m_bzip2_pending.empty();
+}
+
+
+void block_decompressor::end_file()
+{
+    if (m_gzip_stream) {
+        switch (inflateEnd(m_gzip_stream)) {
+            case Z_OK:
+                break;
+
+            case Z_STREAM_ERROR:
+                throw gzip_error("block_decompressor::end_file: stream error",
+                                 m_gzip_stream->msg);
+
+            default:
+                throw gzip_error("Unknown error in block_decompressor::end_file",
+                                 m_gzip_stream->msg);
+        }
+
+        delete m_gzip_stream;
+        m_gzip_stream = nullptr;
+    }
+
+    if (m_bzip2_stream) {
+        bzip2_close_stream(m_bzip2_stream);
+
+        delete m_bzip2_stream;
+        m_bzip2_stream = nullptr;
+    }
+
+    if (!m_bzip2_pending.empty()) {
+        throw bzip2_error("block_decompressor::end_file: malformed bzip2 file");
+    }
+
+    m_bzip2_crc = 0;
+    m_identified = false;
+    m_gzip_state = gzip_state::header;
+    m_gzip_buffer.clear();
+}
+
+
+void block_decompressor::identify_format(const char* data, size_t length)
+{
+    m_identified = true;
+
+    if (is_gzip(data, length)) {
+        m_gzip_stream = new z_stream();
+        m_gzip_stream->zalloc = nullptr;
+        m_gzip_stream->zfree = nullptr;
+        m_gzip_stream->opaque = nullptr;
+        m_gzip_stream->avail_in = 0;
+        m_gzip_stream->next_in = nullptr;
+
+        // Raw deflate streams; headers and trailers are processed separately
+        switch (inflateInit2(m_gzip_stream, -15)) {
+            case Z_OK:
+                break;
+
+            case Z_MEM_ERROR:
+                throw gzip_error("block_decompressor::identify_format: insufficient memory",
+                                 m_gzip_stream->msg);
+
+            case Z_VERSION_ERROR:
+                throw gzip_error("block_decompressor::identify_format: incompatible zlib version",
+                                 m_gzip_stream->msg);
+
+            case Z_STREAM_ERROR:
+                throw gzip_error("block_decompressor::identify_format: invalid parameters",
+                                 m_gzip_stream->msg);
+
+            default:
+                throw gzip_error("block_decompressor::identify_format: unknown error",
+                                 m_gzip_stream->msg);
+        }
+    } else if (is_bzip2_header(data, length)) {
+        m_bzip2_stream = new bz_stream();
+        m_bzip2_stream->bzalloc = nullptr;
+        m_bzip2_stream->bzfree = nullptr;
+        m_bzip2_stream->opaque = nullptr;
+
+        bzip2_initialize_stream(m_bzip2_stream);
+    }
+}
+
+
+void block_decompressor::decompress_gzip(const char* data, size_t length,
+                                         std::string& dst,
+                                         const speculative_block* speculative)
+{
+    if (speculative && !speculative->found) {
+        speculative = nullptr;
+    }
+
+    const char* const end = data + length;
+    for (const char* position = data; position != end;) {
+        switch (m_gzip_state) {
+            case gzip_state::header:
+                position = read_gzip_header(position, end);
+                break;
+
+            case gzip_state::deflate:
+                position = inflate_gzip(data, position, end, dst, speculative);
+                break;
+
+            case gzip_state::trailer:
+                position = read_gzip_trailer(position, end);
+                break;
+
+            default:
+                AR_DEBUG_FAIL("invalid gzip_state in decompress_gzip");
+        }
+    }
+}
+
+
+const char* block_decompressor::read_gzip_header(const char* data,
+                                                 const char* end)
+{
+    size_t size = 0;
+    const size_t buffered = m_gzip_buffer.size();
+    if (buffered) {
+        m_gzip_buffer.append(data, end);
+        size = gzip_header_size(m_gzip_buffer.data(), m_gzip_buffer.size());
+    } else {
+        size = gzip_header_size(data, end - data);
+        if (!size) {
+            m_gzip_buffer.assign(data, end);
+        }
+    }
+
+    if (!size) {
+        return end;
+    }
+
+    if (inflateReset(m_gzip_stream) != Z_OK) {
+        throw gzip_error("block_decompressor::read_gzip_header: failed to reset stream",
+                         m_gzip_stream->msg);
+    }
+
+    m_gzip_buffer.clear();
+    m_gzip_state = gzip_state::deflate;
+    m_gzip_crc = crc32(0, nullptr, 0);
+    m_gzip_size = 0;
+
+    return data + (size - buffered);
+}
+
+
+const char* block_decompressor::inflate_gzip(const char* begin,
+                                             const char* data,
+                                             const char* end,
+                                             std::string& dst,
+                                             const speculative_block*& speculative)
+{
+    m_gzip_stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    m_gzip_stream->avail_in = end - data;
+
+    do {
+        const size_t offset = dst.size();
+        const size_t reserved = output_size(m_gzip_stream->avail_in);
+        dst.resize(offset + reserved);
+
+        m_gzip_stream->next_out = reinterpret_cast<Bytef*>(&dst[offset]);
+        m_gzip_stream->avail_out = reserved;
+
+        // Stop at block boundaries while looking for the speculative blocks
+        const int result = inflate(m_gzip_stream, speculative ? Z_BLOCK : Z_NO_FLUSH);
+        const size_t produced = reserved - m_gzip_stream->avail_out;
+        dst.resize(offset + produced);
+
+        m_gzip_crc = crc32(m_gzip_crc, reinterpret_cast<Bytef*>(&dst[offset]), produced);
+        m_gzip_size += produced;
+
+        const char* next_in = reinterpret_cast<const char*>(m_gzip_stream->next_in);
+        switch (result) {
+            case Z_OK:
+            case Z_BUF_ERROR: /* input buffer empty or output buffer full */
+                break;
+
+            case Z_STREAM_END:
+                m_gzip_state = gzip_state::trailer;
+                return next_in;
+
+            case Z_STREAM_ERROR:
+                throw gzip_error("block_decompressor::decompress_gzip: inconsistent stream state",
+                                 m_gzip_stream->msg);
+
+            default:
+                throw gzip_error("block_decompressor::decompress_gzip: unknown error",
+                                 m_gzip_stream->msg);
+        }
+
+        // At the end of a (non-final) block; bits 0-2 are the unused bits
+        const int data_type = m_gzip_stream->data_type;
+        if (speculative && (data_type & 128) && !(data_type & 64)) {
+            const size_t bit = (next_in - begin) * 8 - (data_type & 7);
+
+            if (bit == speculative->start_bit) {
+                next_in = use_speculative_block(begin, *speculative, dst);
+                speculative = nullptr;
+
+                if (next_in && m_gzip_state == gzip_state::trailer) {
+                    return next_in;
+                } else if (next_in) {
+                    m_gzip_stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(next_in));
+                    m_gzip_stream->avail_in = end - next_in;
+                }
+            } else if (bit > speculative->start_bit) {
+                speculative = nullptr;
+            }
+        }
+    } while (m_gzip_stream->avail_in || !m_gzip_stream->avail_out);
+
+    return end;
+}
+
+
+const char* block_decompressor::use_speculative_block(const char* begin,
+                                                      const speculative_block& speculative,
+                                                      std::string& dst)
+{
+    std::string window(DEFLATE_WINDOW_SIZE, '\0');
+    uInt window_size = 0;
+    if (inflateGetDictionary(m_gzip_stream, reinterpret_cast<Bytef*>(&window[0]), &window_size) != Z_OK) {
+        return nullptr;
+    }
+
+    window.resize(window_size);
+    // Markers before the start of the member cannot be resolved
+    const size_t missing = DEFLATE_WINDOW_SIZE - window_size;
+
+    const std::vector<uint16_t>& symbols = speculative.symbols;
+    const size_t offset = dst.size();
+    dst.resize(offset + symbols.size());
+
+    char* output = &dst[offset];
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        const size_t symbol = symbols[i];
+        if (symbol < DEFLATE_MARKER) {
+            output[i] = symbol;
+        } else if (symbol - DEFLATE_MARKER >= missing) {
+            output[i] = window[symbol - DEFLATE_MARKER - missing];
+        } else {
+            dst.resize(offset);
+            return nullptr;
+        }
+    }
+
+    m_gzip_crc = crc32(m_gzip_crc, reinterpret_cast<Bytef*>(output), symbols.size());
+    m_gzip_size += symbols.size();
+
+    // The stream continues in the byte containing the end of the last block
+    const size_t end_byte = (speculative.end_bit + 7) / 8;
+    if (speculative.final) {
+        m_gzip_state = gzip_state::trailer;
+
+        return begin + end_byte;
+    }
+
+    // The window following the blocks
+    window.append(dst, offset, std::string::npos);
+    if (window.size() > DEFLATE_WINDOW_SIZE) {
+        window.erase(0, window.size() - DEFLATE_WINDOW_SIZE);
+    }
+
+    if (inflateReset(m_gzip_stream) != Z_OK
+        || inflateSetDictionary(m_gzip_stream, reinterpret_cast<const Bytef*>(window.data()), window.size()) != Z_OK) {
+        throw gzip_error("block_decompressor::use_speculative_block: failed to reset stream",
+                         m_gzip_stream->msg);
+    }
+
+    const size_t bits = end_byte * 8 - speculative.end_bit;
+    if (bits) {
+        const unsigned char last_byte = begin[end_byte - 1];
+        if (inflatePrime(m_gzip_stream, bits, last_byte >> (8 - bits)) != Z_OK) {
+            throw gzip_error("block_decompressor::use_speculative_block: failed to prime stream",
+                             m_gzip_stream->msg);
+        }
+    }
+
+    return begin + end_byte;
+}
+
+
+const char* block_decompressor::read_gzip_trailer(const char* data,
+                                                  const char* end)
+{
+    // The CRC32 and the size (modulo 2^32) of the uncompressed data
+    const size_t size = std::min<size_t>(8 - m_gzip_buffer.size(), end - data);
+    m_gzip_buffer.append(data, size);
+
+    if (m_gzip_buffer.size() == 8) {
+        const unsigned char* trailer = reinterpret_cast<const unsigned char*>(m_gzip_buffer.data());
+
+        uLong crc = 0;
+        uLong length = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            crc |= static_cast<uLong>(trailer[i]) << (8 * i);
+            length |= static_cast<uLong>(trailer[i + 4]) << (8 * i);
+        }
+
+        if (crc != m_gzip_crc) {
+            throw gzip_error("block_decompressor::decompress_gzip: unknown error",
+                             "incorrect data check");
+        } else if (length != (m_gzip_size & 0xffffffffUL)) {
+            throw gzip_error("block_decompressor::decompress_gzip: unknown error",
+                             "incorrect length check");
+        }
+
+        m_gzip_buffer.clear();
+        m_gzip_state = gzip_state::header;
+    }
+
+    return data + size;
+}
+
+
+void block_decompressor::decompress_bzip2(const char* data, size_t length,
+                                          std::string& dst)
+{
+    m_bzip2_stream->next_in = const_cast<char*>(data);
+    m_bzip2_stream->avail_in = length;
+
+    do {
+        const size_t offset = dst.size();
+        const size_t reserved = output_size(m_bzip2_stream->avail_in);
+        dst.resize(offset + reserved);
+
+        m_bzip2_stream->next_out = &dst[offset];
+        m_bzip2_stream->avail_out = reserved;
+
+        const int result = BZ2_bzDecompress(m_bzip2_stream);
+        dst.resize(offset + reserved - m_bzip2_stream->avail_out);
+
+        switch (result) {
+            case BZ_OK:
+                break;
+
+            case BZ_STREAM_END:
+                // Close an restart stream, to handle concatenated files
+                bzip2_close_stream(m_bzip2_stream);
+                bzip2_initialize_stream(m_bzip2_stream);
+                break;
+
+            case BZ_PARAM_ERROR:
+                throw bzip2_error("block_decompressor::decompress_bzip2: "
+                                  "inconsistent bzip2 parameters");
+
+            case BZ_DATA_ERROR:
+            case BZ_DATA_ERROR_MAGIC:
+                throw bzip2_error("block_decompressor::decompress_bzip2: "
+                                  "malformed bzip2 file");
+
+            case BZ_MEM_ERROR:
+                throw bzip2_error("block_decompressor::decompress_bzip2: "
+                                  "insufficient memory to deflate bzip2 stream");
+
+            case BZ_SEQUENCE_ERROR:
+                throw bzip2_error("block_decompressor::decompress_bzip2: "
+                                  "bzip2 sequence error");
+
+            default:
+                throw bzip2_error("block_decompressor::decompress_bzip2: "
+                                  "unknown bzip2 error");
+        }
+    } while (m_bzip2_stream->avail_in || !m_bzip2_stream->avail_out);
+}
+
+
+void block_decompressor::add_bzip2_block(const char* data,
+                                         const bzip2_block& block)
+{
+    if (block.begin != block.end) {
+        const uint32_t crc = read_bits(data, block.begin + BZIP2_MAGIC_BITS, 32);
+
+        m_bzip2_crc = ((m_bzip2_crc << 1) | (m_bzip2_crc >> 31)) ^ crc;
+    }
+
+    if (block.stream_end) {
+        if (m_bzip2_crc != block.stream_crc) {
+            throw bzip2_error("block_decompressor::add_bzip2_block: "
+                              "malformed bzip2 file");
+        }
+
+        m_bzip2_crc = 0;
+    }
+}
+
+} // namespace ar
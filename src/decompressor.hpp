@@ -0,0 +1,275 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2017 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef DECOMPRESSOR_H
+#define DECOMPRESSOR_H
+
+#include <cstdint>
+#include <string>
+
+#include <zlib.h>
+#include <bzlib.h>
+
+namespace ar
+{
+
+struct speculative_block;
+
+//! Minimum size of a gzip member (header, empty deflate block, and trailer)
+const size_t GZIP_MIN_MEMBER_SIZE = 20;
+//! Size of the fixed part of the gzip header
+const size_t GZIP_HEADER_SIZE = 10;
+
+
+/** Returns true if the data starts with the gzip magic bytes. */
+bool is_gzip(const char* data, size_t length);
+
+
+/**
+ * Returns true if a file starting with the given data is decompressed by the
+ * block_decompressor, that is, if it starts with gzip or bzip2 magic bytes.
+ */
+bool is_compressed(const char* data, size_t length);
+
+
+/**
+ * Returns the size of the gzip member starting at 'data', if it is a BGZF
+ * block, that is, if the header contains a 'BC' field (the BSIZE). Zero is
+ * returned for other members and if the header is incomplete.
+ */
+size_t bgzf_block_size(const char* data, size_t length);
+
+
+/**
+ * Returns the position of the first plausible gzip header found in the range
+ * [start, end), or 'end' if none were found. Only the fixed part of headers
+ * are checked, and the match may therefore be part of another member.
+ */
+size_t find_gzip_header(const char* data, size_t start, size_t end);
+
+
+/**
+ * Inflates a sequence of complete gzip members, appending the output to 'dst'.
+ * Returns false if the data did not consist of complete and valid members, in
+ * which case the contents of 'dst' are unspecified.
+ */
+bool inflate_gzip_members(const char* data, size_t length, std::string& dst);
+
+
+//! Size of the bzip2 stream header ('BZh' followed by the block size)
+const size_t BZIP2_HEADER_SIZE = 4;
+//! Size of the magic numbers marking blocks and the end of bzip2 streams
+const size_t BZIP2_MAGIC_BITS = 48;
+//! Magic number found at the start of each bzip2 block
+const uint64_t BZIP2_BLOCK_MAGIC = 0x314159265359;
+//! Magic number marking the end of a bzip2 stream; followed by the stream CRC
+const uint64_t BZIP2_END_MAGIC = 0x177245385090;
+//! Upper bound on the (compressed) size of valid bzip2 blocks
+const size_t BZIP2_MAX_BLOCK_SIZE = 4 * 1024 * 1024;
+
+
+/**
+ * Reads 'bits' (at most 57) bits starting at bit 'offset', where bits are
+ * numbered starting from the most significant bit of each byte (as in bzip2).
+ */
+uint64_t read_bits(const char* data, size_t offset, size_t bits);
+
+
+/**
+ * Returns true if the data starts with a bzip2 stream header, followed by the
+ * magic number of a block or of the end of the stream.
+ */
+bool is_bzip2(const char* data, size_t length);
+
+
+/**
+ * Returns the offset (in bits) of the first block or end-of-stream magic
+ * number starting at or after bit 'offset', or length * 8 if none were found.
+ * Since blocks are not byte-aligned, matches may be part of another block.
+ */
+size_t find_bzip2_magic(const char* data, size_t length, size_t offset);
+
+
+/**
+ * A single bzip2 block, or the end of an empty bzip2 stream. Offsets are in
+ * bits, relative to the start of the data containing the block.
+ */
+struct bzip2_block
+{
+    /** Constructor; creates an empty, incomplete block. */
+    bzip2_block();
+
+    //! Offset of the block magic number
+    size_t begin;
+    //! Offset following the last bit of the block
+    size_t end;
+    //! Set if the block is followed by a magic number; otherwise the block is
+    //! the (possibly truncated) end of a file
+    bool complete;
+    //! Set if the block is followed by the end of the stream
+    bool stream_end;
+    //! The combined CRC of the stream, if 'stream_end' is set
+    uint32_t stream_crc;
+};
+
+
+/**
+ * Decompresses a single bzip2 block, appending the output to 'dst'. The block
+ * CRC is verified, but not the stream CRC. Returns false if the block was not
+ * valid, in which case the contents of 'dst' are unspecified. Incomplete
+ * blocks at the end of a file produce no output.
+ */
+bool inflate_bzip2_block(const char* data, const bzip2_block& block,
+                         std::string& dst);
+
+
+/**
+ * Incremental decompression of blocks of raw data read from files.
+ *
+ * The format of each file is identified from its first block: gzip and bzip2
+ * compressed data is decompressed (including concatenated streams), while any
+ * other data is passed through unchanged. Errors are reported using either
+ * 'gzip_error' or 'bzip2_error'.
+ *
+ * Gzip headers and trailers are processed by the class, while the deflate
+ * streams are inflated in raw mode. This allows the use of deflate blocks
+ * decompressed speculatively by other threads (see speculative_inflate), once
+ * the stream has reached the first of these blocks.
+ *
+ * Bzip2 files may also be split into blocks (see find_bzip2_magic), which are
+ * decompressed independently. Blocks split at false magic numbers are joined
+ * and decompressed again, and the CRC of each stream is checked once the end
+ * of the stream has been reached.
+ */
+class block_decompressor
+{
+public:
+    /** Constructor; does nothing. */
+    block_decompressor();
+
+    /** Frees any open streams. */
+    ~block_decompressor();
+
+    /**
+     * Decompresses a block of data, appending the output to 'dst'. For gzip
+     * files, 'speculative' may contain blocks speculatively decompressed from
+     * 'data', which are used if the stream reaches the first of these blocks.
+     */
+    void decompress(const char* data, size_t length, std::string& dst,
+                    const speculative_block* speculative = nullptr);
+
+    /**
+     * Notes that a block of complete gzip members was inflated elsewhere; must
+     * only be called if 'at_gzip_member' returns true.
+     */
+    void skip_gzip_members(const char* data, size_t length);
+
+    /** Returns true if the next block must start with a new gzip member. */
+    bool at_gzip_member() const;
+
+    /**
+     * Decompresses a bzip2 block found in 'data', appending the output to
+     * 'dst'. If the block cannot be decompressed, it is assumed to be split
+     * at a false magic number, and is joined with the following block(s).
+     */
+    void decompress_bzip2_block(const char* data, size_t length,
+                                const bzip2_block& block, std::string& dst);
+
+    /**
+     * Notes that a bzip2 block was decompressed elsewhere; must only be
+     * called if 'at_bzip2_block' returns true.
+     */
+    void skip_bzip2_block(const char* data, const bzip2_block& block);
+
+    /** Returns true if no partial bzip2 blocks are pending. */
+    bool at_bzip2_block() const;
+
+    /** Ends the current file; the next block is the start of a new file. */
+    void end_file();
+
+    //! Copy construction not supported
+    block_decompressor(const block_decompressor&) = delete;
+    //! Assignment not supported
+    block_decompressor& operator=(const block_decompressor&) = delete;
+
+private:
+    /** Identifies the format of a file from its first block of data. */
+    void identify_format(const char* data, size_t length);
+
+    /** Decompresses gzip'd data; see 'decompress'. */
+    void decompress_gzip(const char* data, size_t length, std::string& dst,
+                         const speculative_block* speculative);
+    /** Reads a (partial) gzip header; returns the end of the header. */
+    const char* read_gzip_header(const char* data, const char* end);
+    /** Inflates deflate data; returns the end of the data consumed. */
+    const char* inflate_gzip(const char* begin, const char* data,
+                             const char* end, std::string& dst,
+                             const speculative_block*& speculative);
+    /**
+     * Adds the speculatively decompressed blocks to 'dst', and prepares the
+     * stream to continue after the last block. Returns the position following
+     * the blocks, or nullptr if the blocks could not be used.
+     */
+    const char* use_speculative_block(const char* begin,
+                                      const speculative_block& speculative,
+                                      std::string& dst);
+    /** Reads a (partial) gzip trailer; returns the end of the trailer. */
+    const char* read_gzip_trailer(const char* data, const char* end);
+    /** Decompresses bzip2'd data; see 'decompress'. */
+    void decompress_bzip2(const char* data, size_t length, std::string& dst);
+    /** Adds the CRC of a bzip2 block to the stream CRC; checks stream ends. */
+    void add_bzip2_block(const char* data, const bzip2_block& block);
+
+    //! Set once the format of the current file has been identified
+    bool m_identified;
+    /** The part of a gzip member currently being read. */
+    enum class gzip_state
+    {
+        header,
+        deflate,
+        trailer
+    };
+
+    //! GZip stream pointer; used if input it detected to be gzip compressed.
+    z_stream* m_gzip_stream;
+    //! The part of the current gzip member being read
+    gzip_state m_gzip_state;
+    //! Partial gzip header or trailer
+    std::string m_gzip_buffer;
+    //! CRC32 of the data inflated for the current gzip member
+    uLong m_gzip_crc;
+    //! Size of the data inflated for the current gzip member
+    uLong m_gzip_size;
+    //! BZip2 stream pointer; used if input it detected to be bzip2 compressed.
+    bz_stream* m_bzip2_stream;
+    //! Partial bzip2 block(s) that could not be decompressed on their own
+    std::string m_bzip2_pending;
+    //! Location of the block in 'm_bzip2_pending'
+    bzip2_block m_bzip2_block;
+    //! The combined CRC of the bzip2 blocks in the current stream
+    uint32_t m_bzip2_crc;
+};
+
+} // namespace ar
+
+#endif
@@ -31,6 +31,15 @@
 #include "debug.hpp"
 #include "fastq.hpp"
 #include "linereader.hpp"
+#include "simd.hpp"
+
+#if defined(__SSE__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef AR_SIMD_DISPATCH
+#include <immintrin.h>
+#endif
 
 namespace ar
 {
@@ -256,10 +265,8 @@ void fastq::reverse_complement()
     std::reverse(m_sequence.begin(), m_sequence.end());
     std::reverse(m_qualities.begin(), m_qualities.end());
 
-    // Lookup table for complementary bases based only on the last 4 bits
-    static const char complements[] = "-T-GA--C------N-";
     for (auto& nuc : m_sequence) {
-        nuc = complements[nuc & 0xf];
+        nuc = complement_nt(nuc);
     }
 }
 
@@ -320,6 +327,19 @@ bool fastq::read(line_reader_base& reader, const fastq_encoding& encoding)
 }
 
 
+void fastq::assign(const char* header, size_t header_len,
+                   const char* sequence, size_t sequence_len,
+                   const char* qualities, size_t qualities_len,
+                   const fastq_encoding& encoding)
+{
+    m_header.assign(header, header_len);
+    m_sequence.assign(sequence, sequence_len);
+    m_qualities.assign(qualities, qualities_len);
+
+    process_record(encoding);
+}
+
+
 std::string fastq::to_str(const fastq_encoding& encoding) const
 {
     std::string result;
@@ -342,9 +362,19 @@ std::string fastq::to_str(const fastq_encoding& encoding) const
 ///////////////////////////////////////////////////////////////////////////////
 // Public helper functions
 
-void fastq::clean_sequence(std::string& sequence)
+/**
+ * Signature of functions cleaning a sequence in-place (see clean_sequence);
+ * returns the position of the first invalid character, or the length of the
+ * sequence if all characters are valid.
+ */
+typedef size_t (*clean_sequence_func)(char* sequence, size_t length);
+
+
+size_t clean_sequence_std(char* sequence, size_t length)
 {
-    for (char& nuc : sequence) {
+    for (size_t i = 0; i < length; ++i) {
+        char& nuc = sequence[i];
+
         switch (nuc) {
             case 'A':
             case 'C':
@@ -366,9 +396,121 @@ void fastq::clean_sequence(std::string& sequence)
                 break;
 
             default:
-                throw fastq_error("invalid character in FASTQ sequence; "
-                                  "only A, C, G, T and N are expected!");
+                return i;
+        }
+    }
+
+    return length;
+}
+
+
+#if defined(__SSE__) && defined(__SSE2__)
+/**
+ * SSE2 implementation of clean_sequence; processes 16 characters at a time.
+ * Clearing bit 5 uppercases the letters "acgtn", while mapping no other
+ * characters onto "ACGTN", so that the alphabet can be validated afterwards.
+ */
+size_t clean_sequence_sse2(char* sequence, size_t length)
+{
+    const __m128i case_mask = _mm_set1_epi8(~0x20);
+    const __m128i dot = _mm_set1_epi8('.');
+    const __m128i n_mask = _mm_set1_epi8('N');
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i* ptr = reinterpret_cast<__m128i*>(sequence + i);
+        const __m128i raw = _mm_loadu_si128(ptr);
+        const __m128i upper = _mm_and_si128(raw, case_mask);
+        const __m128i dots = _mm_cmpeq_epi8(raw, dot);
+
+        const __m128i valid = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(upper, _mm_set1_epi8('A')),
+                                      _mm_cmpeq_epi8(upper, _mm_set1_epi8('C'))),
+                         _mm_or_si128(_mm_cmpeq_epi8(upper, _mm_set1_epi8('G')),
+                                      _mm_cmpeq_epi8(upper, _mm_set1_epi8('T')))),
+            _mm_or_si128(_mm_cmpeq_epi8(upper, n_mask), dots));
+
+        const unsigned int invalid = ~_mm_movemask_epi8(valid) & 0xFFFFu;
+        if (invalid) {
+            return i + __builtin_ctz(invalid);
         }
+
+        _mm_storeu_si128(ptr, _mm_or_si128(_mm_andnot_si128(dots, upper),
+                                           _mm_and_si128(dots, n_mask)));
+    }
+
+    return i + clean_sequence_std(sequence + i, length - i);
+}
+#endif
+
+
+#ifdef AR_SIMD_DISPATCH
+/** AVX2 implementation of clean_sequence; processes 32 characters at a time. */
+AR_TARGET("avx2")
+size_t clean_sequence_avx2(char* sequence, size_t length)
+{
+    const __m256i case_mask = _mm256_set1_epi8(~0x20);
+    const __m256i dot = _mm256_set1_epi8('.');
+    const __m256i n_mask = _mm256_set1_epi8('N');
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i* ptr = reinterpret_cast<__m256i*>(sequence + i);
+        const __m256i raw = _mm256_loadu_si256(ptr);
+        const __m256i upper = _mm256_and_si256(raw, case_mask);
+        const __m256i dots = _mm256_cmpeq_epi8(raw, dot);
+
+        const __m256i valid = _mm256_or_si256(
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(upper, _mm256_set1_epi8('A')),
+                                            _mm256_cmpeq_epi8(upper, _mm256_set1_epi8('C'))),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(upper, _mm256_set1_epi8('G')),
+                                            _mm256_cmpeq_epi8(upper, _mm256_set1_epi8('T')))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(upper, n_mask), dots));
+
+        const unsigned int invalid = ~static_cast<unsigned int>(_mm256_movemask_epi8(valid));
+        if (invalid) {
+            return i + __builtin_ctz(invalid);
+        }
+
+        _mm256_storeu_si256(ptr, _mm256_blendv_epi8(upper, n_mask, dots));
+    }
+
+    return i + clean_sequence_std(sequence + i, length - i);
+}
+#endif
+
+
+/**
+ * Returns the implementation of clean_sequence for a given instruction set;
+ * the instruction set is assumed to be supported by the host CPU.
+ */
+clean_sequence_func select_clean_sequence(simd::instruction_set is)
+{
+    switch (is) {
+        case simd::instruction_set::none:
+            return &clean_sequence_std;
+#if defined(__SSE__) && defined(__SSE2__)
+        case simd::instruction_set::sse2:
+            return &clean_sequence_sse2;
+#endif
+#ifdef AR_SIMD_DISPATCH
+        case simd::instruction_set::avx2:
+        case simd::instruction_set::avx512:
+            return &clean_sequence_avx2;
+#endif
+        default:
+            throw std::invalid_argument("unsupported instruction set");
+    }
+}
+
+
+void fastq::clean_sequence(std::string& sequence)
+{
+    static const clean_sequence_func func = select_clean_sequence(simd::detect());
+
+    if (func(&sequence[0], sequence.size()) != sequence.size()) {
+        throw fastq_error("invalid character in FASTQ sequence; "
+                          "only A, C, G, T and N are expected!");
     }
 }
 
@@ -26,7 +26,7 @@
 #define FASTQ_H
 
 #include <iostream>
-
+#include <random>
 #include <string>
 
 #include "commontypes.hpp"
@@ -37,6 +37,7 @@ namespace ar
 
 class line_reader_base;
 struct mate_info;
+struct alignment_info;
 
 
 /**
@@ -164,6 +165,16 @@ public:
     bool read(line_reader_base& reader,
               const fastq_encoding& encoding = FASTQ_ENCODING_33);
 
+    /**
+     * Initializes the record from the fields of a FASTQ record, with the
+     * header excluding the @ sigil. Fields are validated as in 'read', but
+     * the structure of the record is assumed to have been checked already.
+     */
+    void assign(const char* header, size_t header_len,
+                const char* sequence, size_t sequence_len,
+                const char* qualities, size_t qualities_len,
+                const fastq_encoding& encoding = FASTQ_ENCODING_33);
+
     /**
      * Converts a FASTQ record to a string ending with a newline.
      *
@@ -208,6 +219,18 @@ private:
     /** Helper function to get mate numbering and fix the separator char. */
     friend mate_info get_and_fix_mate_info(fastq& read, char mate_separator);
 
+    /** Collapsing builds the merged sequence / qualities in place. */
+    friend fastq collapse_paired_ended_sequences(const alignment_info& alignment,
+                                                 const fastq& read1,
+                                                 const fastq& read2,
+                                                 std::mt19937& rng,
+                                                 const char mate_sep);
+    friend fastq collapse_paired_ended_mates(const alignment_info& alignment,
+                                             const fastq& read1,
+                                             const fastq& read2,
+                                             std::mt19937& rng,
+                                             const char mate_sep);
+
     //! Header excluding the @ sigil, but (possibly) including meta-info
 	std::string m_header;
     //! Nucleotide sequence; contains only uppercase letters "ACGTN"
@@ -231,6 +254,19 @@ inline size_t ACGT_TO_IDX(char nt)
 }
 
 
+/**
+ * Returns the complement of a nucleotide in "ACGTN" (uppercase only), using
+ * only the last 4 bits of the nucleotide.
+ */
+inline char complement_nt(char nt)
+{
+    // Lookup table for complementary bases based only on the last 4 bits
+    static const char complements[] = "-T-GA--C------N-";
+
+    return complements[nt & 0xf];
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 
@@ -31,6 +31,15 @@
 
 #include "debug.hpp"
 #include "fastq_enc.hpp"
+#include "simd.hpp"
+
+#if defined(__SSE__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef AR_SIMD_DISPATCH
+#include <immintrin.h>
+#endif
 
 
 namespace ar
@@ -222,6 +231,220 @@ void invalid_solexa(const char offset, const char max_score, const char raw)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Kernels for decoding / encoding quality scores
+
+/**
+ * Signature of functions checking that (raw) quality scores lie in the range
+ * [min_score; max_score], and adding 'offset' to each score in-place. Returns
+ * the position of the first score outside of the range, or the length of the
+ * string if all scores are valid.
+ */
+typedef size_t (*decode_qualities_func)(char* qualities, size_t length,
+                                        char min_score, char max_score,
+                                        char offset);
+
+/**
+ * Signature of functions writing quality scores plus 'offset' to 'dst',
+ * truncated to 'max_score'.
+ */
+typedef void (*encode_qualities_func)(const char* qualities, char* dst,
+                                      size_t length, char offset,
+                                      char max_score);
+
+
+size_t decode_qualities_std(char* qualities, size_t length, char min_score,
+                            char max_score, char offset)
+{
+    for (size_t i = 0; i < length; ++i) {
+        if (qualities[i] < min_score || qualities[i] > max_score) {
+            return i;
+        }
+
+        qualities[i] += offset;
+    }
+
+    return length;
+}
+
+
+void encode_qualities_std(const char* qualities, char* dst, size_t length,
+                          char offset, char max_score)
+{
+    for (size_t i = 0; i < length; ++i) {
+        dst[i] = std::min<int>(max_score, qualities[i] + offset);
+    }
+}
+
+
+#if defined(__SSE__) && defined(__SSE2__)
+/** SSE2 implementation of decode_qualities; processes 16 scores at a time. */
+size_t decode_qualities_sse2(char* qualities, size_t length, char min_score,
+                             char max_score, char offset)
+{
+    // Scores are compared as signed chars, as in the scalar implementation
+    const __m128i min_mask = _mm_set1_epi8(min_score);
+    const __m128i max_mask = _mm_set1_epi8(max_score);
+    const __m128i offset_mask = _mm_set1_epi8(offset);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i* ptr = reinterpret_cast<__m128i*>(qualities + i);
+        const __m128i raw = _mm_loadu_si128(ptr);
+        const unsigned int invalid = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmplt_epi8(raw, min_mask),
+                         _mm_cmpgt_epi8(raw, max_mask)));
+
+        if (invalid) {
+            return i + __builtin_ctz(invalid);
+        }
+
+        _mm_storeu_si128(ptr, _mm_add_epi8(raw, offset_mask));
+    }
+
+    return i + decode_qualities_std(qualities + i, length - i, min_score,
+                                    max_score, offset);
+}
+
+
+/** SSE2 implementation of encode_qualities; processes 16 scores at a time. */
+void encode_qualities_sse2(const char* qualities, char* dst, size_t length,
+                           char offset, char max_score)
+{
+    // Valid scores plus offsets never exceed 127 + 31, and so fit in a byte
+    const __m128i offset_mask = _mm_set1_epi8(offset);
+    const __m128i max_mask = _mm_set1_epi8(max_score);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(qualities + i));
+        const __m128i encoded = _mm_min_epu8(_mm_adds_epu8(raw, offset_mask), max_mask);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), encoded);
+    }
+
+    encode_qualities_std(qualities + i, dst + i, length - i, offset, max_score);
+}
+#endif
+
+
+#ifdef AR_SIMD_DISPATCH
+/** AVX2 implementation of decode_qualities; processes 32 scores at a time. */
+AR_TARGET("avx2")
+size_t decode_qualities_avx2(char* qualities, size_t length, char min_score,
+                             char max_score, char offset)
+{
+    const __m256i min_mask = _mm256_set1_epi8(min_score);
+    const __m256i max_mask = _mm256_set1_epi8(max_score);
+    const __m256i offset_mask = _mm256_set1_epi8(offset);
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i* ptr = reinterpret_cast<__m256i*>(qualities + i);
+        const __m256i raw = _mm256_loadu_si256(ptr);
+        const unsigned int invalid = _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpgt_epi8(min_mask, raw),
+                            _mm256_cmpgt_epi8(raw, max_mask)));
+
+        if (invalid) {
+            return i + __builtin_ctz(invalid);
+        }
+
+        _mm256_storeu_si256(ptr, _mm256_add_epi8(raw, offset_mask));
+    }
+
+    return i + decode_qualities_std(qualities + i, length - i, min_score,
+                                    max_score, offset);
+}
+
+
+/** AVX2 implementation of encode_qualities; processes 32 scores at a time. */
+AR_TARGET("avx2")
+void encode_qualities_avx2(const char* qualities, char* dst, size_t length,
+                           char offset, char max_score)
+{
+    const __m256i offset_mask = _mm256_set1_epi8(offset);
+    const __m256i max_mask = _mm256_set1_epi8(max_score);
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i raw = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qualities + i));
+        const __m256i encoded = _mm256_min_epu8(_mm256_adds_epu8(raw, offset_mask), max_mask);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), encoded);
+    }
+
+    encode_qualities_std(qualities + i, dst + i, length - i, offset, max_score);
+}
+#endif
+
+
+/**
+ * Returns the implementation of decode_qualities for a given instruction set;
+ * the instruction set is assumed to be supported by the host CPU.
+ */
+decode_qualities_func select_decode_qualities(simd::instruction_set is)
+{
+    switch (is) {
+        case simd::instruction_set::none:
+            return &decode_qualities_std;
+#if defined(__SSE__) && defined(__SSE2__)
+        case simd::instruction_set::sse2:
+            return &decode_qualities_sse2;
+#endif
+#ifdef AR_SIMD_DISPATCH
+        case simd::instruction_set::avx2:
+        case simd::instruction_set::avx512:
+            return &decode_qualities_avx2;
+#endif
+        default:
+            throw std::invalid_argument("unsupported instruction set");
+    }
+}
+
+
+/**
+ * Returns the implementation of encode_qualities for a given instruction set;
+ * the instruction set is assumed to be supported by the host CPU.
+ */
+encode_qualities_func select_encode_qualities(simd::instruction_set is)
+{
+    switch (is) {
+        case simd::instruction_set::none:
+            return &encode_qualities_std;
+#if defined(__SSE__) && defined(__SSE2__)
+        case simd::instruction_set::sse2:
+            return &encode_qualities_sse2;
+#endif
+#ifdef AR_SIMD_DISPATCH
+        case simd::instruction_set::avx2:
+        case simd::instruction_set::avx512:
+            return &encode_qualities_avx2;
+#endif
+        default:
+            throw std::invalid_argument("unsupported instruction set");
+    }
+}
+
+
+/** Returns the best implementation of decode_qualities for this CPU. */
+decode_qualities_func get_decode_qualities()
+{
+    static const decode_qualities_func func = select_decode_qualities(simd::detect());
+
+    return func;
+}
+
+
+/** Returns the best implementation of encode_qualities for this CPU. */
+encode_qualities_func get_encode_qualities()
+{
+    static const encode_qualities_func func = select_encode_qualities(simd::detect());
+
+    return func;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 fastq_encoding::fastq_encoding(char offset, char max_score)
@@ -249,10 +472,11 @@ void fastq_encoding::encode(const std::string& qualities,
 {
     const char ascii_max = m_offset + m_max_score;
     const char offset = m_offset - '!';
+    const size_t dst_offset = dst.size();
 
-    for (const auto& quality : qualities) {
-        dst.push_back(std::min<int>(ascii_max, quality + offset));
-    }
+    dst.resize(dst_offset + qualities.size());
+    get_encode_qualities()(qualities.data(), &dst[dst_offset],
+                           qualities.size(), offset, ascii_max);
 }
 
 
@@ -261,12 +485,12 @@ void fastq_encoding::decode(std::string& qualities) const
     const char max_score = m_offset + m_max_score;
     const char offset = PHRED_OFFSET_33 - m_offset;
 
-    for (auto& quality : qualities) {
-        if (quality < m_offset || quality > max_score) {
-            invalid_phred(m_offset, m_max_score, quality);
-        }
-
-        quality += offset;
+    const size_t invalid = get_decode_qualities()(&qualities[0],
+                                                  qualities.size(),
+                                                  m_offset, max_score,
+                                                  offset);
+    if (invalid != qualities.size()) {
+        invalid_phred(m_offset, m_max_score, qualities.at(invalid));
     }
 }
 
@@ -309,12 +533,18 @@ void fastq_encoding_solexa::encode(const std::string& qualities,
 void fastq_encoding_solexa::decode(std::string& qualities) const
 {
     const char max_score = m_offset + m_max_score;
-    for (auto& quality : qualities) {
-        if (quality < ';' || quality > max_score) {
-            invalid_phred(m_offset, m_max_score, quality);
-        }
 
-        quality = g_solexa_to_phred.at(quality - ';') + '!';
+    // Scores are range-checked using a vectorized kernel, but the conversion
+    // from Solexa to Phred scores is a table lookup
+    const size_t invalid = get_decode_qualities()(&qualities[0],
+                                                  qualities.size(),
+                                                  ';', max_score, 0);
+    if (invalid != qualities.size()) {
+        invalid_phred(m_offset, m_max_score, qualities.at(invalid));
+    }
+
+    for (auto& quality : qualities) {
+        quality = g_solexa_to_phred[quality - ';'] + '!';
     }
 }
 
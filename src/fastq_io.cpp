@@ -21,44 +21,178 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
 #include <cerrno>
 #include <cstring>
+#include <sstream>
+
+#include <sys/stat.h>
 
 #include "debug.hpp"
 #include "fastq_io.hpp"
+#include "linereader.hpp"
 #include "userconfig.hpp"
 
 
 namespace ar
 {
 
-size_t read_fastq_reads(fastq_vec& dst, joined_line_readers& reader,
-                        size_t offset, const fastq_encoding& encoding)
+/** Describes an invalid record at the given line of the input. */
+std::string describe_fastq_error(const fastq_error& error, bool interleaved,
+                                 size_t line)
 {
-    dst.reserve(FASTQ_CHUNK_SIZE);
+    std::ostringstream stream;
+    if (interleaved) {
+        stream << "Error reading FASTQ record starting at line " << line
+               << ":\n";
+    } else {
+        stream << "Error reading FASTQ record at line " << line
+               << "; aborting:\n";
+    }
 
-    try {
-        fastq record;
-        for (size_t i = 0; i < FASTQ_CHUNK_SIZE; ++i) {
-            if (record.read(reader, encoding)) {
-                dst.push_back(record);
-            } else {
-                break;
+    stream << cli_formatter::fmt(error.what());
+
+    return stream.str();
+}
+
+
+/** Maps a file to be sharded, which must be an uncompressed regular file. */
+std::unique_ptr<mapped_file> map_shard_file(const std::string& filename)
+{
+    FILE* handle = fopen(filename.c_str(), "rb");
+    if (!handle) {
+        throw io_error("failed to open file '" + filename + "'", errno);
+    }
+
+    struct stat info;
+    const bool is_regular = !fstat(fileno(handle), &info) && S_ISREG(info.st_mode);
+    std::unique_ptr<mapped_file> file(new mapped_file(fileno(handle)));
+    fclose(handle);
+
+    if (!is_regular) {
+        throw io_error("--shard requires regular files, but '" + filename
+                       + "' is not a regular file");
+    } else if (info.st_size && !file->data()) {
+        throw io_error("failed to map file '" + filename + "'");
+    } else if (is_compressed(file->data(), file->size())) {
+        throw io_error("--shard requires uncompressed files, but '" + filename
+                       + "' is compressed");
+    }
+
+    return file;
+}
+
+
+/**
+ * Determines the parts of the mate 1 and (optionally) mate 2 files that are
+ * read by the shard selected using --shard. Shards start at the first record
+ * following an equally sized fraction of the mate 1 file, and the mate 2 file
+ * is split after the same number of records. Interleaved files are only split
+ * between read pairs.
+ */
+void shard_input(const userconfig& config, byte_range ranges[2])
+{
+    const size_t shards = config.shard.second;
+    const std::unique_ptr<mapped_file> file_1 = map_shard_file(config.input_files_1.front());
+    std::unique_ptr<mapped_file> file_2;
+    if (!config.input_files_2.empty()) {
+        file_2 = map_shard_file(config.input_files_2.front());
+    }
+
+    const char* data_1 = file_1->data();
+    const size_t size_1 = file_1->size();
+    // Lines preceding offset 'counted' in the mate 1 file, and the
+    // corresponding offset in the mate 2 file
+    size_t counted = 0;
+    size_t lines = 0;
+    size_t offset_2 = 0;
+
+    for (size_t i = 0; i < 2; ++i) {
+        const size_t nth = config.shard.first + i;
+        size_t offset_1 = 0;
+
+        if (nth == shards) {
+            offset_1 = size_1;
+            offset_2 = file_2 ? file_2->size() : 0;
+        } else if (nth) {
+            offset_1 = find_fastq_record(data_1, size_1, size_1 * nth / shards);
+
+            // PE reads are split by counting the preceding records
+            if (file_2 || config.interleaved_input) {
+                const size_t skipped = lines;
+                lines += count_lines(data_1 + counted, offset_1 - counted);
+                counted = offset_1;
+
+                if (config.interleaved_input && (lines / 4) % 2) {
+                    // Shards must start with a mate 1 read
+                    offset_1 = skip_lines(data_1, size_1, offset_1, 4);
+                }
+
+                if (file_2) {
+                    offset_2 = skip_lines(file_2->data(), file_2->size(),
+                                          offset_2, lines - skipped);
+                }
             }
         }
-    } catch (const fastq_error& error) {
-        print_locker lock;
-        std::cerr << "Error reading FASTQ record at line "
-                  << offset + dst.size()
-                  << "; aborting:\n"
-                  << cli_formatter::fmt(error.what()) << std::endl;
 
-        throw thread_abort();
+        if (i) {
+            ranges[0].second = offset_1;
+            ranges[1].second = offset_2;
+        } else {
+            ranges[0].first = offset_1;
+            ranges[1].first = offset_2;
+        }
     }
+}
 
-    return dst.size();
+
+void add_read_steps(scheduler& sch, const userconfig& config, size_t next_step)
+{
+    const size_t mates = config.input_files_2.empty() ? 1 : 2;
+    byte_range ranges[2] = { FASTQ_WHOLE_FILE, FASTQ_WHOLE_FILE };
+    if (config.shard.second > 1) {
+        shard_input(config, ranges);
+    }
+
+    // Speculation only pays off if run in parallel
+    const bool speculate = config.max_threads > 1;
+
+    decompress_fastq* decompressor_1 = new decompress_fastq(0,
+                                                            config.interleaved_input,
+                                                            ai_join_fastq);
+    decompress_fastq* decompressor_2 = nullptr;
+
+    sch.add_step(ai_inflate_blocks_1, "inflate_blocks_1",
+                 new inflate_blocks(speculate, ai_decompress_fastq_1));
+    sch.add_step(ai_decompress_fastq_1, "decompress_fastq_1", decompressor_1);
+
+    if (mates == 2) {
+        decompressor_2 = new decompress_fastq(1, false, ai_join_fastq);
+
+        sch.add_step(ai_inflate_blocks_2, "inflate_blocks_2",
+                     new inflate_blocks(speculate, ai_decompress_fastq_2));
+        sch.add_step(ai_decompress_fastq_2, "decompress_fastq_2", decompressor_2);
+    }
+
+    sch.add_step(ai_read_fastq, "read_fastq",
+                 new read_fastq(config.input_files_1,
+                                config.input_files_2,
+                                decompressor_1,
+                                decompressor_2,
+                                ai_split_blocks,
+                                ranges[0],
+                                ranges[1]));
+    sch.add_step(ai_split_blocks, "split_blocks",
+                 new split_blocks(ai_inflate_blocks_1, ai_inflate_blocks_2));
+    sch.add_step(ai_join_fastq, "join_fastq",
+                 new join_fastq(mates, config.interleaved_input, ai_parse_fastq));
+    sch.add_step(ai_parse_fastq, "parse_fastq",
+                 new parse_fastq(config.quality_input_fmt.get(),
+                                 config.interleaved_input,
+                                 ai_check_fastq));
+    sch.add_step(ai_check_fastq, "check_fastq", new check_fastq(next_step));
 }
 
 
@@ -68,8 +202,15 @@ size_t read_fastq_reads(fastq_vec& dst, joined_line_readers& reader,
 
 fastq_read_chunk::fastq_read_chunk(bool eof_)
   : eof(eof_)
+  , mate(0)
   , reads_1()
   , reads_2()
+  , line_offset(1)
+  , buffer_1()
+  , buffer_2()
+  , views_1()
+  , views_2()
+  , error()
 {
 }
 
@@ -105,208 +246,909 @@ void fastq_output_chunk::add(const fastq_encoding& encoding,
 
 
 ///////////////////////////////////////////////////////////////////////////////
-// Implementations for 'read_single_fastq'
+// Implementations for 'fastq_raw_chunk'
+
+fastq_raw_chunk::fastq_raw_chunk(size_t mate_)
+  : mate(mate_)
+  , end_of_file(false)
+  , eof(false)
+  , gzip(false)
+  , members(false)
+  , bzip2(false)
+  , inflated(false)
+  , data()
+  , decompressed()
+  , speculative()
+  , block()
+  , mapping()
+  , mapped_data(nullptr)
+  , mapped_size(0)
+{
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'block_prefetcher'
+
+block_prefetcher::prefetched_block::prefetched_block()
+  : filename()
+  , block()
+  , error()
+{
+}
+
+
+block_prefetcher::block_prefetcher(const string_vec& filenames, size_t mate,
+                                   const byte_range& range)
+  : m_filenames(filenames.rbegin(), filenames.rend())
+  , m_mate(mate)
+  , m_range(range)
+  , m_file(nullptr)
+  , m_mapping()
+  , m_mapped_offset(0)
+  , m_mapped_end(0)
+  , m_queue()
+  , m_stop(false)
+  , m_lock()
+  , m_not_empty()
+  , m_not_full()
+  , m_thread()
+{
+    AR_DEBUG_ASSERT(!filenames.empty());
+    AR_DEBUG_ASSERT(range == FASTQ_WHOLE_FILE || filenames.size() == 1);
+}
+
+
+block_prefetcher::~block_prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+
+    m_not_full.notify_one();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    if (m_file) {
+        fclose(m_file);
+    }
+}
+
+
+std::unique_ptr<fastq_raw_chunk> block_prefetcher::next_block()
+{
+    if (!m_thread.joinable()) {
+        m_thread = std::thread(&block_prefetcher::run, this);
+    }
+
+    prefetched_block prefetched;
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_not_empty.wait(lock, [this]() { return !m_queue.empty(); });
+
+        prefetched = std::move(m_queue.front());
+        m_queue.pop_front();
+    }
+
+    m_not_full.notify_one();
+
+    if (!prefetched.filename.empty()) {
+        print_locker lock;
+        std::cerr << "Opening FASTQ file '" << prefetched.filename << "'" << std::endl;
+    }
+
+    if (prefetched.error) {
+        std::rethrow_exception(prefetched.error);
+    }
+
+    return std::move(prefetched.block);
+}
+
+
+void block_prefetcher::run()
+{
+    for (bool eof = false; !eof;) {
+        prefetched_block prefetched;
+
+        try {
+            prefetched.block = read_block(prefetched.filename);
+            eof = prefetched.block->eof;
+        } catch (...) {
+            // Reported once the block is requested
+            prefetched.error = std::current_exception();
+            eof = true;
+        }
+
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_not_full.wait(lock, [this]() {
+            return m_stop || m_queue.size() < FASTQ_READ_AHEAD;
+        });
+
+        if (m_stop) {
+            break;
+        }
+
+        m_queue.push_back(std::move(prefetched));
+        m_not_empty.notify_one();
+    }
+}
+
+
+std::unique_ptr<fastq_raw_chunk> block_prefetcher::read_block(std::string& filename)
+{
+    if (!m_file) {
+        AR_DEBUG_ASSERT(!m_filenames.empty());
+        filename = m_filenames.back();
+        m_filenames.pop_back();
+
+        m_file = fopen(filename.c_str(), "rb");
+        if (!m_file) {
+            throw io_error("block_prefetcher::read_block: failed to open file", errno);
+        }
+
+        // Compressed files are not mapped, as the data is copied when
+        // decompressed, and since gzip files may be inflated in parallel
+        std::shared_ptr<const mapped_file> mapping(new mapped_file(fileno(m_file)));
+        if (mapping->data() && !is_compressed(mapping->data(), mapping->size())) {
+            m_mapping = mapping;
+            m_mapped_offset = std::min(m_range.first, mapping->size());
+            m_mapped_end = std::min(m_range.second, mapping->size());
+        } else if (m_range != FASTQ_WHOLE_FILE && m_range.second) {
+            // Sharded files were mapped when determining the range to read
+            throw io_error("block_prefetcher::read_block: failed to map sharded file");
+        }
+    }
+
+    std::unique_ptr<fastq_raw_chunk> block(new fastq_raw_chunk(m_mate));
+
+    bool end_of_file = false;
+    if (m_mapping) {
+        block->mapping = m_mapping;
+        block->mapped_data = m_mapping->data() + m_mapped_offset;
+        block->mapped_size = std::min(FASTQ_RAW_BLOCK_SIZE,
+                                      m_mapped_end - m_mapped_offset);
+        m_mapping->prefetch(block->mapped_data, block->mapped_size);
+
+        m_mapped_offset += block->mapped_size;
+        if (m_mapped_offset == m_mapped_end) {
+            m_mapping.reset();
+            end_of_file = true;
+        }
+    } else {
+        block->data.resize(FASTQ_RAW_BLOCK_SIZE);
+
+        const size_t nread = fread(&block->data[0], 1, FASTQ_RAW_BLOCK_SIZE, m_file);
+        if (nread != FASTQ_RAW_BLOCK_SIZE) {
+            if (ferror(m_file)) {
+                throw io_error("block_prefetcher::read_block: error reading file", errno);
+            }
+
+            block->data.resize(nread);
+            end_of_file = true;
+        }
+    }
 
-read_single_fastq::read_single_fastq(const fastq_encoding* encoding,
-                                     const string_vec& filenames,
-                                     size_t next_step)
+    if (end_of_file) {
+        FILE* file = m_file;
+        m_file = nullptr;
+
+        if (fclose(file)) {
+            throw io_error("block_prefetcher::read_block: error closing file", errno);
+        }
+
+        block->end_of_file = true;
+        block->eof = m_filenames.empty();
+    }
+
+    return block;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'read_fastq'
+
+read_fastq::read_fastq(const string_vec& filenames_1,
+                       const string_vec& filenames_2,
+                       const decompress_fastq* decompressor_1,
+                       const decompress_fastq* decompressor_2,
+                       size_t next_step,
+                       const byte_range& range_1,
+                       const byte_range& range_2)
   : analytical_step(analytical_step::ordering::ordered, true)
-  , m_encoding(encoding)
-  , m_line_offset(1)
-  , m_io_input(filenames)
+  , m_readers()
+  , m_mate_eof()
+  , m_mates(filenames_2.empty() ? 1 : 2)
+  , m_next_mate(0)
+  , m_decompressors{decompressor_1, decompressor_2}
   , m_next_step(next_step)
-  , m_eof(false)
   , m_lock()
 {
-  AR_DEBUG_ASSERT(!filenames.empty());
+    AR_DEBUG_ASSERT(!filenames_1.empty());
+    AR_DEBUG_ASSERT(filenames_2.empty() || filenames_1.size() == filenames_2.size());
+    AR_DEBUG_ASSERT(decompressor_1 && (filenames_2.empty() || decompressor_2));
+
+    m_readers[0].reset(new block_prefetcher(filenames_1, 0, range_1));
+    if (m_mates == 2) {
+        m_readers[1].reset(new block_prefetcher(filenames_2, 1, range_2));
+    }
+
+    // Mate 2 files are treated as exhausted for SE / interleaved reads
+    m_mate_eof[0] = false;
+    m_mate_eof[1] = (m_mates == 1);
 }
 
 
-chunk_vec read_single_fastq::process(analytical_chunk* chunk)
+chunk_vec read_fastq::process(analytical_chunk* chunk)
 {
     AR_DEBUG_LOCK(m_lock);
     AR_DEBUG_ASSERT(chunk == nullptr);
-    if (m_eof) {
+
+    size_t mate = m_next_mate;
+    if (m_mate_eof[0] && m_mate_eof[1]) {
         return chunk_vec();
+    } else if (m_mate_eof[0] || m_mate_eof[1]) {
+        mate = m_mate_eof[0] ? 1 : 0;
+    } else {
+        // Read from the mate lagging behind, to limit the number of unpaired
+        // chunks of records held by the join_fastq step
+        const size_t records_1 = m_decompressors[0]->records();
+        const size_t records_2 = m_decompressors[1]->records();
+
+        if (records_1 != records_2) {
+            mate = (records_1 < records_2) ? 0 : 1;
+        }
+    }
+
+    m_next_mate = (mate + 1) % m_mates;
+
+    std::unique_ptr<fastq_raw_chunk> block = m_readers[mate]->next_block();
+    m_mate_eof[mate] = block->eof;
+
+    chunk_vec chunks;
+    chunks.push_back(chunk_pair(m_next_step, std::move(block)));
+
+    return chunks;
+}
+
+
+void read_fastq::finalize()
+{
+    AR_DEBUG_LOCK(m_lock);
+    if (!m_mate_eof[0] || !m_mate_eof[1]) {
+        throw thread_error("read_fastq::finalize: terminated before EOF");
     }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'split_blocks'
+
+split_blocks::mate_state::mate_state()
+  : pending()
+  , new_file(true)
+  , format(input_format::plain)
+  , at_member(false)
+  , offset(0)
+  , scanned(0)
+  , at_stream(false)
+{
+}
+
+
+split_blocks::split_blocks(size_t next_step_1, size_t next_step_2)
+  : analytical_step(analytical_step::ordering::ordered)
+  , m_states()
+  , m_next_steps{next_step_1, next_step_2}
+  , m_lock()
+{
+}
 
-    read_chunk_ptr file_chunk(new fastq_read_chunk());
 
-    const size_t n_read = read_fastq_reads(file_chunk->reads_1, m_io_input,
-                                           m_line_offset, *m_encoding);
+chunk_vec split_blocks::process(analytical_chunk* chunk)
+{
+    AR_DEBUG_LOCK(m_lock);
+    std::unique_ptr<fastq_raw_chunk> block(dynamic_cast<fastq_raw_chunk*>(chunk));
+    AR_DEBUG_ASSERT(block);
+
+    mate_state& state = m_states[block->mate];
+    if (state.new_file) {
+        const char* data = block->data.data();
+        const size_t length = block->data.size();
+
+        if (block->mapping) {
+            // Only uncompressed files are mapped (see read_fastq)
+            state.format = input_format::plain;
+        } else if (is_gzip(data, length)) {
+            state.format = input_format::gzip;
+        } else if (is_bzip2(data, length)) {
+            state.format = input_format::bzip2;
+        } else {
+            state.format = input_format::plain;
+        }
 
-    if (!n_read) {
-        // EOF is detected by failure to read any lines, not line_reader::eof,
-        // so that unbalanced files can be caught in all cases.
-        file_chunk->eof = true;
-        m_eof = true;
+        state.at_member = (state.format == input_format::gzip);
+        state.at_stream = (state.format == input_format::bzip2);
+        state.offset = state.scanned = 0;
     }
 
-    m_line_offset += n_read;
+    state.new_file = block->end_of_file;
 
     chunk_vec chunks;
-    chunks.push_back(chunk_pair(m_next_step, std::move(file_chunk)));
+    switch (state.format) {
+        case input_format::plain:
+            chunks.push_back(chunk_pair(m_next_steps[block->mate], std::move(block)));
+            break;
+
+        case input_format::gzip:
+            split_gzip(state, *block, chunks);
+            break;
+
+        case input_format::bzip2:
+            split_bzip2(state, *block, chunks);
+            break;
+
+        default:
+            AR_DEBUG_FAIL("invalid input_format in split_blocks::process");
+    }
 
     return chunks;
 }
 
 
-void read_single_fastq::finalize()
+void split_blocks::split_gzip(mate_state& state, fastq_raw_chunk& block,
+                              chunk_vec& chunks)
 {
-    AR_DEBUG_LOCK(m_lock);
-    if (!m_eof) {
-        throw thread_error("read_single_fastq::finalize: terminated before EOF");
+    std::string& pending = state.pending;
+    if (pending.empty()) {
+        pending.swap(block.data);
+    } else {
+        pending.append(block.data);
+    }
+
+    const char* data = pending.data();
+    const size_t length = pending.size();
+
+    // Start of the next piece, which is (expected to be) the start of a member
+    // if 'start_at_member' is set, and the position of the last member found
+    size_t start = 0;
+    bool start_at_member = state.at_member;
+    size_t boundary = 0;
+    bool at_member = state.at_member;
+
+    auto forward = [&](size_t end, bool members) {
+        std::unique_ptr<fastq_raw_chunk> piece(new fastq_raw_chunk(block.mate));
+        piece->data.assign(pending, start, end - start);
+        piece->gzip = true;
+        piece->members = members && end > start;
+
+        chunks.push_back(chunk_pair(m_next_steps[block.mate], std::move(piece)));
+        start = end;
+    };
+
+    while (true) {
+        size_t next = length;
+        if (!at_member) {
+            next = find_gzip_header(data, boundary, length);
+        } else if (const size_t block_size = bgzf_block_size(data + boundary, length - boundary)) {
+            if (block_size <= length - boundary) {
+                next = boundary + block_size;
+            }
+        } else {
+            next = find_gzip_header(data, boundary + GZIP_MIN_MEMBER_SIZE, length);
+        }
+
+        if (next >= length) {
+            break;
+        } else if (!at_member) {
+            forward(next, false);
+            start_at_member = true;
+        } else if (next - start >= FASTQ_RAW_BLOCK_SIZE) {
+            forward(next, start_at_member);
+            start_at_member = true;
+        }
+
+        boundary = next;
+        at_member = true;
+    }
+
+    if (block.end_of_file) {
+        forward(length, start_at_member);
+
+        fastq_raw_chunk* last = dynamic_cast<fastq_raw_chunk*>(chunks.back().second.get());
+        last->end_of_file = true;
+        last->eof = block.eof;
+    } else if (!at_member) {
+        // Forward data in the current member, except for partial gzip headers
+        if (length >= start + GZIP_HEADER_SIZE) {
+            forward(length - GZIP_HEADER_SIZE + 1, false);
+        }
+    } else if (length - start > FASTQ_MAX_MEMBER_BUFFER) {
+        // The end of the current member was not found; decompressed serially
+        if (boundary > start) {
+            forward(boundary, start_at_member);
+        }
+
+        forward(length, false);
+        start_at_member = false;
+    }
+
+    pending.erase(0, start);
+    state.at_member = start_at_member;
+}
+
+
+/**
+ * Returns 1 if the end-of-stream magic at 'offset' is followed by the end of
+ * the file or by another bzip2 stream, 0 if it is not, and -1 if this cannot
+ * be determined without more data.
+ */
+static int is_bzip2_stream_end(const char* data, size_t length, size_t offset,
+                               bool end_of_file)
+{
+    const size_t stream_end = (offset + BZIP2_MAGIC_BITS + 32 + 7) / 8;
+    const size_t header_size = BZIP2_HEADER_SIZE + BZIP2_MAGIC_BITS / 8;
+
+    if (length >= stream_end + header_size) {
+        return is_bzip2(data + stream_end, length - stream_end);
+    } else if (!end_of_file) {
+        return -1;
+    } else if (length < stream_end) {
+        return 0;
+    }
+
+    // Partial stream headers at the end of files are ignored by libbzip2
+    for (size_t i = stream_end; i < length && i < stream_end + BZIP2_HEADER_SIZE; ++i) {
+        const char expected = "BZh9"[i - stream_end];
+        if (expected == '9' ? (data[i] < '1' || data[i] > '9') : data[i] != expected) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+void split_blocks::split_bzip2(mate_state& state, fastq_raw_chunk& block,
+                               chunk_vec& chunks)
+{
+    std::string& pending = state.pending;
+    if (pending.empty()) {
+        pending.swap(block.data);
+    } else {
+        pending.append(block.data);
+    }
+
+    const char* data = pending.data();
+    const size_t length = pending.size();
+
+    // Forwards the data from 'offset' to 'end' (bits) as a single block
+    auto forward = [&](size_t end, bool complete) {
+        std::unique_ptr<fastq_raw_chunk> piece(new fastq_raw_chunk(block.mate));
+        piece->bzip2 = true;
+        piece->block.begin = state.offset % 8;
+        piece->block.end = end - state.offset / 8 * 8;
+        piece->block.complete = complete;
+        piece->data.assign(pending, state.offset / 8,
+                           (end + 7) / 8 - state.offset / 8);
+
+        if (complete && read_bits(data, end, BZIP2_MAGIC_BITS) == BZIP2_END_MAGIC) {
+            piece->block.stream_end = true;
+            piece->block.stream_crc = read_bits(data, end + BZIP2_MAGIC_BITS, 32);
+
+            // The next stream starts at the following byte
+            state.offset = (end + BZIP2_MAGIC_BITS + 32 + 7) / 8 * 8;
+            state.at_stream = true;
+        } else {
+            state.offset = end;
+        }
+
+        state.scanned = 0;
+        chunks.push_back(chunk_pair(m_next_steps[block.mate], std::move(piece)));
+    };
+
+    while (state.offset < length * 8) {
+        if (state.at_stream) {
+            if (length - state.offset / 8 < BZIP2_HEADER_SIZE + BZIP2_MAGIC_BITS / 8) {
+                // Partial header at the end of the file (see is_bzip2_stream_end)
+                state.offset = block.end_of_file ? length * 8 : state.offset;
+                break;
+            }
+
+            state.offset += BZIP2_HEADER_SIZE * 8;
+            state.at_stream = false;
+        }
+
+        // The current block ends at the next magic number, which may be a
+        // false positive; the end of the stream is therefore verified
+        size_t offset = state.offset;
+        if (read_bits(data, offset, BZIP2_MAGIC_BITS) == BZIP2_BLOCK_MAGIC) {
+            offset = std::max(offset + BZIP2_MAGIC_BITS, state.scanned);
+        }
+
+        int found = -1;
+        while ((offset = find_bzip2_magic(data, length, offset)) < length * 8) {
+            if (read_bits(data, offset, BZIP2_MAGIC_BITS) == BZIP2_BLOCK_MAGIC) {
+                found = 1;
+            } else {
+                found = is_bzip2_stream_end(data, length, offset, block.end_of_file);
+            }
+
+            if (found) {
+                break;
+            }
+
+            ++offset;
+        }
+
+        if (found == 1) {
+            forward(offset, true);
+        } else if (block.end_of_file) {
+            // Truncated block at the end of the file
+            forward(length * 8, false);
+        } else {
+            state.scanned = std::min(offset, length * 8 - BZIP2_MAGIC_BITS + 1);
+            break;
+        }
+    }
+
+    if (block.end_of_file) {
+        if (chunks.empty()) {
+            chunks.push_back(chunk_pair(m_next_steps[block.mate],
+                                        chunk_ptr(new fastq_raw_chunk(block.mate))));
+        }
+
+        fastq_raw_chunk* last = dynamic_cast<fastq_raw_chunk*>(chunks.back().second.get());
+        last->bzip2 = true;
+        last->end_of_file = true;
+        last->eof = block.eof;
+
+        pending.clear();
+    } else if (length - state.offset / 8 > BZIP2_MAX_BLOCK_SIZE) {
+        throw bzip2_error("split_blocks::split_bzip2: malformed bzip2 file");
+    } else {
+        pending.erase(0, state.offset / 8);
+        state.scanned -= std::min(state.scanned, state.offset / 8 * 8);
+        state.offset %= 8;
     }
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////
-// Implementations for 'read_paired_fastq'
+// Implementations for 'inflate_blocks'
 
-read_paired_fastq::read_paired_fastq(const fastq_encoding* encoding,
-                                     const string_vec& filenames_1,
-                                     const string_vec& filenames_2,
-                                     size_t next_step)
-  : analytical_step(analytical_step::ordering::ordered, true)
-  , m_encoding(encoding)
+inflate_blocks::inflate_blocks(bool speculate, size_t next_step)
+  : analytical_step(analytical_step::ordering::unordered)
+  , m_speculate(speculate)
+  , m_next_step(next_step)
+{
+}
+
+
+chunk_vec inflate_blocks::process(analytical_chunk* chunk)
+{
+    std::unique_ptr<fastq_raw_chunk> block(dynamic_cast<fastq_raw_chunk*>(chunk));
+    AR_DEBUG_ASSERT(block);
+
+    if (block->members) {
+        block->inflated = inflate_gzip_members(block->data.data(),
+                                               block->data.size(),
+                                               block->decompressed);
+    } else if (block->bzip2) {
+        block->inflated = inflate_bzip2_block(block->data.data(), block->block,
+                                              block->decompressed);
+    }
+
+    if (!block->inflated) {
+        // Decompressed serially by decompress_fastq
+        std::string().swap(block->decompressed);
+    }
+
+    if (m_speculate && block->gzip && !block->inflated) {
+        speculative_inflate(block->data.data(), block->data.size(),
+                            block->speculative);
+    }
+
+    chunk_vec chunks;
+    chunks.push_back(chunk_pair(m_next_step, std::move(block)));
+
+    return chunks;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'decompress_fastq'
+
+decompress_fastq::decompress_fastq(size_t mate, bool interleaved,
+                                   size_t next_step)
+  : analytical_step(analytical_step::ordering::ordered)
+  , m_mate(mate)
+  , m_interleaved(interleaved)
+  , m_decompressor()
+  , m_parser()
+  , m_decompressed()
+  , m_buffer()
+  , m_views()
   , m_line_offset(1)
-  , m_io_input_1(filenames_1)
-  , m_io_input_2(filenames_2)
+  , m_records(0)
   , m_next_step(next_step)
   , m_eof(false)
   , m_lock()
 {
-  AR_DEBUG_ASSERT(filenames_1.size() == filenames_2.size());
+    AR_DEBUG_ASSERT(mate == 0 || (mate == 1 && !interleaved));
 }
 
 
-chunk_vec read_paired_fastq::process(analytical_chunk* chunk)
+chunk_vec decompress_fastq::process(analytical_chunk* chunk)
 {
     AR_DEBUG_LOCK(m_lock);
-    AR_DEBUG_ASSERT(chunk == nullptr);
+    std::unique_ptr<fastq_raw_chunk> block(dynamic_cast<fastq_raw_chunk*>(chunk));
+    AR_DEBUG_ASSERT(block);
+    AR_DEBUG_ASSERT(block->mate == m_mate);
+
     if (m_eof) {
+        // Data following a blank line in place of a header is ignored
         return chunk_vec();
     }
 
-    read_chunk_ptr file_chunk(new fastq_read_chunk());
-
-    const size_t n_read_1 = read_fastq_reads(file_chunk->reads_1, m_io_input_1,
-                                             m_line_offset, *m_encoding);
-    const size_t n_read_2 = read_fastq_reads(file_chunk->reads_2, m_io_input_2,
-                                             m_line_offset, *m_encoding);
+    if (block->mapping) {
+        // Mapped data is only copied once, and is not needed afterwards
+        m_parser.add_block(block->mapped_data, block->mapped_size);
+        block->mapping->release(block->mapped_data, block->mapped_size);
+    } else if (block->bzip2) {
+        if (block->inflated && m_decompressor.at_bzip2_block()) {
+            m_decompressor.skip_bzip2_block(block->data.data(), block->block);
+            m_parser.add_block(block->decompressed.data(),
+                               block->decompressed.size());
+        } else {
+            // Blocks split at false magic numbers are joined and decompressed
+            m_decompressed.clear();
+            m_decompressor.decompress_bzip2_block(block->data.data(),
+                                                  block->data.size(),
+                                                  block->block,
+                                                  m_decompressed);
+            m_parser.add_block(m_decompressed.data(), m_decompressed.size());
+        }
+    } else if (block->inflated && m_decompressor.at_gzip_member()) {
+        m_decompressor.skip_gzip_members(block->data.data(),
+                                         block->data.size());
+        m_parser.add_block(block->decompressed.data(),
+                           block->decompressed.size());
+    } else {
+        // Serial decompression of partial members, in which case a member may
+        // have been split at a false header in a following piece
+        m_decompressed.clear();
+        m_decompressor.decompress(block->data.data(), block->data.size(),
+                                  m_decompressed, &block->speculative);
+        m_parser.add_block(m_decompressed.data(), m_decompressed.size());
+    }
 
-    if (n_read_1 != n_read_2) {
-        print_locker lock;
-        std::cerr << "ERROR: Input --file1 and --file2 contains different "
-                  << "numbers of lines; one or the other file may have been "
-                  << "truncated. Please correct before continuing!"
-                  << std::endl;
+    if (block->end_of_file) {
+        m_decompressor.end_file();
+        m_parser.end_file();
+    }
 
-        throw thread_abort();
-    } else if (!n_read_1) {
-        // EOF is detected by failure to read any lines, not line_reader::eof,
-        // so that unbalanced files can be caught in all cases.
-        file_chunk->eof = true;
-        m_eof = true;
+    if (block->eof) {
+        m_parser.set_eof();
     }
 
-    m_line_offset += n_read_1;
+    return build_chunks();
+}
+
+
+chunk_vec decompress_fastq::build_chunks()
+{
+    const size_t max_records = (m_interleaved ? 2 : 1) * FASTQ_CHUNK_SIZE;
 
     chunk_vec chunks;
-    chunks.push_back(chunk_pair(m_next_step, std::move(file_chunk)));
+    while (!m_eof) {
+        std::string error;
+        try {
+            if (!m_parser.read(m_buffer, m_views, max_records)) {
+                break;
+            }
+        } catch (const fastq_error& err) {
+            // Reported by check_fastq, following any errors in earlier records
+            const size_t line = m_line_offset + m_views.size() * (m_interleaved ? 4 : 1);
+            error = describe_fastq_error(err, m_interleaved, line);
+        }
+
+        const size_t n_read = m_views.size();
+
+        // EOF is detected by failure to read any records, not by the EOF
+        // of the files, so that unbalanced files can be caught in all cases.
+        read_chunk_ptr file_chunk(new fastq_read_chunk(!n_read && error.empty()));
+        file_chunk->mate = m_mate;
+        file_chunk->line_offset = m_line_offset;
+        file_chunk->error.swap(error);
+
+        if (m_mate) {
+            file_chunk->buffer_2.swap(m_buffer);
+            file_chunk->views_2.swap(m_views);
+        } else {
+            file_chunk->buffer_1.swap(m_buffer);
+            file_chunk->views_1.swap(m_views);
+        }
+
+        m_buffer.clear();
+        m_views.clear();
+
+        // SE/PE offsets count records, while interleaved offsets count lines
+        m_line_offset += m_interleaved ? n_read * 4 : n_read;
+        m_records += n_read;
+        // No further records are read following an error
+        m_eof = file_chunk->eof || !file_chunk->error.empty();
+
+        chunks.push_back(chunk_pair(m_next_step, std::move(file_chunk)));
+    }
 
     return chunks;
 }
 
 
-void read_paired_fastq::finalize()
+void decompress_fastq::finalize()
 {
     AR_DEBUG_LOCK(m_lock);
     if (!m_eof) {
-        throw thread_error("read_paired_fastq::finalize: terminated before EOF");
+        throw thread_error("decompress_fastq::finalize: terminated before EOF");
     }
 }
 
 
+size_t decompress_fastq::records() const
+{
+    return m_records;
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
-// Implementations for 'read_interleaved_fastq'
+// Implementations for 'join_fastq'
 
-read_interleaved_fastq::read_interleaved_fastq(const fastq_encoding* encoding,
-                                          const string_vec& filenames,
-                                          size_t next_step)
-  : analytical_step(analytical_step::ordering::ordered, true)
-  , m_encoding(encoding)
+join_fastq::join_fastq(size_t mates, bool interleaved, size_t next_step)
+  : analytical_step(analytical_step::ordering::ordered)
+  , m_pending()
+  , m_mates(mates)
+  , m_interleaved(interleaved)
   , m_line_offset(1)
-  , m_io_input(filenames)
   , m_next_step(next_step)
   , m_eof(false)
   , m_lock()
 {
-  AR_DEBUG_ASSERT(!filenames.empty());
+    AR_DEBUG_ASSERT(mates == 1 || (mates == 2 && !interleaved));
 }
 
 
-chunk_vec read_interleaved_fastq::process(analytical_chunk* chunk)
+chunk_vec join_fastq::process(analytical_chunk* chunk)
 {
     AR_DEBUG_LOCK(m_lock);
-    AR_DEBUG_ASSERT(chunk == nullptr);
-    if (m_eof) {
-        return chunk_vec();
-    }
+    read_chunk_ptr mate_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
+    AR_DEBUG_ASSERT(mate_chunk);
+    AR_DEBUG_ASSERT(mate_chunk->mate < m_mates);
+    AR_DEBUG_ASSERT(!m_eof);
 
-    read_chunk_ptr file_chunk(new fastq_read_chunk());
+    m_pending[mate_chunk->mate].push_back(std::move(mate_chunk));
 
-    file_chunk->reads_1.reserve(FASTQ_CHUNK_SIZE);
-    file_chunk->reads_2.reserve(FASTQ_CHUNK_SIZE);
-
-    try {
-        fastq record;
-        for (size_t i = 0; i < FASTQ_CHUNK_SIZE; ++i) {
-            // Mate 1 reads
-            if (record.read(m_io_input, *m_encoding)) {
-                file_chunk->reads_1.push_back(record);
-            } else {
-                break;
+    chunk_vec chunks;
+    while (!m_pending[0].empty() && (m_mates == 1 || !m_pending[1].empty())) {
+        read_chunk_ptr file_chunk = std::move(m_pending[0].front());
+        m_pending[0].pop_front();
+
+        // Mate 1 records are read before mate 2 records, so an error in the
+        // mate 1 chunk precedes any error in the mate 2 chunk
+        if (m_mates == 2) {
+            read_chunk_ptr chunk_2 = std::move(m_pending[1].front());
+            m_pending[1].pop_front();
+
+            if (file_chunk->error.empty()) {
+                file_chunk->buffer_2.swap(chunk_2->buffer_2);
+                file_chunk->views_2.swap(chunk_2->views_2);
+                file_chunk->error.swap(chunk_2->error);
             }
+        }
 
-            // Mate 2 reads
-            if (record.read(m_io_input, *m_encoding)) {
-                file_chunk->reads_2.push_back(record);
-            } else {
-                break;
+        const size_t n_read_1 = file_chunk->views_1.size();
+        const size_t n_read_2 = file_chunk->views_2.size();
+
+        // Errors are reported by check_fastq, following any invalid records;
+        // chunks are not expected to be balanced following a malformed record
+        if (file_chunk->error.empty()) {
+            if (m_interleaved && n_read_1 % 2) {
+                file_chunk->error = "ERROR: Interleaved FASTQ file contains "
+                                    "uneven number of reads; file may have been "
+                                    "truncated! Please correct before continuing!";
+            } else if (m_mates == 2 && n_read_1 != n_read_2) {
+                file_chunk->error = "ERROR: Input --file1 and --file2 contains "
+                                    "different numbers of lines; one or the "
+                                    "other file may have been truncated. Please "
+                                    "correct before continuing!";
             }
         }
-    } catch (const fastq_error& error) {
-        const size_t offset = m_line_offset
-            + file_chunk->reads_1.size() * 4
-            + file_chunk->reads_2.size() * 4;
 
-        print_locker lock;
-        std::cerr << "Error reading FASTQ record starting at line "
-                  << offset << ":\n"
-                  << cli_formatter::fmt(error.what()) << std::endl;
+        file_chunk->line_offset = m_line_offset;
+        file_chunk->eof = !n_read_1 && file_chunk->error.empty();
+        m_eof = file_chunk->eof;
 
-        throw thread_abort();
+        // SE/PE offsets count records, while interleaved offsets count lines
+        m_line_offset += m_interleaved ? n_read_1 * 4 : n_read_1;
+
+        chunks.push_back(chunk_pair(m_next_step, std::move(file_chunk)));
     }
 
-    const size_t n_read_1 = file_chunk->reads_1.size();
-    const size_t n_read_2 = file_chunk->reads_2.size();
+    return chunks;
+}
 
-    if (n_read_1 != n_read_2) {
-        print_locker lock;
-        std::cerr << "ERROR: Interleaved FASTQ file contains uneven number of "
-                  << "reads; file may have been truncated! Please correct "
-                  << "before continuing!"
-                  << std::endl;
 
-        throw thread_abort();
-    } else if (!n_read_1) {
-        file_chunk->eof = true;
-        m_eof = true;
+void join_fastq::finalize()
+{
+    AR_DEBUG_LOCK(m_lock);
+    if (!m_eof) {
+        throw thread_error("join_fastq::finalize: terminated before EOF");
     }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'parse_fastq'
+
+parse_fastq::parse_fastq(const fastq_encoding* encoding, bool interleaved,
+                         size_t next_step)
+  : analytical_step(analytical_step::ordering::unordered)
+  , m_encoding(encoding)
+  , m_interleaved(interleaved)
+  , m_next_step(next_step)
+{
+}
 
-    m_line_offset += (n_read_1 + n_read_2) * 4;
+
+chunk_vec parse_fastq::process(analytical_chunk* chunk)
+{
+    read_chunk_ptr file_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
+    AR_DEBUG_ASSERT(file_chunk);
+
+    const fastq_view_vec& views_1 = file_chunk->views_1;
+    const fastq_view_vec& views_2 = file_chunk->views_2;
+
+    // Errors found here precede any error recorded by earlier steps, which
+    // are only recorded for data following the records in the chunk
+    size_t n_read = 0;
+    try {
+        if (m_interleaved) {
+            // Uneven numbers of records are reported once the chunk is checked
+            file_chunk->reads_1.resize((views_1.size() + 1) / 2);
+            file_chunk->reads_2.resize(views_1.size() / 2);
+
+            for (; n_read < views_1.size(); ++n_read) {
+                fastq_vec& reads = (n_read % 2) ? file_chunk->reads_2
+                                                : file_chunk->reads_1;
+
+                fastq_block_parser::assign(reads.at(n_read / 2),
+                                           file_chunk->buffer_1,
+                                           views_1.at(n_read),
+                                           *m_encoding);
+            }
+        } else {
+            file_chunk->reads_1.resize(views_1.size());
+            file_chunk->reads_2.resize(views_2.size());
+
+            for (; n_read < views_1.size(); ++n_read) {
+                fastq_block_parser::assign(file_chunk->reads_1.at(n_read),
+                                           file_chunk->buffer_1,
+                                           views_1.at(n_read),
+                                           *m_encoding);
+            }
+
+            for (n_read = 0; n_read < views_2.size(); ++n_read) {
+                fastq_block_parser::assign(file_chunk->reads_2.at(n_read),
+                                           file_chunk->buffer_2,
+                                           views_2.at(n_read),
+                                           *m_encoding);
+            }
+        }
+    } catch (const fastq_error& error) {
+        const size_t line = file_chunk->line_offset + n_read * (m_interleaved ? 4 : 1);
+        file_chunk->error = describe_fastq_error(error, m_interleaved, line);
+    }
 
     chunk_vec chunks;
     chunks.push_back(chunk_pair(m_next_step, std::move(file_chunk)));
@@ -315,12 +1157,32 @@ chunk_vec read_interleaved_fastq::process(analytical_chunk* chunk)
 }
 
 
-void read_interleaved_fastq::finalize()
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'check_fastq'
+
+check_fastq::check_fastq(size_t next_step)
+  : analytical_step(analytical_step::ordering::ordered)
+  , m_next_step(next_step)
 {
-    AR_DEBUG_LOCK(m_lock);
-    if (!m_eof) {
-        throw thread_error("read_interleaved_fastq::finalize: terminated before EOF");
+}
+
+
+chunk_vec check_fastq::process(analytical_chunk* chunk)
+{
+    read_chunk_ptr file_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
+    AR_DEBUG_ASSERT(file_chunk);
+
+    if (!file_chunk->error.empty()) {
+        print_locker lock;
+        std::cerr << file_chunk->error << std::endl;
+
+        throw thread_abort();
     }
+
+    chunk_vec chunks;
+    chunks.push_back(chunk_pair(m_next_step, std::move(file_chunk)));
+
+    return chunks;
 }
 
 
@@ -24,8 +24,16 @@
 #ifndef FASTQ_IO_H
 #define FASTQ_IO_H
 
-#include <vector>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
 #include <fstream>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include <zlib.h>
 
@@ -33,9 +41,12 @@
 
 
 #include "commontypes.hpp"
+#include "decompressor.hpp"
 #include "fastq.hpp"
-#include "linereader_joined.hpp"
+#include "fastq_reader.hpp"
+#include "mapped_file.hpp"
 #include "scheduler.hpp"
+#include "speculative_inflate.hpp"
 #include "strutils.hpp"
 #include "timer.hpp"
 
@@ -56,6 +67,22 @@ typedef std::vector<buffer_pair> buffer_vec;
 const size_t FASTQ_CHUNK_SIZE = 2 * 1024;
 //! Size of compressed chunks used to transport compressed data
 const size_t FASTQ_COMPRESSED_CHUNK = 40 * 1024;
+//! Size of blocks of raw (possibly compressed) data read from input files
+const size_t FASTQ_RAW_BLOCK_SIZE = 256 * 1024;
+//! Maximum amount of gzip data held while looking for the end of a member
+const size_t FASTQ_MAX_MEMBER_BUFFER = 4 * FASTQ_RAW_BLOCK_SIZE;
+//! Number of blocks of raw data read ahead for the mate 1 and mate 2 files
+const size_t FASTQ_READ_AHEAD = 4;
+
+
+/**
+ * Adds the steps reading, decompressing and parsing the input FASTQ files
+ * specified in the userconfig to the scheduler, with ai_read_fastq as the
+ * first step; chunks of parsed reads are forwarded to 'next_step'. If the
+ * input is sharded (--shard), the part of the files to read is determined
+ * here, and an io_error is thrown if the files cannot be sharded.
+ */
+void add_read_steps(scheduler& sch, const userconfig& config, size_t next_step);
 
 
 /**
@@ -69,11 +96,28 @@ public:
 
     //! Indicates that EOF has been reached.
     bool eof;
+    //! The mate of the records in chunks not yet joined by join_fastq
+    size_t mate;
 
     //! Lines read from the mate 1 files
     fastq_vec reads_1;
     //! Lines read from the mate 2 files
     fastq_vec reads_2;
+
+    //! Position of the first record in the input; used for error messages
+    size_t line_offset;
+    //! Decompressed data from which the mate 1 reads (or interleaved reads) were parsed
+    std::string buffer_1;
+    //! Decompressed data from which the mate 2 reads were parsed
+    std::string buffer_2;
+    //! Locations of records in buffer_1
+    fastq_view_vec views_1;
+    //! Locations of mate 2 records in buffer_2
+    fastq_view_vec views_2;
+
+    //! Error found while reading the records in this chunk, if any; reported
+    //! by check_fastq, so that only the first error in the input is printed
+    std::string error;
 };
 
 
@@ -112,97 +156,396 @@ private:
 };
 
 
+/**
+ * Container object for blocks of raw (possibly compressed) data.
+ */
+class fastq_raw_chunk : public analytical_chunk
+{
+public:
+    /** Create empty chunk for data read from the specified mate (0 or 1). */
+    fastq_raw_chunk(size_t mate_ = 0);
+
+    //! The files read; 0 for mate 1 (or interleaved) files, 1 for mate 2
+    size_t mate;
+    //! Indicates that this is the last block of a file
+    bool end_of_file;
+    //! Indicates that this is the last block of the last file for the mate
+    bool eof;
+    //! Indicates that the data is (part of) a gzip file
+    bool gzip;
+    //! Indicates that the data is expected to consist of whole gzip members
+    bool members;
+    //! Indicates that the data is (part of) a bzip2 file, split into blocks
+    bool bzip2;
+    //! Indicates that the data has been decompressed into 'decompressed'
+    bool inflated;
+
+    //! Data read from the file
+    std::string data;
+    //! Decompressed data, if 'inflated' is set
+    std::string decompressed;
+    //! Deflate blocks speculatively decompressed from partial gzip members
+    speculative_block speculative;
+    //! Location of the bzip2 block in 'data', if 'bzip2' is set
+    bzip2_block block;
+
+    //! Mapped (uncompressed) file containing the block, in place of 'data'
+    std::shared_ptr<const mapped_file> mapping;
+    //! Start of the block in the mapped file, if 'mapping' is set
+    const char* mapped_data;
+    //! Size of the block in the mapped file, if 'mapping' is set
+    size_t mapped_size;
+
+    //! Copy construction not supported
+    fastq_raw_chunk(const fastq_raw_chunk&) = delete;
+    //! Assignment not supported
+    fastq_raw_chunk& operator=(const fastq_raw_chunk&) = delete;
+};
+
+
+class decompress_fastq;
+
+
+//! Start (inclusive) and end (exclusive) offsets of the part of a file read
+typedef std::pair<size_t, size_t> byte_range;
+
+//! Range used to read files in their entirety
+const byte_range FASTQ_WHOLE_FILE(0, std::numeric_limits<size_t>::max());
+
+
+/**
+ * Reads blocks of raw data from a list of files in a background thread.
+ *
+ * Up to FASTQ_READ_AHEAD blocks are read ahead of the blocks requested,
+ * including the first blocks of the following files, in order to hide the
+ * latency of opening and reading files on slow storage. Uncompressed regular
+ * files are memory mapped, and blocks refer directly to the mapped data; for
+ * these, the kernel is instead asked to read the blocks ahead. Other files
+ * (pipes, compressed files, etc.) are read using 'fread'.
+ *
+ * Errors are reported once the block in which they occurred is requested.
+ *
+ * When sharding input, only part of a single (uncompressed) file is read.
+ */
+class block_prefetcher
+{
+public:
+    /**
+     * Constructor; the background thread is started by the first request.
+     *
+     * @param filenames Paths to FASTQ files to be read in order.
+     * @param mate The mate (0 or 1) for which blocks are read.
+     * @param range The part of the file to read, if sharding input.
+     */
+    block_prefetcher(const string_vec& filenames, size_t mate,
+                     const byte_range& range = FASTQ_WHOLE_FILE);
+
+    /** Stops the background thread, and closes any open files. */
+    ~block_prefetcher();
+
+    /**
+     * Returns the next block, waiting for it to be read if needed; must not
+     * be called once the block marked as 'eof' has been returned.
+     */
+    std::unique_ptr<fastq_raw_chunk> next_block();
+
+    //! Copy construction not supported
+    block_prefetcher(const block_prefetcher&) = delete;
+    //! Assignment not supported
+    block_prefetcher& operator=(const block_prefetcher&) = delete;
+
+private:
+    /** A block read by the background thread, or an error. */
+    struct prefetched_block
+    {
+        prefetched_block();
+
+        //! The name of the file opened for this block, if any
+        std::string filename;
+        //! The block read, unless an error occurred
+        std::unique_ptr<fastq_raw_chunk> block;
+        //! Error raised while reading the block, if any
+        std::exception_ptr error;
+    };
+
+    /** Reads blocks until all files have been read, or until stopped. */
+    void run();
+
+    /** Reads a block, setting 'filename' if the next file was opened. */
+    std::unique_ptr<fastq_raw_chunk> read_block(std::string& filename);
+
+    //! Files left to read; stored in reverse order.
+    string_vec m_filenames;
+    //! The mate for which blocks are read
+    const size_t m_mate;
+    //! The part of the file to read, if sharding input
+    const byte_range m_range;
+    //! Currently open file, if any.
+    FILE* m_file;
+    //! Mapping of the currently open file, if mapped.
+    std::shared_ptr<const mapped_file> m_mapping;
+    //! Offset of the next block in the mapped file.
+    size_t m_mapped_offset;
+    //! Offset at which to stop reading the mapped file.
+    size_t m_mapped_end;
+
+    //! Blocks read ahead of those requested
+    std::deque<prefetched_block> m_queue;
+    //! Set to stop the background thread
+    bool m_stop;
+    //! Lock protecting the queue and 'm_stop'
+    std::mutex m_lock;
+    //! Signaled when a block has been added to the queue
+    std::condition_variable m_not_empty;
+    //! Signaled when a block has been taken from the queue, or when stopped
+    std::condition_variable m_not_full;
+    //! The background thread
+    std::thread m_thread;
+};
+
+
 /**
  * Simple file reading step.
  *
- * Reads from a single FASTQ file, storing the reads in a fastq_file_chunk.
- * Once the EOF has been reached, a single empty chunk will be returned,
- * marked using the 'eof' property.
+ * Reads blocks of raw data from the mate 1 and (optionally) mate 2 files,
+ * using a block_prefetcher for each, which are forwarded to a split_blocks
+ * step. For paired files, blocks are taken from the mate for which the fewest
+ * records have been located by the decompress_fastq steps, in order to keep
+ * the mates balanced. Once all files have been read, the step ceases to
+ * return chunks.
  */
-class read_single_fastq : public analytical_step
+class read_fastq : public analytical_step
 {
 public:
     /**
      * Constructor.
      *
-     * @param encoding FASTQ encoding for reading quality scores.
-     * @param filename Path to FASTQ file containing mate 1 / 2 reads.
+     * @param filenames_1 Paths to FASTQ files containing mate 1 reads.
+     * @param filenames_2 Paths to FASTQ files containing mate 2 reads, if any.
+     * @param decompressor_1 Step decompressing the mate 1 files.
+     * @param decompressor_2 Step decompressing the mate 2 files, if any.
      * @param next_step ID of analytical step to which data is forwarded.
-     *
-     * Opens the input file corresponding to the specified mate.
+     * @param range_1 The part of the mate 1 file to read, if sharding input.
+     * @param range_2 The part of the mate 2 file to read, if sharding input.
      */
-    read_single_fastq(const fastq_encoding* encoding,
-                      const string_vec& filenames,
-                      size_t next_step);
-
-    /** Reads N lines from the input file and saves them in an fastq_read_chunk. */
+    read_fastq(const string_vec& filenames_1,
+               const string_vec& filenames_2,
+               const decompress_fastq* decompressor_1,
+               const decompress_fastq* decompressor_2,
+               size_t next_step,
+               const byte_range& range_1 = FASTQ_WHOLE_FILE,
+               const byte_range& range_2 = FASTQ_WHOLE_FILE);
+
+    /** Takes a block of raw data read from one of the input files. */
     virtual chunk_vec process(analytical_chunk* chunk);
 
     /** Finalizer; checks that all input has been processed. */
     virtual void finalize();
 
     //! Copy construction not supported
-    read_single_fastq(const read_single_fastq&) = delete;
+    read_fastq(const read_fastq&) = delete;
     //! Assignment not supported
-    read_single_fastq& operator=(const read_single_fastq&) = delete;
+    read_fastq& operator=(const read_fastq&) = delete;
 
 private:
-    //! Encoding used to parse FASTQ reads.
-    const fastq_encoding* m_encoding;
-    //! Current line in the input file (1-based)
-    size_t m_line_offset;
-    //! Line reader used to read raw / gzip'd / bzip2'd FASTQ files.
-    joined_line_readers m_io_input;
+    //! Readers for the mate 1 and mate 2 files; the latter may be unused.
+    std::unique_ptr<block_prefetcher> m_readers[2];
+    //! Indicates that all files have been read for a mate.
+    bool m_mate_eof[2];
+    //! The number of mates (files per read)
+    const size_t m_mates;
+    //! The mate to read from, if neither mate is behind the other
+    size_t m_next_mate;
+    //! Steps decompressing the mate 1 and mate 2 files
+    const decompress_fastq* m_decompressors[2];
     //! The analytical step following this step
     const size_t m_next_step;
-    //! Used to track whether an EOF block has been received.
-    bool m_eof;
     //! Lock used to verify that the analytical_step is only run sequentially.
     std::mutex m_lock;
 };
 
 
 /**
- * Simple file reading step.
+ * Step for splitting compressed data into independently decompressible pieces.
+ *
+ * Blocks read from gzip files are split at the boundaries between gzip members,
+ * as given by the BSIZE field of BGZF blocks, or as found by scanning for gzip
+ * headers. Pieces expected to consist of whole members are marked as such, and
+ * may be inflated in parallel by an inflate_blocks step. Since a header may be
+ * found inside a member, the decompress_fastq step falls back to serial
+ * decompression if a piece does not start at the end of the previous member.
+ *
+ * Blocks read from bzip2 files are split into bzip2 blocks, by scanning for
+ * the (bit-aligned) magic numbers found at the start of each block. Stream
+ * headers and ends are removed, and the stream CRCs are passed on with the
+ * last block of each stream. Blocks from other files are forwarded unchanged.
+ *
+ * Pieces are forwarded to separate steps for the mate 1 and mate 2 files, so
+ * that the two mates may be decompressed concurrently.
+ */
+class split_blocks : public analytical_step
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param next_step_1 ID of analytical step to which mate 1 data is forwarded.
+     * @param next_step_2 ID of analytical step to which mate 2 data is forwarded.
+     */
+    split_blocks(size_t next_step_1, size_t next_step_2);
+
+    /** Splits a block into pieces that can be decompressed independently. */
+    virtual chunk_vec process(analytical_chunk* chunk);
+
+    //! Copy construction not supported
+    split_blocks(const split_blocks&) = delete;
+    //! Assignment not supported
+    split_blocks& operator=(const split_blocks&) = delete;
+
+private:
+    /** The format of an input file. */
+    enum class input_format
+    {
+        plain,
+        gzip,
+        bzip2
+    };
+
+    /** Data for the mate 1 or mate 2 files that has yet to be forwarded. */
+    struct mate_state
+    {
+        mate_state();
+
+        //! Data carried over from previous blocks
+        std::string pending;
+        //! Set if the next block is the first block of a file
+        bool new_file;
+        //! The format of the current file
+        input_format format;
+        //! Set if 'pending' starts at the (expected) start of a gzip member
+        bool at_member;
+        //! Offset (in bits) of the next bzip2 block or stream in 'pending'
+        size_t offset;
+        //! Offset up to which 'pending' has been searched for the next block
+        size_t scanned;
+        //! Set if 'offset' is the start of a bzip2 stream header
+        bool at_stream;
+    };
+
+    /** Splits gzip data into pieces consisting of whole members, if possible. */
+    void split_gzip(mate_state& state, fastq_raw_chunk& block, chunk_vec& chunks);
+    /** Splits bzip2 data into blocks. */
+    void split_bzip2(mate_state& state, fastq_raw_chunk& block, chunk_vec& chunks);
+
+    //! State for the mate 1 and mate 2 files
+    mate_state m_states[2];
+    //! The analytical steps following this step for mate 1 and mate 2 data
+    const size_t m_next_steps[2];
+    //! Lock used to verify that the analytical_step is only run sequentially.
+    std::mutex m_lock;
+};
+
+
+/**
+ * Step for decompressing pieces found by split_blocks.
  *
- * Reads from the mate 1 and the mate 2 files, storing the reads in a
- * fastq_file_chunk. Once the EOF has been reached, a single empty chunk will
- * be returned, marked using the 'eof' property.
+ * Chunks expected to consist of whole gzip members are inflated, and bzip2
+ * blocks are decompressed, and marked as such if successful. For other gzip
+ * data, deflate blocks are located and decompressed speculatively, to be used
+ * by decompress_fastq if the serial decompression of the preceding data
+ * confirms the location of the blocks. All chunks are forwarded, in order to
+ * allow the decompress_fastq step to fall back to serial decompression.
  */
-class read_paired_fastq : public analytical_step
+class inflate_blocks : public analytical_step
 {
 public:
     /**
      * Constructor.
+     *
+     * @param speculate Speculatively decompress parts of gzip members.
+     * @param next_step ID of analytical step to which data is forwarded.
      */
-    read_paired_fastq(const fastq_encoding* encoding,
-                      const string_vec& filenames_1,
-                      const string_vec& filenames_2,
-                      size_t next_step);
+    inflate_blocks(bool speculate, size_t next_step);
 
-    /** Reads N lines from the input file and saves them in an fastq_file_chunk. */
+    /** Decompresses a piece of gzip or bzip2 data, if possible. */
+    virtual chunk_vec process(analytical_chunk* chunk);
+
+    //! Copy construction not supported
+    inflate_blocks(const inflate_blocks&) = delete;
+    //! Assignment not supported
+    inflate_blocks& operator=(const inflate_blocks&) = delete;
+
+private:
+    //! Speculatively decompress parts of gzip members
+    const bool m_speculate;
+    //! The analytical step following this step
+    const size_t m_next_step;
+};
+
+
+/**
+ * Decompression step.
+ *
+ * Decompresses blocks of data read by read_fastq for either the mate 1 or the
+ * mate 2 files, and locates the FASTQ records in them, carrying partial
+ * records over to the following blocks. Chunks of up to FASTQ_CHUNK_SIZE
+ * records (or pairs of interleaved records) are forwarded to a join_fastq
+ * step. Once the EOF has been reached, a single empty chunk will be returned,
+ * marked using the 'eof' property. A malformed record ends the chunk being
+ * built, which is forwarded with an error, after which no further chunks are
+ * returned.
+ */
+class decompress_fastq : public analytical_step
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param mate The mate (0 or 1) for which blocks are decompressed.
+     * @param interleaved Indicates if mate 1 and 2 reads are interleaved.
+     * @param next_step ID of analytical step to which data is forwarded.
+     */
+    decompress_fastq(size_t mate, bool interleaved, size_t next_step);
+
+    /** Decompresses a block, and forwards any completed chunks of records. */
     virtual chunk_vec process(analytical_chunk* chunk);
 
     /** Finalizer; checks that all input has been processed. */
     virtual void finalize();
 
+    /** Returns the number of records forwarded so far. */
+    size_t records() const;
+
     //! Copy construction not supported
-    read_paired_fastq(const read_paired_fastq&) = delete;
+    decompress_fastq(const decompress_fastq&) = delete;
     //! Assignment not supported
-    read_paired_fastq& operator=(const read_paired_fastq&) = delete;
+    decompress_fastq& operator=(const decompress_fastq&) = delete;
 
 private:
-    //! Encoding used to parse FASTQ reads.
-    const fastq_encoding* m_encoding;
+    /** Builds chunks from the records located so far. */
+    chunk_vec build_chunks();
+
+    //! The mate for which blocks are decompressed
+    const size_t m_mate;
+    //! Indicates if mate 1 and 2 reads are interleaved
+    const bool m_interleaved;
+    //! Decompressor for the current file
+    block_decompressor m_decompressor;
+    //! Parser locating records in the decompressed data
+    fastq_block_parser m_parser;
+    //! Buffer used for decompressed data
+    std::string m_decompressed;
+    //! Data for the chunk currently being built
+    std::string m_buffer;
+    //! Records located for the chunk currently being built
+    fastq_view_vec m_views;
     //! Current line in the input file (1-based)
     size_t m_line_offset;
-    //! Line reader used to read raw / gzip'd / bzip2'd FASTQ files.
-    joined_line_readers m_io_input_1;
-    //! Line reader used to read raw / gzip'd / bzip2'd FASTQ files.
-    joined_line_readers m_io_input_2;
+    //! Number of records forwarded; read by the read_fastq step
+    std::atomic<size_t> m_records;
     //! The analytical step following this step
     const size_t m_next_step;
-    //! Used to track whether an EOF block has been received.
+    //! Used to track whether an EOF block has been sent.
     bool m_eof;
     //! Lock used to verify that the analytical_step is only run sequentially.
     std::mutex m_lock;
@@ -210,49 +553,123 @@ private:
 
 
 /**
- * Simple file reading step.
+ * Step joining chunks of mate 1 and mate 2 records.
  *
- * Reads from an FASTQ file containing interleaved FASTQ reads, storing the
- * reads in a fastq_file_chunk. Once the EOF has been reached, a single empty
- * chunk will be returned, marked using the 'eof' property.
+ * Chunks forwarded by the decompress_fastq steps for the mate 1 and mate 2
+ * files are received in the order in which they were completed, and the nth
+ * chunk of mate 1 records is joined with the nth chunk of mate 2 records. The
+ * number of records in each pair of chunks is checked in order to detect
+ * truncated files, as is the number of records in interleaved files; errors
+ * are recorded in the chunk. Joined chunks are forwarded to a parse_fastq
+ * step.
  */
-class read_interleaved_fastq : public analytical_step
+class join_fastq : public analytical_step
 {
 public:
     /**
      * Constructor.
+     *
+     * @param mates The number of mates read (1 for SE or interleaved reads).
+     * @param interleaved Indicates if mate 1 and 2 reads are interleaved.
+     * @param next_step ID of analytical step to which data is forwarded.
      */
-    read_interleaved_fastq(const fastq_encoding* encoding,
-                           const string_vec& filenames,
-                           size_t next_step);
+    join_fastq(size_t mates, bool interleaved, size_t next_step);
 
-    /** Reads N lines from the input file and saves them in an fastq_file_chunk. */
+    /** Joins chunks of records, once chunks for both mates are available. */
     virtual chunk_vec process(analytical_chunk* chunk);
 
     /** Finalizer; checks that all input has been processed. */
     virtual void finalize();
 
     //! Copy construction not supported
-    read_interleaved_fastq(const read_interleaved_fastq&) = delete;
+    join_fastq(const join_fastq&) = delete;
     //! Assignment not supported
-    read_interleaved_fastq& operator=(const read_interleaved_fastq&) = delete;
+    join_fastq& operator=(const join_fastq&) = delete;
 
 private:
-    //! Encoding used to parse FASTQ reads.
-    const fastq_encoding* m_encoding;
+    //! Chunks of mate 1 and mate 2 records not yet joined
+    std::deque<std::unique_ptr<fastq_read_chunk>> m_pending[2];
+    //! The number of mates (files per read)
+    const size_t m_mates;
+    //! Indicates if mate 1 and 2 reads are interleaved
+    const bool m_interleaved;
     //! Current line in the input file (1-based)
     size_t m_line_offset;
-    //! Line reader used to read raw / gzip'd / bzip2'd FASTQ files.
-    joined_line_readers m_io_input;
     //! The analytical step following this step
     const size_t m_next_step;
-    //! Used to track whether an EOF block has been received.
+    //! Used to track whether an EOF block has been sent.
     bool m_eof;
     //! Lock used to verify that the analytical_step is only run sequentially.
     std::mutex m_lock;
 };
 
 
+/**
+ * Parsing step.
+ *
+ * Creates FASTQ records from the records located by decompress_fastq; for
+ * interleaved input, records are alternately assigned to mate 1 and mate 2.
+ * Chunks may be processed in any order; invalid records are therefore only
+ * recorded in the chunk, to be reported by a check_fastq step.
+ */
+class parse_fastq : public analytical_step
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param encoding FASTQ encoding for reading quality scores.
+     * @param interleaved Indicates if mate 1 and 2 reads are interleaved.
+     * @param next_step ID of analytical step to which data is forwarded.
+     */
+    parse_fastq(const fastq_encoding* encoding, bool interleaved,
+                size_t next_step);
+
+    /** Creates FASTQ records from the views in a fastq_read_chunk. */
+    virtual chunk_vec process(analytical_chunk* chunk);
+
+    //! Copy construction not supported
+    parse_fastq(const parse_fastq&) = delete;
+    //! Assignment not supported
+    parse_fastq& operator=(const parse_fastq&) = delete;
+
+private:
+    //! Encoding used to parse FASTQ reads.
+    const fastq_encoding* m_encoding;
+    //! Indicates if mate 1 and 2 reads are interleaved
+    const bool m_interleaved;
+    //! The analytical step following this step
+    const size_t m_next_step;
+};
+
+
+/**
+ * Step reporting errors found while reading FASTQ records.
+ *
+ * Chunks are processed in order, and the error recorded in the first chunk
+ * with an error (if any) is printed before aborting; chunks preceding it are
+ * forwarded unchanged. Errors are thereby reported for the first invalid
+ * record, regardless of the order in which chunks were parsed.
+ */
+class check_fastq : public analytical_step
+{
+public:
+    /** Constructor; 'next_step' sets the destination of valid chunks. */
+    check_fastq(size_t next_step);
+
+    /** Forwards the chunk, or prints the error recorded in it and aborts. */
+    virtual chunk_vec process(analytical_chunk* chunk);
+
+    //! Copy construction not supported
+    check_fastq(const check_fastq&) = delete;
+    //! Assignment not supported
+    check_fastq& operator=(const check_fastq&) = delete;
+
+private:
+    //! The analytical step following this step
+    const size_t m_next_step;
+};
+
 
 /**
  * BZip2 compression step; takes any lines in the input chunk, compresses them,
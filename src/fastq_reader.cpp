@@ -0,0 +1,421 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2017 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "debug.hpp"
+#include "fastq_reader.hpp"
+
+#if defined(__SSE__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef AR_SIMD_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace ar
+{
+
+/** Scalar implementation of find_newlines. */
+void find_newlines_std(const char* data, size_t start, size_t end,
+                       std::vector<size_t>& dst)
+{
+    while (start < end) {
+        const void* newline = std::memchr(data + start, '\n', end - start);
+        if (!newline) {
+            break;
+        }
+
+        start = static_cast<const char*>(newline) - data;
+        dst.push_back(start++);
+    }
+}
+
+
+/** Appends the offsets of the bits set in a movemask to 'dst'. */
+inline void append_mask_offsets(size_t offset, unsigned int mask,
+                                std::vector<size_t>& dst)
+{
+    for (; mask; mask &= mask - 1) {
+        dst.push_back(offset + __builtin_ctz(mask));
+    }
+}
+
+
+#if defined(__SSE__) && defined(__SSE2__)
+/** SSE2 implementation of find_newlines; scans 16 bytes at a time. */
+void find_newlines_sse2(const char* data, size_t start, size_t end,
+                        std::vector<size_t>& dst)
+{
+    const __m128i newlines = _mm_set1_epi8('\n');
+
+    for (; start + 16 <= end; start += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + start));
+        const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+
+        append_mask_offsets(start, mask, dst);
+    }
+
+    find_newlines_std(data, start, end, dst);
+}
+#endif
+
+
+#ifdef AR_SIMD_DISPATCH
+/** AVX2 implementation of find_newlines; scans 32 bytes at a time. */
+AR_TARGET("avx2")
+void find_newlines_avx2(const char* data, size_t start, size_t end,
+                        std::vector<size_t>& dst)
+{
+    const __m256i newlines = _mm256_set1_epi8('\n');
+
+    for (; start + 32 <= end; start += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + start));
+        const unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newlines));
+
+        append_mask_offsets(start, mask, dst);
+    }
+
+    find_newlines_std(data, start, end, dst);
+}
+#endif
+
+
+void find_newlines(const char* data, size_t start, size_t end,
+                   std::vector<size_t>& dst, simd::instruction_set is)
+{
+    switch (is) {
+        case simd::instruction_set::none:
+            return find_newlines_std(data, start, end, dst);
+#if defined(__SSE__) && defined(__SSE2__)
+        case simd::instruction_set::sse2:
+            return find_newlines_sse2(data, start, end, dst);
+#endif
+#ifdef AR_SIMD_DISPATCH
+        // Lines are too short for 64 byte blocks to pay off
+        case simd::instruction_set::avx2:
+        case simd::instruction_set::avx512:
+            return find_newlines_avx2(data, start, end, dst);
+#endif
+        default:
+            throw std::invalid_argument("unsupported instruction set");
+    }
+}
+
+
+size_t skip_lines(const char* data, size_t length, size_t offset, size_t n)
+{
+    for (; n && offset < length; --n) {
+        const void* newline = memchr(data + offset, '\n', length - offset);
+        if (!newline) {
+            return length;
+        }
+
+        offset = static_cast<const char*>(newline) - data + 1;
+    }
+
+    return std::min(offset, length);
+}
+
+
+size_t count_lines(const char* data, size_t length)
+{
+    return std::count(data, data + length, '\n');
+}
+
+
+size_t find_fastq_record(const char* data, size_t length, size_t offset)
+{
+    // Records start at the beginning of a line
+    if (offset && offset < length && data[offset - 1] != '\n') {
+        offset = skip_lines(data, length, offset, 1);
+    }
+
+    for (; offset < length; offset = skip_lines(data, length, offset, 1)) {
+        if (data[offset] == '@') {
+            const size_t separator = skip_lines(data, length, offset, 2);
+            if (separator == length) {
+                // Incomplete records are left for the preceding shard
+                break;
+            } else if (data[separator] == '+') {
+                return offset;
+            }
+        }
+    }
+
+    return length;
+}
+
+
+//! Outcomes of attempting to locate a line in a buffer
+enum class line_status { line, missing, partial };
+
+
+/**
+ * Locates the line starting at 'offset', excluding any terminal "\r\n" or
+ * "\n", and advances 'offset' past it; 'line' is the index of the next
+ * newline in 'newlines'. If the line is not terminated, it is only returned
+ * once EOF has been reached.
+ */
+line_status next_line(const std::string& buffer,
+                      const std::vector<size_t>& newlines, size_t& line,
+                      size_t& offset, bool eof, size_t& start, size_t& length)
+{
+    const size_t size = buffer.size();
+    if (offset == size) {
+        return eof ? line_status::missing : line_status::partial;
+    }
+
+    size_t end = size;
+    if (line < newlines.size()) {
+        end = newlines[line++];
+    } else if (!eof) {
+        return line_status::partial;
+    }
+
+    start = offset;
+    length = end - offset;
+    if (length && buffer[end - 1] == '\r') {
+        --length;
+    }
+
+    offset = std::min(end + 1, size);
+
+    return line_status::line;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'fastq_view'
+
+fastq_view::fastq_view()
+  : header(0)
+  , header_len(0)
+  , sequence(0)
+  , sequence_len(0)
+  , qualities(0)
+  , qualities_len(0)
+{
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'fastq_block_parser'
+
+fastq_block_parser::fastq_block_parser()
+  : m_buffer()
+  , m_newlines()
+  , m_offset(0)
+  , m_line(0)
+  , m_eof(false)
+{
+}
+
+
+void fastq_block_parser::add_block(const char* data, size_t length)
+{
+    const size_t scanned = m_buffer.size();
+
+    m_buffer.append(data, length);
+    find_newlines(m_buffer.data(), scanned, m_buffer.size(), m_newlines);
+}
+
+
+void fastq_block_parser::end_file()
+{
+    if (!m_buffer.empty() && m_buffer.back() != '\n') {
+        add_block("\n", 1);
+    }
+}
+
+
+void fastq_block_parser::set_eof()
+{
+    m_eof = true;
+}
+
+
+bool fastq_block_parser::read(std::string& buffer, fastq_view_vec& views,
+                              size_t max_records)
+{
+    fastq_view view;
+    while (views.size() < max_records) {
+        status result = status::partial;
+        try {
+            result = parse_record(view);
+        } catch (const fastq_error&) {
+            // The records preceding the malformed record remain valid
+            hand_over(buffer);
+            throw;
+        }
+
+        if (result == status::record) {
+            views.push_back(view);
+        } else if (result == status::blank) {
+            break;
+        } else {
+            return false;
+        }
+    }
+
+    hand_over(buffer);
+
+    return true;
+}
+
+
+void fastq_block_parser::hand_over(std::string& buffer)
+{
+    // Hand over the buffer, and carry over the data following the records
+    buffer.swap(m_buffer);
+    m_buffer.reserve(buffer.capacity());
+    m_buffer.assign(buffer, m_offset, std::string::npos);
+    buffer.resize(m_offset);
+
+    m_newlines.erase(m_newlines.begin(), m_newlines.begin() + m_line);
+    for (auto& newline : m_newlines) {
+        newline -= m_offset;
+    }
+
+    m_offset = 0;
+    m_line = 0;
+}
+
+
+void fastq_block_parser::assign(fastq& record, const std::string& buffer,
+                                const fastq_view& view,
+                                const fastq_encoding& encoding)
+{
+    const char* data = buffer.data();
+
+    record.assign(data + view.header, view.header_len,
+                  data + view.sequence, view.sequence_len,
+                  data + view.qualities, view.qualities_len,
+                  encoding);
+}
+
+
+fastq_block_parser::status
+fastq_block_parser::parse_record(fastq_view& view)
+{
+    const std::string& buffer = m_buffer;
+    const char* data = buffer.data();
+    size_t position = m_offset;
+    size_t next = m_line;
+    size_t start = 0;
+    size_t length = 0;
+
+    switch (next_line(buffer, m_newlines, next, position, m_eof, start, length)) {
+        case line_status::partial:
+            return status::partial;
+
+        case line_status::missing:
+            return status::blank;
+
+        case line_status::line:
+            if (!length) {
+                // Blank lines terminate reading, as with fastq::read
+                m_offset = position;
+                m_line = next;
+                return status::blank;
+            } else if (length == 1 || data[start] != '@') {
+                throw fastq_error("Malformed or empty FASTQ header");
+            }
+
+            view.header = start + 1;
+            view.header_len = length - 1;
+            break;
+
+        default:
+            AR_DEBUG_FAIL("invalid line_status in parse_record");
+    }
+
+    switch (next_line(buffer, m_newlines, next, position, m_eof, start, length)) {
+        case line_status::partial:
+            return status::partial;
+
+        case line_status::missing:
+            throw fastq_error("partial FASTQ record; cut off after header");
+
+        case line_status::line:
+            if (!length) {
+                throw fastq_error("partial FASTQ record; cut off after header");
+            }
+
+            view.sequence = start;
+            view.sequence_len = length;
+            break;
+
+        default:
+            AR_DEBUG_FAIL("invalid line_status in parse_record");
+    }
+
+    switch (next_line(buffer, m_newlines, next, position, m_eof, start, length)) {
+        case line_status::partial:
+            return status::partial;
+
+        case line_status::missing:
+            throw fastq_error("partial FASTQ record; cut off after sequence");
+
+        case line_status::line:
+            if (!length) {
+                throw fastq_error("partial FASTQ record; cut off after sequence");
+            } else if (data[start] != '+') {
+                throw fastq_error("FASTQ record lacks separator character (+)");
+            }
+            break;
+
+        default:
+            AR_DEBUG_FAIL("invalid line_status in parse_record");
+    }
+
+    switch (next_line(buffer, m_newlines, next, position, m_eof, start, length)) {
+        case line_status::partial:
+            return status::partial;
+
+        case line_status::missing:
+            throw fastq_error("partial FASTQ record; cut off after separator");
+
+        case line_status::line:
+            if (!length) {
+                throw fastq_error("partial FASTQ record; cut off after separator");
+            }
+
+            view.qualities = start;
+            view.qualities_len = length;
+            break;
+
+        default:
+            AR_DEBUG_FAIL("invalid line_status in parse_record");
+    }
+
+    m_offset = position;
+    m_line = next;
+
+    return status::record;
+}
+
+} // namespace ar
@@ -0,0 +1,172 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2017 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef FASTQ_READER_H
+#define FASTQ_READER_H
+
+#include <string>
+#include <vector>
+
+#include "fastq.hpp"
+#include "simd.hpp"
+
+namespace ar
+{
+
+/**
+ * Location of a FASTQ record in a buffer; the header excludes the @ sigil,
+ * and no field includes the terminal newline.
+ */
+struct fastq_view
+{
+    fastq_view();
+
+    //! Offset and length of the header
+    size_t header;
+    size_t header_len;
+    //! Offset and length of the nucleotide sequence
+    size_t sequence;
+    size_t sequence_len;
+    //! Offset and length of the (encoded) quality scores
+    size_t qualities;
+    size_t qualities_len;
+};
+
+typedef std::vector<fastq_view> fastq_view_vec;
+
+
+/**
+ * Appends the offsets of all newlines in data[start .. end) to 'dst', in
+ * ascending order, using the specified instruction set (which must be
+ * supported by the host CPU).
+ */
+void find_newlines(const char* data, size_t start, size_t end,
+                   std::vector<size_t>& dst,
+                   simd::instruction_set is = simd::detect());
+
+
+/**
+ * Returns the offset following the nth newline at or after 'offset' in
+ * data[0 .. length), or 'length' if there are fewer newlines.
+ */
+size_t skip_lines(const char* data, size_t length, size_t offset, size_t n);
+
+
+/** Returns the number of newlines in data[0 .. length). */
+size_t count_lines(const char* data, size_t length);
+
+
+/**
+ * Returns the offset of the first FASTQ record starting at or after 'offset'
+ * in data[0 .. length), or 'length' if there is no such record. A record is
+ * identified as a line starting with '@', where the line after the next line
+ * starts with '+'. Quality scores starting with '@' are not mistaken for
+ * headers, as the next two lines are a header and a sequence.
+ */
+size_t find_fastq_record(const char* data, size_t length, size_t offset);
+
+
+/**
+ * Block based FASTQ parser.
+ *
+ * Blocks of (decompressed) data are added to an internal buffer, and records
+ * are located in place, yielding views into that buffer rather than copies of
+ * individual lines. Once enough records have been located, the data containing
+ * them is handed to the caller, while any following data (including a partial
+ * record) is carried over.
+ *
+ * Each block is scanned for newlines once, as it is added, using SIMD where
+ * available; records are then located by walking the resulting line spans.
+ *
+ * Records are checked as by fastq::read: a blank line in place of a header
+ * ends the current set of records, and other blank or missing lines are errors.
+ */
+class fastq_block_parser
+{
+public:
+    /** Creates an empty parser. */
+    fastq_block_parser();
+
+    /** Appends a block of data to the buffer. */
+    void add_block(const char* data, size_t length);
+
+    /**
+     * Marks the end of a file; a newline is added if the last line of the
+     * file was not terminated, so that it is not joined with the next file.
+     */
+    void end_file();
+
+    /** Marks the end of input; an unterminated final line is then accepted. */
+    void set_eof();
+
+    /**
+     * Locates records in the data added so far, appending views to 'views'
+     * until it holds 'max_records' records, a blank line is found, or EOF is
+     * reached. The same vector must be passed until the function returns
+     * true, in which case 'buffer' is replaced with the data the views refer
+     * to. Returns false if more data is required.
+     *
+     * A fastq_error is thrown for malformed records, in which case 'views'
+     * contains the valid records preceding it, and 'buffer' is replaced with
+     * the data they refer to.
+     */
+    bool read(std::string& buffer, fastq_view_vec& views, size_t max_records);
+
+    /** Creates a FASTQ record from a view into the buffer it was read into. */
+    static void assign(fastq& record, const std::string& buffer,
+                       const fastq_view& view,
+                       const fastq_encoding& encoding = FASTQ_ENCODING_33);
+
+    //! Copy construction not supported
+    fastq_block_parser(const fastq_block_parser&) = delete;
+    //! Assignment not supported
+    fastq_block_parser& operator=(const fastq_block_parser&) = delete;
+
+private:
+    /** Outcomes of attempting to parse a record at the current offset. */
+    enum class status { record, blank, partial };
+
+    /**
+     * Parses a record starting at m_offset, which is advanced past the
+     * record (or blank line) unless more data is required.
+     */
+    status parse_record(fastq_view& view);
+
+    /** Replaces 'buffer' with the data of the records located so far. */
+    void hand_over(std::string& buffer);
+
+    //! Data added, starting with data carried over from the last read
+    std::string m_buffer;
+    //! Offsets of newlines in m_buffer
+    std::vector<size_t> m_newlines;
+    //! Offset of the first byte not part of a located record
+    size_t m_offset;
+    //! Index of the first newline at or after m_offset
+    size_t m_line;
+    //! Set once the end of input has been reached
+    bool m_eof;
+};
+
+} // namespace ar
+
+#endif
@@ -59,6 +59,12 @@ public:
 };
 
 
+/** Initializes a bzip2 stream for decompression; throws on errors. */
+void bzip2_initialize_stream(bz_stream* stream);
+/** Frees resources used by a bzip2 decompression stream; throws on errors. */
+void bzip2_close_stream(bz_stream* stream);
+
+
 /** Base-class for line reading; used by receivers. */
 class line_reader_base
 {
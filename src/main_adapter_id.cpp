@@ -363,8 +363,9 @@ public:
         }
 
         const fastq empty_adapter("dummy", "", "");
-        fastq_pair_vec adapters;
-        adapters.push_back(fastq_pair(empty_adapter, empty_adapter));
+        fastq_pair_vec adapter_pairs;
+        adapter_pairs.push_back(fastq_pair(empty_adapter, empty_adapter));
+        const adapter_profile adapters(adapter_pairs, m_config.shift, m_config.aligner);
 
         read_chunk_ptr file_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
 
@@ -407,7 +408,7 @@ public:
     }
 
 private:
-    void process_reads(const fastq_pair_vec& adapters,
+    void process_reads(const adapter_profile& adapters,
                        statistics& stats,
                        adapter_stats& sink,
                        fastq& read1,
@@ -419,7 +420,7 @@ private:
         // Reverse complement to match the orientation of read1
         read2.reverse_complement();
 
-        const alignment_info alignment = align_paired_ended_sequences(read1, read2, adapters, m_config.shift);
+        const alignment_info alignment = align_paired_ended_sequences(read1, read2, adapters);
 
         if (m_config.is_good_alignment(alignment)) {
             stats.well_aligned_reads++;
@@ -470,18 +471,7 @@ int identify_adapter_sequences(const userconfig& config)
 
     scheduler sch;
     try {
-        if (config.interleaved_input) {
-            sch.add_step(ai_read_fastq, "read_interleaved_fastq",
-                         new read_interleaved_fastq(config.quality_input_fmt.get(),
-                                                    config.input_files_1,
-                                                    ai_identify_adapters));
-        } else {
-            sch.add_step(ai_read_fastq, "read_paired_fastq",
-                         new read_paired_fastq(config.quality_input_fmt.get(),
-                                               config.input_files_1,
-                                               config.input_files_2,
-                                               ai_identify_adapters));
-        }
+        add_read_steps(sch, config, ai_identify_adapters);
     } catch (const std::ios_base::failure& error) {
         std::cerr << "IO error opening file; aborting:\n"
                   << cli_formatter::fmt(error.what()) << std::endl;
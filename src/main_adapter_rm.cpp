@@ -32,6 +32,8 @@
 #include <vector>
 
 #include "alignment.hpp"
+#include "alignment_cache.hpp"
+#include "batch_alignment.hpp"
 #include "debug.hpp"
 #include "demultiplex.hpp"
 #include "fastq.hpp"
@@ -82,6 +84,11 @@ void write_settings(const userconfig& config, std::ostream& output, int nth)
         output << "single-end reads\n";
     }
 
+    if (config.shard.second > 1) {
+        output << "Input shard " << config.shard.first << " of "
+               << config.shard.second << "\n";
+    }
+
     if (config.adapters.barcode_count()) {
         output << "\n\n[Demultiplexing]"
                << "\nMaximum mismatches (total): " << config.barcode_mm;
@@ -184,7 +191,20 @@ void write_trimming_settings(const userconfig& config,
     settings << "\n\n\n[Trimming statistics]"
              << "\nTotal number of " << reads_type << stats.records
              << "\nNumber of unaligned " << reads_type << stats.unaligned_reads
-             << "\nNumber of well aligned " << reads_type << stats.well_aligned_reads
+             << "\nNumber of well aligned " << reads_type << stats.well_aligned_reads;
+
+    if (config.alignment_cache_size) {
+        settings << "\nNumber of alignment cache hits: " << stats.alignment_cache_hits
+                 << "\nNumber of alignment cache misses: " << stats.alignment_cache_misses;
+    }
+
+    if (config.adapter_prefilter_length) {
+        settings << "\nNumber of reads skipped by adapter prefilter: " << stats.prefiltered_reads
+                 << "\nFraction of reads skipped by adapter prefilter: "
+                 << (stats.records ? static_cast<double>(stats.prefiltered_reads) / stats.records : 0);
+    }
+
+    settings
              << "\nNumber of discarded mate 1 reads: " << stats.discard1
              << "\nNumber of singleton mate 1 reads: " << stats.keep1;
 
@@ -385,14 +405,70 @@ void process_collapsed_read(const userconfig& config,
 }
 
 
+/** Class for building alignment caches on demand; one cache per thread. */
+class cache_sink : public statistics_sink<alignment_cache>
+{
+public:
+    cache_sink(size_t capacity)
+      : m_capacity(capacity)
+    {
+    }
+
+protected:
+    virtual pointer new_sink() const {
+        return pointer(new alignment_cache(m_capacity));
+    }
+
+    virtual void reduce(pointer&, const pointer&) const {
+        // Intentionally left empty
+    }
+
+    //! Copy construction not supported
+    cache_sink(const cache_sink&) = delete;
+    //! Assignment not supported
+    cache_sink& operator=(const cache_sink&) = delete;
+
+private:
+    const size_t m_capacity;
+};
+
+
+/** Returns the prefilter for a sample; disabled unless enabled by the user. */
+adapter_prefilter create_adapter_prefilter(const userconfig& config, size_t nth)
+{
+    if (!config.adapter_prefilter_length) {
+        return adapter_prefilter();
+    }
+
+    const adapter_prefilter prefilter(config.adapters.get_adapter_set(nth),
+                                      config.shift,
+                                      config.adapter_prefilter_length,
+                                      [&config](const alignment_info& alignment) {
+                                          return config.is_good_alignment(alignment);
+                                      });
+
+    if (!prefilter.enabled()) {
+        std::cerr << "Warning: --adapter-prefilter is not used, since k-mers "
+                  << "of length " << config.adapter_prefilter_length << " "
+                  << "cannot rule out alignments given the --mm value; use a "
+                  << "shorter k-mer length or a lower --mm value."
+                  << std::endl;
+    }
+
+    return prefilter;
+}
+
+
 class reads_processor : public analytical_step
 {
 public:
     reads_processor(const userconfig& config, size_t nth)
       : analytical_step(analytical_step::ordering::unordered)
       , m_config(config)
-      , m_adapters(config.adapters.get_adapter_set(nth))
+      , m_adapters(config.adapters.get_adapter_profile(nth, config.shift, config.aligner))
+      , m_prefilter(create_adapter_prefilter(config, nth))
       , m_stats(config)
+      , m_caches(config.alignment_cache_size)
       , m_nth(nth)
     {
 
@@ -423,9 +499,74 @@ protected:
         const userconfig& m_config;
     };
 
+    /**
+     * Aligns SE reads (reads_2 is null) or PE reads, with mate 2 reads in the
+     * orientation in which they were sequenced, re-using cached alignments for
+     * previously seen sequences if the cache is enabled, and skipping SE reads
+     * that cannot be aligned if the prefilter is enabled.
+     */
+    std::vector<alignment_info> align_reads(const fastq_vec& reads_1,
+                                            const fastq_vec* reads_2,
+                                            statistics& stats)
+    {
+        if (!m_config.alignment_cache_size && !m_prefilter.enabled()) {
+            if (reads_2) {
+                return align_paired_ended_mates(reads_1, *reads_2, m_adapters);
+            } else {
+                return align_single_ended_sequences(reads_1, m_adapters);
+            }
+        }
+
+        cache_sink::pointer cache;
+        if (m_config.alignment_cache_size) {
+            cache = m_caches.get_sink();
+        }
+
+        const std::string no_sequence;
+        std::vector<alignment_info> alignments(reads_1.size());
+        index_vec misses;
+        for (size_t i = 0; i < reads_1.size(); ++i) {
+            const std::string& sequence_2 = reads_2 ? reads_2->at(i).sequence() : no_sequence;
+            if (cache && cache->lookup(reads_1.at(i).sequence(), sequence_2, alignments.at(i))) {
+                stats.alignment_cache_hits++;
+            } else if (!reads_2 && m_prefilter.is_adapter_free(reads_1.at(i))) {
+                // Left as an empty (unaligned) alignment
+                stats.prefiltered_reads++;
+            } else {
+                misses.push_back(i);
+            }
+        }
+
+        const std::vector<alignment_info> results = reads_2
+            ? align_paired_ended_mates(reads_1, *reads_2, misses, m_adapters)
+            : align_single_ended_sequences(reads_1, misses, m_adapters);
+
+        for (size_t i = 0; i < misses.size(); ++i) {
+            const size_t index = misses.at(i);
+            alignments.at(index) = results.at(i);
+
+            if (cache) {
+                const std::string& sequence_2 = reads_2 ? reads_2->at(index).sequence() : no_sequence;
+                cache->insert(reads_1.at(index).sequence(), sequence_2, results.at(i));
+                stats.alignment_cache_misses++;
+            }
+        }
+
+        if (cache) {
+            m_caches.return_sink(std::move(cache));
+        }
+
+        return alignments;
+    }
+
     const userconfig& m_config;
-    const fastq_pair_vec m_adapters;
+    //! Adapters for this sample, compiled for alignments
+    const adapter_profile m_adapters;
+    //! Filter used to skip SE reads that cannot be aligned; if enabled
+    const adapter_prefilter m_prefilter;
     stats_sink m_stats;
+    //! Per-thread caches of alignments; only used if enabled
+    cache_sink m_caches;
     const size_t m_nth;
 };
 
@@ -446,8 +587,12 @@ public:
         trimmed_reads chunks(m_config, offset, read_chunk->eof);
         stats_sink::pointer stats = m_stats.get_sink();
 
+        const std::vector<alignment_info> alignments
+            = align_reads(read_chunk->reads_1, nullptr, *stats);
+
+        auto it_alignment = alignments.cbegin();
         for (auto& read : read_chunk->reads_1) {
-            const alignment_info alignment = align_single_ended_sequence(read, m_adapters, m_config.shift);
+            const alignment_info& alignment = *it_alignment++;
 
             if (m_config.is_good_alignment(alignment)) {
                 truncate_single_ended_sequence(alignment, read);
@@ -536,28 +681,35 @@ public:
 
         AR_DEBUG_ASSERT(read_chunk->reads_1.size() == read_chunk->reads_2.size());
 
+        for (size_t i = 0; i < read_chunk->reads_1.size(); ++i) {
+            // Throws if read-names or mate numbering does not match
+            fastq::validate_paired_reads(read_chunk->reads_1.at(i),
+                                         read_chunk->reads_2.at(i),
+                                         m_config.mate_separator);
+        }
+
+        // Mate 2 reads are reverse complemented on the fly where needed, so
+        // that they never have to be flipped (and flipped back) in place
+
+        const std::vector<alignment_info> alignments
+            = align_reads(read_chunk->reads_1, &read_chunk->reads_2, *stats);
+
         auto it_1 = read_chunk->reads_1.begin();
         auto it_2 = read_chunk->reads_2.begin();
+        auto it_alignment = alignments.cbegin();
         while (it_1 != read_chunk->reads_1.end()) {
             fastq read_1 = *it_1++;
             fastq read_2 = *it_2++;
-
-            // Throws if read-names or mate numbering does not match
-            fastq::validate_paired_reads(read_1, read_2, m_config.mate_separator);
-
-            // Reverse complement to match the orientation of read_1
-            read_2.reverse_complement();
-
-            const alignment_info alignment = align_paired_ended_sequences(read_1, read_2, m_adapters, m_config.shift);
+            const alignment_info& alignment = *it_alignment++;
 
             if (m_config.is_good_alignment(alignment)) {
                 stats->well_aligned_reads++;
-                const size_t n_adapters = truncate_paired_ended_sequences(alignment, read_1, read_2);
+                const size_t n_adapters = truncate_paired_ended_mates(alignment, read_1, read_2);
                 stats->number_of_reads_with_adapter.at(alignment.adapter_id) += n_adapters;
 
                 if (m_config.is_alignment_collapsible(alignment)) {
-                    fastq collapsed_read = collapse_paired_ended_sequences(alignment, read_1, read_2, *rng,
-                                                                           mate_separator);
+                    fastq collapsed_read = collapse_paired_ended_mates(alignment, read_1, read_2, *rng,
+                                                                       mate_separator);
                     process_collapsed_read(m_config,
                                            *stats,
                                            collapsed_read,
@@ -577,9 +729,6 @@ public:
             }
 
             // Reads were not aligned or collapsing is not enabled
-            // Undo reverse complementation (post truncation of adapters)
-            read_2.reverse_complement();
-
             // Trim fixed number of bases from 5' and/or 3' termini
             trim_read_termini_if_enabled(m_config, read_1, read_type::mate_1);
             trim_read_termini_if_enabled(m_config, read_2, read_type::mate_2);
@@ -686,10 +835,7 @@ int remove_adapter_sequences_se(const userconfig& config)
     try {
         if (config.adapters.barcode_count()) {
             // Step 1: Read input file
-            sch.add_step(ai_read_fastq, "read_fastq",
-                         new read_single_fastq(config.quality_input_fmt.get(),
-                                               config.input_files_1,
-                                               ai_demultiplex));
+            add_read_steps(sch, config, ai_demultiplex);
 
             // Step 2: Parse and demultiplex reads based on single or double indices
             sch.add_step(ai_demultiplex, "demultiplex_se",
@@ -698,10 +844,7 @@ int remove_adapter_sequences_se(const userconfig& config)
             add_write_step(config, sch, ai_write_unidentified_1, "unidentified",
                            new write_fastq(config.get_output_filename("demux_unknown")));
         } else {
-            sch.add_step(ai_read_fastq, "read_fastq",
-                         new read_single_fastq(config.quality_input_fmt.get(),
-                                               config.input_files_1,
-                                               ai_analyses_offset));
+            add_read_steps(sch, config, ai_analyses_offset);
         }
 
         // Step 3 - N: Trim and write demultiplexed reads
@@ -758,18 +901,7 @@ int remove_adapter_sequences_pe(const userconfig& config)
     try {
         // Step 1: Read input file
         const size_t next_step = config.adapters.barcode_count() ? ai_demultiplex : ai_analyses_offset;
-        if (config.interleaved_input) {
-            sch.add_step(ai_read_fastq, "read_interleaved_fastq",
-                         new read_interleaved_fastq(config.quality_input_fmt.get(),
-                                                    config.input_files_1,
-                                                    next_step));
-        } else {
-            sch.add_step(ai_read_fastq, "read_paired_fastq",
-                         new read_paired_fastq(config.quality_input_fmt.get(),
-                                               config.input_files_1,
-                                               config.input_files_2,
-                                               next_step));
-        }
+        add_read_steps(sch, config, next_step);
 
         if (config.adapters.barcode_count()) {
             // Step 2: Parse and demultiplex reads based on single or double indices
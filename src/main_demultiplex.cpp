@@ -273,10 +273,7 @@ int demultiplex_sequences_se(const userconfig& config)
 
     try {
         // Step 1: Read input file
-        sch.add_step(ai_read_fastq, "read_fastq",
-                     new read_single_fastq(config.quality_input_fmt.get(),
-                                           config.input_files_1,
-                                           ai_demultiplex));
+        add_read_steps(sch, config, ai_demultiplex);
 
         // Step 2: Parse and demultiplex reads based on single or double indices
         sch.add_step(ai_demultiplex, "demultiplex_se",
@@ -327,18 +324,7 @@ int demultiplex_sequences_pe(const userconfig& config)
 
     try {
         // Step 1: Read input file
-        if (config.interleaved_input) {
-            sch.add_step(ai_read_fastq, "read_interleaved_fastq",
-                         new read_interleaved_fastq(config.quality_input_fmt.get(),
-                                                    config.input_files_1,
-                                                    ai_demultiplex));
-        } else {
-            sch.add_step(ai_read_fastq, "read_paired_fastq",
-                         new read_paired_fastq(config.quality_input_fmt.get(),
-                                               config.input_files_1,
-                                               config.input_files_2,
-                                               ai_demultiplex));
-        }
+        add_read_steps(sch, config, ai_demultiplex);
 
         // Step 2: Parse and demultiplex reads based on single or double indices
         sch.add_step(ai_demultiplex, "demultiplex_pe",
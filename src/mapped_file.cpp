@@ -0,0 +1,95 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2017 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+
+namespace ar
+{
+
+mapped_file::mapped_file(int fd)
+  : m_data(nullptr)
+  , m_size(0)
+{
+    struct stat info;
+    if (fstat(fd, &info) || !S_ISREG(info.st_mode) || info.st_size <= 0) {
+        return;
+    }
+
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+        m_data = static_cast<char*>(data);
+        m_size = info.st_size;
+
+        // Failure only means that the kernel does not optimize for our use
+        madvise(m_data, m_size, MADV_SEQUENTIAL);
+    }
+}
+
+
+mapped_file::~mapped_file()
+{
+    if (m_data) {
+        munmap(m_data, m_size);
+    }
+}
+
+
+const char* mapped_file::data() const
+{
+    return m_data;
+}
+
+
+size_t mapped_file::size() const
+{
+    return m_size;
+}
+
+
+void mapped_file::prefetch(const char* data, size_t length) const
+{
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+
+    // The range is extended to whole pages, as required by madvise
+    const size_t begin = (data - m_data) / page_size * page_size;
+    madvise(m_data + begin, data + length - m_data - begin, MADV_WILLNEED);
+}
+
+
+void mapped_file::release(const char* data, size_t length) const
+{
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+
+    const size_t begin = (data - m_data + page_size - 1) / page_size * page_size;
+    const size_t end = (data + length - m_data) / page_size * page_size;
+
+    if (begin < end) {
+        madvise(m_data + begin, end - begin, MADV_DONTNEED);
+    }
+}
+
+} // namespace ar
@@ -21,61 +21,58 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
-#ifndef LINEREADER_JOINED_H
-#define LINEREADER_JOINED_H
-
-#include <memory>
-
-#include "commontypes.hpp"
-#include "linereader.hpp"
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
 
+#include <cstddef>
 
 namespace ar
 {
 
-
 /**
- * Multi-file line-reader
+ * Read-only memory mapping of a regular file.
  *
- * Wrapper around line_reader that automatically reads through one or more
- * files, returning the content as a contiguous stream of lines. No assumptions
- * are made about the format of the individual files.
+ * The file is mapped for sequential access; pages may be read ahead using
+ * 'prefetch', and pages that have been read may be released using 'release',
+ * in order to avoid keeping the entire file in memory. Files that cannot be mapped (pipes, empty files, etc.) are
+ * represented by an empty mapping, in which case 'data' returns nullptr.
  */
-class joined_line_readers : public line_reader_base
+class mapped_file
 {
 public:
-    /** Creates line-reader over multiple files in the specified order. */
-    joined_line_readers(const string_vec& filenames);
+    /** Maps the entire file open as 'fd', if possible. */
+    mapped_file(int fd);
+
+    /** Unmaps the file. */
+    ~mapped_file();
+
+    /** Returns the start of the mapping, or nullptr if not mapped. */
+    const char* data() const;
 
-    /** Closes any still open files. */
-    ~joined_line_readers();
+    /** Returns the size of the mapped file. */
+    size_t size() const;
+
+    /** Notes that the range will be read soon; it may be read ahead. */
+    void prefetch(const char* data, size_t length) const;
 
     /**
-     * Reads a line from the currently open file; if EOF is encountered, the
-     * currently open file is closed and the next file is opened. Returns true
-     * if a line was successfully read, or false if no files remain.
+     * Notes that the range will not be read again; whole pages in the range
+     * are released, while any partial pages at either end are kept.
      */
-    bool getline(std::string& dst);
+    void release(const char* data, size_t length) const;
 
     //! Copy construction not supported
-    joined_line_readers(const joined_line_readers&) = delete;
+    mapped_file(const mapped_file&) = delete;
     //! Assignment not supported
-    joined_line_readers& operator=(const joined_line_readers&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
 
 private:
-    /**
-     * Open the next file, removes it from the queue, and returns true; returns
-     * false if no files remain to be processed.
-     */
-    bool open_next_file();
-
-    //! Files left to read; stored in reverse order.
-    string_vec m_filenames;
-    //! Currently open file, if any.
-    std::unique_ptr<line_reader> m_reader;
+    //! Start of the mapping
+    char* m_data;
+    //! Size of the mapping
+    size_t m_size;
 };
 
-
 } // namespace ar
 
 #endif
@@ -0,0 +1,148 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include "debug.hpp"
+#include "packed_sequence.hpp"
+
+namespace ar
+{
+
+packed_sequence::packed_sequence()
+    : m_length(0)
+    , m_bases(1)
+    , m_ambiguous(1)
+{
+}
+
+
+packed_sequence::packed_sequence(const std::string& sequence)
+    : m_length(0)
+    , m_bases()
+    , m_ambiguous()
+{
+    assign(sequence);
+}
+
+
+void packed_sequence::assign(const std::string& sequence)
+{
+    assign(sequence, std::string());
+}
+
+
+void packed_sequence::assign_reverse_complement(const std::string& sequence)
+{
+    m_length = sequence.length();
+
+    const size_t n_words = (m_length + 31) / 32 + 1;
+    m_bases.assign(n_words, 0);
+    m_ambiguous.assign(n_words, 0);
+
+    pack(sequence, 0, true);
+}
+
+
+void packed_sequence::assign(const std::string& sequence_1,
+                             const std::string& sequence_2)
+{
+    m_length = sequence_1.length() + sequence_2.length();
+
+    // One additional word is needed for bases(pos) / ambiguous(pos)
+    const size_t n_words = (m_length + 31) / 32 + 1;
+    m_bases.assign(n_words, 0);
+    m_ambiguous.assign(n_words, 0);
+
+    pack(sequence_1, 0);
+    pack(sequence_2, sequence_1.length());
+}
+
+
+void packed_sequence::assign(const packed_sequence& sequence_1,
+                             const packed_sequence& sequence_2)
+{
+    m_length = sequence_1.length() + sequence_2.length();
+
+    const size_t n_words = (m_length + 31) / 32 + 1;
+    m_bases.assign(n_words, 0);
+    m_ambiguous.assign(n_words, 0);
+
+    // Lanes past the end of a sequence are always zero
+    append(m_bases, sequence_1.m_bases, 0);
+    append(m_bases, sequence_2.m_bases, sequence_1.length());
+    append(m_ambiguous, sequence_1.m_ambiguous, 0);
+    append(m_ambiguous, sequence_2.m_ambiguous, sequence_1.length());
+}
+
+
+void packed_sequence::append(std::vector<uint64_t>& dst,
+                             const std::vector<uint64_t>& src,
+                             size_t pos)
+{
+    const size_t index = pos / 32;
+    const size_t shift = (pos % 32) * 2;
+
+    // The trailing zero'd word in src is not copied
+    for (size_t i = 0; i + 1 < src.size(); ++i) {
+        dst[index + i] |= src[i] << shift;
+        if (shift) {
+            dst[index + i + 1] |= src[i] >> (64 - shift);
+        }
+    }
+}
+
+
+void packed_sequence::pack(const std::string& sequence, size_t pos, bool reverse_complement)
+{
+    // The codes of complementary bases sum to 3, so XOR'ing with 3 complements
+    const uint64_t complement = reverse_complement ? 3 : 0;
+
+    for (size_t i = 0; i < sequence.length(); ++i, ++pos) {
+        const size_t index = pos / 32;
+        const size_t shift = (pos % 32) * 2;
+        const char nuc = reverse_complement ? sequence[sequence.length() - i - 1] : sequence[i];
+
+        uint64_t code = 0;
+        switch (nuc) {
+            case 'A':
+                break;
+            case 'C':
+                code = 1;
+                break;
+            case 'G':
+                code = 2;
+                break;
+            case 'T':
+                code = 3;
+                break;
+            default:
+                AR_DEBUG_ASSERT(nuc == 'N');
+                m_ambiguous[index] |= static_cast<uint64_t>(1) << shift;
+                continue;
+        }
+
+        m_bases[index] |= (code ^ complement) << shift;
+    }
+}
+
+} // namespace ar
@@ -0,0 +1,111 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef PACKED_SEQUENCE_H
+#define PACKED_SEQUENCE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ar
+{
+
+/**
+ * Nucleotide sequence using 2 bits per base (A = 0, C = 1, G = 2, T = 3).
+ *
+ * Ambiguous bases (N) are stored as A, and are tracked using a separate mask
+ * in which the least significant bit of each 2-bit lane is set for Ns. This
+ * allows 32 bases to be compared per 64-bit word, using XOR to find differing
+ * lanes and POPCNT to count mismatches and Ns. Sequences are assumed to only
+ * contain the uppercase nucleotides 'A', 'C', 'G', 'T', and 'N'.
+ */
+class packed_sequence
+{
+public:
+    /** Creates an empty sequence. */
+    packed_sequence();
+
+    /** Creates a packed copy of a sequence. */
+    explicit packed_sequence(const std::string& sequence);
+
+    /** Packs a sequence, replacing the current contents. */
+    void assign(const std::string& sequence);
+
+    /** Packs the reverse complement of a sequence, without copying it. */
+    void assign_reverse_complement(const std::string& sequence);
+
+    /** Packs the concatenation of two sequences, without copying them. */
+    void assign(const std::string& sequence_1, const std::string& sequence_2);
+
+    /** Assigns the concatenation of two packed sequences. */
+    void assign(const packed_sequence& sequence_1, const packed_sequence& sequence_2);
+
+    /** Returns the number of bases in the sequence. */
+    size_t length() const { return m_length; }
+
+    /** Returns the 32 bases starting at pos; positions past the end are 0. */
+    uint64_t bases(size_t pos) const { return extract(m_bases, pos); }
+
+    /** Returns the N-mask for 32 bases starting at pos (see above). */
+    uint64_t ambiguous(size_t pos) const { return extract(m_ambiguous, pos); }
+
+private:
+    /**
+     * Packs the bases in 'sequence' (or its reverse complement) starting at
+     * position 'pos'.
+     */
+    void pack(const std::string& sequence, size_t pos, bool reverse_complement = false);
+
+    /** Adds the packed words of a sequence, starting at position 'pos'. */
+    static void append(std::vector<uint64_t>& dst,
+                       const std::vector<uint64_t>& src,
+                       size_t pos);
+
+    /** Returns the 2-bit lanes for the 32 bases starting at pos. */
+    static uint64_t extract(const std::vector<uint64_t>& words, size_t pos)
+    {
+        const size_t index = pos / 32;
+        const size_t shift = (pos % 32) * 2;
+
+        uint64_t value = words[index] >> shift;
+        if (shift) {
+            // Storage includes an additional zero'd word, so this is safe
+            value |= words[index + 1] << (64 - shift);
+        }
+
+        return value;
+    }
+
+    //! Number of bases in the sequence
+    size_t m_length;
+    //! Packed bases, with one trailing zero'd word.
+    std::vector<uint64_t> m_bases;
+    //! Packed N-mask, with one trailing zero'd word.
+    std::vector<uint64_t> m_ambiguous;
+};
+
+} // namespace ar
+
+#endif
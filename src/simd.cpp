@@ -0,0 +1,96 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include "simd.hpp"
+
+namespace ar
+{
+namespace simd
+{
+
+/** Determines the best supported instruction set using CPUID. */
+instruction_set detect_instruction_set()
+{
+#ifdef AR_SIMD_DISPATCH
+    // Required when called prior to constructors being run (GCC)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512bw")) {
+        return instruction_set::avx512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return instruction_set::avx2;
+    }
+#endif
+
+#if defined(__SSE__) && defined(__SSE2__)
+    return instruction_set::sse2;
+#else
+    return instruction_set::none;
+#endif
+}
+
+
+instruction_set detect()
+{
+    static const instruction_set value = detect_instruction_set();
+
+    return value;
+}
+
+
+std::vector<instruction_set> supported()
+{
+    std::vector<instruction_set> values;
+    const instruction_set best = detect();
+    for (auto value : { instruction_set::none,
+                        instruction_set::sse2,
+                        instruction_set::avx2,
+                        instruction_set::avx512 }) {
+        if (value <= best) {
+            values.push_back(value);
+        }
+    }
+
+    return values;
+}
+
+
+const char* name(instruction_set value)
+{
+    switch (value) {
+        case instruction_set::none:
+            return "none";
+        case instruction_set::sse2:
+            return "SSE2";
+        case instruction_set::avx2:
+            return "AVX2";
+        case instruction_set::avx512:
+            return "AVX512";
+        default:
+            return "unknown";
+    }
+}
+
+} // namespace simd
+} // namespace ar
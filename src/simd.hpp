@@ -1,7 +1,8 @@
 /*************************************************************************\
  * AdapterRemoval - cleaning next-generation sequencing reads            *
  *                                                                       *
- * Copyright (C) 2015 by Mikkel Schubert - mikkelsch@gmail.com           *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
  *                                                                       *
  * If you use the program, please cite the paper:                        *
  * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
@@ -21,67 +22,50 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
-#include <algorithm>
-#include <cerrno>
-#include <cstdio>
-#include <cstring>
-#include <cstdlib>
-#include <iostream>
-#include <sstream>
+#ifndef SIMD_H
+#define SIMD_H
 
-#include "debug.hpp"
-#include "linereader_joined.hpp"
-#include "threads.hpp"
+#include <vector>
 
+/** Target attributes are only used on x86 compilers supporting GNU extensions */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AR_SIMD_DISPATCH 1
+#define AR_TARGET(value) __attribute__((target(value)))
+#else
+#define AR_TARGET(value)
+#endif
 
 namespace ar
 {
-
-joined_line_readers::joined_line_readers(const string_vec& filenames)
-  : m_filenames(filenames.rbegin(), filenames.rend())
-  , m_reader()
+namespace simd
 {
-}
-
-
-joined_line_readers::~joined_line_readers()
-{
-}
-
 
-bool joined_line_readers::getline(std::string& dst)
+//! Instruction sets for which specialized kernels may be available.
+enum class instruction_set
 {
-    dst.clear();
+    none,
+    sse2,
+    avx2,
+    avx512
+};
 
-    while (dst.empty()) {
-        if (m_reader && m_reader->getline(dst)) {
-            break;
-        } else if (!open_next_file()) {
-            break;
-        }
-    }
-
-    return !dst.empty();
-}
-
-
-bool joined_line_readers::open_next_file()
-{
-    if (m_filenames.empty()) {
-        return false;
-    }
 
-    auto filename = m_filenames.back();
+/**
+ * Returns the most capable instruction set supported by both the build and
+ * the host CPU. The result is determined once and cached.
+ */
+instruction_set detect();
 
-    {
-        print_locker lock;
-        std::cerr << "Opening FASTQ file '" << filename << "'" << std::endl;
-    }
+/**
+ * Returns all instruction sets supported by the build and the host CPU,
+ * starting with the least capable (always 'none').
+ */
+std::vector<instruction_set> supported();
 
-    m_reader.reset(new line_reader(filename));
-    m_filenames.pop_back();
+/** Returns a short, human readable name for an instruction set. */
+const char* name(instruction_set value);
 
-    return true;
-}
+} // namespace simd
+} // namespace ar
 
-}
+#endif
@@ -0,0 +1,581 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2017 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cstring>
+
+#include "speculative_inflate.hpp"
+
+namespace ar
+{
+
+//! Maximum length of Huffman codes used by deflate
+const size_t MAX_CODE_BITS = 15;
+//! Maximum output size relative to the input size; limits speculative output
+const size_t MAX_EXPANSION = 32;
+
+//! Base lengths for length symbols 257 to 285
+const uint16_t LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+//! Extra bits for length symbols 257 to 285
+const uint8_t LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+//! Base distances for distance symbols 0 to 29
+const uint16_t DISTANCE_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+    513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+//! Extra bits for distance symbols 0 to 29
+const uint8_t DISTANCE_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+    8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+//! Order in which the lengths of the code length code are stored
+const uint8_t CODE_LENGTH_ORDER[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+
+/** Outcome of decompressing (part of) a deflate block. */
+enum class block_status
+{
+    //! The block was decompressed
+    ok,
+    //! The block was not valid
+    invalid,
+    //! The block continues past the end of the data
+    truncated
+};
+
+
+/** Reads bits from a buffer, least significant bit first. */
+class bit_reader
+{
+public:
+    bit_reader(const char* data, size_t length)
+      : m_data(reinterpret_cast<const uint8_t*>(data))
+      , m_length(length)
+      , m_position(0)
+    {
+    }
+
+    /** Returns the next 57 or more bits; bits past the end are zero. */
+    inline uint64_t peek() const
+    {
+        const size_t offset = m_position / 8;
+
+        uint64_t value = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        if (offset + 8 <= m_length) {
+            std::memcpy(&value, m_data + offset, 8);
+
+            return value >> (m_position % 8);
+        }
+#endif
+        for (size_t i = 0; i < 8 && offset + i < m_length; ++i) {
+            value |= static_cast<uint64_t>(m_data[offset + i]) << (8 * i);
+        }
+
+        return value >> (m_position % 8);
+    }
+
+    /** Reads up to 32 bits. */
+    inline uint32_t read(size_t bits)
+    {
+        const uint32_t value = peek() & ((uint64_t(1) << bits) - 1);
+        m_position += bits;
+
+        return value;
+    }
+
+    inline void skip(size_t bits) { m_position += bits; }
+    inline void seek(size_t position) { m_position = position; }
+    inline size_t position() const { return m_position; }
+
+    /** Returns true if 'bits' more bits can be read. */
+    inline bool available(size_t bits) const
+    {
+        return m_position + bits <= m_length * 8;
+    }
+
+    /** Returns true if bits past the end of the data have been read. */
+    inline bool overrun() const { return m_position > m_length * 8; }
+
+private:
+    const uint8_t* m_data;
+    size_t m_length;
+    size_t m_position;
+};
+
+
+/**
+ * Table for decoding canonical Huffman codes.
+ *
+ * Codes of up to ROOT_BITS are decoded using a single lookup, while longer
+ * codes are decoded using a second lookup in a sub-table for the first
+ * ROOT_BITS of the code. Entries consist of the code length (bits 0-3), a flag
+ * indicating a link to a sub-table (bit 4), and the symbol or the offset of the
+ * sub-table (bits 5+); links store the number of bits in the sub-table index.
+ */
+class huffman_table
+{
+public:
+    huffman_table()
+      : m_table()
+    {
+    }
+
+    /**
+     * Builds a table from the code lengths of 'count' symbols. Returns false
+     * if the lengths do not form a valid code; as in zlib, incomplete codes
+     * are only permitted for literals / distances with a single 1-bit code.
+     */
+    bool build(const uint8_t* lengths, size_t count, bool code_lengths)
+    {
+        uint16_t counts[MAX_CODE_BITS + 1] = {};
+        for (size_t i = 0; i < count; ++i) {
+            ++counts[lengths[i]];
+        }
+
+        counts[0] = 0;
+        size_t max_bits = MAX_CODE_BITS;
+        while (max_bits && !counts[max_bits]) {
+            --max_bits;
+        }
+
+        if (!max_bits) {
+            // No symbols; any attempt at decoding is an error
+            m_table.assign(size_t(1) << ROOT_BITS, 0);
+            return true;
+        }
+
+        int left = 1;
+        for (size_t bits = 1; bits <= MAX_CODE_BITS; ++bits) {
+            left = (left << 1) - counts[bits];
+            if (left < 0) {
+                return false;
+            }
+        }
+
+        if (left > 0 && (code_lengths || max_bits != 1)) {
+            return false;
+        }
+
+        m_table.assign(size_t(1) << ROOT_BITS, 0);
+        uint16_t next_code[MAX_CODE_BITS + 1] = {};
+        for (size_t bits = 1, code = 0; bits <= max_bits; ++bits) {
+            code = (code + counts[bits - 1]) << 1;
+            next_code[bits] = code;
+        }
+
+        // Sub-tables are indexed using all bits beyond the root bits
+        const size_t sub_bits = max_bits > ROOT_BITS ? max_bits - ROOT_BITS : 0;
+        for (size_t symbol = 0; symbol < count; ++symbol) {
+            const size_t bits = lengths[symbol];
+            if (!bits) {
+                continue;
+            }
+
+            // Codes are stored most significant bit first
+            size_t code = next_code[bits]++;
+            size_t reversed = 0;
+            for (size_t i = 0; i < bits; ++i, code >>= 1) {
+                reversed = (reversed << 1) | (code & 1);
+            }
+
+            const uint32_t entry = (symbol << 5) | bits;
+            if (bits <= ROOT_BITS) {
+                fill(0, reversed, bits, ROOT_BITS, entry);
+            } else {
+                const size_t root = reversed & ((1u << ROOT_BITS) - 1);
+                if (!(m_table[root] & 0x10)) {
+                    m_table[root] = (m_table.size() << 5) | 0x10 | sub_bits;
+                    m_table.resize(m_table.size() + (size_t(1) << sub_bits), 0);
+                }
+
+                fill(m_table[root] >> 5, reversed >> ROOT_BITS,
+                     bits - ROOT_BITS, sub_bits, entry);
+            }
+        }
+
+        return true;
+    }
+
+    /** Decodes a symbol; returns -1 for invalid codes. */
+    inline int decode(bit_reader& reader) const
+    {
+        const uint64_t bits = reader.peek();
+        uint32_t entry = m_table[bits & ((1u << ROOT_BITS) - 1)];
+        if (entry & 0x10) {
+            const size_t index = (bits >> ROOT_BITS) & ((1u << (entry & 0xf)) - 1);
+            entry = m_table[(entry >> 5) + index];
+        }
+
+        if (!(entry & 0xf)) {
+            return -1;
+        }
+
+        reader.skip(entry & 0xf);
+        return entry >> 5;
+    }
+
+private:
+    /** Fills entries for a code of 'bits' bits in a table of 'size_bits' bits. */
+    void fill(size_t offset, size_t code, size_t bits, size_t size_bits,
+              uint32_t entry)
+    {
+        for (; code < (size_t(1) << size_bits); code += size_t(1) << bits) {
+            m_table[offset + code] = entry;
+        }
+    }
+
+    //! Number of bits used for the first lookup
+    static const size_t ROOT_BITS = 10;
+
+    std::vector<uint32_t> m_table;
+};
+
+
+/** Status for an invalid symbol, which may be caused by reading past the end. */
+inline block_status invalid_symbol(const bit_reader& reader)
+{
+    return reader.available(MAX_CODE_BITS) ? block_status::invalid
+                                           : block_status::truncated;
+}
+
+
+/** Tables for deflate blocks compressed using fixed Huffman codes. */
+struct fixed_tables
+{
+    fixed_tables()
+      : literals()
+      , distances()
+    {
+        uint8_t lengths[288];
+        std::fill(lengths, lengths + 144, 8);
+        std::fill(lengths + 144, lengths + 256, 9);
+        std::fill(lengths + 256, lengths + 280, 7);
+        std::fill(lengths + 280, lengths + 288, 8);
+        literals.build(lengths, 288, false);
+
+        std::fill(lengths, lengths + 32, 5);
+        distances.build(lengths, 32, false);
+    }
+
+    huffman_table literals;
+    huffman_table distances;
+};
+
+
+/** Reads the Huffman codes of a dynamic block following the block header. */
+block_status read_dynamic_tables(bit_reader& reader,
+                                 huffman_table& literals,
+                                 huffman_table& distances,
+                                 huffman_table& code_lengths)
+{
+    if (!reader.available(14)) {
+        return block_status::truncated;
+    }
+
+    const size_t n_literals = reader.read(5) + 257;
+    const size_t n_distances = reader.read(5) + 1;
+    const size_t n_code_lengths = reader.read(4) + 4;
+    if (n_literals > 286 || n_distances > 30) {
+        return block_status::invalid;
+    } else if (!reader.available(3 * n_code_lengths)) {
+        return block_status::truncated;
+    }
+
+    uint8_t lengths[286 + 30];
+    std::fill(lengths, lengths + 19, 0);
+    for (size_t i = 0; i < n_code_lengths; ++i) {
+        lengths[CODE_LENGTH_ORDER[i]] = reader.read(3);
+    }
+
+    if (!code_lengths.build(lengths, 19, true)) {
+        return block_status::invalid;
+    }
+
+    const size_t n_lengths = n_literals + n_distances;
+    for (size_t i = 0; i < n_lengths;) {
+        const int symbol = code_lengths.decode(reader);
+        if (symbol < 0) {
+            return invalid_symbol(reader);
+        } else if (symbol < 16) {
+            lengths[i++] = symbol;
+        } else {
+            uint8_t value = 0;
+            size_t repeats = 0;
+            if (symbol == 16) {
+                if (!i) {
+                    return block_status::invalid;
+                }
+
+                value = lengths[i - 1];
+                repeats = 3 + reader.read(2);
+            } else if (symbol == 17) {
+                repeats = 3 + reader.read(3);
+            } else {
+                repeats = 11 + reader.read(7);
+            }
+
+            if (i + repeats > n_lengths) {
+                return block_status::invalid;
+            }
+
+            std::fill(lengths + i, lengths + i + repeats, value);
+            i += repeats;
+        }
+
+        if (reader.overrun()) {
+            return block_status::truncated;
+        }
+    }
+
+    if (!lengths[256]
+        || !literals.build(lengths, n_literals, false)
+        || !distances.build(lengths + n_literals, n_distances, false)) {
+        return block_status::invalid;
+    }
+
+    return block_status::ok;
+}
+
+
+/** Decompresses Huffman coded data until the end-of-block symbol. */
+block_status inflate_codes(bit_reader& reader,
+                           const huffman_table& literals,
+                           const huffman_table& distances,
+                           std::vector<uint16_t>& output)
+{
+    // Output is written to a pre-allocated buffer, resized on return
+    size_t size = output.size();
+    block_status status = block_status::ok;
+
+    while (true) {
+        if (output.size() < size + 258) {
+            output.resize(std::max<size_t>(2 * output.size(), size + 258));
+        }
+
+        uint16_t* const dst = output.data() + size;
+        const int symbol = literals.decode(reader);
+        if (symbol < 256) {
+            if (symbol < 0) {
+                status = invalid_symbol(reader);
+                break;
+            }
+
+            *dst = symbol;
+            size += 1;
+        } else if (symbol == 256) {
+            status = reader.overrun() ? block_status::truncated : block_status::ok;
+            break;
+        } else if (symbol > 285) {
+            status = block_status::invalid;
+            break;
+        } else {
+            const size_t length = LENGTH_BASE[symbol - 257]
+                                + reader.read(LENGTH_EXTRA[symbol - 257]);
+
+            const int code = distances.decode(reader);
+            if (code < 0 || code > 29) {
+                status = (code < 0) ? invalid_symbol(reader) : block_status::invalid;
+                break;
+            }
+
+            const size_t distance = DISTANCE_BASE[code]
+                                  + reader.read(DISTANCE_EXTRA[code]);
+            if (reader.overrun()) {
+                status = block_status::truncated;
+                break;
+            } else if (distance > size + DEFLATE_WINDOW_SIZE) {
+                status = block_status::invalid;
+                break;
+            }
+
+            if (distance <= size) {
+                // Element-wise copy, as the ranges may overlap
+                const uint16_t* src = dst - distance;
+                for (size_t i = 0; i < length; ++i) {
+                    dst[i] = src[i];
+                }
+            } else {
+                for (size_t i = 0; i < length; ++i) {
+                    if (i >= distance - size) {
+                        dst[i] = dst[i - distance];
+                    } else {
+                        // Byte in the unknown window preceding the output
+                        dst[i] = DEFLATE_MARKER + DEFLATE_WINDOW_SIZE + size + i - distance;
+                    }
+                }
+            }
+
+            size += length;
+        }
+
+        if (reader.overrun()) {
+            status = block_status::truncated;
+            break;
+        }
+    }
+
+    output.resize(size);
+
+    return status;
+}
+
+
+/** Decompresses a stored (uncompressed) block following the block header. */
+block_status inflate_stored(bit_reader& reader, std::vector<uint16_t>& output)
+{
+    reader.seek((reader.position() + 7) / 8 * 8);
+    if (!reader.available(32)) {
+        return block_status::truncated;
+    }
+
+    const size_t length = reader.read(16);
+    if (length != (~reader.read(16) & 0xffff)) {
+        return block_status::invalid;
+    } else if (!reader.available(8 * length)) {
+        return block_status::truncated;
+    }
+
+    for (size_t i = 0; i < length; ++i) {
+        output.push_back(reader.read(8));
+    }
+
+    return block_status::ok;
+}
+
+
+/** Decompresses a single deflate block. */
+block_status inflate_block(bit_reader& reader,
+                           std::vector<uint16_t>& output,
+                           bool& final,
+                           huffman_table& literals,
+                           huffman_table& distances,
+                           huffman_table& code_lengths)
+{
+    static const fixed_tables fixed;
+
+    if (!reader.available(3)) {
+        return block_status::truncated;
+    }
+
+    final = reader.read(1);
+    switch (reader.read(2)) {
+        case 0:
+            return inflate_stored(reader, output);
+
+        case 1:
+            return inflate_codes(reader, fixed.literals, fixed.distances, output);
+
+        case 2: {
+            const block_status status = read_dynamic_tables(reader, literals,
+                                                            distances,
+                                                            code_lengths);
+            if (status != block_status::ok) {
+                return status;
+            }
+
+            return inflate_codes(reader, literals, distances, output);
+        }
+
+        default:
+            return block_status::invalid;
+    }
+}
+
+
+speculative_block::speculative_block()
+  : found(false)
+  , start_bit(0)
+  , end_bit(0)
+  , final(false)
+  , symbols()
+{
+}
+
+
+bool speculative_inflate(const char* data, size_t length,
+                         speculative_block& result)
+{
+    result = speculative_block();
+
+    bit_reader reader(data, length);
+    huffman_table literals;
+    huffman_table distances;
+    huffman_table code_lengths;
+    std::vector<uint16_t>& output = result.symbols;
+    output.reserve(4 * length);
+
+    const size_t max_output = MAX_EXPANSION * length;
+    // The shortest dynamic block header consists of 3 + 14 + 4 * 3 bits
+    for (size_t start = 0; start + 29 <= length * 8; ++start) {
+        reader.seek(start);
+
+        // A dynamic block that is not the final block, with at most 286
+        // literal / length codes and 30 distance codes
+        const uint64_t header = reader.peek();
+        if ((header & 0x7) != 0x4 || ((header >> 3) & 0x1f) > 29
+            || ((header >> 8) & 0x1f) > 29) {
+            continue;
+        }
+
+        output.clear();
+        size_t end_bit = start;
+        size_t end_size = 0;
+        bool end_final = false;
+        bool final = false;
+
+        block_status status = block_status::ok;
+        while (!final && output.size() < max_output) {
+            status = inflate_block(reader, output, final, literals, distances,
+                                   code_lengths);
+            if (status != block_status::ok) {
+                break;
+            }
+
+            end_bit = reader.position();
+            end_size = output.size();
+            end_final = final;
+        }
+
+        // Invalid blocks means that the start was not an actual block
+        if (end_bit > start && status != block_status::invalid) {
+            output.resize(end_size);
+
+            result.found = true;
+            result.start_bit = start;
+            result.end_bit = end_bit;
+            result.final = end_final;
+
+            return true;
+        }
+    }
+
+    output.clear();
+
+    return false;
+}
+
+} // namespace ar
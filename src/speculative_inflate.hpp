@@ -0,0 +1,81 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2017 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef SPECULATIVE_INFLATE_H
+#define SPECULATIVE_INFLATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ar
+{
+
+//! Size of the window of previous output used by deflate back-references
+const size_t DEFLATE_WINDOW_SIZE = 32 * 1024;
+//! Symbols at or above this value refer to the unknown window (see below)
+const uint16_t DEFLATE_MARKER = 256;
+
+
+/**
+ * Deflate blocks decompressed without knowledge of the preceding data.
+ *
+ * Bytes are stored as symbols below DEFLATE_MARKER, while bytes copied from
+ * the (unknown) window preceding the first block are stored as markers, with
+ * DEFLATE_MARKER + i representing byte i of that window. The final output is
+ * obtained by replacing markers with the corresponding bytes, once the window
+ * is known.
+ */
+struct speculative_block
+{
+    speculative_block();
+
+    //! Set if one or more complete blocks were found
+    bool found;
+    //! Position (in bits) of the first block
+    size_t start_bit;
+    //! Position (in bits) following the last block
+    size_t end_bit;
+    //! Set if the last block is the final block of the deflate stream
+    bool final;
+    //! Decompressed data, with markers for bytes in the unknown window
+    std::vector<uint16_t> symbols;
+};
+
+
+/**
+ * Locates and decompresses a series of deflate blocks in a piece of a deflate
+ * stream, starting at an unknown position. The first dynamic Huffman block
+ * that can be decompressed is used, and decompression ends at the end of the
+ * last complete block in the data (or at the final block of the stream).
+ *
+ * Since the block may have been found by chance, the output must only be used
+ * if the start of the block has been confirmed by decompressing the preceding
+ * data; returns false if no blocks were found.
+ */
+bool speculative_inflate(const char* data, size_t length,
+                         speculative_block& result);
+
+} // namespace ar
+
+#endif
@@ -52,6 +52,9 @@ struct statistics
       , keep2(0)
       , discard2(0)
       , records(0)
+      , alignment_cache_hits(0)
+      , alignment_cache_misses(0)
+      , prefiltered_reads(0)
       , read_lengths()
     {
     }
@@ -84,6 +87,12 @@ struct statistics
     size_t discard2;
     //! Total number of reads / pairs processed
     size_t records;
+    //! Number of reads / pairs for which a cached alignment was used
+    size_t alignment_cache_hits;
+    //! Number of reads / pairs aligned while the alignment cache was enabled
+    size_t alignment_cache_misses;
+    //! Number of reads classified as unaligned by the adapter prefilter
+    size_t prefiltered_reads;
 
     /** Increment the number of reads with of a given type / length. */
     void inc_length_count(read_type type, size_t length) {
@@ -113,6 +122,9 @@ struct statistics
         discard2 += other.discard2;
 
         records += other.records;
+        alignment_cache_hits += other.alignment_cache_hits;
+        alignment_cache_misses += other.alignment_cache_misses;
+        prefiltered_reads += other.prefiltered_reads;
 
         merge_vectors(number_of_reads_with_adapter, other.number_of_reads_with_adapter);
         merge_sub_vectors(read_lengths, other.read_lengths);
@@ -96,6 +96,26 @@ std::pair<unsigned, unsigned> parse_trim_argument(const string_vec& values)
 }
 
 
+std::pair<unsigned, unsigned> parse_shard_argument(const std::string& value)
+{
+    const size_t separator = value.find('/');
+    if (separator == std::string::npos) {
+        throw std::invalid_argument("expected a value on the form I/N");
+    }
+
+    const unsigned nth = str_to_unsigned(value.substr(0, separator));
+    const unsigned shards = str_to_unsigned(value.substr(separator + 1));
+
+    if (!shards) {
+        throw std::invalid_argument("the number of shards must be at least 1");
+    } else if (nth >= shards) {
+        throw std::invalid_argument("the shard must be in the range 0 to N - 1");
+    }
+
+    return std::pair<unsigned, unsigned>(nth, shards);
+}
+
+
 userconfig::userconfig(const std::string& name,
                        const std::string& version,
                        const std::string& help)
@@ -126,6 +146,10 @@ userconfig::userconfig(const std::string& name,
     , shift(2)
     , seed(get_seed())
     , max_threads(1)
+    , shard(0, 1)
+    , aligner()
+    , alignment_cache_size(0)
+    , adapter_prefilter_length(0)
     , gzip(false)
     , gzip_level(6)
     , bzip2(false)
@@ -148,6 +172,7 @@ userconfig::userconfig(const std::string& name,
     , demultiplex_sequences(false)
     , trim5p()
     , trim3p()
+    , shard_str()
 {
     argparser["--file1"] =
         new argparse::many(&input_files_1, "FILE [FILE ...]",
@@ -412,6 +437,55 @@ userconfig::userconfig(const std::string& name,
     argparser["--threads"] =
         new argparse::knob(&max_threads, "THREADS",
             "Maximum number of threads [current: %default]");
+    argparser["--shard"] =
+        new argparse::any(&shard_str, "I/N",
+            "Only process the Ith of N (0-based) roughly equally sized parts "
+            "of the input, so that a single large file may be processed by "
+            "N independent runs; use --basename to give each run its own "
+            "output files. Requires exactly one uncompressed file per mate; "
+            "PE files are split at the same record.");
+
+    argparser.add_header("PERFORMANCE:");
+    argparser["--packed-alignment"] =
+        new argparse::flag(&aligner.packed,
+            "Align 2-bit packed reads and adapters, comparing 32 bases at a "
+            "time; reads are aligned one at a time rather than in batches. "
+            "Does not change the resulting alignments [current: %default].");
+    argparser["--alignment-seed-length"] =
+        new argparse::knob(&aligner.seed_length, "LENGTH",
+            "If not zero, only offsets at which read and adapter share an "
+            "exact k-mer of this length (4 to 16 bp) are scored, while "
+            "overlaps shorter than twice this length are always scored. "
+            "Alignments without exact seeds may be missed [current: "
+            "%default].");
+    argparser["--adapter-index"] =
+        new argparse::knob(&aligner.index_kmer_length, "LENGTH",
+            "If not zero, reads are only fully aligned against adapters "
+            "sharing at least one k-mer of this length (4 to 16 bp) with the "
+            "read; other adapters are only aligned where they overlap fewer "
+            "than twice this many bases. Recommended for large adapter "
+            "lists [current: %default].");
+    argparser["--long-read-window"] =
+        new argparse::knob(&aligner.long_read_window, "LENGTH",
+            "If not zero, SE reads longer than twice this length are only "
+            "aligned against adapters within this many bases of the 5' and "
+            "3' ends. Only supported for SE reads; does not change the seed "
+            "length, so combining it with --alignment-seed-length (e.g. 8) "
+            "is recommended. Intended for long reads (e.g. ONT/PacBio) "
+            "[current: %default].");
+    argparser["--alignment-cache"] =
+        new argparse::knob(&alignment_cache_size, "N",
+            "If not zero, the alignments of up to N distinct reads (or read "
+            "pairs) are cached per thread, and reused for reads with "
+            "identical sequences. Recommended for libraries with many "
+            "duplicate reads, e.g. amplicons [current: %default].");
+    argparser["--adapter-prefilter"] =
+        new argparse::knob(&adapter_prefilter_length, "LENGTH",
+            "If not zero, SE reads sharing no k-mers of this length (4 to 12 "
+            "bp) with any adapter, and for which no acceptable short "
+            "alignment is possible, are classified as unaligned without "
+            "being aligned. Does not change the results, but is only "
+            "effective with low --mm values [current: %default].");
 }
 
 
@@ -574,6 +648,37 @@ argparse::parse_result userconfig::parse_args(int argc, char *argv[])
         return argparse::parse_result::error;
     }
 
+    if (aligner.seed_length && (aligner.seed_length < 4 || aligner.seed_length > 16)) {
+        std::cerr << "Error: --alignment-seed-length must be 0 or in the range "
+                  << "4 to 16, not " << aligner.seed_length << std::endl;
+        return argparse::parse_result::error;
+    }
+
+    if (aligner.index_kmer_length && (aligner.index_kmer_length < 4 || aligner.index_kmer_length > 16)) {
+        std::cerr << "Error: --adapter-index must be 0 or in the range 4 to "
+                  << "16, not " << aligner.index_kmer_length << std::endl;
+        return argparse::parse_result::error;
+    }
+
+    if (aligner.long_read_window && paired_ended_mode) {
+        std::cerr << "Error: --long-read-window is only supported for SE "
+                  << "reads." << std::endl;
+        return argparse::parse_result::error;
+    }
+
+    if (adapter_prefilter_length) {
+        if (adapter_prefilter_length < 4 || adapter_prefilter_length > 12) {
+            std::cerr << "Error: --adapter-prefilter must be 0 or in the range "
+                      << "4 to 12, not " << adapter_prefilter_length << std::endl;
+            return argparse::parse_result::error;
+        } else if (paired_ended_mode) {
+            std::cerr << "Error: --adapter-prefilter is only supported for SE "
+                      << "reads, since PE reads may also be aligned against "
+                      << "each other." << std::endl;
+            return argparse::parse_result::error;
+        }
+    }
+
     if (!max_threads) {
         std::cerr << "Error: --threads must be at least 1!" << std::endl;
         return argparse::parse_result::error;
@@ -608,6 +713,25 @@ argparse::parse_result userconfig::parse_args(int argc, char *argv[])
         return argparse::parse_result::error;
     }
 
+    try {
+        if (argparser.is_set("--shard")) {
+            shard = parse_shard_argument(shard_str);
+        }
+    } catch (const std::invalid_argument& error) {
+        std::cerr << "Error: Could not parse --shard argument: "
+                  << error.what()
+                  << std::endl;
+
+        return argparse::parse_result::error;
+    }
+
+    if (shard.second > 1 && input_files_1.size() != 1) {
+        std::cerr << "Error: --shard requires exactly one input file per "
+                  << "mate (--file1 / --file2)." << std::endl;
+
+        return argparse::parse_result::error;
+    }
+
     return argparse::parse_result::ok;
 }
 
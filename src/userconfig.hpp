@@ -160,6 +160,15 @@ public:
 
     //! The maximum number of threads used by the program
     unsigned max_threads;
+    //! The (0-based) shard of the input to process, and the number of shards
+    std::pair<unsigned, unsigned> shard;
+
+    //! Options determining how reads and adapters are aligned
+    alignment_options aligner;
+    //! Max number of alignments cached per thread; 0 disables the cache
+    unsigned alignment_cache_size;
+    //! Length of k-mers used by the SE adapter prefilter; 0 if disabled
+    unsigned adapter_prefilter_length;
 
     //! GZip compression enabled / disabled
     bool gzip;
@@ -225,6 +234,8 @@ private:
     string_vec trim5p;
     //! Sink for --trim3p
     string_vec trim3p;
+    //! Sink for --shard
+    std::string shard_str;
 };
 
 } // namespace ar
@@ -28,7 +28,10 @@
 
 #include "testing.hpp"
 #include "alignment.hpp"
+#include "alignment_cache.hpp"
+#include "batch_alignment.hpp"
 #include "fastq.hpp"
+#include "simd.hpp"
 
 
 #define TEST_ALIGNMENT_SETTER(TYPE, NAME) \
@@ -495,6 +498,28 @@ TEST_CASE("Best matching adapter returned: Second", "[alignment::single_end]")
 }
 
 
+TEST_CASE("Ties are resolved in favor of the first alignment", "[alignment::single_end]")
+{
+    // The overlap at offset 4 can at most tie the best alignment at offset 0
+    const fastq record("Read", "AACCAA", "!!!!!!");
+    const fastq_pair_vec adapters = create_adapter_vec(fastq("adapter", "AA", "JJ"));
+    const alignment_info expected = ALN().score(2).offset(0).length(2);
+    REQUIRE(align_single_ended_sequence(record, adapters, 0) == expected);
+}
+
+
+TEST_CASE("Ties are resolved in favor of the first adapter", "[alignment::single_end]")
+{
+    fastq_pair_vec adapters;
+    adapters.push_back(fastq_pair(fastq("adapter", "TGCTGC", "JJJJJJ"), fastq()));
+    adapters.push_back(fastq_pair(fastq("adapter", "TGCTGCA", "JJJJJJJ"), fastq()));
+
+    const fastq record("Read", "TAGTCGCTATGCTGC", "!!!!!!!!!103459");
+    const alignment_info expected = ALN().score(6).offset(9).length(6);
+    REQUIRE(align_single_ended_sequence(record, adapters, 0) == expected);
+}
+
+
 TEST_CASE("Best matching adapter returned: Neither", "[alignment::single_end]")
 {
     fastq_pair_vec barcodes;
@@ -711,6 +736,34 @@ TEST_CASE("Adapter only sequences, with missing base", "[alignment::paired_end]"
 }
 
 
+TEST_CASE("Read-only alignments are attributed to the first adapter pair", "[alignment::paired_end]")
+{
+    // Alignments where neither adapter overlaps the other read are identical
+    // for every adapter pair, and are only considered for the first pair
+    const fastq record1("Rec", "ACGTAGTA", "!!!!!!!!");
+    const fastq record2 = record1;
+    fastq_pair_vec adapters = create_adapter_vec(fastq("PCR1", "CGCTGA", "!!!!!!"),
+                                                 fastq("PCR2", "TGTAC",  "!!!!!"));
+    adapters.push_back(fastq_pair(fastq("PCR1", "TTTTTT", "!!!!!!"),
+                                  fastq("PCR2", "GGGGG",  "!!!!!")));
+    const alignment_info expected = ALN().score(8).length(8);
+    REQUIRE(align_paired_ended_sequences(record1, record2, adapters, 0) == expected);
+}
+
+
+TEST_CASE("Later adapter pairs are aligned where adapters overlap", "[alignment::paired_end]")
+{
+    const fastq record1("Rec", "ACGTAGTATTTTTT", "!!!!!!!!!!!!!!");
+    const fastq record2("Rec", "GGGGGACGTAGTA", "!!!!!!!!!!!!!");
+    fastq_pair_vec adapters = create_adapter_vec(fastq("PCR1", "CGCTGA", "!!!!!!"),
+                                                 fastq("PCR2", "TGTAC",  "!!!!!"));
+    adapters.push_back(fastq_pair(fastq("PCR1", "TTTTTT", "!!!!!!"),
+                                  fastq("PCR2", "GGGGG",  "!!!!!")));
+    const alignment_info expected = ALN().score(19).offset(-5).length(19).adapter_id(1);
+    REQUIRE(align_paired_ended_sequences(record1, record2, adapters, 0) == expected);
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // 
 
@@ -896,6 +949,85 @@ TEST_CASE("Offsets past the end throws", "[alignment::collapse]")
 }
 
 
+TEST_CASE("Truncating mates as sequenced", "[alignment::collapse]")
+{
+    fastq record1("Rec1", "ATATTATA", "01234567");
+    fastq record2("Rec2", "CCTATAAT", "ABCDEFGH");
+    const alignment_info alignment = ALN().offset(-2);
+    REQUIRE(truncate_paired_ended_mates(alignment, record1, record2) == 2);
+    REQUIRE(record1 == fastq("Rec1", "ATATTA", "012345"));
+    REQUIRE(record2 == fastq("Rec2", "CCTATA", "ABCDEF"));
+}
+
+
+TEST_CASE("Collapsing mates as sequenced", "[alignment::collapse]")
+{
+    const std::string nucleotides = "ACGTN";
+    const std::string qualities = "#+5?I";
+
+    unsigned int state = 31415;
+    std::string seq_1, seq_2, qual_1, qual_2;
+    for (size_t i = 0; i < 90; ++i) {
+        seq_1.push_back(nucleotides.at(random_value(state, 5)));
+        seq_2.push_back(i >= 20 && random_value(state, 3) ? seq_1.at(i - 20)
+                                                          : nucleotides.at(random_value(state, 5)));
+        qual_1.push_back(qualities.at(random_value(state, 5)));
+        qual_2.push_back(qualities.at(random_value(state, 5)));
+    }
+
+    // Mate 2 overlaps the last 70 bases of mate 1 and extends 20 bases past it
+    const alignment_info alignment = ALN().offset(20);
+    const fastq record1("Rec1", seq_1, qual_1);
+    fastq record2("Rec2", seq_2, qual_2);
+    fastq mate2 = record2;
+    mate2.reverse_complement();
+
+    std::mt19937 rng_1(1234);
+    std::mt19937 rng_2(1234);
+    const fastq expected = collapse_paired_ended_sequences(alignment, record1, record2, rng_1);
+    const fastq result = collapse_paired_ended_mates(alignment, record1, mate2, rng_2);
+
+    REQUIRE(result == expected);
+    REQUIRE(rng_1() == rng_2());
+}
+
+
+TEST_CASE("Collapsing long overlaps matches collapsing one site at a time", "[alignment::collapse]")
+{
+    const std::string nucleotides = "ACGTN";
+    const std::string qualities = "#+5?I";
+
+    unsigned int state = 2718;
+    std::string seq_1, seq_2, qual_1, qual_2;
+    for (size_t i = 0; i < 75; ++i) {
+        seq_1.push_back(nucleotides.at(random_value(state, 5)));
+        // Mostly identical bases, to exercise both the fast and the slow path
+        seq_2.push_back(random_value(state, 3) ? seq_1.back() : nucleotides.at(random_value(state, 5)));
+        qual_1.push_back(qualities.at(random_value(state, 5)));
+        qual_2.push_back(qualities.at(random_value(state, 5)));
+    }
+
+    const fastq record1("Rec1", seq_1, qual_1);
+    const fastq record2("Rec2", seq_2, qual_2);
+    std::mt19937 rng_1(1234);
+    const fastq result = collapse_paired_ended_sequences(ALN(), record1, record2, rng_1);
+
+    std::string expected_seq, expected_qual;
+    std::mt19937 rng_2(1234);
+    for (size_t i = 0; i < seq_1.length(); ++i) {
+        const fastq site1("Rec1", seq_1.substr(i, 1), qual_1.substr(i, 1));
+        const fastq site2("Rec2", seq_2.substr(i, 1), qual_2.substr(i, 1));
+        const fastq site = collapse_paired_ended_sequences(ALN(), site1, site2, rng_2);
+
+        expected_seq += site.sequence();
+        expected_qual += site.qualities();
+    }
+
+    REQUIRE(result == fastq("Rec1", expected_seq, expected_qual, FASTQ_ENCODING_SAM));
+    REQUIRE(rng_1() == rng_2());
+}
+
+
 TEST_CASE("Mate numbering is removed", "[alignment::collapse]")
 {
     const fastq record1("Read/1", "ATATTATA", "01234567");
@@ -1183,4 +1315,875 @@ TEST_CASE("Brute-force validation", "[alignment::compare_subsequences]")
     }
 }
 
+
+typedef bool (*compare_subsequences_func)(const alignment_info&, alignment_info&,
+                                          const char*, const char*);
+compare_subsequences_func select_compare_subsequences(simd::instruction_set is);
+
+typedef bool (*compare_joined_subsequences_func)(const alignment_info&, alignment_info&,
+                                                 const std::string&, const std::string&,
+                                                 const std::string&, const std::string&);
+compare_joined_subsequences_func select_compare_joined_subsequences(simd::instruction_set is);
+compare_joined_subsequences_func select_compare_reverse_complement_subsequences(simd::instruction_set is);
+
+
+TEST_CASE("SIMD kernels match scalar implementation", "[alignment::compare_subsequences]")
+{
+    const compare_subsequences_func expected_func = select_compare_subsequences(simd::instruction_set::none);
+    const std::string nucleotides = "ACGTN";
+
+    for (const auto is : simd::supported()) {
+        const compare_subsequences_func func = select_compare_subsequences(is);
+        unsigned int state = 12345;
+
+        for (size_t seqlen = 1; seqlen <= 150; ++seqlen) {
+            for (size_t round = 0; round < 20; ++round) {
+                std::string mate1;
+                std::string mate2;
+                for (size_t i = 0; i < seqlen; ++i) {
+                    mate1.push_back(nucleotides.at(random_value(state, 5)));
+                    // Mostly matching bases, to avoid early termination
+                    mate2.push_back(random_value(state, 4) ? mate1.back() : nucleotides.at(random_value(state, 5)));
+                }
+
+                alignment_info best;
+                best.score = static_cast<int>(round % 5) * static_cast<int>(seqlen) / 5;
+
+                alignment_info expected;
+                expected.length = seqlen;
+                const bool expected_result = expected_func(best, expected, mate1.c_str(), mate2.c_str());
+
+                alignment_info current;
+                current.length = seqlen;
+                const bool result = func(best, current, mate1.c_str(), mate2.c_str());
+
+                // Don't count all these checks in test statistics
+                if (result != expected_result) {
+                    INFO("instruction set: " << simd::name(is));
+                    REQUIRE(result == expected_result);
+                }
+
+                // Counts are only reliable for successful alignments
+                if (result && !(current == expected)) {
+                    INFO("instruction set: " << simd::name(is));
+                    REQUIRE(current == expected);
+                }
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Joined sequence kernels match contiguous kernels", "[alignment::compare_subsequences]")
+{
+    const compare_subsequences_func expected_func = select_compare_subsequences(simd::instruction_set::none);
+    const std::string nucleotides = "ACGTN";
+
+    for (const auto is : simd::supported()) {
+        const compare_joined_subsequences_func func = select_compare_joined_subsequences(is);
+        unsigned int state = 12345;
+
+        for (size_t seqlen = 1; seqlen <= 150; ++seqlen) {
+            for (size_t round = 0; round < 20; ++round) {
+                std::string mate1;
+                std::string mate2;
+                for (size_t i = 0; i < seqlen; ++i) {
+                    mate1.push_back(nucleotides.at(random_value(state, 5)));
+                    mate2.push_back(random_value(state, 4) ? mate1.back() : nucleotides.at(random_value(state, 5)));
+                }
+
+                // Split each sequence at an arbitrary position, including at either end
+                const size_t split_1 = random_value(state, seqlen + 1);
+                const size_t split_2 = random_value(state, seqlen + 1);
+
+                alignment_info best;
+                best.score = static_cast<int>(round % 5) * static_cast<int>(seqlen) / 5;
+
+                alignment_info expected;
+                expected.length = seqlen;
+                const bool expected_result = expected_func(best, expected, mate1.c_str(), mate2.c_str());
+
+                alignment_info current;
+                current.length = seqlen;
+                const bool result = func(best, current,
+                                         mate1.substr(0, split_1), mate1.substr(split_1),
+                                         mate2.substr(0, split_2), mate2.substr(split_2));
+
+                if (result != expected_result) {
+                    INFO("instruction set: " << simd::name(is));
+                    REQUIRE(result == expected_result);
+                }
+
+                if (result && !(current == expected)) {
+                    INFO("instruction set: " << simd::name(is));
+                    REQUIRE(current == expected);
+                }
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Reverse complement sequence kernels match contiguous kernels", "[alignment::compare_subsequences]")
+{
+    const compare_subsequences_func expected_func = select_compare_subsequences(simd::instruction_set::none);
+    const std::string nucleotides = "ACGTN";
+
+    for (const auto is : simd::supported()) {
+        const compare_joined_subsequences_func func = select_compare_reverse_complement_subsequences(is);
+        unsigned int state = 12345;
+
+        for (size_t seqlen = 1; seqlen <= 150; ++seqlen) {
+            for (size_t round = 0; round < 20; ++round) {
+                std::string mate1;
+                std::string mate2;
+                for (size_t i = 0; i < seqlen; ++i) {
+                    mate1.push_back(nucleotides.at(random_value(state, 5)));
+                    mate2.push_back(random_value(state, 4) ? mate1.back() : nucleotides.at(random_value(state, 5)));
+                }
+
+                const size_t split_1 = random_value(state, seqlen + 1);
+                const size_t split_2 = random_value(state, seqlen + 1);
+
+                // The start of mate 2 is passed as the reverse complement
+                fastq head_2("Read", mate2.substr(0, split_2));
+                head_2.reverse_complement();
+
+                alignment_info best;
+                best.score = static_cast<int>(round % 5) * static_cast<int>(seqlen) / 5;
+
+                alignment_info expected;
+                expected.length = seqlen;
+                const bool expected_result = expected_func(best, expected, mate1.c_str(), mate2.c_str());
+
+                alignment_info current;
+                current.length = seqlen;
+                const bool result = func(best, current,
+                                         mate1.substr(0, split_1), mate1.substr(split_1),
+                                         head_2.sequence(), mate2.substr(split_2));
+
+                if (result != expected_result) {
+                    INFO("instruction set: " << simd::name(is));
+                    REQUIRE(result == expected_result);
+                }
+
+                if (result && !(current == expected)) {
+                    INFO("instruction set: " << simd::name(is));
+                    REQUIRE(current == expected);
+                }
+            }
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Validation of optional alignment strategies
+
+/** Returns a pseudo-random read, optionally containing (part of) an adapter */
+fastq random_read(unsigned int& state, const std::string& adapter)
+{
+    std::string sequence = random_sequence(state, 1 + random_value(state, 150));
+    const size_t pos = random_value(state, sequence.length() + 1);
+    sequence.replace(pos, std::string::npos, adapter.substr(0, sequence.length() - pos));
+
+    return fastq("read", sequence, std::string(sequence.length(), 'I'));
+}
+
+
+void require_same_alignments(const alignment_options& options)
+{
+    unsigned int state = 54321;
+
+    fastq_pair_vec adapters;
+    for (size_t i = 0; i < 3; ++i) {
+        const std::string adapter_1 = random_sequence(state, 20 + i * 10);
+        const std::string adapter_2 = random_sequence(state, 25 + i * 10);
+        adapters.push_back(fastq_pair(fastq("pcr1", adapter_1, std::string(adapter_1.length(), 'I')),
+                                      fastq("pcr2", adapter_2, std::string(adapter_2.length(), 'I'))));
+    }
+
+    for (size_t round = 0; round < 1000; ++round) {
+        const fastq_pair& adapter = adapters.at(round % adapters.size());
+        const fastq read_1 = random_read(state, adapter.first.sequence());
+        const fastq read_2 = random_read(state, adapter.second.sequence());
+
+        for (int shift = 0; shift < 3; ++shift) {
+            const alignment_info expected_se = align_single_ended_sequence(read_1, adapters, shift);
+            const alignment_info result_se = align_single_ended_sequence(read_1, adapters, shift, options);
+            // Don't count all these checks in test statistics
+            if (!(expected_se == result_se)) {
+                REQUIRE(expected_se == result_se);
+            }
+
+            const alignment_info expected_pe = align_paired_ended_sequences(read_1, read_2, adapters, shift);
+            const alignment_info result_pe = align_paired_ended_sequences(read_1, read_2, adapters, shift, options);
+            if (!(expected_pe == result_pe)) {
+                REQUIRE(expected_pe == result_pe);
+            }
+        }
+    }
+}
+
+
+/**
+ * Checks that aligning mate 2 as sequenced gives the same results as aligning
+ * the reverse complemented mate 2.
+ */
+void require_same_mate_alignments(const alignment_options& options)
+{
+    unsigned int state = 13579;
+
+    fastq_pair_vec adapters;
+    for (size_t i = 0; i < 3; ++i) {
+        const std::string adapter_1 = random_sequence(state, 20 + i * 10);
+        const std::string adapter_2 = random_sequence(state, 25 + i * 10);
+        adapters.push_back(fastq_pair(fastq("pcr1", adapter_1, std::string(adapter_1.length(), 'I')),
+                                      fastq("pcr2", adapter_2, std::string(adapter_2.length(), 'I'))));
+    }
+
+    const adapter_profile profile(adapters, 2, options);
+    for (size_t round = 0; round < 1000; ++round) {
+        const fastq_pair& adapter = adapters.at(round % adapters.size());
+        const fastq read_1 = random_read(state, adapter.first.sequence());
+        const fastq read_2 = random_read(state, adapter.second.sequence());
+
+        fastq mate_2 = read_2;
+        mate_2.reverse_complement();
+
+        const alignment_info expected = align_paired_ended_sequences(read_1, read_2, profile);
+        const alignment_info result = align_paired_ended_mates(read_1, mate_2, profile);
+        // Don't count all these checks in test statistics
+        if (!(expected == result)) {
+            REQUIRE(expected == result);
+        }
+    }
+}
+
+
+TEST_CASE("PE alignments of mates as sequenced match reverse complemented mates", "[alignment::mates]")
+{
+    require_same_mate_alignments(alignment_options());
+}
+
+
+TEST_CASE("Packed PE alignments of mates as sequenced", "[alignment::mates]")
+{
+    alignment_options options;
+    options.packed = true;
+
+    require_same_mate_alignments(options);
+}
+
+
+TEST_CASE("Seeded PE alignments of mates as sequenced", "[alignment::mates]")
+{
+    alignment_options options;
+    options.seed_length = 4;
+
+    require_same_mate_alignments(options);
+}
+
+
+TEST_CASE("Indexed PE alignments of mates as sequenced", "[alignment::mates]")
+{
+    alignment_options options;
+    options.index_kmer_length = 6;
+
+    require_same_mate_alignments(options);
+}
+
+
+TEST_CASE("Packed alignments match unpacked alignments", "[alignment::packed]")
+{
+    alignment_options options;
+    options.packed = true;
+
+    require_same_alignments(options);
+}
+
+
+TEST_CASE("Seeded alignment finds adapter with exact seed", "[alignment::seeds]")
+{
+    alignment_options options;
+    options.seed_length = 4;
+
+    const fastq record("Rec", "TTGCATTGCATTAGATCGGAATAGCACACG", std::string(30, 'I'));
+    const fastq_pair_vec adapters = create_adapter_vec(fastq("Adp", "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC", std::string(34, 'I')));
+    const alignment_info expected = ALN().score(16).offset(12).length(18).n_mismatches(1);
+    REQUIRE(align_single_ended_sequence(record, adapters, 2) == expected);
+    REQUIRE(align_single_ended_sequence(record, adapters, 2, options) == expected);
+}
+
+
+TEST_CASE("Seeded alignment scores short terminal overlaps", "[alignment::seeds]")
+{
+    alignment_options options;
+    options.seed_length = 4;
+
+    const fastq record("Rec", "GGGGGGGGGGGGTAC", std::string(15, 'I'));
+    const fastq_pair_vec adapters = create_adapter_vec(fastq("Adp", "TACTTTTTTTT", std::string(11, 'I')));
+    const alignment_info expected = ALN().score(3).offset(12).length(3);
+    REQUIRE(align_single_ended_sequence(record, adapters, 0) == expected);
+    REQUIRE(align_single_ended_sequence(record, adapters, 0, options) == expected);
+}
+
+
+TEST_CASE("Seeded alignment skips offsets without seeds", "[alignment::seeds]")
+{
+    alignment_options options;
+    options.seed_length = 4;
+
+    // Every 4-mer in the overlap contains a mismatch
+    const fastq record("Rec", "TTTTTTTTTTACGAACGAACGA", std::string(22, 'I'));
+    const fastq_pair_vec adapters = create_adapter_vec(fastq("Adp", "ACGTACGTACGTGGGG", std::string(16, 'I')));
+    const alignment_info expected = ALN().score(6).offset(10).length(12).n_mismatches(3);
+    REQUIRE(align_single_ended_sequence(record, adapters, 0) == expected);
+    REQUIRE(!(align_single_ended_sequence(record, adapters, 0, options) == expected));
+}
+
+
+TEST_CASE("Seeded PE alignment finds overlapping mates", "[alignment::seeds]")
+{
+    alignment_options options;
+    options.seed_length = 5;
+
+    const fastq record1("Rec", "ACGTAGTAACCGATTGCA", std::string(18, 'I'));
+    const fastq record2("Rec", "AGTAACCGATTGCAAGGT", std::string(18, 'I'));
+    const fastq_pair_vec adapters = create_adapter_vec(fastq("PCR1", "CGCTGA", "!!!!!!"),
+                                                       fastq("PCR2", "TGTAC",  "!!!!!"));
+    const alignment_info expected = align_paired_ended_sequences(record1, record2, adapters, 0);
+    REQUIRE(expected == ALN().score(14).offset(4).length(14));
+    REQUIRE(align_paired_ended_sequences(record1, record2, adapters, 0, options) == expected);
+}
+
+
+TEST_CASE("Seeded PE alignment finds seeds spanning adapter 2 and read 1", "[alignment::seeds]")
+{
+    alignment_options options;
+    options.seed_length = 4;
+
+    const fastq record1("Rec", "TAGTTAAG", std::string(8, 'I'));
+    const fastq record2("Rec", "ATAGCTAGGCCGA", std::string(13, 'I'));
+    const fastq_pair_vec adapters = create_adapter_vec(fastq("PCR1", "CCAGC", "!!!!!"),
+                                                       fastq("PCR2", "TAAATCAA", "!!!!!!!!"));
+    const alignment_info expected = align_paired_ended_sequences(record1, record2, adapters, 0);
+    REQUIRE(expected == ALN().score(5).offset(-1).length(9).n_mismatches(2));
+    REQUIRE(align_paired_ended_sequences(record1, record2, adapters, 0, options) == expected);
+}
+
+
+TEST_CASE("Seeded PE alignment finds seeds spanning read 2 and adapter 1", "[alignment::seeds]")
+{
+    alignment_options options;
+    options.seed_length = 4;
+
+    const fastq record1("Rec", "CCCTCTGGCTGCA", std::string(13, 'I'));
+    const fastq record2("Rec", "ATGGTTGC", std::string(8, 'I'));
+    const fastq_pair_vec adapters = create_adapter_vec(fastq("PCR1", "ACCATATC", "!!!!!!!!"),
+                                                       fastq("PCR2", "CAACCAAT", "!!!!!!!!"));
+    const alignment_info expected = align_paired_ended_sequences(record1, record2, adapters, 0);
+    REQUIRE(expected == ALN().score(5).offset(4).length(9).n_mismatches(2));
+    REQUIRE(align_paired_ended_sequences(record1, record2, adapters, 0, options) == expected);
+}
+
+
+TEST_CASE("Long-read windows find adapters at the 3' end", "[alignment::long_reads]")
+{
+    alignment_options options;
+    options.long_read_window = 10;
+
+    const fastq record("Rec", std::string(40, 'T') + "AGATCGGA", std::string(48, 'I'));
+    const fastq_pair_vec adapters = create_adapter_vec(fastq("Adp", "AGATCGGAAGAG", std::string(12, 'I')));
+    const alignment_info expected = ALN().score(8).offset(40).length(8);
+    REQUIRE(align_single_ended_sequence(record, adapters, 0) == expected);
+    REQUIRE(align_single_ended_sequence(record, adapters, 0, options) == expected);
+
+    options.packed = true;
+    REQUIRE(align_single_ended_sequence(record, adapters, 0, options) == expected);
+}
+
+
+TEST_CASE("Long-read windows find adapters at the 5' end", "[alignment::long_reads]")
+{
+    alignment_options options;
+    options.long_read_window = 10;
+
+    const fastq record("Rec", "TTTTTAGATCGGAAGAG" + std::string(40, 'T'), std::string(57, 'I'));
+    const fastq_pair_vec adapters = create_adapter_vec(fastq("Adp", "AGATCGGAAGAG", std::string(12, 'I')));
+    const alignment_info expected = ALN().score(12).offset(5).length(12);
+    REQUIRE(align_single_ended_sequence(record, adapters, 0) == expected);
+    REQUIRE(align_single_ended_sequence(record, adapters, 0, options) == expected);
+
+    options.packed = true;
+    REQUIRE(align_single_ended_sequence(record, adapters, 0, options) == expected);
+}
+
+
+TEST_CASE("Long-read windows skip adapters in the middle of reads", "[alignment::long_reads]")
+{
+    alignment_options options;
+    options.long_read_window = 10;
+
+    const fastq record("Rec", std::string(20, 'T') + "AGATCGGAAGAG" + std::string(20, 'T'), std::string(52, 'I'));
+    const fastq_pair_vec adapters = create_adapter_vec(fastq("Adp", "AGATCGGAAGAG", std::string(12, 'I')));
+    REQUIRE(align_single_ended_sequence(record, adapters, 0) == ALN().score(12).offset(20).length(12));
+    REQUIRE(align_single_ended_sequence(record, adapters, 0, options) == alignment_info());
+
+    // Reads no longer than twice the window are aligned in full
+    options.long_read_window = 26;
+    REQUIRE(align_single_ended_sequence(record, adapters, 0, options) == ALN().score(12).offset(20).length(12));
+}
+
+
+fastq_pair_vec create_indexed_adapters()
+{
+    fastq_pair_vec adapters;
+    adapters.push_back(fastq_pair(fastq("adapter", "CCCCCCCCCCCCCCCCCCCC"), fastq("adapter", "GGGGGGGGGGGGGGGGGGGG")));
+    adapters.push_back(fastq_pair(fastq("adapter", "AGATCGGAAGAGCACACGTC"), fastq("adapter", "TTTTTTTTTTTTTTTTTTTT")));
+    adapters.push_back(fastq_pair(fastq("adapter", "ACACACACACACACACACAC"), fastq("adapter", "AGATCGGAAGAGCGTCGTGT")));
+
+    return adapters;
+}
+
+
+TEST_CASE("Adapter index finds adapters sharing k-mers", "[alignment::adapter_index]")
+{
+    const adapter_index index(create_indexed_adapters(), 6);
+    REQUIRE(index.kmer_length() == 6);
+
+    std::vector<bool> candidates(3, false);
+    index.find_candidates("TTTTAGATCGGAAGATTTT", true, candidates);
+    REQUIRE(candidates == std::vector<bool>({false, true, false}));
+
+    candidates.assign(3, false);
+    index.find_candidates("TTTTAGATCGGAAGATTTT", false, candidates);
+    REQUIRE(candidates == std::vector<bool>({false, false, true}));
+
+    candidates.assign(3, false);
+    index.find_candidates("ATATATATATATATAT", true, candidates);
+    REQUIRE(candidates == std::vector<bool>({false, false, false}));
+}
+
+
+TEST_CASE("Empty adapter index finds no candidates", "[alignment::adapter_index]")
+{
+    const adapter_index index;
+    REQUIRE(index.kmer_length() == 0);
+
+    std::vector<bool> candidates(3, false);
+    index.find_candidates("CCCCCCCCCCCCCCCCCCCC", true, candidates);
+    REQUIRE(candidates == std::vector<bool>(3, false));
+}
+
+
+TEST_CASE("Indexed SE alignment selects adapter sharing k-mers", "[alignment::adapter_index]")
+{
+    const fastq_pair_vec adapters = create_indexed_adapters();
+    alignment_options options;
+    options.index_kmer_length = 6;
+
+    const fastq record("Read", "TGCATGCATGCAAGATCGGAAGAGCAC");
+    const alignment_info expected = ALN().score(15).offset(12).length(15).adapter_id(1);
+    REQUIRE(align_single_ended_sequence(record, adapters, 2) == expected);
+    REQUIRE(align_single_ended_sequence(record, adapters, 2, options) == expected);
+}
+
+
+TEST_CASE("Indexed SE alignment finds short overlaps with all adapters", "[alignment::adapter_index]")
+{
+    const fastq_pair_vec adapters = create_indexed_adapters();
+    alignment_options options;
+    options.index_kmer_length = 6;
+
+    const fastq record("Read", "TGCATGCATGCATGCATGCAACAC");
+    const alignment_info expected = ALN().score(4).offset(20).length(4).adapter_id(2);
+    REQUIRE(align_single_ended_sequence(record, adapters, 2) == expected);
+    REQUIRE(align_single_ended_sequence(record, adapters, 2, options) == expected);
+}
+
+
+TEST_CASE("Adapter profile caches adapter sequences", "[alignment::adapter_profile]")
+{
+    alignment_options options;
+    options.index_kmer_length = 6;
+    options.packed = true;
+
+    const adapter_profile profile(create_indexed_adapters(), 9, options);
+    REQUIRE(profile.size() == 3);
+    REQUIRE(profile.max_shift() == 9);
+    REQUIRE(profile.index().kmer_length() == 6);
+
+    const adapter_profile::adapter_pair& pair = profile.at(1);
+    REQUIRE(std::string(profile.sequence_1(pair), pair.length_1) == "AGATCGGAAGAGCACACGTC");
+    REQUIRE(std::string(profile.sequence_2(pair), pair.length_2) == "TTTTTTTTTTTTTTTTTTTT");
+    REQUIRE(profile.packed_1(1).length() == 20);
+    REQUIRE(profile.packed_2(1).length() == 20);
+    // Overlaps of 12+ bases cannot be pruned in SE mode given a shift of 9
+    REQUIRE(!pair.se_prunable);
+    REQUIRE(pair.pe_prunable);
+}
+
+
+TEST_CASE("Empty adapter profile finds no alignments", "[alignment::adapter_profile]")
+{
+    const adapter_profile profile;
+    REQUIRE(profile.size() == 0);
+
+    const fastq record("Read", "ACGTACGTACGT");
+    REQUIRE(align_single_ended_sequence(record, profile) == alignment_info());
+    REQUIRE(align_paired_ended_sequences(record, record, profile) == alignment_info());
+}
+
+
+TEST_CASE("Indexed PE alignment matches unindexed alignment", "[alignment::adapter_index]")
+{
+    const fastq_pair_vec adapters = create_indexed_adapters();
+    alignment_options options;
+    options.index_kmer_length = 6;
+
+    // Mate 2 has been reverse complemented, as during trimming
+    const fastq record1("Read", "TGCATGCATGCAAGATCGGAAGAGCAC");
+    const fastq record2("Read", "AGCGTCGTGTTGCATGCATGCA");
+    const alignment_info expected = align_paired_ended_sequences(record1, record2, adapters, 2);
+    REQUIRE(expected.adapter_id == 1);
+    REQUIRE(align_paired_ended_sequences(record1, record2, adapters, 2, options) == expected);
+}
+
+
+/**
+ * Returns reads consisting of random bases followed by (part of) an adapter;
+ * runs of reads have the same length, as required for batched alignment.
+ */
+fastq_vec create_batch_reads(const std::string& adapter, unsigned int seed)
+{
+    const std::string nucleotides = "ACGTN";
+    // Runs of reads with identical lengths, incl. runs too short for batching
+    const size_t run_lengths[][2] = {{70, 40}, {3, 30}, {64, 25}, {130, 300}, {10, 50}};
+
+    fastq_vec reads;
+    unsigned int state = seed;
+    for (const auto& run : run_lengths) {
+        for (size_t i = 0; i < run[0]; ++i) {
+            const size_t insert_size = random_value(state, run[1] + 10);
+
+            std::string sequence;
+            for (size_t j = 0; j < run[1]; ++j) {
+                char nt = nucleotides.at(random_value(state, 5));
+                if (j >= insert_size && j - insert_size < adapter.length() && random_value(state, 8)) {
+                    nt = adapter.at(j - insert_size);
+                }
+
+                sequence.push_back(nt);
+            }
+
+            reads.push_back(fastq("Read", sequence));
+        }
+    }
+
+    return reads;
+}
+
+
+TEST_CASE("Batched SE alignments match per-read alignments", "[alignment::batch]")
+{
+    const adapter_profile adapters(create_indexed_adapters(), 3);
+    const fastq_vec reads = create_batch_reads("AGATCGGAAGAGCACACGTC", 12345);
+
+    for (const auto is : simd::supported()) {
+        const std::vector<alignment_info> results = align_single_ended_sequences(reads, adapters, is);
+        REQUIRE(results.size() == reads.size());
+
+        for (size_t i = 0; i < reads.size(); ++i) {
+            const alignment_info expected = align_single_ended_sequence(reads.at(i), adapters);
+
+            // Don't count all these checks in test statistics
+            if (!(results.at(i) == expected)) {
+                INFO("instruction set: " << simd::name(is) << ", read: " << i);
+                REQUIRE(results.at(i) == expected);
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Batched PE alignments match per-read alignments", "[alignment::batch]")
+{
+    const adapter_profile adapters(create_indexed_adapters(), 3);
+    const fastq_vec reads1 = create_batch_reads("AGATCGGAAGAGCACACGTC", 12345);
+    // Mate 2 has been reverse complemented, as during trimming
+    const fastq_vec reads2 = create_batch_reads("ACACGTCGCTCTTCCGATCT", 54321);
+
+    for (const auto is : simd::supported()) {
+        const std::vector<alignment_info> results = align_paired_ended_sequences(reads1, reads2, adapters, is);
+        REQUIRE(results.size() == reads1.size());
+
+        for (size_t i = 0; i < reads1.size(); ++i) {
+            const alignment_info expected = align_paired_ended_sequences(reads1.at(i), reads2.at(i), adapters);
+
+            // Don't count all these checks in test statistics
+            if (!(results.at(i) == expected)) {
+                INFO("instruction set: " << simd::name(is) << ", read: " << i);
+                REQUIRE(results.at(i) == expected);
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Batched PE alignments of mates as sequenced", "[alignment::batch]")
+{
+    const adapter_profile adapters(create_indexed_adapters(), 3);
+    const fastq_vec reads1 = create_batch_reads("AGATCGGAAGAGCACACGTC", 12345);
+    const fastq_vec reads2 = create_batch_reads("ACACGTCGCTCTTCCGATCT", 54321);
+
+    fastq_vec mates2 = reads2;
+    for (auto& read : mates2) {
+        read.reverse_complement();
+    }
+
+    for (const auto is : simd::supported()) {
+        const std::vector<alignment_info> expected = align_paired_ended_sequences(reads1, reads2, adapters, is);
+        const std::vector<alignment_info> results = align_paired_ended_mates(reads1, mates2, adapters, is);
+
+        INFO("instruction set: " << simd::name(is));
+        REQUIRE(results == expected);
+    }
+}
+
+
+TEST_CASE("Batched alignments with seeds match per-read alignments", "[alignment::batch]")
+{
+    alignment_options options;
+    options.seed_length = 4;
+
+    const adapter_profile adapters(create_indexed_adapters(), 3, options);
+    const fastq_vec reads = create_batch_reads("AGATCGGAAGAGCACACGTC", 12345);
+    const std::vector<alignment_info> results = align_single_ended_sequences(reads, adapters);
+
+    REQUIRE(results.size() == reads.size());
+    for (size_t i = 0; i < reads.size(); ++i) {
+        // Don't count all these checks in test statistics
+        if (!(results.at(i) == align_single_ended_sequence(reads.at(i), adapters))) {
+            REQUIRE(results.at(i) == align_single_ended_sequence(reads.at(i), adapters));
+        }
+    }
+}
+
+
+TEST_CASE("Batched alignments with long adapters match per-read alignments", "[alignment::batch]")
+{
+    // Adapter 2 + read 1 and read 2 + adapter 1 exceed the length supported
+    // by batches, and PE reads must therefore be aligned one at a time
+    fastq_pair_vec adapter_vec;
+    adapter_vec.push_back(fastq_pair(fastq("adapter", "AGATCGGAAGAGCACACGTC" + std::string(70000, 'N')),
+                                     fastq("adapter", std::string(70000, 'N') + "AGATCGGAAGAGCGTCGTGT")));
+
+    const adapter_profile adapters(adapter_vec, 3);
+    const fastq_vec reads1 = create_batch_reads("AGATCGGAAGAGCACACGTC", 12345);
+    const fastq_vec reads2 = create_batch_reads("ACACGTCGCTCTTCCGATCT", 54321);
+
+    for (const auto is : simd::supported()) {
+        const std::vector<alignment_info> results_se = align_single_ended_sequences(reads1, adapters, is);
+        const std::vector<alignment_info> results_pe = align_paired_ended_sequences(reads1, reads2, adapters, is);
+        REQUIRE(results_se.size() == reads1.size());
+        REQUIRE(results_pe.size() == reads1.size());
+
+        for (size_t i = 0; i < reads1.size(); ++i) {
+            const alignment_info expected_se = align_single_ended_sequence(reads1.at(i), adapters);
+            const alignment_info expected_pe = align_paired_ended_sequences(reads1.at(i), reads2.at(i), adapters);
+
+            // Don't count all these checks in test statistics
+            if (!(results_se.at(i) == expected_se) || !(results_pe.at(i) == expected_pe)) {
+                INFO("instruction set: " << simd::name(is) << ", read: " << i);
+                REQUIRE(results_se.at(i) == expected_se);
+                REQUIRE(results_pe.at(i) == expected_pe);
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Batched alignment of unequal numbers of mates throws", "[alignment::batch]")
+{
+    const adapter_profile adapters(create_indexed_adapters(), 3);
+    const fastq_vec reads1(2, fastq("Read", "ACGTACGT"));
+    const fastq_vec reads2(1, fastq("Read", "ACGTACGT"));
+
+    REQUIRE_THROWS_AS(align_paired_ended_sequences(reads1, reads2, adapters), std::invalid_argument);
+}
+
+
+TEST_CASE("Alignment cache returns inserted alignments", "[alignment::cache]")
+{
+    alignment_cache cache(16);
+    REQUIRE(cache.capacity() == 16);
+
+    alignment_info expected;
+    expected.offset = 7;
+    expected.length = 5;
+    expected.score = 5;
+    expected.adapter_id = 1;
+
+    alignment_info result;
+    REQUIRE(!cache.lookup("ACGTACGTACGT", "", result));
+    cache.insert("ACGTACGTACGT", "", expected);
+    REQUIRE(cache.lookup("ACGTACGTACGT", "", result));
+    REQUIRE(result == expected);
+}
+
+
+TEST_CASE("Alignment cache compares full sequences", "[alignment::cache]")
+{
+    alignment_cache cache(1);
+    alignment_info alignment;
+    alignment.adapter_id = 0;
+    cache.insert("ACGT", "TTTT", alignment);
+
+    alignment_info result;
+    REQUIRE(!cache.lookup("ACGT", "", result));
+    REQUIRE(!cache.lookup("ACG", "TTTTT", result));
+    REQUIRE(!cache.lookup("ACGT", "TTTA", result));
+    REQUIRE(cache.lookup("ACGT", "TTTT", result));
+
+    // A single slot only holds the most recently inserted alignment
+    cache.insert("GGGG", "", alignment);
+    REQUIRE(!cache.lookup("ACGT", "TTTT", result));
+    REQUIRE(cache.lookup("GGGG", "", result));
+}
+
+
+TEST_CASE("Alignment cache requires a capacity", "[alignment::cache]")
+{
+    REQUIRE_THROWS_AS(alignment_cache(0), std::invalid_argument);
+}
+
+
+TEST_CASE("Batched alignment of selected reads", "[alignment::batch]")
+{
+    const adapter_profile adapters(create_indexed_adapters(), 3);
+    const fastq_vec reads = create_batch_reads("AGATCGGAAGAGCACACGTC", 12345);
+
+    index_vec indices;
+    for (size_t i = 1; i < reads.size(); i += 3) {
+        indices.push_back(i);
+    }
+
+    const std::vector<alignment_info> results = align_single_ended_sequences(reads, indices, adapters);
+    REQUIRE(results.size() == indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        const alignment_info expected = align_single_ended_sequence(reads.at(indices.at(i)), adapters);
+
+        // Don't count all these checks in test statistics
+        if (!(results.at(i) == expected)) {
+            REQUIRE(results.at(i) == expected);
+        }
+    }
+}
+
+
+/** Acceptance criteria equivalent to userconfig::is_good_alignment. */
+bool is_good_test_alignment(const alignment_info& alignment, double mismatch_rate, size_t min_overlap)
+{
+    if (!alignment.length || alignment.score <= 0) {
+        return false;
+    }
+
+    const size_t n_aligned = alignment.length - alignment.n_ambiguous;
+    size_t mm_threshold = static_cast<size_t>(mismatch_rate * n_aligned);
+    if (n_aligned < min_overlap) {
+        return false;
+    } else if (n_aligned < 6) {
+        mm_threshold = 0;
+    } else if (n_aligned < 10) {
+        mm_threshold = std::min<size_t>(1, mm_threshold);
+    }
+
+    return static_cast<size_t>(alignment.n_mismatches) <= mm_threshold;
+}
+
+
+TEST_CASE("Prefiltered reads have no acceptable alignments", "[alignment::prefilter]")
+{
+    fastq_pair_vec adapters = create_indexed_adapters();
+    // Ns in adapters (e.g. barcodes) are not counted as mismatches
+    adapters.push_back(fastq_pair(fastq("adapter", "TGGAATTCTCGGNNNNNNGCCAAGG"), fastq("adapter", "A")));
+
+    const auto is_good = [](const alignment_info& alignment) {
+        return is_good_test_alignment(alignment, 0.1, 3);
+    };
+
+    const adapter_profile profile(adapters, 2);
+    const adapter_prefilter prefilter(adapters, 2, 6, is_good);
+    REQUIRE(prefilter.enabled());
+
+    const std::string nucleotides = "ACGT";
+    const std::string adapter = "TGGAATTCTCGGACGTACGCCAAGG";
+    unsigned int state = 12345;
+    size_t n_filtered = 0;
+    for (size_t round = 0; round < 2000; ++round) {
+        const size_t insert_size = random_value(state, 60);
+
+        std::string sequence;
+        for (size_t i = 0; i < 50; ++i) {
+            char nt = nucleotides.at(random_value(state, 4));
+            if (i >= insert_size && random_value(state, 16)) {
+                nt = adapter.at((i - insert_size) % adapter.length());
+            }
+
+            sequence.push_back(nt);
+        }
+
+        const fastq read("Read", sequence);
+        if (prefilter.is_adapter_free(read)) {
+            n_filtered++;
+
+            // Don't count all these checks in test statistics
+            if (is_good(align_single_ended_sequence(read, profile))) {
+                REQUIRE(!is_good(align_single_ended_sequence(read, profile)));
+            }
+        }
+    }
+
+    REQUIRE(n_filtered > 0);
+}
+
+
+TEST_CASE("Prefilter does not exclude reads with Ns", "[alignment::prefilter]")
+{
+    const auto is_good = [](const alignment_info& alignment) {
+        return is_good_test_alignment(alignment, 0.1, 3);
+    };
+
+    const adapter_prefilter prefilter(create_indexed_adapters(), 2, 6, is_good);
+    REQUIRE(prefilter.is_adapter_free(fastq("Read", "GTGTGTGTGTGTGTGTGTGTGTGTA")));
+    REQUIRE(!prefilter.is_adapter_free(fastq("Read", "GTGTGTGTGTGTGTGTGTGTGTGTN")));
+    // Short overlaps are checked directly
+    REQUIRE(!prefilter.is_adapter_free(fastq("Read", "GTGTGTGTGTGTGTGTGTGTGTAGA")));
+}
+
+
+TEST_CASE("Prefilter is disabled for high mismatch rates", "[alignment::prefilter]")
+{
+    const auto is_good = [](const alignment_info& alignment) {
+        return is_good_test_alignment(alignment, 1.0 / 3.0, 0);
+    };
+
+    REQUIRE(!adapter_prefilter().enabled());
+    REQUIRE(!adapter_prefilter(create_indexed_adapters(), 2, 8, is_good).enabled());
+    REQUIRE(adapter_prefilter(create_indexed_adapters(), 2, 2, is_good).enabled());
+}
+
+
+TEST_CASE("Prefilter k-mer length must be in the range 1 to 12", "[alignment::prefilter]")
+{
+    const auto is_good = [](const alignment_info& alignment) {
+        return is_good_test_alignment(alignment, 0.0, 0);
+    };
+
+    REQUIRE_THROWS_AS(adapter_prefilter(create_indexed_adapters(), 2, 0, is_good), std::invalid_argument);
+    REQUIRE_THROWS_AS(adapter_prefilter(create_indexed_adapters(), 2, 13, is_good), std::invalid_argument);
+    REQUIRE_THROWS_AS(adapter_prefilter(create_indexed_adapters(), 2, 40, is_good), std::invalid_argument);
+}
+
 } // namespace ar
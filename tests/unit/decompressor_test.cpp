@@ -0,0 +1,697 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <string>
+
+#include <bzlib.h>
+#include <zlib.h>
+
+#include "testing.hpp"
+#include "decompressor.hpp"
+#include "linereader.hpp"
+#include "speculative_inflate.hpp"
+
+namespace ar
+{
+
+/** Returns 'data' compressed as a single gzip member. */
+std::string gzip_member(const std::string& data)
+{
+    z_stream stream;
+    stream.zalloc = nullptr;
+    stream.zfree = nullptr;
+    stream.opaque = nullptr;
+    REQUIRE(deflateInit2(&stream, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+
+    std::string result(deflateBound(&stream, data.size()) + 32, '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = data.size();
+    stream.next_out = reinterpret_cast<Bytef*>(&result[0]);
+    stream.avail_out = result.size();
+
+    REQUIRE(deflate(&stream, Z_FINISH) == Z_STREAM_END);
+    result.resize(result.size() - stream.avail_out);
+    REQUIRE(deflateEnd(&stream) == Z_OK);
+
+    return result;
+}
+
+
+/** Returns 'data' compressed as a BGZF block. */
+std::string bgzf_block(const std::string& data)
+{
+    const std::string member = gzip_member(data);
+    // The header is extended by XLEN (2 bytes) and the 'BC' field (6 bytes)
+    const size_t bsize = member.size() + 8 - 1;
+
+    // Replace the plain header with one containing the 'BC' field
+    std::string block("\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0", 16);
+    block.push_back(bsize & 0xff);
+    block.push_back(bsize >> 8);
+    block.append(member, GZIP_HEADER_SIZE, std::string::npos);
+
+    return block;
+}
+
+
+/** Returns a pseudo-random FASTQ file containing 'n' records. */
+std::string random_fastq(size_t n)
+{
+    std::string fastq;
+    unsigned int state = 12345;
+    for (size_t i = 0; i < n; ++i) {
+        fastq += "@read_" + std::to_string(i) + "\n";
+        fastq += random_sequence(state, 50, "ACGT");
+        fastq += "\n+\n";
+        for (size_t j = 0; j < 50; ++j) {
+            fastq.push_back('!' + random_value(state, 40));
+        }
+
+        fastq += "\n";
+    }
+
+    return fastq;
+}
+
+
+/** Position of a deflate block (in bits) and the output preceding it. */
+typedef std::pair<size_t, size_t> block_pos;
+
+
+/** Returns the positions of the (non-final) blocks in a member. */
+std::vector<block_pos> deflate_blocks(const std::string& member)
+{
+    z_stream stream;
+    stream.zalloc = nullptr;
+    stream.zfree = nullptr;
+    stream.opaque = nullptr;
+    stream.avail_in = 0;
+    stream.next_in = nullptr;
+    REQUIRE(inflateInit2(&stream, 15 + 16) == Z_OK);
+
+    std::string output(1024 * 1024, '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(member.data()));
+    stream.avail_in = member.size();
+
+    std::vector<block_pos> blocks;
+    int result = Z_OK;
+    while (result == Z_OK) {
+        stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+        stream.avail_out = output.size();
+
+        result = inflate(&stream, Z_BLOCK);
+        if ((stream.data_type & 128) && !(stream.data_type & 64)) {
+            const size_t bit = (member.size() - stream.avail_in) * 8 - (stream.data_type & 7);
+            blocks.push_back(block_pos(bit, stream.total_out));
+        }
+    }
+
+    REQUIRE(result == Z_STREAM_END);
+    REQUIRE(inflateEnd(&stream) == Z_OK);
+
+    return blocks;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests for 'bgzf_block_size'
+
+TEST_CASE("BGZF block sizes are read from headers", "[decompressor::bgzf]")
+{
+    const std::string block = bgzf_block("@read\nACGT\n+\nIIII\n");
+
+    REQUIRE(bgzf_block_size(block.data(), block.size()) == block.size());
+    REQUIRE(bgzf_block_size((block + block).data(), 2 * block.size()) == block.size());
+}
+
+
+TEST_CASE("Plain gzip members are not BGZF blocks", "[decompressor::bgzf]")
+{
+    const std::string member = gzip_member("@read\nACGT\n+\nIIII\n");
+
+    REQUIRE(bgzf_block_size(member.data(), member.size()) == 0);
+}
+
+
+TEST_CASE("Incomplete BGZF headers are not recognized", "[decompressor::bgzf]")
+{
+    const std::string block = bgzf_block("@read\nACGT\n+\nIIII\n");
+
+    REQUIRE(bgzf_block_size(block.data(), 12) == 0);
+    REQUIRE(bgzf_block_size(block.data(), 17) == 0);
+    REQUIRE(bgzf_block_size(block.data(), 18) == block.size());
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests for 'find_gzip_header'
+
+TEST_CASE("Gzip headers are found in concatenated members", "[decompressor::find_gzip_header]")
+{
+    const std::string member_1 = gzip_member("@read_1\nACGT\n+\nIIII\n");
+    const std::string member_2 = gzip_member("@read_2\nTGCA\n+\nIIII\n");
+    const std::string data = member_1 + member_2;
+
+    REQUIRE(find_gzip_header(data.data(), 0, data.size()) == 0);
+    REQUIRE(find_gzip_header(data.data(), 1, data.size()) == member_1.size());
+}
+
+
+TEST_CASE("Gzip headers must be complete", "[decompressor::find_gzip_header]")
+{
+    const std::string member = gzip_member("@read_1\nACGT\n+\nIIII\n");
+
+    REQUIRE(find_gzip_header(member.data(), 0, GZIP_HEADER_SIZE) == 0);
+    REQUIRE(find_gzip_header(member.data(), 0, GZIP_HEADER_SIZE - 1) == GZIP_HEADER_SIZE - 1);
+}
+
+
+TEST_CASE("Gzip magic bytes with reserved flags are ignored", "[decompressor::find_gzip_header]")
+{
+    const std::string data("\x1f\x8b\x08\xe0\0\0\0\0\0\x03", GZIP_HEADER_SIZE);
+
+    REQUIRE(find_gzip_header(data.data(), 0, data.size()) == data.size());
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests for 'inflate_gzip_members'
+
+TEST_CASE("Concatenated members are inflated", "[decompressor::inflate_gzip_members]")
+{
+    const std::string data = gzip_member("@read_1\nACGT\n")
+                           + bgzf_block("+\nIIII\n")
+                           + bgzf_block("");
+
+    std::string result;
+    REQUIRE(inflate_gzip_members(data.data(), data.size(), result));
+    REQUIRE(result == "@read_1\nACGT\n+\nIIII\n");
+}
+
+
+TEST_CASE("Inflated output is appended", "[decompressor::inflate_gzip_members]")
+{
+    const std::string data = gzip_member("ACGT\n");
+
+    std::string result = "@read_1\n";
+    REQUIRE(inflate_gzip_members(data.data(), data.size(), result));
+    REQUIRE(result == "@read_1\nACGT\n");
+}
+
+
+TEST_CASE("Truncated members are not inflated", "[decompressor::inflate_gzip_members]")
+{
+    const std::string data = gzip_member("@read_1\nACGT\n+\nIIII\n");
+
+    std::string result;
+    REQUIRE_FALSE(inflate_gzip_members(data.data(), data.size() - 1, result));
+    REQUIRE_FALSE(inflate_gzip_members(data.data(), 0, result));
+}
+
+
+TEST_CASE("Members starting mid-stream are not inflated", "[decompressor::inflate_gzip_members]")
+{
+    const std::string data = gzip_member("@read_1\nACGT\n+\nIIII\n");
+
+    std::string result;
+    REQUIRE_FALSE(inflate_gzip_members(data.data() + 1, data.size() - 1, result));
+}
+
+
+TEST_CASE("Trailing garbage is not inflated", "[decompressor::inflate_gzip_members]")
+{
+    const std::string data = gzip_member("@read_1\nACGT\n+\nIIII\n") + "garbage";
+
+    std::string result;
+    REQUIRE_FALSE(inflate_gzip_members(data.data(), data.size(), result));
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests for 'block_decompressor'
+
+TEST_CASE("Blocks are decompressed across members", "[decompressor::block_decompressor]")
+{
+    const std::string data = gzip_member("@read_1\nACGT\n") + gzip_member("+\nIIII\n");
+
+    block_decompressor decompressor;
+    std::string result;
+    REQUIRE(decompressor.at_gzip_member());
+
+    decompressor.decompress(data.data(), 5, result);
+    REQUIRE_FALSE(decompressor.at_gzip_member());
+
+    decompressor.decompress(data.data() + 5, data.size() - 5, result);
+    REQUIRE(decompressor.at_gzip_member());
+    REQUIRE(result == "@read_1\nACGT\n+\nIIII\n");
+
+    decompressor.end_file();
+}
+
+
+TEST_CASE("Skipped members are followed by decompressed blocks", "[decompressor::block_decompressor]")
+{
+    const std::string member_1 = gzip_member("@read_1\nACGT\n");
+    const std::string member_2 = gzip_member("+\nIIII\n");
+
+    block_decompressor decompressor;
+    decompressor.skip_gzip_members(member_1.data(), member_1.size());
+    REQUIRE(decompressor.at_gzip_member());
+
+    std::string result;
+    decompressor.decompress(member_2.data(), member_2.size(), result);
+    REQUIRE(result == "+\nIIII\n");
+
+    decompressor.end_file();
+}
+
+
+TEST_CASE("Uncompressed blocks are passed through", "[decompressor::block_decompressor]")
+{
+    block_decompressor decompressor;
+    std::string result;
+
+    decompressor.decompress("@read_1\n", 8, result);
+    decompressor.decompress("ACGT\n", 5, result);
+    REQUIRE(result == "@read_1\nACGT\n");
+    REQUIRE_FALSE(decompressor.at_gzip_member());
+
+    decompressor.end_file();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests for gzip headers and trailers
+
+TEST_CASE("Gzip headers with optional fields are read", "[decompressor::block_decompressor]")
+{
+    const std::string member = gzip_member("@read_1\nACGT\n+\nIIII\n");
+    // FEXTRA, FNAME, and FCOMMENT fields
+    std::string data("\x1f\x8b\x08\x1c\0\0\0\0\0\x03\x02\0XYname\0comment\0", 27);
+    data.append(member, GZIP_HEADER_SIZE, std::string::npos);
+
+    // The format is identified from the first block, which must be 2+ bytes
+    block_decompressor decompressor;
+    std::string result;
+    decompressor.decompress(data.data(), 2, result);
+    for (size_t i = 2; i < data.size(); ++i) {
+        decompressor.decompress(data.data() + i, 1, result);
+    }
+
+    REQUIRE(result == "@read_1\nACGT\n+\nIIII\n");
+    REQUIRE(decompressor.at_gzip_member());
+
+    decompressor.end_file();
+}
+
+
+TEST_CASE("Invalid gzip headers are reported", "[decompressor::block_decompressor]")
+{
+    const std::string member = gzip_member("@read_1\nACGT\n+\nIIII\n");
+    const std::string data = member + std::string("\x1f\x8b\x07", 3);
+
+    block_decompressor decompressor;
+    std::string result;
+    REQUIRE_THROWS_AS(decompressor.decompress(data.data(), data.size(), result),
+                      gzip_error);
+}
+
+
+TEST_CASE("Invalid gzip trailers are reported", "[decompressor::block_decompressor]")
+{
+    const std::string member = gzip_member("@read_1\nACGT\n+\nIIII\n");
+
+    for (size_t i = 1; i <= 8; ++i) {
+        std::string data = member;
+        data.at(data.size() - i) ^= 1;
+
+        block_decompressor decompressor;
+        std::string result;
+        REQUIRE_THROWS_AS(decompressor.decompress(data.data(), data.size(), result),
+                          gzip_error);
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests for 'speculative_inflate'
+
+TEST_CASE("Deflate blocks are found and speculatively inflated", "[decompressor::speculative]")
+{
+    const std::string fastq = random_fastq(10000);
+    const std::string member = gzip_member(fastq);
+    const std::vector<block_pos> blocks = deflate_blocks(member);
+    REQUIRE(blocks.size() > 4);
+
+    // Start in the middle of the second block, and end in the last block
+    const size_t start = (blocks.at(1).first + blocks.at(2).first) / 16;
+    const size_t end = (blocks.at(blocks.size() - 2).first + blocks.back().first) / 16;
+
+    speculative_block block;
+    REQUIRE(speculative_inflate(member.data() + start, end - start, block));
+    REQUIRE(block.found);
+    REQUIRE(block.start_bit + start * 8 == blocks.at(2).first);
+    REQUIRE(block.end_bit + start * 8 == blocks.at(blocks.size() - 2).first);
+    REQUIRE_FALSE(block.final);
+
+    const size_t offset = blocks.at(2).second;
+    REQUIRE(block.symbols.size() == blocks.at(blocks.size() - 2).second - offset);
+
+    // Markers refer to the 32 KB preceding the first block
+    std::string resolved;
+    size_t n_markers = 0;
+    for (const size_t symbol : block.symbols) {
+        if (symbol < DEFLATE_MARKER) {
+            resolved.push_back(symbol);
+        } else {
+            resolved.push_back(fastq.at(offset - DEFLATE_WINDOW_SIZE + symbol - DEFLATE_MARKER));
+            ++n_markers;
+        }
+    }
+
+    REQUIRE(resolved == fastq.substr(offset, block.symbols.size()));
+    REQUIRE(n_markers > 0);
+}
+
+
+TEST_CASE("Final deflate blocks are marked", "[decompressor::speculative]")
+{
+    const std::string member = gzip_member(random_fastq(10000));
+    const std::vector<block_pos> blocks = deflate_blocks(member);
+    // Blocks are only found starting from non-final blocks
+    const size_t start = blocks.at(blocks.size() - 2).first / 8 - 1;
+
+    speculative_block block;
+    REQUIRE(speculative_inflate(member.data() + start, member.size() - start, block));
+    REQUIRE(block.start_bit + start * 8 == blocks.at(blocks.size() - 2).first);
+    REQUIRE(block.final);
+}
+
+
+TEST_CASE("No blocks are found in truncated blocks", "[decompressor::speculative]")
+{
+    const std::string member = gzip_member(random_fastq(10000));
+    const std::vector<block_pos> blocks = deflate_blocks(member);
+
+    speculative_block block;
+    REQUIRE_FALSE(speculative_inflate(member.data() + blocks.at(1).first / 8, 100, block));
+    REQUIRE_FALSE(block.found);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests for use of speculative blocks by 'block_decompressor'
+
+/** Decompresses a member in two pieces, using speculation for the second. */
+std::string decompress_speculatively(const std::string& member,
+                                     size_t split,
+                                     speculative_block& block)
+{
+    block_decompressor decompressor;
+    std::string result;
+    decompressor.decompress(member.data(), split, result);
+    decompressor.decompress(member.data() + split, member.size() - split,
+                            result, &block);
+    decompressor.end_file();
+
+    return result;
+}
+
+
+TEST_CASE("Speculative blocks are used", "[decompressor::speculative]")
+{
+    const std::string fastq = random_fastq(10000);
+    const std::string member = gzip_member(fastq);
+    const size_t split = member.size() / 3;
+
+    speculative_block block;
+    REQUIRE(speculative_inflate(member.data() + split, member.size() - split, block));
+    REQUIRE(decompress_speculatively(member, split, block) == fastq);
+
+    // Modified blocks are used, but caught by the CRC check
+    block.symbols.at(0) ^= 1;
+    REQUIRE_THROWS_AS(decompress_speculatively(member, split, block), gzip_error);
+}
+
+
+TEST_CASE("Speculative blocks are used across pieces", "[decompressor::speculative]")
+{
+    const std::string fastq = random_fastq(10000);
+    const std::string member = gzip_member(fastq);
+    const size_t split = member.size() / 3;
+
+    // Blocks ending in the middle of the data
+    speculative_block block;
+    REQUIRE(speculative_inflate(member.data() + split, member.size() / 3, block));
+    REQUIRE_FALSE(block.final);
+    REQUIRE(decompress_speculatively(member, split, block) == fastq);
+}
+
+
+TEST_CASE("Speculative blocks at other positions are ignored", "[decompressor::speculative]")
+{
+    const std::string fastq = random_fastq(10000);
+    const std::string member = gzip_member(fastq);
+    const size_t split = member.size() / 3;
+
+    speculative_block block;
+    REQUIRE(speculative_inflate(member.data() + split, member.size() - split, block));
+    block.start_bit += 1;
+    block.symbols.at(0) ^= 1;
+
+    REQUIRE(decompress_speculatively(member, split, block) == fastq);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests for bzip2 blocks
+
+/** Returns 'data' compressed as a bzip2 stream with 100k blocks. */
+std::string bzip2_stream(const std::string& data)
+{
+    std::string result(data.size() * 2 + 1024, '\0');
+    unsigned int length = result.size();
+
+    REQUIRE(BZ2_bzBuffToBuffCompress(&result[0], &length,
+                                     const_cast<char*>(data.data()),
+                                     data.size(), 1, 0, 0) == BZ_OK);
+    result.resize(length);
+
+    return result;
+}
+
+
+/** Returns the positions of the block and end-of-stream magic numbers. */
+std::vector<size_t> bzip2_magics(const std::string& stream)
+{
+    std::vector<size_t> magics;
+    size_t offset = find_bzip2_magic(stream.data(), stream.size(), 0);
+    while (offset < stream.size() * 8) {
+        magics.push_back(offset);
+        offset = find_bzip2_magic(stream.data(), stream.size(), offset + 1);
+    }
+
+    return magics;
+}
+
+
+/** Returns the data containing the bits [begin, end), as split by split_blocks. */
+std::string bzip2_piece(const std::string& stream, size_t begin, size_t end,
+                        bzip2_block& block)
+{
+    block.begin = begin % 8;
+    block.end = end - begin / 8 * 8;
+    block.complete = true;
+
+    return stream.substr(begin / 8, (end + 7) / 8 - begin / 8);
+}
+
+
+TEST_CASE("Bits are read across bytes", "[decompressor::bzip2]")
+{
+    const char data[] = "\x12\x34\x56";
+
+    REQUIRE(read_bits(data, 0, 8) == 0x12);
+    REQUIRE(read_bits(data, 4, 12) == 0x234);
+    REQUIRE(read_bits(data, 3, 5) == 0x12);
+    REQUIRE(read_bits(data, 7, 10) == 0x68);
+}
+
+
+TEST_CASE("Bzip2 streams are recognized", "[decompressor::bzip2]")
+{
+    const std::string stream = bzip2_stream("@read_1\nACGT\n+\nIIII\n");
+
+    REQUIRE(is_bzip2(stream.data(), stream.size()));
+    // The header must be followed by a magic number
+    REQUIRE_FALSE(is_bzip2(stream.data(), 9));
+    REQUIRE_FALSE(is_bzip2("BZh9", 4));
+    REQUIRE_FALSE(is_bzip2("BZ0912345678", 12));
+    REQUIRE_FALSE(is_bzip2("@read_1\nACGT\n", 13));
+}
+
+
+TEST_CASE("Bzip2 blocks are found", "[decompressor::bzip2]")
+{
+    const std::string stream = bzip2_stream(random_fastq(10000));
+    const std::vector<size_t> magics = bzip2_magics(stream);
+
+    // Expected 12 blocks of at most 100k, plus the end of the stream
+    REQUIRE(magics.size() == 13);
+    REQUIRE(magics.front() == BZIP2_HEADER_SIZE * 8);
+    for (size_t i = 0; i < magics.size(); ++i) {
+        const uint64_t magic = read_bits(stream.data(), magics.at(i), BZIP2_MAGIC_BITS);
+        REQUIRE(magic == (i + 1 < magics.size() ? BZIP2_BLOCK_MAGIC : BZIP2_END_MAGIC));
+    }
+}
+
+
+TEST_CASE("Bzip2 blocks are decompressed independently", "[decompressor::bzip2]")
+{
+    const std::string fastq = random_fastq(10000);
+    const std::string stream = bzip2_stream(fastq);
+    const std::vector<size_t> magics = bzip2_magics(stream);
+
+    std::string result;
+    for (size_t i = magics.size() - 1; i > 0; --i) {
+        bzip2_block block;
+        const std::string piece = bzip2_piece(stream, magics.at(i - 1), magics.at(i), block);
+
+        std::string output;
+        REQUIRE(inflate_bzip2_block(piece.data(), block, output));
+        result.insert(0, output);
+    }
+
+    REQUIRE(result == fastq);
+}
+
+
+TEST_CASE("Partial bzip2 blocks are not decompressed", "[decompressor::bzip2]")
+{
+    const std::string stream = bzip2_stream(random_fastq(10000));
+    const std::vector<size_t> magics = bzip2_magics(stream);
+
+    bzip2_block block;
+    const std::string piece = bzip2_piece(stream, magics.at(0), magics.at(1) - 1, block);
+
+    std::string output;
+    REQUIRE_FALSE(inflate_bzip2_block(piece.data(), block, output));
+
+    // Truncated blocks at the end of files are not errors, but yield no data
+    block.complete = false;
+    output.clear();
+    REQUIRE(inflate_bzip2_block(piece.data(), block, output));
+    REQUIRE(output.empty());
+}
+
+
+/** Decompresses a stream split at the given positions using 'block_decompressor'. */
+std::string decompress_bzip2_pieces(const std::string& stream,
+                                    const std::vector<size_t>& positions)
+{
+    block_decompressor decompressor;
+    std::string result;
+    for (size_t i = 1; i < positions.size(); ++i) {
+        bzip2_block block;
+        const std::string piece = bzip2_piece(stream, positions.at(i - 1), positions.at(i), block);
+
+        const uint64_t magic = read_bits(stream.data(), positions.at(i), BZIP2_MAGIC_BITS);
+        if (magic == BZIP2_END_MAGIC) {
+            block.stream_end = true;
+            block.stream_crc = read_bits(stream.data(), positions.at(i) + BZIP2_MAGIC_BITS, 32);
+        }
+
+        decompressor.decompress_bzip2_block(piece.data(), piece.size(), block, result);
+    }
+
+    REQUIRE(decompressor.at_bzip2_block());
+    decompressor.end_file();
+
+    return result;
+}
+
+
+TEST_CASE("Bzip2 blocks are decompressed in order", "[decompressor::bzip2]")
+{
+    const std::string fastq = random_fastq(10000);
+    const std::string stream = bzip2_stream(fastq);
+
+    REQUIRE(decompress_bzip2_pieces(stream, bzip2_magics(stream)) == fastq);
+}
+
+
+TEST_CASE("Bzip2 blocks split at false magic numbers are joined", "[decompressor::bzip2]")
+{
+    const std::string fastq = random_fastq(10000);
+    const std::string stream = bzip2_stream(fastq);
+    std::vector<size_t> magics = bzip2_magics(stream);
+
+    // Split the first and the last block into several pieces
+    const size_t last = magics.at(magics.size() - 2);
+    magics.insert(magics.end() - 1, { last + 1001, last + 10003 });
+    magics.insert(magics.begin() + 1, { magics.at(0) + 4567 });
+
+    REQUIRE(decompress_bzip2_pieces(stream, magics) == fastq);
+}
+
+
+TEST_CASE("Partial bzip2 blocks are reported at the end of the file", "[decompressor::bzip2]")
+{
+    const std::string stream = bzip2_stream(random_fastq(10000));
+    const std::vector<size_t> magics = bzip2_magics(stream);
+
+    bzip2_block block;
+    const std::string piece = bzip2_piece(stream, magics.at(0), magics.at(0) + 1001, block);
+
+    block_decompressor decompressor;
+    std::string result;
+    decompressor.decompress_bzip2_block(piece.data(), piece.size(), block, result);
+    REQUIRE_FALSE(decompressor.at_bzip2_block());
+    REQUIRE(result.empty());
+
+    REQUIRE_THROWS_AS(decompressor.end_file(), bzip2_error);
+}
+
+
+TEST_CASE("Bzip2 stream CRCs are checked", "[decompressor::bzip2]")
+{
+    const std::string stream = bzip2_stream(random_fastq(10000));
+    const std::vector<size_t> magics = bzip2_magics(stream);
+
+    block_decompressor decompressor;
+    for (size_t i = 1; i < magics.size(); ++i) {
+        bzip2_block block;
+        const std::string piece = bzip2_piece(stream, magics.at(i - 1), magics.at(i), block);
+
+        if (i + 1 < magics.size()) {
+            decompressor.skip_bzip2_block(piece.data(), block);
+        } else {
+            block.stream_end = true;
+            block.stream_crc = read_bits(stream.data(), magics.at(i) + BZIP2_MAGIC_BITS, 32) ^ 1;
+
+            REQUIRE_THROWS_AS(decompressor.skip_bzip2_block(piece.data(), block), bzip2_error);
+        }
+    }
+}
+
+} // namespace ar
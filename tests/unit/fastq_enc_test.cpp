@@ -24,6 +24,7 @@
 \*************************************************************************/
 #include "testing.hpp"
 #include "fastq.hpp"
+#include "simd.hpp"
 
 
 namespace ar
@@ -40,4 +41,117 @@ TEST_CASE("Global encodings have expected names", "[fastq_encoding]")
     REQUIRE(FASTQ_ENCODING_SOLEXA.name() == std::string("Solexa"));
 }
 
+
+///////////////////////////////////////////////////////////////////////////////
+// Vectorized decoding / encoding
+
+typedef size_t (*decode_qualities_func)(char*, size_t, char, char, char);
+decode_qualities_func select_decode_qualities(simd::instruction_set is);
+
+typedef void (*encode_qualities_func)(const char*, char*, size_t, char, char);
+encode_qualities_func select_encode_qualities(simd::instruction_set is);
+
+
+TEST_CASE("decode_qualities SIMD kernels match scalar implementation", "[fastq_encoding]")
+{
+    const decode_qualities_func expected_func = select_decode_qualities(simd::instruction_set::none);
+    // Ranges and offsets used for Phred+33, Phred+64, and Solexa scores
+    const char ranges[][3] = { { '!', 'J', 0 }, { '@', 'i', -31 }, { ';', 'h', 0 } };
+
+    for (const auto is : simd::supported()) {
+        const decode_qualities_func func = select_decode_qualities(is);
+        unsigned int state = 12345;
+
+        for (const auto& range : ranges) {
+            for (size_t seqlen = 0; seqlen <= 100; ++seqlen) {
+                for (size_t round = 0; round < 20; ++round) {
+                    std::string qualities;
+                    for (size_t i = 0; i < seqlen; ++i) {
+                        // Out of range scores are placed in a quarter of strings
+                        if (round % 4 == 0 && random_value(state, 64) == 0) {
+                            qualities.push_back(static_cast<char>(random_value(state, 256)));
+                        } else {
+                            qualities.push_back(range[0] + random_value(state, range[1] - range[0] + 1));
+                        }
+                    }
+
+                    std::string expected = qualities;
+                    const size_t expected_result = expected_func(&expected[0], expected.size(),
+                                                                 range[0], range[1], range[2]);
+
+                    std::string current = qualities;
+                    const size_t result = func(&current[0], current.size(),
+                                               range[0], range[1], range[2]);
+
+                    // Don't count all these checks in test statistics
+                    if (result != expected_result) {
+                        INFO("instruction set: " << simd::name(is));
+                        REQUIRE(result == expected_result);
+                    }
+
+                    // Scores are left in an unspecified state on failure
+                    if (result == qualities.size() && current != expected) {
+                        INFO("instruction set: " << simd::name(is));
+                        REQUIRE(current == expected);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+TEST_CASE("encode_qualities SIMD kernels match scalar implementation", "[fastq_encoding]")
+{
+    const encode_qualities_func expected_func = select_encode_qualities(simd::instruction_set::none);
+    // Offsets and max scores used for Phred+33, Phred+64, and SAM scores
+    const char ranges[][2] = { { 0, 'J' }, { 31, 'i' }, { 0, '~' } };
+
+    for (const auto is : simd::supported()) {
+        const encode_qualities_func func = select_encode_qualities(is);
+        unsigned int state = 12345;
+
+        for (const auto& range : ranges) {
+            for (size_t seqlen = 0; seqlen <= 100; ++seqlen) {
+                std::string qualities;
+                for (size_t i = 0; i < seqlen; ++i) {
+                    qualities.push_back('!' + random_value(state, '~' - '!' + 1));
+                }
+
+                std::string expected(seqlen, '\0');
+                expected_func(qualities.data(), &expected[0], seqlen, range[0], range[1]);
+
+                std::string current(seqlen, '\0');
+                func(qualities.data(), &current[0], seqlen, range[0], range[1]);
+
+                if (current != expected) {
+                    INFO("instruction set: " << simd::name(is));
+                    REQUIRE(current == expected);
+                }
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Invalid scores are reported in long strings", "[fastq_encoding]")
+{
+    std::string qualities(100, 'I');
+    REQUIRE_NOTHROW(FASTQ_ENCODING_33.decode(qualities));
+    REQUIRE(qualities == std::string(100, 'I'));
+
+    qualities = std::string(100, 'h');
+    REQUIRE_NOTHROW(FASTQ_ENCODING_64.decode(qualities));
+    REQUIRE(qualities == std::string(100, 'I'));
+
+    qualities = std::string(100, 'I');
+    qualities.at(70) = ' ';
+    REQUIRE_THROWS_AS(FASTQ_ENCODING_33.decode(qualities), fastq_error);
+
+    qualities = std::string(100, 'h');
+    qualities.at(70) = 'j';
+    REQUIRE_THROWS_AS(FASTQ_ENCODING_64.decode(qualities), fastq_error);
+    REQUIRE_THROWS_AS(FASTQ_ENCODING_SOLEXA.decode(qualities), fastq_error);
+}
+
 }
@@ -28,7 +28,9 @@
 #include "testing.hpp"
 #include "debug.hpp"
 #include "fastq.hpp"
+#include "fastq_reader.hpp"
 #include "linereader.hpp"
+#include "simd.hpp"
 
 namespace ar
 {
@@ -57,7 +59,6 @@ private:
 };
 
 
-
 ///////////////////////////////////////////////////////////////////////////////
 // Default constructor
 
@@ -188,6 +189,55 @@ TEST_CASE("constructor_invalid_nucleotides", "[fastq::fastq]")
 }
 
 
+typedef size_t (*clean_sequence_func)(char*, size_t);
+clean_sequence_func select_clean_sequence(simd::instruction_set is);
+
+
+TEST_CASE("clean_sequence SIMD kernels match scalar implementation", "[fastq::fastq]")
+{
+    const clean_sequence_func expected_func = select_clean_sequence(simd::instruction_set::none);
+    const std::string valid = "ACGTNacgtn.";
+    const std::string invalid = "!7SsUu\x0e\xc1\xe1\xff";
+
+    for (const auto is : simd::supported()) {
+        const clean_sequence_func func = select_clean_sequence(is);
+        unsigned int state = 12345;
+
+        for (size_t seqlen = 0; seqlen <= 100; ++seqlen) {
+            for (size_t round = 0; round < 20; ++round) {
+                std::string sequence;
+                for (size_t i = 0; i < seqlen; ++i) {
+                    // Invalid characters are placed in a quarter of sequences
+                    if (round % 4 == 0 && random_value(state, 64) == 0) {
+                        sequence.push_back(invalid.at(random_value(state, invalid.size())));
+                    } else {
+                        sequence.push_back(valid.at(random_value(state, valid.size())));
+                    }
+                }
+
+                std::string expected = sequence;
+                const size_t expected_result = expected_func(&expected[0], expected.size());
+
+                std::string current = sequence;
+                const size_t result = func(&current[0], current.size());
+
+                // Don't count all these checks in test statistics
+                if (result != expected_result) {
+                    INFO("instruction set: " << simd::name(is));
+                    REQUIRE(result == expected_result);
+                }
+
+                // Sequences are left in an unspecified state on failure
+                if (result == sequence.size() && current != expected) {
+                    INFO("instruction set: " << simd::name(is));
+                    REQUIRE(current == expected);
+                }
+            }
+        }
+    }
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Constructor without qualities
 
@@ -949,6 +999,214 @@ TEST_CASE("eof_after_qualities_following_previous_read_2", "[fastq::fastq]")
     REQUIRE_THROWS_AS(record.read(reader), fastq_error);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Block based reading
+
+/** Adds blocks to a parser, and returns the records of each completed read. */
+std::vector<fastq_vec> parse_blocks(const string_vec& blocks, size_t max_records)
+{
+    fastq_block_parser parser;
+    std::vector<fastq_vec> results;
+    std::string buffer;
+    fastq_view_vec views;
+
+    for (size_t i = 0; i <= blocks.size(); ++i) {
+        if (i < blocks.size()) {
+            parser.add_block(blocks.at(i).data(), blocks.at(i).size());
+        } else {
+            parser.set_eof();
+        }
+
+        while (parser.read(buffer, views, max_records)) {
+            fastq_vec records(views.size());
+            for (size_t j = 0; j < views.size(); ++j) {
+                fastq_block_parser::assign(records.at(j), buffer, views.at(j));
+            }
+
+            views.clear();
+            results.push_back(records);
+            if (records.empty()) {
+                return results;
+            }
+        }
+    }
+
+    return results;
+}
+
+
+TEST_CASE("Finding newlines using all instruction sets", "[fastq::block]")
+{
+    std::string data;
+    for (size_t i = 0; i < 300; ++i) {
+        data.push_back((i % 7 == 0 || i % 11 == 0) ? '\n' : 'A' + i % 26);
+    }
+
+    for (const auto is : simd::supported()) {
+        for (size_t start = 0; start < 40; start += 3) {
+            for (size_t end = start; end <= data.size(); end += 17) {
+                std::vector<size_t> expected;
+                for (size_t i = start; i < end; ++i) {
+                    if (data.at(i) == '\n') {
+                        expected.push_back(i);
+                    }
+                }
+
+                std::vector<size_t> result;
+                find_newlines(data.data(), start, end, result, is);
+                REQUIRE(result == expected);
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Block parsing records split across blocks", "[fastq::block]")
+{
+    string_vec blocks;
+    blocks.push_back("@record_1\nACGAG");
+    blocks.push_back("TCA\n+\n!7BF8DGI\n@rec");
+    blocks.push_back("ord_2 meta\r\nGTCAGGAT\r\n+\r\nD7BIG!F8\r\n");
+
+    const std::vector<fastq_vec> results = parse_blocks(blocks, 1);
+    REQUIRE(results.size() == 3);
+    REQUIRE(results.at(0).size() == 1);
+    REQUIRE(results.at(0).front() == fastq("record_1", "ACGAGTCA", "!7BF8DGI"));
+    REQUIRE(results.at(1).size() == 1);
+    REQUIRE(results.at(1).front() == fastq("record_2 meta", "GTCAGGAT", "D7BIG!F8"));
+    REQUIRE(results.at(2).empty());
+}
+
+
+TEST_CASE("Block parsing final line without newline", "[fastq::block]")
+{
+    string_vec blocks;
+    blocks.push_back("@record_1\nacgt.\n+\n!!!!!");
+
+    const std::vector<fastq_vec> results = parse_blocks(blocks, 1024);
+    REQUIRE(results.size() == 2);
+    REQUIRE(results.front().size() == 1);
+    REQUIRE(results.front().front() == fastq("record_1", "ACGTN", "!!!!!"));
+    REQUIRE(results.back().empty());
+}
+
+
+TEST_CASE("Block parsing adds newlines between files", "[fastq::block]")
+{
+    fastq_block_parser parser;
+    const std::string file_1 = "@record_1\nACGTA\n+\n!!!!!";
+    const std::string file_2 = "@record_2\nTGCAT\n+\n#####\n";
+
+    parser.add_block(file_1.data(), file_1.size());
+    parser.end_file();
+    parser.add_block(file_2.data(), file_2.size());
+    parser.end_file();
+    parser.set_eof();
+
+    std::string buffer;
+    fastq_view_vec views;
+    REQUIRE(parser.read(buffer, views, 1024));
+    REQUIRE(views.size() == 2);
+    REQUIRE(buffer == file_1 + "\n" + file_2);
+}
+
+
+TEST_CASE("Block parsing stops at blank lines", "[fastq::block]")
+{
+    string_vec blocks;
+    blocks.push_back("@record_1\nACGTA\n+\n!!!!!\n\n");
+    blocks.push_back("@record_2\nTGCAT\n+\n#####\n");
+
+    const std::vector<fastq_vec> results = parse_blocks(blocks, 1024);
+    REQUIRE(results.size() == 3);
+    REQUIRE(results.at(0).size() == 1);
+    REQUIRE(results.at(1).size() == 1);
+    REQUIRE(results.at(2).empty());
+}
+
+
+TEST_CASE("Block parsing malformed records", "[fastq::block]")
+{
+    string_vec no_header;
+    no_header.push_back("record\nACGTA\n+\n!!!!!\n");
+    REQUIRE_THROWS_AS(parse_blocks(no_header, 1024), fastq_error);
+
+    string_vec no_separator;
+    no_separator.push_back("@record_1\nACGTA\n+\n!!!!!\n@record_2\nACGTA\n-\n!!!!!\n");
+    REQUIRE_THROWS_AS(parse_blocks(no_separator, 1024), fastq_error);
+
+    string_vec truncated;
+    truncated.push_back("@record_1\nACGTA\n+\n");
+    REQUIRE_THROWS_AS(parse_blocks(truncated, 1024), fastq_error);
+}
+
+
+TEST_CASE("Block parsing hands over records preceding malformed records", "[fastq::block]")
+{
+    fastq_block_parser parser;
+    const std::string data = "@record_1\nACGTA\n+\n!!!!!\n@record_2\nTGCAT\n-\n#####\n";
+    parser.add_block(data.data(), data.size());
+    parser.set_eof();
+
+    std::string buffer;
+    fastq_view_vec views;
+    REQUIRE_THROWS_AS(parser.read(buffer, views, 1024), fastq_error);
+    REQUIRE(views.size() == 1);
+
+    fastq record;
+    fastq_block_parser::assign(record, buffer, views.front());
+    REQUIRE(record == fastq("record_1", "ACGTA", "!!!!!"));
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Locating records for sharding
+
+TEST_CASE("Skipping and counting lines", "[fastq::shard]")
+{
+    const std::string data = "a\nbb\n\nccc";
+
+    REQUIRE(skip_lines(data.data(), data.size(), 0, 0) == 0);
+    REQUIRE(skip_lines(data.data(), data.size(), 0, 1) == 2);
+    REQUIRE(skip_lines(data.data(), data.size(), 0, 3) == 6);
+    REQUIRE(skip_lines(data.data(), data.size(), 0, 4) == data.size());
+    REQUIRE(skip_lines(data.data(), data.size(), 3, 1) == 5);
+    REQUIRE(skip_lines(data.data(), data.size(), data.size(), 1) == data.size());
+
+    REQUIRE(count_lines(data.data(), 0) == 0);
+    REQUIRE(count_lines(data.data(), 2) == 1);
+    REQUIRE(count_lines(data.data(), data.size()) == 3);
+}
+
+
+TEST_CASE("Finding records at arbitrary offsets", "[fastq::shard]")
+{
+    const std::string data = "@r1\nACGT\n+\n@@@@\n"
+                             "@r2\nACGT\n+r2\n+@@@\n"
+                             "@r3\nACGT\n+\nIIII\n";
+
+    REQUIRE(find_fastq_record(data.data(), data.size(), 0) == 0);
+    // Partial lines are skipped
+    REQUIRE(find_fastq_record(data.data(), data.size(), 1) == 16);
+    // Quality scores starting with '@' are not records
+    REQUIRE(find_fastq_record(data.data(), data.size(), 11) == 16);
+    REQUIRE(find_fastq_record(data.data(), data.size(), 16) == 16);
+    // Quality scores starting with '+' are not records either
+    REQUIRE(find_fastq_record(data.data(), data.size(), 17) == 34);
+    REQUIRE(find_fastq_record(data.data(), data.size(), 35) == data.size());
+    REQUIRE(find_fastq_record(data.data(), data.size(), data.size()) == data.size());
+}
+
+
+TEST_CASE("Finding records in truncated data", "[fastq::shard]")
+{
+    const std::string data = "@r1\nACGT\n+\nIIII\n@r2\nACGT";
+
+    REQUIRE(find_fastq_record(data.data(), data.size(), 1) == data.size());
+    REQUIRE(find_fastq_record(data.data(), data.size(), 0) == 0);
+    REQUIRE(find_fastq_record(nullptr, 0, 0) == 0);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Writing to stream
 
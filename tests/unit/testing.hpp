@@ -26,6 +26,7 @@
 #define TESTING_H
 
 #include <iostream>
+#include <string>
 
 #include "catch.hpp"
 #include "fastq.hpp"
@@ -40,6 +41,34 @@ inline std::ostream& operator<<(std::ostream& stream, const fastq& record)
                   << record.qualities() << "\\n'";
 }
 
+
+/**
+ * Returns a pseudo-random value in the range [0, n), using a simple LCG with
+ * the given state; ensures identical test data across runs and platforms.
+ */
+inline size_t random_value(unsigned int& state, size_t n)
+{
+    state = state * 1103515245u + 12345u;
+    return (state >> 16) % n;
+}
+
+
+/**
+ * Returns a pseudo-random sequence drawn from 'alphabet'; by default ACGTNs,
+ * mostly without Ns.
+ */
+inline std::string random_sequence(unsigned int& state,
+                                   size_t length,
+                                   const std::string& alphabet = "ACGTACGTACGTACGTACGN")
+{
+    std::string sequence;
+    for (size_t i = 0; i < length; ++i) {
+        sequence.push_back(alphabet.at(random_value(state, alphabet.size())));
+    }
+
+    return sequence;
+}
+
 }
 
 #endif
\ No newline at end of file